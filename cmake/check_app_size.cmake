@@ -0,0 +1,16 @@
+# Fails when the app image leaves less than HEADROOM_PCT percent of its OTA slot free.
+# Run by the project's CMakeLists.txt after every build of the app target:
+#   cmake -DBIN=<image> -DSLOT_SIZE=<bytes> -DHEADROOM_PCT=<percent> -P check_app_size.cmake
+
+file(SIZE "${BIN}" bin_size)
+math(EXPR slot_size "${SLOT_SIZE}")
+math(EXPR limit "${slot_size} - ${slot_size} * ${HEADROOM_PCT} / 100")
+math(EXPR free_bytes "${slot_size} - ${bin_size}")
+math(EXPR used_pct "${bin_size} * 100 / ${slot_size}")
+
+if(bin_size GREATER limit)
+    message(FATAL_ERROR "${BIN} is ${bin_size} bytes, ${used_pct}% of the ${slot_size} byte OTA slot. "
+                        "Updates need ${HEADROOM_PCT}% of it free, the image has to stay below ${limit} bytes")
+endif()
+
+message(STATUS "App image ${bin_size} bytes, ${used_pct}% of the ${slot_size} byte OTA slot, ${free_bytes} bytes free")
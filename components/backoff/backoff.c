@@ -0,0 +1,30 @@
+#include "backoff.h"
+
+uint32_t backoff_delay(const backoff_policy_t *policy, uint32_t attempt, uint32_t random)
+{
+    uint64_t delay = policy->base;
+    uint64_t spread;
+
+    // Shifting further would only overflow, the cap is reached long before
+    while (attempt-- > 0 && delay < policy->max)
+    {
+        delay <<= 1;
+    }
+    if (delay > policy->max)
+    {
+        delay = policy->max;
+    }
+
+    spread = delay * policy->jitter_pct / 100;
+    if (spread > 0)
+    {
+        delay = delay - spread + random % (2 * spread + 1);
+    }
+
+    if (delay > UINT32_MAX)
+    {
+        return UINT32_MAX;
+    }
+
+    return delay > 0 ? (uint32_t)delay : 1;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * @brief Backoff Policy Type
+ *
+ * Units are up to the caller, milliseconds between reconnects or seconds between wakes.
+ */
+typedef struct backoff_policy_s
+{
+    uint32_t base;      /*!< delay before the first retry */
+    uint32_t max;       /*!< the doubling stops here */
+    uint8_t jitter_pct; /*!< spread the delay by up to this percentage either way */
+} backoff_policy_t;
+
+/**
+ * @brief Delay before a retry: base doubled per attempt, capped at max, then jittered
+ *
+ * @param policy: backoff policy
+ * @param attempt: 0 for the first retry
+ * @param random: any random value, e.g. esp_random(), so devices behind one AP do not retry in step
+ * @return
+ *      delay, at least 1
+ */
+uint32_t backoff_delay(const backoff_policy_t *policy, uint32_t attempt, uint32_t random);
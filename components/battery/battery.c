@@ -0,0 +1,68 @@
+#include "esp_log.h"
+#include "esp_adc/adc_oneshot.h"
+#include "esp_adc/adc_cali.h"
+#include "esp_adc/adc_cali_scheme.h"
+
+#include "battery.h"
+
+/* Up to about 2.5 V calibrated at the pin */
+#define BATTERY_ATTEN ADC_ATTEN_DB_11
+/* The ESP32 reference without an eFuse value */
+#define BATTERY_DEFAULT_VREF_MV 1100
+
+static const char *TAG = "battery";
+
+esp_err_t battery_read_mv(const battery_conf_t *conf, uint16_t *mv)
+{
+    adc_oneshot_unit_handle_t unit;
+    adc_cali_handle_t cali;
+    adc_oneshot_unit_init_cfg_t unit_cfg = {
+        .unit_id = ADC_UNIT_1,
+    };
+    adc_oneshot_chan_cfg_t channel_cfg = {
+        .atten = BATTERY_ATTEN,
+        .bitwidth = ADC_BITWIDTH_DEFAULT,
+    };
+    adc_cali_line_fitting_config_t cali_cfg = {
+        .unit_id = ADC_UNIT_1,
+        .atten = BATTERY_ATTEN,
+        .bitwidth = ADC_BITWIDTH_DEFAULT,
+        .default_vref = BATTERY_DEFAULT_VREF_MV,
+    };
+    esp_err_t ret = ESP_FAIL;
+    uint32_t sum = 0;
+    int raw;
+    int pin_mv;
+
+    if (adc_oneshot_new_unit(&unit_cfg, &unit) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to init ADC");
+        return ESP_FAIL;
+    }
+    if (adc_oneshot_config_channel(unit, conf->channel, &channel_cfg) != ESP_OK ||
+        adc_cali_create_scheme_line_fitting(&cali_cfg, &cali) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to configure channel %d", conf->channel);
+        goto out_unit;
+    }
+
+    for (int i = 0; i < conf->samples; i++)
+    {
+        if (adc_oneshot_read(unit, conf->channel, &raw) != ESP_OK ||
+            adc_cali_raw_to_voltage(cali, raw, &pin_mv) != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to read channel %d", conf->channel);
+            goto out_cali;
+        }
+        sum += pin_mv;
+    }
+
+    *mv = (uint16_t)(sum / (conf->samples ? conf->samples : 1) * conf->divider_num / conf->divider_den);
+    ret = ESP_OK;
+
+out_cali:
+    adc_cali_delete_scheme_line_fitting(cali);
+out_unit:
+    adc_oneshot_del_unit(unit);
+    return ret;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "hal/adc_types.h"
+
+/**
+ * @brief Battery Configuration Type
+ *
+ * The battery is measured through a resistor divider on an ADC1 pin, ADC2 is taken by Wi-Fi.
+ */
+typedef struct battery_conf_s
+{
+    adc_channel_t channel; /*!< ADC1 channel, e.g. ADC_CHANNEL_7 on GPIO35 */
+    uint16_t divider_num;  /*!< battery voltage = pin voltage * divider_num / divider_den */
+    uint16_t divider_den;
+    uint8_t samples;       /*!< averaged per reading */
+} battery_conf_t;
+
+/**
+ * @brief Read the battery voltage
+ *
+ * Meant to run before the radio starts, its current draw sags the voltage. The ADC unit is
+ * set up and released on every call.
+ *
+ * @param conf: battery configuration
+ * @param mv: output battery voltage in millivolts
+ * @return
+ *      ESP_OK, ESP_FAIL if the ADC could not be set up or read
+ */
+esp_err_t battery_read_mv(const battery_conf_t *conf, uint16_t *mv);
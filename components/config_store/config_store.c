@@ -0,0 +1,196 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "nvs_flash.h"
+
+#include "config_store.h"
+#include "dlog.h"
+
+#define NVS_NAMESPACE "WIFI"
+#define NVS_NETWORKS_KEY "networks"
+
+static const char *TAG = "config_store";
+
+/* Key names predate the store, "TZ" was written by smartconfig_init_timezone() */
+static const char *const s_nvs_keys[CONFIG_STORE_MAX] = {
+    [CONFIG_STORE_SSID] = "ssid",
+    [CONFIG_STORE_PASSWORD] = "password",
+    [CONFIG_STORE_TIMEZONE] = "TZ",
+    [CONFIG_STORE_HOSTNAME] = "hostname",
+    [CONFIG_STORE_NTP_SERVER] = "ntp_server",
+};
+
+static const size_t s_max_len[CONFIG_STORE_MAX] = {
+    [CONFIG_STORE_SSID] = 32,
+    [CONFIG_STORE_PASSWORD] = 64,
+    [CONFIG_STORE_TIMEZONE] = 64,
+    [CONFIG_STORE_HOSTNAME] = 32,
+    [CONFIG_STORE_NTP_SERVER] = 64,
+};
+
+/* Mirror of the NVS values, so warm wakes neither touch flash nor allocate */
+typedef struct
+{
+    uint32_t crc;
+    char values[CONFIG_STORE_MAX][CONFIG_STORE_MAX_LEN + 1];
+    net_store_t networks; /*!< ranking statistics are ahead of the NVS copy */
+} config_store_mirror_t;
+
+RTC_DATA_ATTR static config_store_mirror_t s_mirror;
+static bool s_warm;
+
+static uint32_t config_store_crc(void)
+{
+    return esp_rom_crc32_le(0, (const uint8_t *)&s_mirror + sizeof(s_mirror.crc), sizeof(s_mirror) - sizeof(s_mirror.crc));
+}
+
+esp_err_t config_store_load(void)
+{
+    nvs_handle_t handle;
+    size_t len;
+    esp_err_t err;
+
+    s_warm = s_mirror.crc == config_store_crc();
+    if (s_warm)
+    {
+        return ESP_OK;
+    }
+
+    memset(&s_mirror, 0, sizeof(s_mirror));
+
+    err = nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle);
+    if (err == ESP_OK)
+    {
+        for (int key = 0; key < CONFIG_STORE_MAX; key++)
+        {
+            len = sizeof(s_mirror.values[key]);
+            err = nvs_get_str(handle, s_nvs_keys[key], s_mirror.values[key], &len);
+            if (err != ESP_OK)
+            {
+                if (err != ESP_ERR_NVS_NOT_FOUND)
+                {
+                    ESP_LOGW(TAG, "Failed to read %s from NVS %d", s_nvs_keys[key], err);
+                }
+                s_mirror.values[key][0] = '\0';
+            }
+        }
+        len = sizeof(s_mirror.networks);
+        if (nvs_get_blob(handle, NVS_NETWORKS_KEY, &s_mirror.networks, &len) != ESP_OK ||
+            len != sizeof(s_mirror.networks) || s_mirror.networks.num_networks > NET_STORE_MAX_NETWORKS)
+        {
+            memset(&s_mirror.networks, 0, sizeof(s_mirror.networks));
+        }
+        nvs_close(handle);
+    }
+    else if (err != ESP_ERR_NVS_NOT_FOUND)
+    {
+        // Never provisioned leaves no namespace, anything else is worth a warning
+        ESP_LOGW(TAG, "Failed to open NVS %d", err);
+    }
+
+    // Stored before the list existed, persisted with the first change to the list
+    if (s_mirror.networks.num_networks == 0 && s_mirror.values[CONFIG_STORE_SSID][0])
+    {
+        net_store_network_t *network = &s_mirror.networks.networks[0];
+        strcpy(network->ssid, s_mirror.values[CONFIG_STORE_SSID]);
+        strcpy(network->password, s_mirror.values[CONFIG_STORE_PASSWORD]);
+        s_mirror.networks.num_networks = 1;
+    }
+
+    s_mirror.crc = config_store_crc();
+    DLOGI(TAG, "Loaded from NVS, %d networks", s_mirror.networks.num_networks);
+
+    return ESP_OK;
+}
+
+bool config_store_warm(void)
+{
+    return s_warm;
+}
+
+const char *config_store_get(config_store_key_t key)
+{
+    return s_mirror.values[key];
+}
+
+esp_err_t config_store_set(config_store_key_t key, const char *value)
+{
+    nvs_handle_t handle;
+    esp_err_t err;
+
+    if (strlen(value) > s_max_len[key])
+    {
+        ESP_LOGE(TAG, "Value for %s too long", s_nvs_keys[key]);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (strcmp(s_mirror.values[key], value) == 0)
+    {
+        return ESP_OK;
+    }
+
+    err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to open NVS %d", err);
+        return err;
+    }
+    err = nvs_set_str(handle, s_nvs_keys[key], value);
+    if (err == ESP_OK)
+    {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to write %s to NVS %d", s_nvs_keys[key], err);
+        return err;
+    }
+
+    strcpy(s_mirror.values[key], value);
+    s_mirror.crc = config_store_crc();
+    DLOGI(TAG, "Updated %s", s_nvs_keys[key]);
+
+    return ESP_OK;
+}
+
+net_store_t *config_store_networks(void)
+{
+    return &s_mirror.networks;
+}
+
+esp_err_t config_store_commit_networks(bool persist)
+{
+    nvs_handle_t handle;
+    esp_err_t err;
+
+    s_mirror.crc = config_store_crc();
+    if (!persist)
+    {
+        return ESP_OK;
+    }
+
+    err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to open NVS %d", err);
+        return err;
+    }
+    err = nvs_set_blob(handle, NVS_NETWORKS_KEY, &s_mirror.networks, sizeof(s_mirror.networks));
+    if (err == ESP_OK)
+    {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to write networks to NVS %d", err);
+        return err;
+    }
+    DLOGI(TAG, "Updated networks");
+
+    return ESP_OK;
+}
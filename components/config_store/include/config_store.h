@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "esp_err.h"
+
+#include "net_store.h"
+
+/* Longest value of any key, without the terminator */
+#define CONFIG_STORE_MAX_LEN 64
+
+/**
+ * @brief Config Key Type
+ *
+ */
+typedef enum
+{
+    CONFIG_STORE_SSID = 0,   /*!< station SSID, up to 32 characters */
+    CONFIG_STORE_PASSWORD,   /*!< station password, up to 64 characters */
+    CONFIG_STORE_TIMEZONE,   /*!< POSIX TZ string, sent as smartconfig reserved data */
+    CONFIG_STORE_HOSTNAME,   /*!< DHCP hostname, overrides wifi_conf_t.hostname */
+    CONFIG_STORE_NTP_SERVER, /*!< SNTP server, overrides wifi_conf_t.ntp_server */
+    CONFIG_STORE_MAX,
+} config_store_key_t;
+
+/**
+ * @brief Load the configuration
+ *
+ * Warm wakes are served from the CRC checked copy in RTC memory. Only when that copy is
+ * invalid, e.g. after power on, the values are read from NVS, which has to be initialized.
+ *
+ * @return
+ *      ESP_OK, also when keys are missing from NVS
+ */
+esp_err_t config_store_load(void);
+
+/**
+ * @brief Whether config_store_load() was served from RTC memory
+ *
+ */
+bool config_store_warm(void);
+
+/**
+ * @brief Get a value
+ *
+ * @param key: config key
+ * @return
+ *      the value, an empty string if it was never set
+ */
+const char *config_store_get(config_store_key_t key);
+
+/**
+ * @brief Set a value, writing it to NVS only if it differs from the stored one
+ *
+ * @param key: config key
+ * @param value: new value
+ * @return
+ *      ESP_OK, ESP_ERR_INVALID_SIZE if the value is too long for the key, or the NVS error
+ */
+esp_err_t config_store_set(config_store_key_t key, const char *value);
+
+/**
+ * @brief Get the known networks
+ *
+ * Loaded with the other values. On the first load after an update the network of
+ * CONFIG_STORE_SSID and CONFIG_STORE_PASSWORD is carried over. Changes have to be
+ * committed with config_store_commit_networks().
+ *
+ * @return
+ *      the networks, in RTC memory
+ */
+net_store_t *config_store_networks(void);
+
+/**
+ * @brief Commit changes to the known networks
+ *
+ * @param persist: also write them to NVS, otherwise they only survive deep sleep
+ * @return
+ *      ESP_OK, or the NVS error
+ */
+esp_err_t config_store_commit_networks(bool persist);
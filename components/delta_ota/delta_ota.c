@@ -0,0 +1,173 @@
+#include <inttypes.h>
+#include <stdio.h>
+
+#include "esp_app_desc.h"
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+
+#include "delta_ota.h"
+#include "delta_patch.h"
+
+#define ELF_SHA_HEX_LEN 16
+
+static const char *TAG = "delta_ota";
+
+typedef struct
+{
+    const esp_partition_t *running;
+    const esp_partition_t *target;
+    esp_ota_handle_t handle;
+    bool begun;
+    size_t patch_bytes;
+} delta_ota_ctx_t;
+
+/* Static, so applying a patch costs no heap and little stack */
+static delta_patch_t s_patch;
+static delta_ota_ctx_t s_ctx;
+
+static bool delta_ota_begin(void *ctx, const delta_patch_header_t *header)
+{
+    uint8_t buf[DELTA_PATCH_CHUNK_SIZE];
+    uint32_t crc = 0;
+    esp_err_t ret;
+
+    if (header->old_size > s_ctx.running->size || header->new_size > s_ctx.target->size)
+    {
+        ESP_LOGE(TAG, "Patch does not fit the partitions");
+        return false;
+    }
+
+    // Only the exact image the patch was made against yields the right output
+    for (uint32_t offset = 0; offset < header->old_size; offset += sizeof(buf))
+    {
+        size_t len = header->old_size - offset < sizeof(buf) ? header->old_size - offset : sizeof(buf);
+        if (esp_partition_read(s_ctx.running, offset, buf, len) != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to read the running image");
+            return false;
+        }
+        crc = delta_patch_crc32(crc, buf, len);
+    }
+    if (crc != header->old_crc)
+    {
+        ESP_LOGE(TAG, "Patch is for another image");
+        return false;
+    }
+
+    // Sequential writes erase as they go, instead of stalling the download up front
+    ret = esp_ota_begin(s_ctx.target, OTA_WITH_SEQUENTIAL_WRITES, &s_ctx.handle);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to begin update: %s", esp_err_to_name(ret));
+        return false;
+    }
+    s_ctx.begun = true;
+    ESP_LOGI(TAG, "Patching %" PRIu32 " into %" PRIu32 " bytes on %s",
+             header->old_size, header->new_size, s_ctx.target->label);
+
+    return true;
+}
+
+static bool delta_ota_read_old(void *ctx, uint32_t offset, void *buf, size_t len)
+{
+    return esp_partition_read(s_ctx.running, offset, buf, len) == ESP_OK;
+}
+
+static bool delta_ota_write_new(void *ctx, const void *data, size_t len)
+{
+    return esp_ota_write(s_ctx.handle, data, len) == ESP_OK;
+}
+
+static bool delta_ota_sink(void *ctx, const char *data, size_t len)
+{
+    s_ctx.patch_bytes += len;
+
+    return delta_patch_feed(&s_patch, data, len) != DELTA_PATCH_ERROR;
+}
+
+static const delta_patch_io_t s_io = {
+    .begin = delta_ota_begin,
+    .read_old = delta_ota_read_old,
+    .write_new = delta_ota_write_new,
+    .ctx = NULL,
+};
+
+esp_err_t delta_ota_update(uploader_t *uploader, const char *path_prefix)
+{
+    char elf_sha[ELF_SHA_HEX_LEN + 1];
+    char path[96];
+    int status = 0;
+    esp_err_t ret;
+
+    s_ctx = (delta_ota_ctx_t){
+        .running = esp_ota_get_running_partition(),
+        .target = esp_ota_get_next_update_partition(NULL),
+    };
+    if (s_ctx.target == NULL)
+    {
+        ESP_LOGE(TAG, "No partition to update");
+        return ESP_FAIL;
+    }
+
+    esp_app_get_elf_sha256(elf_sha, sizeof(elf_sha));
+    snprintf(path, sizeof(path), "%s/%s.patch", path_prefix, elf_sha);
+
+    delta_patch_init(&s_patch, &s_io);
+    ret = uploader->fetch(uploader, path, delta_ota_sink, NULL, &status);
+    if (ret == ESP_OK && status == 404)
+    {
+        ESP_LOGI(TAG, "No update for %s", elf_sha);
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (ret != ESP_OK || status / 100 != 2 || s_patch.status != DELTA_PATCH_DONE)
+    {
+        ESP_LOGE(TAG, "Update failed after %u patch bytes, status %d", (unsigned)s_ctx.patch_bytes, status);
+        if (s_ctx.begun)
+        {
+            esp_ota_abort(s_ctx.handle);
+        }
+        return ESP_FAIL;
+    }
+
+    // Checks the image header, segments and appended SHA-256 before the slot can boot
+    ret = esp_ota_end(s_ctx.handle);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Patched image is invalid: %s", esp_err_to_name(ret));
+        return ESP_FAIL;
+    }
+    if (esp_ota_set_boot_partition(s_ctx.target) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to set boot partition");
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(TAG, "Update ready on %s, %u patch bytes for %" PRIu32 " image bytes",
+             s_ctx.target->label, (unsigned)s_ctx.patch_bytes, s_patch.header.new_size);
+
+    return ESP_OK;
+}
+
+bool delta_ota_pending_verify(void)
+{
+    esp_ota_img_states_t state;
+
+    return esp_ota_get_state_partition(esp_ota_get_running_partition(), &state) == ESP_OK &&
+           state == ESP_OTA_IMG_PENDING_VERIFY;
+}
+
+void delta_ota_confirm(void)
+{
+    if (esp_ota_mark_app_valid_cancel_rollback() == ESP_OK)
+    {
+        ESP_LOGI(TAG, "Image confirmed");
+    }
+}
+
+void delta_ota_rollback(void)
+{
+    ESP_LOGE(TAG, "Image failed its checks, rolling back");
+    esp_ota_mark_app_invalid_rollback_and_reboot();
+    ESP_LOGE(TAG, "No image to roll back to");
+}
@@ -0,0 +1,288 @@
+#include <string.h>
+
+#include "delta_patch.h"
+
+#define WINDOW_MASK (DELTA_PATCH_WINDOW_SIZE - 1)
+#define LONG_MATCH_CODE 15
+
+typedef enum
+{
+    OP_ADD_LEN = 0,
+    OP_INSERT_LEN,
+    OP_SEEK,
+    OP_ADD,
+    OP_INSERT,
+} op_state_t;
+
+uint32_t delta_patch_crc32(uint32_t crc, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+
+    crc = ~crc;
+    while (len--)
+    {
+        crc ^= *p++;
+        for (int i = 0; i < 8; i++)
+        {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+
+    return ~crc;
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+    return p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+void delta_patch_init(delta_patch_t *patch, const delta_patch_io_t *io)
+{
+    memset(patch, 0, sizeof(*patch));
+    patch->io = io;
+    patch->status = DELTA_PATCH_MORE;
+    patch->op_state = OP_ADD_LEN;
+}
+
+static void delta_patch_fail(delta_patch_t *patch)
+{
+    patch->status = DELTA_PATCH_ERROR;
+}
+
+static void delta_patch_flush(delta_patch_t *patch)
+{
+    if (patch->out_len == 0)
+    {
+        return;
+    }
+    if (!patch->io->write_new(patch->io->ctx, patch->out_buf, patch->out_len))
+    {
+        delta_patch_fail(patch);
+        return;
+    }
+    patch->crc = delta_patch_crc32(patch->crc, patch->out_buf, patch->out_len);
+    patch->out_len = 0;
+}
+
+static void delta_patch_output(delta_patch_t *patch, uint8_t c)
+{
+    patch->out_buf[patch->out_len++] = c;
+    patch->new_pos++;
+    if (patch->out_len == sizeof(patch->out_buf))
+    {
+        delta_patch_flush(patch);
+    }
+}
+
+static bool delta_patch_old_byte(delta_patch_t *patch, uint32_t pos, uint8_t *c)
+{
+    if (pos < patch->old_buf_start || pos >= patch->old_buf_start + patch->old_buf_len)
+    {
+        uint32_t len = patch->header.old_size - pos;
+        if (len > sizeof(patch->old_buf))
+        {
+            len = sizeof(patch->old_buf);
+        }
+        if (!patch->io->read_old(patch->io->ctx, pos, patch->old_buf, len))
+        {
+            return false;
+        }
+        patch->old_buf_start = pos;
+        patch->old_buf_len = len;
+    }
+    *c = patch->old_buf[pos - patch->old_buf_start];
+
+    return true;
+}
+
+/**
+ * @brief Move on to the data of the current control, or finish it
+ *
+ */
+static void delta_patch_next_op(delta_patch_t *patch)
+{
+    if (patch->add_len > 0)
+    {
+        patch->op_state = OP_ADD;
+        return;
+    }
+    if (patch->insert_len > 0)
+    {
+        patch->op_state = OP_INSERT;
+        return;
+    }
+
+    // Seeking to the very end is fine, reading there is not
+    if ((patch->seek < 0 && (uint32_t)-patch->seek > patch->old_pos) ||
+        (patch->seek > 0 && (uint32_t)patch->seek > patch->header.old_size - patch->old_pos))
+    {
+        delta_patch_fail(patch);
+        return;
+    }
+    patch->old_pos += patch->seek;
+    patch->op_state = OP_ADD_LEN;
+
+    if (patch->new_pos == patch->header.new_size)
+    {
+        delta_patch_flush(patch);
+        if (patch->status == DELTA_PATCH_MORE)
+        {
+            patch->status = patch->crc == patch->header.new_crc ? DELTA_PATCH_DONE : DELTA_PATCH_ERROR;
+        }
+    }
+}
+
+/**
+ * @brief Consume one byte of the decompressed op stream
+ *
+ */
+static void delta_patch_op(delta_patch_t *patch, uint8_t b)
+{
+    uint8_t c;
+
+    switch (patch->op_state)
+    {
+    case OP_ADD_LEN:
+    case OP_INSERT_LEN:
+    case OP_SEEK:
+        if (patch->varint_shift > 28)
+        {
+            delta_patch_fail(patch);
+            return;
+        }
+        patch->varint |= (uint32_t)(b & 0x7F) << patch->varint_shift;
+        patch->varint_shift += 7;
+        if (b & 0x80)
+        {
+            return;
+        }
+
+        if (patch->op_state == OP_ADD_LEN)
+        {
+            patch->add_len = patch->varint;
+            patch->op_state = OP_INSERT_LEN;
+        }
+        else if (patch->op_state == OP_INSERT_LEN)
+        {
+            patch->insert_len = patch->varint;
+            patch->op_state = OP_SEEK;
+        }
+        else
+        {
+            patch->seek = (int32_t)((patch->varint >> 1) ^ -(patch->varint & 1));
+            if (patch->add_len > patch->header.old_size - patch->old_pos ||
+                patch->add_len > patch->header.new_size - patch->new_pos ||
+                patch->insert_len > patch->header.new_size - patch->new_pos - patch->add_len)
+            {
+                delta_patch_fail(patch);
+                return;
+            }
+            delta_patch_next_op(patch);
+        }
+        patch->varint = 0;
+        patch->varint_shift = 0;
+        break;
+    case OP_ADD:
+        if (!delta_patch_old_byte(patch, patch->old_pos++, &c))
+        {
+            delta_patch_fail(patch);
+            return;
+        }
+        delta_patch_output(patch, c + b);
+        if (--patch->add_len == 0)
+        {
+            delta_patch_next_op(patch);
+        }
+        break;
+    case OP_INSERT:
+        delta_patch_output(patch, b);
+        if (--patch->insert_len == 0)
+        {
+            delta_patch_next_op(patch);
+        }
+        break;
+    default:
+        delta_patch_fail(patch);
+        break;
+    }
+}
+
+static void delta_patch_emit(delta_patch_t *patch, uint8_t c)
+{
+    patch->window[patch->window_pos] = c;
+    patch->window_pos = (patch->window_pos + 1) & WINDOW_MASK;
+    delta_patch_op(patch, c);
+}
+
+static bool delta_patch_parse_header(delta_patch_t *patch)
+{
+    const uint8_t *p = patch->header_buf;
+
+    if (get_u32(p) != DELTA_PATCH_MAGIC)
+    {
+        return false;
+    }
+    patch->header.old_size = get_u32(p + 4);
+    patch->header.old_crc = get_u32(p + 8);
+    patch->header.new_size = get_u32(p + 12);
+    patch->header.new_crc = get_u32(p + 16);
+
+    return patch->header.new_size > 0 && patch->io->begin(patch->io->ctx, &patch->header);
+}
+
+delta_patch_status_t delta_patch_feed(delta_patch_t *patch, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+
+    for (size_t i = 0; i < len && patch->status == DELTA_PATCH_MORE; i++)
+    {
+        uint8_t b = p[i];
+
+        if (patch->header_len < DELTA_PATCH_HEADER_SIZE)
+        {
+            patch->header_buf[patch->header_len++] = b;
+            if (patch->header_len == DELTA_PATCH_HEADER_SIZE && !delta_patch_parse_header(patch))
+            {
+                delta_patch_fail(patch);
+            }
+            continue;
+        }
+
+        if (patch->flags_left == 0)
+        {
+            patch->flags = b;
+            patch->flags_left = 8;
+            continue;
+        }
+
+        if (patch->flags & 1)
+        {
+            delta_patch_emit(patch, b);
+        }
+        else
+        {
+            patch->token[patch->token_len++] = b;
+            if (patch->token_len < 2 || (patch->token_len == 2 && (patch->token[1] & 0x0F) == LONG_MATCH_CODE))
+            {
+                continue;
+            }
+
+            uint16_t distance = (patch->token[0] | (uint16_t)(patch->token[1] >> 4) << 8) + 1;
+            uint16_t match_len = (patch->token[1] & 0x0F) + DELTA_PATCH_MIN_MATCH;
+            if (patch->token_len == 3)
+            {
+                match_len += patch->token[2];
+            }
+            patch->token_len = 0;
+
+            for (uint16_t n = 0; n < match_len && patch->status == DELTA_PATCH_MORE; n++)
+            {
+                delta_patch_emit(patch, patch->window[(patch->window_pos - distance) & WINDOW_MASK]);
+            }
+        }
+        patch->flags >>= 1;
+        patch->flags_left--;
+    }
+
+    return patch->status;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "esp_err.h"
+
+#include "uploader.h"
+
+/**
+ * @brief Look for a delta patch against the running image and apply it to the other slot
+ *
+ * The patch is fetched from <path_prefix>/<first 8 bytes of the running ELF SHA-256 in
+ * hex>.patch and applied while it downloads. The boot partition is switched only after the
+ * patched image checked out against the patch CRC and esp_ota_end() validated it.
+ *
+ * @param uploader: connected or not, the fetch connects
+ * @param path_prefix: e.g. "/ota"
+ * @return
+ *      ESP_OK if an update is ready to boot, ESP_ERR_NOT_FOUND if there is none, or ESP_FAIL
+ */
+esp_err_t delta_ota_update(uploader_t *uploader, const char *path_prefix);
+
+/**
+ * @brief Whether the running image was just updated and still has to prove itself
+ *
+ */
+bool delta_ota_pending_verify(void);
+
+/**
+ * @brief Keep the running image
+ *
+ */
+void delta_ota_confirm(void);
+
+/**
+ * @brief Give up on the running image and reboot into the previous one
+ *
+ *        Also after delta_ota_confirm(), as long as the previous image is still in its slot.
+ *
+ */
+void delta_ota_rollback(void);
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define DELTA_PATCH_MAGIC 0x31444D53 // "SMD1"
+#define DELTA_PATCH_HEADER_SIZE 20
+/* LZSS window of the compressed op stream, the largest RAM cost of applying a patch */
+#define DELTA_PATCH_WINDOW_BITS 12
+#define DELTA_PATCH_WINDOW_SIZE (1 << DELTA_PATCH_WINDOW_BITS)
+#define DELTA_PATCH_MIN_MATCH 3
+/* Old image reads and new image writes are done in chunks of this size */
+#define DELTA_PATCH_CHUNK_SIZE 256
+
+/**
+ * @brief Patch Header Type
+ *
+ * The patch starts with the magic and these fields, little endian, followed by the
+ * compressed op stream.
+ */
+typedef struct delta_patch_header_s
+{
+    uint32_t old_size; /*!< length of the image the patch applies to */
+    uint32_t old_crc;  /*!< CRC-32 of that image, see delta_patch_crc32() */
+    uint32_t new_size; /*!< length of the patched image */
+    uint32_t new_crc;  /*!< CRC-32 of the patched image */
+} delta_patch_header_t;
+
+/**
+ * @brief Patch I/O Type
+ *
+ * The op stream is a sequence of controls, each followed by its data:
+ * add_len, insert_len and seek as LEB128 varints (seek zigzag encoded), add_len bytes
+ * added to the old image at the old position, which then advances by add_len, insert_len
+ * literal bytes, then the old position moves by seek. It is LZSS compressed: a flag byte,
+ * least significant bit first, announces 8 items, a set bit a literal byte, a clear bit a
+ * match of two bytes, 12 bits of distance - 1 and 4 bits of length - 3. A length code of 15
+ * is followed by a byte, length 18 + that byte.
+ */
+typedef struct delta_patch_io_s
+{
+    /* Accept the header before anything is written, e.g. check the old image and begin the update */
+    bool (*begin)(void *ctx, const delta_patch_header_t *header);
+
+    bool (*read_old)(void *ctx, uint32_t offset, void *buf, size_t len);
+
+    bool (*write_new)(void *ctx, const void *data, size_t len);
+
+    void *ctx;
+} delta_patch_io_t;
+
+/**
+ * @brief Patch Status Type
+ *
+ */
+typedef enum
+{
+    DELTA_PATCH_MORE = 0, /*!< waiting for more patch data */
+    DELTA_PATCH_DONE,     /*!< the new image is written and its CRC matches */
+    DELTA_PATCH_ERROR,    /*!< malformed patch, rejected header, I/O failure or CRC mismatch */
+} delta_patch_status_t;
+
+/**
+ * @brief Patch State Type
+ *
+ * Everything needed to apply a patch of any size, so it can be allocated once, statically.
+ */
+typedef struct delta_patch_s
+{
+    const delta_patch_io_t *io;
+    delta_patch_status_t status;
+    delta_patch_header_t header;
+    uint8_t header_buf[DELTA_PATCH_HEADER_SIZE];
+    uint8_t header_len;
+
+    /* LZSS decoder */
+    uint8_t window[DELTA_PATCH_WINDOW_SIZE];
+    uint16_t window_pos;
+    uint8_t flags;      /*!< flag byte of the current group */
+    uint8_t flags_left; /*!< items left in the group */
+    uint8_t token[3];
+    uint8_t token_len;
+
+    /* Op decoder */
+    uint8_t op_state;
+    uint8_t varint_shift;
+    uint32_t varint;
+    uint32_t add_len;
+    uint32_t insert_len;
+    int32_t seek;
+    uint32_t old_pos;
+    uint32_t new_pos;
+
+    uint8_t old_buf[DELTA_PATCH_CHUNK_SIZE];
+    uint32_t old_buf_start;
+    uint16_t old_buf_len;
+    uint8_t out_buf[DELTA_PATCH_CHUNK_SIZE];
+    uint16_t out_len;
+    uint32_t crc; /*!< of the new image so far */
+} delta_patch_t;
+
+/**
+ * @brief CRC-32 (IEEE 802.3), chainable, as used in the patch header
+ *
+ * @param crc: 0, or the CRC of the preceding data
+ * @param data: data
+ * @param len: length of data
+ * @return
+ *      updated CRC
+ */
+uint32_t delta_patch_crc32(uint32_t crc, const void *data, size_t len);
+
+/**
+ * @brief Start applying a patch
+ *
+ * @param patch: patch state
+ * @param io: I/O operations, must stay valid until the patch is done
+ */
+void delta_patch_init(delta_patch_t *patch, const delta_patch_io_t *io);
+
+/**
+ * @brief Feed the next piece of the patch, pieces may be split anywhere
+ *
+ * @param patch: patch state
+ * @param data: patch data
+ * @param len: length of data
+ * @return
+ *      DELTA_PATCH_MORE until the last byte of the new image is written and checked
+ */
+delta_patch_status_t delta_patch_feed(delta_patch_t *patch, const void *data, size_t len);
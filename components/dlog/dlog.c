@@ -0,0 +1,154 @@
+#include <inttypes.h>
+#include <time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_app_desc.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+
+#include "dlog.h"
+
+/* Bytes per line of dlog_dump() */
+#define DLOG_DUMP_LINE 32
+
+static const char *TAG = "dlog";
+
+/* Survives resets other than power on, so the reset button can dump it */
+RTC_NOINIT_ATTR static dlog_ring_t s_dlog_ring;
+/* The event loop and esp_timer tasks log too */
+static portMUX_TYPE s_dlog_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/* With the lock held */
+static void dlog_init(void)
+{
+    dlog_ring_init(&s_dlog_ring);
+    if (s_dlog_ring.session == 0)
+    {
+        s_dlog_ring.session = esp_random() | 1;
+    }
+}
+
+static void dlog_push(const uint8_t *record, size_t len)
+{
+    taskENTER_CRITICAL(&s_dlog_lock);
+    dlog_init();
+    dlog_ring_push(&s_dlog_ring, record, len);
+    taskEXIT_CRITICAL(&s_dlog_lock);
+}
+
+static size_t dlog_copy(uint8_t *out, size_t size, uint32_t *end)
+{
+    size_t len;
+
+    taskENTER_CRITICAL(&s_dlog_lock);
+    dlog_init();
+    len = dlog_ring_copy(&s_dlog_ring, out, size, end);
+    taskEXIT_CRITICAL(&s_dlog_lock);
+
+    return len;
+}
+
+static void dlog_hex(const uint8_t *data, size_t len, char *out)
+{
+    static const char digits[] = "0123456789abcdef";
+
+    for (size_t i = 0; i < len; i++)
+    {
+        out[2 * i] = digits[data[i] >> 4];
+        out[2 * i + 1] = digits[data[i] & 0xF];
+    }
+    out[2 * len] = '\0';
+}
+
+void dlog_write(const char *tag, const char *format, ...)
+{
+    uint8_t record[DLOG_MAX_RECORD];
+    va_list args;
+    size_t len;
+
+    // Encoded outside the lock, only the copy into the ring is serialized
+    va_start(args, format);
+    len = dlog_record_encode(record, (uint32_t)esp_timer_get_time(), (uint32_t)(uintptr_t)tag,
+                             (uint32_t)(uintptr_t)format, format, args);
+    va_end(args);
+
+    dlog_push(record, len);
+}
+
+static void dlog_write_wake(const char *format, ...)
+{
+    uint8_t record[DLOG_MAX_RECORD];
+    va_list args;
+    size_t len;
+
+    va_start(args, format);
+    len = dlog_record_encode(record, (uint32_t)esp_timer_get_time(), 0, 0, format, args);
+    va_end(args);
+
+    dlog_push(record, len);
+}
+
+void dlog_begin_wake(void)
+{
+    char elf_sha[9];
+
+    esp_app_get_elf_sha256(elf_sha, sizeof(elf_sha));
+    dlog_write_wake(DLOG_WAKE_FORMAT, (long long)time(NULL), elf_sha);
+}
+
+size_t dlog_export_hex(char *out, size_t size, uint32_t *end)
+{
+    static uint8_t records[DLOG_RING_SIZE];
+    size_t len;
+
+    len = size > 0 ? (size - 1) / 2 : 0;
+    len = dlog_copy(records, len < sizeof(records) ? len : sizeof(records), end);
+    if (size > 0)
+    {
+        dlog_hex(records, len, out);
+    }
+
+    return len;
+}
+
+void dlog_consume(uint32_t end)
+{
+    taskENTER_CRITICAL(&s_dlog_lock);
+    dlog_ring_consume(&s_dlog_ring, end);
+    taskEXIT_CRITICAL(&s_dlog_lock);
+}
+
+uint32_t dlog_session(void)
+{
+    uint32_t session;
+
+    taskENTER_CRITICAL(&s_dlog_lock);
+    dlog_init();
+    session = s_dlog_ring.session;
+    taskEXIT_CRITICAL(&s_dlog_lock);
+
+    return session;
+}
+
+uint32_t dlog_dropped(void)
+{
+    return s_dlog_ring.dropped;
+}
+
+void dlog_dump(void)
+{
+    static uint8_t records[DLOG_RING_SIZE];
+    char line[2 * DLOG_DUMP_LINE + 1];
+    uint32_t end;
+    size_t len;
+
+    len = dlog_copy(records, sizeof(records), &end);
+    ESP_LOGI(TAG, "%zu bytes, %" PRIu32 " records dropped", len, dlog_dropped());
+    for (size_t offset = 0; offset < len; offset += DLOG_DUMP_LINE)
+    {
+        dlog_hex(records + offset, len - offset < DLOG_DUMP_LINE ? len - offset : DLOG_DUMP_LINE, line);
+        ESP_LOGI(TAG, "DLOG %s", line);
+    }
+}
@@ -0,0 +1,428 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "dlog_ring.h"
+
+#define DLOG_RING_MAGIC 0x444C4F47 // "DLOG"
+
+const char dlog_secret[] = "<redacted>";
+
+/**
+ * @brief Conversion Specification Type
+ *
+ */
+typedef struct
+{
+    const char *start; /*!< the % */
+    size_t flags_len;  /*!< %, flags, width and precision, without the length modifier */
+    char conversion;
+    uint8_t longs; /*!< number of l */
+    char modifier; /*!< z, j or t, 0 for none */
+} dlog_spec_t;
+
+/**
+ * @brief Find the next conversion
+ *
+ * @return
+ *      the character after it, NULL if there is none
+ */
+static const char *dlog_next_spec(const char *p, dlog_spec_t *spec)
+{
+    const char *q;
+
+    for (; *p != '\0'; p++)
+    {
+        if (*p != '%')
+        {
+            continue;
+        }
+        if (p[1] == '%')
+        {
+            p++;
+            continue;
+        }
+
+        spec->start = p;
+        q = p + 1 + strspn(p + 1, "-+ #0123456789.");
+        spec->flags_len = q - p;
+        spec->longs = 0;
+        spec->modifier = 0;
+        for (; *q != '\0' && strchr("hlLzjt", *q) != NULL; q++)
+        {
+            if (*q == 'l')
+            {
+                spec->longs++;
+            }
+            else if (*q != 'h' && *q != 'L')
+            {
+                spec->modifier = *q;
+            }
+        }
+        spec->conversion = *q;
+
+        return *q != '\0' ? q + 1 : NULL;
+    }
+
+    return NULL;
+}
+
+static void dlog_put_le(uint8_t *p, uint64_t value, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        p[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+static uint64_t dlog_get_le(const uint8_t *p, size_t n)
+{
+    uint64_t value = 0;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        value |= (uint64_t)p[i] << (8 * i);
+    }
+
+    return value;
+}
+
+void dlog_ring_init(dlog_ring_t *ring)
+{
+    if (ring->magic == DLOG_RING_MAGIC && ring->head < DLOG_RING_SIZE && ring->used <= DLOG_RING_SIZE)
+    {
+        return;
+    }
+
+    memset(ring, 0, sizeof(*ring));
+    ring->magic = DLOG_RING_MAGIC;
+}
+
+size_t dlog_record_encode(uint8_t out[DLOG_MAX_RECORD], uint32_t timestamp_us, uint32_t tag, uint32_t format_id,
+                          const char *format, va_list args)
+{
+    uint8_t *arg = out + DLOG_HEADER_SIZE;
+    uint8_t *end = out + DLOG_MAX_RECORD;
+    dlog_spec_t spec;
+    const char *s;
+    uint64_t value;
+    double real;
+    size_t len;
+    bool wide;
+
+    dlog_put_le(out, format_id, 4);
+    dlog_put_le(out + 4, tag, 4);
+    dlog_put_le(out + 8, timestamp_us, 4);
+
+    for (const char *p = format; p != NULL && (p = dlog_next_spec(p, &spec)) != NULL;)
+    {
+        // Whatever does not fit is left out, the varargs are not read past it
+        if (end - arg < 1 + 8)
+        {
+            break;
+        }
+
+        switch (spec.conversion)
+        {
+        case 'd':
+        case 'i':
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'o':
+        case 'c':
+        case 'p':
+            if (spec.conversion == 'p')
+            {
+                value = (uintptr_t)va_arg(args, void *);
+                len = sizeof(void *);
+            }
+            else if (spec.longs >= 2 || spec.modifier == 'j')
+            {
+                value = (uint64_t)va_arg(args, long long);
+                len = sizeof(long long);
+            }
+            else if (spec.longs == 1)
+            {
+                value = (uint64_t)va_arg(args, long);
+                len = sizeof(long);
+            }
+            else if (spec.modifier == 'z' || spec.modifier == 't')
+            {
+                value = (uint64_t)va_arg(args, size_t);
+                len = sizeof(size_t);
+            }
+            else
+            {
+                value = (uint64_t)va_arg(args, int);
+                len = sizeof(int);
+            }
+            // Signed values are sign extended to 64 bits, unsigned ones take the width they were passed with
+            if (spec.conversion == 'd' || spec.conversion == 'i')
+            {
+                wide = (int64_t)value != (int32_t)value;
+            }
+            else
+            {
+                value &= len > 4 ? UINT64_MAX : UINT32_MAX;
+                wide = value > UINT32_MAX;
+            }
+            *arg++ = wide ? DLOG_ARG_INT64 : DLOG_ARG_INT32;
+            dlog_put_le(arg, value, wide ? 8 : 4);
+            arg += wide ? 8 : 4;
+            break;
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            real = va_arg(args, double);
+            memcpy(&value, &real, sizeof(value));
+            *arg++ = DLOG_ARG_DOUBLE;
+            dlog_put_le(arg, value, 8);
+            arg += 8;
+            break;
+        case 's':
+            s = va_arg(args, const char *);
+            if (s == dlog_secret)
+            {
+                *arg++ = DLOG_ARG_SECRET;
+                break;
+            }
+            s = s != NULL ? s : "(null)";
+            len = strnlen(s, DLOG_MAX_STRING);
+            if ((size_t)(end - arg) < 2 + len)
+            {
+                len = end - arg - 2;
+            }
+            *arg++ = DLOG_ARG_STRING;
+            *arg++ = (uint8_t)len;
+            memcpy(arg, s, len);
+            arg += len;
+            break;
+        default:
+            // e.g. a * width, the arguments can no longer be told apart
+            p = NULL;
+            break;
+        }
+    }
+
+    out[12] = (uint8_t)(arg - out - DLOG_HEADER_SIZE);
+
+    return arg - out;
+}
+
+static size_t dlog_ring_tail(const dlog_ring_t *ring)
+{
+    return (ring->head + DLOG_RING_SIZE - ring->used) % DLOG_RING_SIZE;
+}
+
+static void dlog_ring_drop(dlog_ring_t *ring)
+{
+    size_t size = DLOG_HEADER_SIZE + ring->data[(dlog_ring_tail(ring) + 12) % DLOG_RING_SIZE];
+
+    // Only a damaged ring has a partial record left
+    size = size < ring->used ? size : ring->used;
+    ring->used -= size;
+    ring->tail_pos += size;
+}
+
+void dlog_ring_push(dlog_ring_t *ring, const uint8_t *record, size_t len)
+{
+    if (len > DLOG_RING_SIZE)
+    {
+        return;
+    }
+
+    while (DLOG_RING_SIZE - ring->used < len)
+    {
+        dlog_ring_drop(ring);
+        ring->dropped++;
+    }
+
+    for (size_t i = 0; i < len; i++)
+    {
+        ring->data[ring->head] = record[i];
+        ring->head = (ring->head + 1) % DLOG_RING_SIZE;
+    }
+    ring->used += len;
+}
+
+size_t dlog_ring_copy(const dlog_ring_t *ring, uint8_t *out, size_t size, uint32_t *end)
+{
+    size_t tail = dlog_ring_tail(ring);
+    size_t copied = 0;
+    size_t record_size;
+
+    while (copied < ring->used)
+    {
+        record_size = DLOG_HEADER_SIZE + ring->data[(tail + copied + 12) % DLOG_RING_SIZE];
+        if (copied + record_size > size)
+        {
+            break;
+        }
+        for (size_t i = 0; i < record_size; i++)
+        {
+            out[copied + i] = ring->data[(tail + copied + i) % DLOG_RING_SIZE];
+        }
+        copied += record_size;
+    }
+
+    *end = ring->tail_pos + (uint32_t)copied;
+
+    return copied;
+}
+
+void dlog_ring_consume(dlog_ring_t *ring, uint32_t end)
+{
+    // Wraps like any stream position
+    while (ring->used > 0 && (int32_t)(end - ring->tail_pos) > 0)
+    {
+        dlog_ring_drop(ring);
+    }
+}
+
+size_t dlog_record_parse(const uint8_t *data, size_t len, dlog_record_t *record)
+{
+    if (len < DLOG_HEADER_SIZE || len < (size_t)DLOG_HEADER_SIZE + data[12])
+    {
+        return 0;
+    }
+
+    record->format = (uint32_t)dlog_get_le(data, 4);
+    record->tag = (uint32_t)dlog_get_le(data + 4, 4);
+    record->timestamp_us = (uint32_t)dlog_get_le(data + 8, 4);
+    record->args_len = data[12];
+    record->args = data + DLOG_HEADER_SIZE;
+
+    return DLOG_HEADER_SIZE + record->args_len;
+}
+
+/* Literal text of a format, %% printed as % */
+static size_t dlog_append_literal(char *out, size_t size, size_t len, const char *literal, size_t n)
+{
+    for (size_t i = 0; i < n && len < size - 1; i++)
+    {
+        out[len++] = literal[i];
+        i += literal[i] == '%' && i + 1 < n && literal[i + 1] == '%';
+    }
+    out[len] = '\0';
+
+    return len;
+}
+
+size_t dlog_record_format(const dlog_record_t *record, const char *format, char *out, size_t size)
+{
+    const uint8_t *arg = record->args;
+    const uint8_t *end = record->args + record->args_len;
+    const char *literal = format;
+    const char *next;
+    dlog_spec_t spec;
+    char conversion[24];
+    char string[DLOG_MAX_STRING + 1];
+    size_t len = 0;
+    uint64_t value;
+    double real;
+    int n;
+
+#define DLOG_APPEND(...)                                                 \
+    do                                                                   \
+    {                                                                    \
+        n = snprintf(out + len, size - len, __VA_ARGS__);                \
+        len += n > 0 ? (size_t)n : 0;                                    \
+        len = len < size ? len : size - 1;                               \
+    } while (0)
+
+    out[0] = '\0';
+    while ((next = dlog_next_spec(literal, &spec)) != NULL)
+    {
+        len = dlog_append_literal(out, size, len, literal, spec.start - literal);
+        literal = next;
+
+        // Flags, width and precision are kept, the length modifier follows the stored width
+        if (spec.flags_len > sizeof(conversion) - 4)
+        {
+            spec.flags_len = sizeof(conversion) - 4;
+        }
+        memcpy(conversion, spec.start, spec.flags_len);
+
+        if (arg >= end)
+        {
+            DLOG_APPEND("?");
+            continue;
+        }
+        switch (*arg++)
+        {
+        case DLOG_ARG_INT32:
+        case DLOG_ARG_INT64:
+            n = arg[-1] == DLOG_ARG_INT64 ? 8 : 4;
+            if (end - arg < n)
+            {
+                arg = end;
+                DLOG_APPEND("?");
+                break;
+            }
+            value = dlog_get_le(arg, n);
+            arg += n;
+            if (n == 4 && (spec.conversion == 'd' || spec.conversion == 'i'))
+            {
+                value = (uint64_t)(int64_t)(int32_t)value;
+            }
+            if (spec.conversion == 'c')
+            {
+                strcpy(conversion + spec.flags_len, "c");
+                DLOG_APPEND(conversion, (int)value);
+            }
+            else if (spec.conversion == 'p')
+            {
+                DLOG_APPEND("0x%llx", (unsigned long long)value);
+            }
+            else
+            {
+                sprintf(conversion + spec.flags_len, "ll%c", spec.conversion);
+                DLOG_APPEND(conversion, (long long)value);
+            }
+            break;
+        case DLOG_ARG_DOUBLE:
+            if (end - arg < 8)
+            {
+                arg = end;
+                DLOG_APPEND("?");
+                break;
+            }
+            value = dlog_get_le(arg, 8);
+            arg += 8;
+            memcpy(&real, &value, sizeof(real));
+            sprintf(conversion + spec.flags_len, "%c", spec.conversion);
+            DLOG_APPEND(conversion, real);
+            break;
+        case DLOG_ARG_STRING:
+            n = arg < end ? *arg++ : 0;
+            if (end - arg < n)
+            {
+                n = end - arg;
+            }
+            memcpy(string, arg, n);
+            string[n] = '\0';
+            arg += n;
+            strcpy(conversion + spec.flags_len, "s");
+            DLOG_APPEND(conversion, string);
+            break;
+        case DLOG_ARG_SECRET:
+            strcpy(conversion + spec.flags_len, "s");
+            DLOG_APPEND(conversion, dlog_secret);
+            break;
+        default:
+            arg = end;
+            DLOG_APPEND("?");
+            break;
+        }
+    }
+    len = dlog_append_literal(out, size, len, literal, strlen(literal));
+
+#undef DLOG_APPEND
+
+    return len;
+}
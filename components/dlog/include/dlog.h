@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "dlog_ring.h"
+
+/**
+ * @brief Log a line without formatting it, in place of ESP_LOGI()
+ *
+ * Only the format and tag addresses, a timestamp and the arguments are stored, strings
+ * up to DLOG_MAX_STRING characters. host/dlog_decode prints the records with the formats
+ * from the firmware's ELF file.
+ */
+#define DLOGI(tag, format, ...) dlog_write(tag, format, ##__VA_ARGS__)
+
+/**
+ * @brief Pass a string argument, e.g. a password, as DLOGI(TAG, "Password %s", DLOG_SECRET(password))
+ * to log a placeholder in its place
+ *
+ */
+#define DLOG_SECRET(value) ((void)(value), dlog_secret)
+
+/**
+ * @brief Append a record to the RTC log ring, see DLOGI()
+ *
+ */
+void dlog_write(const char *tag, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+/**
+ * @brief Mark the start of a wake with the wall clock and the ELF file it needs to be decoded with
+ *
+ */
+void dlog_begin_wake(void);
+
+/**
+ * @brief Hex encode the records in the ring, oldest first
+ *
+ * @param out: output, NUL terminated
+ * @param size: output size, whole records only
+ * @param end: output stream position after the records, for dlog_consume()
+ * @return
+ *      bytes encoded, 0 if the ring is empty
+ */
+size_t dlog_export_hex(char *out, size_t size, uint32_t *end);
+
+/**
+ * @brief Drop exported records once they were uploaded
+ *
+ * @param end: stream position from dlog_export_hex()
+ */
+void dlog_consume(uint32_t end);
+
+/**
+ * @brief Random number drawn whenever the ring starts over, e.g. at power on
+ *
+ * Stream positions repeat across sessions, the session and the position of the first
+ * exported record name an upload uniquely.
+ */
+uint32_t dlog_session(void);
+
+/**
+ * @brief Records overwritten before they were uploaded, since power on
+ *
+ */
+uint32_t dlog_dropped(void);
+
+/**
+ * @brief Log the ring in hex on the console, for host/dlog_decode
+ *
+ */
+void dlog_dump(void);
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Bytes kept in the ring, a record is DLOG_HEADER_SIZE plus its arguments */
+#define DLOG_RING_SIZE 1024
+#define DLOG_HEADER_SIZE 13
+#define DLOG_MAX_ARGS_SIZE 96
+#define DLOG_MAX_RECORD (DLOG_HEADER_SIZE + DLOG_MAX_ARGS_SIZE)
+/* Longer string arguments are truncated */
+#define DLOG_MAX_STRING 32
+
+/* Format of the record dlog_begin_wake() writes, with format and tag 0 */
+#define DLOG_WAKE_FORMAT "wake at %lld, elf %s"
+
+/**
+ * @brief Argument Type, the first byte of each encoded argument
+ *
+ */
+typedef enum
+{
+    DLOG_ARG_INT32 = 1, /*!< 4 bytes, sign extended for %d and %i */
+    DLOG_ARG_INT64,     /*!< 8 bytes */
+    DLOG_ARG_DOUBLE,    /*!< 8 bytes */
+    DLOG_ARG_STRING,    /*!< length byte, then the characters without NUL */
+    DLOG_ARG_SECRET,    /*!< no payload, the string was passed as DLOG_SECRET() */
+} dlog_arg_type_t;
+
+/**
+ * @brief Deferred Log Ring Type
+ *
+ * Meant to live in RTC memory. Records are packed little endian: format address, tag
+ * address and microseconds since boot as 32 bit words, the length of the arguments as a
+ * byte, then the arguments. The formats and tags stay in the firmware image, the host
+ * decoder looks them up in the ELF file.
+ */
+typedef struct dlog_ring_s
+{
+    uint32_t magic;
+    uint16_t head;     /*!< next byte written */
+    uint16_t used;     /*!< bytes of whole records */
+    uint32_t tail_pos; /*!< stream position of the oldest byte, grows as records leave */
+    uint32_t dropped;  /*!< records overwritten before they were consumed */
+    uint32_t session;  /*!< left to the owner, 0 after a reset */
+    uint8_t data[DLOG_RING_SIZE];
+} dlog_ring_t;
+
+/**
+ * @brief Decoded Record Type
+ *
+ */
+typedef struct dlog_record_s
+{
+    uint32_t format;       /*!< address of the format string, 0 for a wake record */
+    uint32_t tag;          /*!< address of the tag string, 0 for a wake record */
+    uint32_t timestamp_us; /*!< since boot */
+    const uint8_t *args;   /*!< encoded arguments */
+    uint8_t args_len;
+} dlog_record_t;
+
+/**
+ * @brief Pass a string argument as this to keep it out of the ring
+ *
+ */
+extern const char dlog_secret[];
+
+/**
+ * @brief Reset the ring unless it already holds valid data
+ *
+ * @param ring: log ring
+ */
+void dlog_ring_init(dlog_ring_t *ring);
+
+/**
+ * @brief Encode a record, the argument types follow the printf conversions of format
+ *
+ * Arguments past DLOG_MAX_ARGS_SIZE and conversions with a * width are left out, the
+ * decoder prints them as ?.
+ *
+ * @param out: output record, DLOG_MAX_RECORD bytes
+ * @param timestamp_us: microseconds since boot
+ * @param tag: tag address
+ * @param format_id: format address
+ * @param format: format
+ * @param args: arguments
+ * @return
+ *      record size
+ */
+size_t dlog_record_encode(uint8_t out[DLOG_MAX_RECORD], uint32_t timestamp_us, uint32_t tag, uint32_t format_id,
+                          const char *format, va_list args);
+
+/**
+ * @brief Append a record, dropping the oldest ones to make room
+ *
+ * @param ring: log ring
+ * @param record: encoded record
+ * @param len: record size
+ */
+void dlog_ring_push(dlog_ring_t *ring, const uint8_t *record, size_t len);
+
+/**
+ * @brief Copy whole records, oldest first
+ *
+ * @param ring: log ring
+ * @param out: output buffer
+ * @param size: output buffer size
+ * @param end: output stream position after the last record copied, for dlog_ring_consume()
+ * @return
+ *      bytes copied
+ */
+size_t dlog_ring_copy(const dlog_ring_t *ring, uint8_t *out, size_t size, uint32_t *end);
+
+/**
+ * @brief Drop the records before a stream position, e.g. once they were uploaded
+ *
+ * Records the ring dropped in the meantime are not dropped twice.
+ *
+ * @param ring: log ring
+ * @param end: stream position from dlog_ring_copy()
+ */
+void dlog_ring_consume(dlog_ring_t *ring, uint32_t end);
+
+/**
+ * @brief Parse the record at the start of a copied stream
+ *
+ * @param data: records
+ * @param len: bytes left
+ * @param record: output record, points into data
+ * @return
+ *      record size, 0 if the record is truncated
+ */
+size_t dlog_record_parse(const uint8_t *data, size_t len, dlog_record_t *record);
+
+/**
+ * @brief Print a record with its format, like snprintf()
+ *
+ * @param record: parsed record
+ * @param format: format found at record->format
+ * @param out: output text
+ * @param size: output size
+ * @return
+ *      length of the text, truncated to size - 1
+ */
+size_t dlog_record_format(const dlog_record_t *record, const char *format, char *out, size_t size);
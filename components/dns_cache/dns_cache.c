@@ -0,0 +1,539 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_random.h"
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
+
+#include "lwip/dns.h"
+#include "lwip/netdb.h"
+#include "lwip/sockets.h"
+
+#include "dns_cache.h"
+#include "dns_message.h"
+#include "dlog.h"
+
+#define DNS_QUERY_TIMEOUT_MS 1500
+#define DNS_QUERY_ATTEMPTS 2
+#define DNS_PORT 53
+/* Refreshed in the background during the last part of the TTL */
+#define DNS_REFRESH_PCT 20
+/* lwIP's own resolver, the fallback, does not tell the TTL */
+#define DNS_FALLBACK_TTL_SEC 60
+#define DNS_PREWARM_TIMEOUT_MS 5000
+#define DNS_TASK_STACK_SIZE 4096
+#define DNS_TASK_PRIORITY 5
+
+static const char *TAG = "dns_cache";
+
+/**
+ * @brief Cache Entry Type
+ *
+ */
+typedef struct
+{
+    char host[DNS_CACHE_HOST_MAX_LEN];
+    uint32_t addr;        /*!< IPv4, network byte order */
+    uint32_t resolved_at; /*!< system time in seconds */
+    uint32_t ttl_sec;
+} dns_cache_entry_t;
+
+typedef struct
+{
+    uint32_t crc;
+    dns_cache_entry_t entries[DNS_CACHE_ENTRIES];
+} dns_cache_table_t;
+
+typedef enum
+{
+    PREWARM_IDLE = 0,
+    PREWARM_RUNNING,   /*!< started, the connection is waiting to be taken */
+    PREWARM_TAKEN,
+    PREWARM_ABANDONED, /*!< dns_cache_connect() timed out, the task closes its socket */
+} prewarm_state_t;
+
+/**
+ * @brief Pre-warmed Connection Type
+ *
+ */
+typedef struct
+{
+    prewarm_state_t state;
+    char host[DNS_CACHE_HOST_MAX_LEN];
+    char port[8];
+    SemaphoreHandle_t done;
+    bool finished; /*!< under s_lock, result and fd are set */
+    esp_err_t result;
+    int fd;
+    int64_t start_us;
+    int64_t done_us;
+} prewarm_t;
+
+RTC_DATA_ATTR static dns_cache_table_t s_table;
+RTC_DATA_ATTR static dns_cache_stats_t s_stats;
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+static bool s_refreshing;
+static char s_refresh_host[DNS_CACHE_HOST_MAX_LEN];
+static prewarm_t s_prewarm;
+static uint32_t s_wake_saved_ms;
+
+#ifdef CONFIG_SMART_MAILS_STATIC_ALLOC
+/* The refresh and pre-warm tasks, each runs at most once per boot */
+static StackType_t s_task_stacks[2][DNS_TASK_STACK_SIZE];
+static StaticTask_t s_task_buffers[2];
+static StaticSemaphore_t s_prewarm_done_buffer;
+#endif
+
+static uint32_t dns_cache_crc(void)
+{
+    return esp_rom_crc32_le(0, (const uint8_t *)&s_table.entries, sizeof(s_table.entries));
+}
+
+/* With the lock held */
+static dns_cache_entry_t *dns_cache_find(const char *host)
+{
+    if (s_table.crc != dns_cache_crc())
+    {
+        memset(&s_table, 0, sizeof(s_table));
+        s_table.crc = dns_cache_crc();
+    }
+
+    for (int i = 0; i < DNS_CACHE_ENTRIES; i++)
+    {
+        if (strcmp(s_table.entries[i].host, host) == 0)
+        {
+            return &s_table.entries[i];
+        }
+    }
+
+    return NULL;
+}
+
+static void dns_cache_store(const char *host, uint32_t addr, uint32_t ttl_sec)
+{
+    dns_cache_entry_t *entry;
+
+    taskENTER_CRITICAL(&s_lock);
+    entry = dns_cache_find(host);
+    if (entry == NULL)
+    {
+        entry = &s_table.entries[0];
+        for (int i = 1; i < DNS_CACHE_ENTRIES; i++)
+        {
+            if (s_table.entries[i].resolved_at < entry->resolved_at)
+            {
+                entry = &s_table.entries[i];
+            }
+        }
+        snprintf(entry->host, sizeof(entry->host), "%s", host);
+    }
+    entry->addr = addr;
+    entry->resolved_at = (uint32_t)time(NULL);
+    entry->ttl_sec = ttl_sec;
+    s_table.crc = dns_cache_crc();
+    taskEXIT_CRITICAL(&s_lock);
+}
+
+static void dns_cache_forget(const char *host)
+{
+    dns_cache_entry_t *entry;
+
+    taskENTER_CRITICAL(&s_lock);
+    entry = dns_cache_find(host);
+    if (entry != NULL)
+    {
+        memset(entry, 0, sizeof(*entry));
+        s_table.crc = dns_cache_crc();
+    }
+    taskEXIT_CRITICAL(&s_lock);
+}
+
+/**
+ * @brief Ask the DHCP provided server for the A record, the answer carries the TTL
+ *
+ */
+static esp_err_t dns_cache_query(const char *host, uint32_t *addr, uint32_t *ttl_sec)
+{
+    uint8_t msg[DNS_MESSAGE_MAX_SIZE];
+    const ip_addr_t *server = dns_getserver(0);
+    struct sockaddr_in to = {
+        .sin_family = AF_INET,
+        .sin_port = htons(DNS_PORT),
+    };
+    struct timeval timeout = {
+        .tv_sec = DNS_QUERY_TIMEOUT_MS / 1000,
+        .tv_usec = (DNS_QUERY_TIMEOUT_MS % 1000) * 1000,
+    };
+    esp_err_t ret = ESP_FAIL;
+    uint16_t id = (uint16_t)esp_random();
+    size_t len;
+    int n;
+    int fd;
+
+    if (server == NULL || !IP_IS_V4(server) || ip_addr_isany(server))
+    {
+        return ESP_FAIL;
+    }
+    to.sin_addr.s_addr = ip_2_ip4(server)->addr;
+
+    len = dns_message_query(msg, sizeof(msg), id, host);
+    if (len == 0)
+    {
+        ESP_LOGE(TAG, "Invalid host name %s", host);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (fd < 0)
+    {
+        return ESP_FAIL;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    for (int attempt = 0; attempt < DNS_QUERY_ATTEMPTS && ret != ESP_OK && ret != ESP_ERR_NOT_FOUND; attempt++)
+    {
+        if (sendto(fd, msg, len, 0, (struct sockaddr *)&to, sizeof(to)) != (int)len)
+        {
+            continue;
+        }
+        // Late answers to an earlier attempt carry the same ID and are as good
+        n = recv(fd, msg + len, sizeof(msg) - len, 0);
+        if (n > 0)
+        {
+            ret = dns_message_parse(msg + len, n, id, addr, ttl_sec);
+        }
+    }
+    close(fd);
+
+    return ret;
+}
+
+/**
+ * @brief Resolve through the server and store the answer
+ *
+ */
+static esp_err_t dns_cache_update(const char *host, uint32_t *addr)
+{
+    struct addrinfo hints = {
+        .ai_family = AF_INET,
+        .ai_socktype = SOCK_STREAM,
+    };
+    struct addrinfo *res;
+    int64_t start_us = esp_timer_get_time();
+    uint32_t ttl_sec;
+    esp_err_t ret;
+
+    ret = dns_cache_query(host, addr, &ttl_sec);
+    if (ret == ESP_FAIL || ret == ESP_ERR_INVALID_RESPONSE)
+    {
+        // No answer to the query, lwIP's resolver may still get one
+        if (getaddrinfo(host, NULL, &hints, &res) != 0 || res == NULL)
+        {
+            ESP_LOGE(TAG, "Failed to resolve %s", host);
+            return ESP_FAIL;
+        }
+        *addr = ((struct sockaddr_in *)res->ai_addr)->sin_addr.s_addr;
+        ttl_sec = DNS_FALLBACK_TTL_SEC;
+        freeaddrinfo(res);
+        ret = ESP_OK;
+    }
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "%s does not resolve", host);
+        return ret;
+    }
+
+    dns_cache_store(host, *addr, ttl_sec);
+    s_stats.last_resolve_ms = (uint32_t)((esp_timer_get_time() - start_us) / 1000);
+    DLOGI(TAG, "Resolved %s in %lu ms, TTL %lu s", host, (unsigned long)s_stats.last_resolve_ms,
+          (unsigned long)ttl_sec);
+
+    return ESP_OK;
+}
+
+static bool dns_cache_create_task(TaskFunction_t task, const char *name, size_t slot)
+{
+#ifdef CONFIG_SMART_MAILS_STATIC_ALLOC
+    return xTaskCreateStatic(task, name, DNS_TASK_STACK_SIZE, NULL, DNS_TASK_PRIORITY, s_task_stacks[slot],
+                             &s_task_buffers[slot]) != NULL;
+#else
+    return xTaskCreate(task, name, DNS_TASK_STACK_SIZE, NULL, DNS_TASK_PRIORITY, NULL) == pdPASS;
+#endif
+}
+
+static void dns_cache_refresh_task(void *arg)
+{
+    uint32_t addr;
+
+    if (dns_cache_update(s_refresh_host, &addr) == ESP_OK)
+    {
+        s_stats.refreshes++;
+    }
+    // A static task buffer is only released by the idle task, so the static task runs once per boot
+#ifndef CONFIG_SMART_MAILS_STATIC_ALLOC
+    s_refreshing = false;
+#endif
+
+    vTaskDelete(NULL);
+}
+
+static void dns_cache_refresh(const char *host)
+{
+    if (s_refreshing)
+    {
+        return;
+    }
+    s_refreshing = true;
+    snprintf(s_refresh_host, sizeof(s_refresh_host), "%s", host);
+    if (!dns_cache_create_task(dns_cache_refresh_task, "dns_refresh", 0))
+    {
+        ESP_LOGE(TAG, "Failed to create refresh task");
+        s_refreshing = false;
+    }
+}
+
+esp_err_t dns_cache_resolve(const char *host, uint32_t *addr)
+{
+    dns_cache_entry_t *found;
+    dns_cache_entry_t entry = {0};
+    uint32_t now = (uint32_t)time(NULL);
+    uint32_t age;
+    esp_err_t ret;
+
+    taskENTER_CRITICAL(&s_lock);
+    found = dns_cache_find(host);
+    if (found != NULL)
+    {
+        entry = *found;
+    }
+    s_stats.lookups++;
+    taskEXIT_CRITICAL(&s_lock);
+
+    // A clock stepped back by SNTP makes the entry look younger than it is, treat it as expired
+    age = now - entry.resolved_at;
+    if (found != NULL && now >= entry.resolved_at && age < entry.ttl_sec)
+    {
+        *addr = entry.addr;
+        s_stats.hits++;
+        s_wake_saved_ms += s_stats.last_resolve_ms;
+        s_stats.total_saved_ms += s_stats.last_resolve_ms;
+        if ((uint64_t)(entry.ttl_sec - age) * 100 <= (uint64_t)entry.ttl_sec * DNS_REFRESH_PCT)
+        {
+            dns_cache_refresh(host);
+        }
+        return ESP_OK;
+    }
+
+    ret = dns_cache_update(host, addr);
+    if (ret == ESP_FAIL && found != NULL)
+    {
+        ESP_LOGW(TAG, "No answer for %s, using the address that expired %lu s ago", host,
+                 (unsigned long)(age - entry.ttl_sec));
+        *addr = entry.addr;
+        s_stats.stale_answers++;
+        return ESP_OK;
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Resolve and connect without the pre-warm
+ *
+ */
+static esp_err_t dns_cache_open(const char *host, const char *port, uint32_t timeout_ms, int *fd)
+{
+    struct sockaddr_in to = {
+        .sin_family = AF_INET,
+        .sin_port = htons((uint16_t)atoi(port)),
+    };
+    struct timeval timeout = {
+        .tv_sec = timeout_ms / 1000,
+        .tv_usec = (timeout_ms % 1000) * 1000,
+    };
+    socklen_t len = sizeof(int);
+    fd_set fds;
+    esp_err_t ret;
+    int error = 0;
+    int flags;
+    int s;
+
+    ret = dns_cache_resolve(host, &to.sin_addr.s_addr);
+    if (ret != ESP_OK)
+    {
+        return ret;
+    }
+
+    s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (s < 0)
+    {
+        ESP_LOGE(TAG, "Failed to create socket");
+        return ESP_FAIL;
+    }
+
+    // Non-blocking, so the connect can be bounded
+    flags = fcntl(s, F_GETFL, 0);
+    fcntl(s, F_SETFL, flags | O_NONBLOCK);
+    if (connect(s, (struct sockaddr *)&to, sizeof(to)) != 0 && errno != EINPROGRESS)
+    {
+        ret = ESP_FAIL;
+    }
+    else
+    {
+        FD_ZERO(&fds);
+        FD_SET(s, &fds);
+        if (select(s + 1, NULL, &fds, NULL, &timeout) <= 0)
+        {
+            ret = ESP_ERR_TIMEOUT;
+        }
+        else if (getsockopt(s, SOL_SOCKET, SO_ERROR, &error, &len) != 0 || error != 0)
+        {
+            ret = ESP_FAIL;
+        }
+    }
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to connect to %s:%s, %s", host, port, esp_err_to_name(ret));
+        close(s);
+        // The host may have moved within the TTL, the next attempt asks the server again
+        dns_cache_forget(host);
+        return ret;
+    }
+    fcntl(s, F_SETFL, flags);
+
+    *fd = s;
+    return ESP_OK;
+}
+
+static void dns_cache_prewarm_task(void *arg)
+{
+    bool abandoned;
+
+    s_prewarm.result = dns_cache_open(s_prewarm.host, s_prewarm.port, DNS_PREWARM_TIMEOUT_MS, &s_prewarm.fd);
+    s_prewarm.done_us = esp_timer_get_time();
+
+    taskENTER_CRITICAL(&s_lock);
+    s_prewarm.finished = true;
+    abandoned = s_prewarm.state == PREWARM_ABANDONED;
+    taskEXIT_CRITICAL(&s_lock);
+
+    if (!abandoned)
+    {
+        xSemaphoreGive(s_prewarm.done);
+    }
+    else
+    {
+        // Nobody waits any more, the socket and the semaphore are left to this task
+        if (s_prewarm.result == ESP_OK)
+        {
+            close(s_prewarm.fd);
+        }
+        vSemaphoreDelete(s_prewarm.done);
+        s_prewarm.done = NULL;
+    }
+
+    vTaskDelete(NULL);
+}
+
+esp_err_t dns_cache_prewarm(const char *host, const char *port)
+{
+    // E.g. a reconnect after the connection is already in use
+    if (s_prewarm.state != PREWARM_IDLE)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+#ifdef CONFIG_SMART_MAILS_STATIC_ALLOC
+    s_prewarm.done = xSemaphoreCreateBinaryStatic(&s_prewarm_done_buffer);
+#else
+    s_prewarm.done = xSemaphoreCreateBinary();
+#endif
+    if (s_prewarm.done == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to create semaphore");
+        return ESP_FAIL;
+    }
+    snprintf(s_prewarm.host, sizeof(s_prewarm.host), "%s", host);
+    snprintf(s_prewarm.port, sizeof(s_prewarm.port), "%s", port);
+    s_prewarm.start_us = esp_timer_get_time();
+    s_prewarm.finished = false;
+    s_prewarm.state = PREWARM_RUNNING;
+
+    if (!dns_cache_create_task(dns_cache_prewarm_task, "dns_prewarm", 1))
+    {
+        ESP_LOGE(TAG, "Failed to create pre-warm task");
+        s_prewarm.state = PREWARM_TAKEN;
+        vSemaphoreDelete(s_prewarm.done);
+        s_prewarm.done = NULL;
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t dns_cache_connect(const char *host, const char *port, uint32_t timeout_ms, int *fd)
+{
+    int64_t take_us = esp_timer_get_time();
+    uint32_t saved_ms;
+    bool finished;
+
+    if (s_prewarm.state != PREWARM_RUNNING || strcmp(s_prewarm.host, host) != 0 || strcmp(s_prewarm.port, port) != 0)
+    {
+        return dns_cache_open(host, port, timeout_ms, fd);
+    }
+    s_prewarm.state = PREWARM_TAKEN;
+
+    if (xSemaphoreTake(s_prewarm.done, pdMS_TO_TICKS(timeout_ms)) != pdTRUE)
+    {
+        taskENTER_CRITICAL(&s_lock);
+        finished = s_prewarm.finished;
+        if (!finished)
+        {
+            s_prewarm.state = PREWARM_ABANDONED;
+        }
+        taskEXIT_CRITICAL(&s_lock);
+
+        // Still connecting, the task closes the socket once it is done. A retry connects on its own
+        if (!finished)
+        {
+            ESP_LOGE(TAG, "Pre-warm of %s:%s still connecting, abandoned", host, port);
+            return ESP_ERR_TIMEOUT;
+        }
+        // Finished between the timeout and the lock, its give is on the way
+        xSemaphoreTake(s_prewarm.done, portMAX_DELAY);
+    }
+    vSemaphoreDelete(s_prewarm.done);
+    s_prewarm.done = NULL;
+
+    if (s_prewarm.result != ESP_OK)
+    {
+        return dns_cache_open(host, port, timeout_ms, fd);
+    }
+
+    // The part of the resolve and connect that ran before the uploader asked
+    saved_ms = (uint32_t)(((s_prewarm.done_us < take_us ? s_prewarm.done_us : take_us) - s_prewarm.start_us) / 1000);
+    s_stats.prewarmed++;
+    s_wake_saved_ms += saved_ms;
+    s_stats.total_saved_ms += saved_ms;
+    DLOGI(TAG, "Pre-warmed connection to %s:%s, %lu ms of it before it was asked for", host, port,
+          (unsigned long)saved_ms);
+
+    *fd = s_prewarm.fd;
+    return ESP_OK;
+}
+
+void dns_cache_get_stats(dns_cache_stats_t *stats)
+{
+    *stats = s_stats;
+    stats->wake_saved_ms = s_wake_saved_ms;
+    stats->hit_ratio = stats->lookups > 0 ? (float)stats->hits / stats->lookups : 0;
+}
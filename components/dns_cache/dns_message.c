@@ -0,0 +1,164 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "dns_message.h"
+
+#define DNS_HEADER_SIZE 12
+#define DNS_FLAG_RESPONSE 0x8000
+#define DNS_FLAG_RECURSION_DESIRED 0x0100
+#define DNS_RCODE_MASK 0x000f
+#define DNS_RCODE_NXDOMAIN 3
+#define DNS_TYPE_A 1
+#define DNS_TYPE_CNAME 5
+#define DNS_CLASS_IN 1
+#define DNS_LABEL_MAX_LEN 63
+#define DNS_POINTER_MASK 0xc0
+
+static uint16_t get_u16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static void put_u16(uint8_t *p, uint16_t value)
+{
+    p[0] = value >> 8;
+    p[1] = value & 0xff;
+}
+
+size_t dns_message_query(uint8_t *buf, size_t size, uint16_t id, const char *host)
+{
+    size_t host_len = strlen(host);
+    size_t pos = DNS_HEADER_SIZE;
+    const char *label = host;
+    const char *dot;
+    size_t label_len;
+
+    // Labels with length prefixes, the root label, QTYPE and QCLASS
+    if (host_len == 0 || host_len > DNS_MESSAGE_MAX_HOST || size < DNS_HEADER_SIZE + host_len + 2 + 4)
+    {
+        return 0;
+    }
+
+    memset(buf, 0, DNS_HEADER_SIZE);
+    put_u16(buf, id);
+    put_u16(buf + 2, DNS_FLAG_RECURSION_DESIRED);
+    put_u16(buf + 4, 1);
+
+    while (*label != '\0')
+    {
+        dot = strchr(label, '.');
+        label_len = dot != NULL ? (size_t)(dot - label) : strlen(label);
+        if (label_len == 0 || label_len > DNS_LABEL_MAX_LEN)
+        {
+            return 0;
+        }
+        buf[pos++] = (uint8_t)label_len;
+        memcpy(buf + pos, label, label_len);
+        pos += label_len;
+        label += label_len + (dot != NULL);
+    }
+    buf[pos++] = 0;
+    put_u16(buf + pos, DNS_TYPE_A);
+    put_u16(buf + pos + 2, DNS_CLASS_IN);
+
+    return pos + 4;
+}
+
+/* Position after the name at pos, 0 if it runs past the message */
+static size_t skip_name(const uint8_t *msg, size_t len, size_t pos)
+{
+    while (pos < len)
+    {
+        if ((msg[pos] & DNS_POINTER_MASK) == DNS_POINTER_MASK)
+        {
+            return pos + 2 <= len ? pos + 2 : 0;
+        }
+        if (msg[pos] == 0)
+        {
+            return pos + 1;
+        }
+        pos += 1 + msg[pos];
+    }
+
+    return 0;
+}
+
+esp_err_t dns_message_parse(const uint8_t *msg, size_t len, uint16_t id, uint32_t *addr, uint32_t *ttl_sec)
+{
+    uint16_t flags;
+    uint16_t questions;
+    uint16_t answers;
+    uint16_t type;
+    uint16_t rdlength;
+    uint32_t ttl;
+    uint32_t min_ttl = UINT32_MAX;
+    size_t pos = DNS_HEADER_SIZE;
+
+    if (len < DNS_HEADER_SIZE || get_u16(msg) != id)
+    {
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    flags = get_u16(msg + 2);
+    if (!(flags & DNS_FLAG_RESPONSE))
+    {
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    if ((flags & DNS_RCODE_MASK) == DNS_RCODE_NXDOMAIN)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if ((flags & DNS_RCODE_MASK) != 0)
+    {
+        return ESP_FAIL;
+    }
+    questions = get_u16(msg + 4);
+    answers = get_u16(msg + 6);
+
+    for (uint16_t i = 0; i < questions; i++)
+    {
+        pos = skip_name(msg, len, pos);
+        if (pos == 0 || pos + 4 > len)
+        {
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+        pos += 4;
+    }
+
+    for (uint16_t i = 0; i < answers; i++)
+    {
+        pos = skip_name(msg, len, pos);
+        if (pos == 0 || pos + 10 > len)
+        {
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+        type = get_u16(msg + pos);
+        ttl = get_u32(msg + pos + 4);
+        rdlength = get_u16(msg + pos + 8);
+        pos += 10;
+        if (pos + rdlength > len)
+        {
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+
+        // A TTL with the top bit set is treated as 0, RFC 2181
+        ttl = ttl > INT32_MAX ? 0 : ttl;
+        if (type == DNS_TYPE_CNAME)
+        {
+            min_ttl = ttl < min_ttl ? ttl : min_ttl;
+        }
+        else if (type == DNS_TYPE_A && get_u16(msg + pos - 8) == DNS_CLASS_IN && rdlength == 4)
+        {
+            memcpy(addr, msg + pos, 4);
+            *ttl_sec = ttl < min_ttl ? ttl : min_ttl;
+            return ESP_OK;
+        }
+        pos += rdlength;
+    }
+
+    return ESP_ERR_NOT_FOUND;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+/* Hosts kept in RTC memory, the least recently resolved one is replaced */
+#define DNS_CACHE_ENTRIES 2
+#define DNS_CACHE_HOST_MAX_LEN 64
+
+/**
+ * @brief DNS Cache Statistics Type
+ *
+ * Counters survive deep sleep.
+ */
+typedef struct dns_cache_stats_s
+{
+    uint32_t lookups;         /*!< addresses asked for, pre-warms included */
+    uint32_t hits;            /*!< answered from RTC memory within the TTL */
+    uint32_t refreshes;       /*!< background refreshes of an entry near expiry */
+    uint32_t stale_answers;   /*!< expired entries used because the server did not answer */
+    uint32_t prewarmed;       /*!< connections opened before the uploader asked */
+    uint32_t last_resolve_ms; /*!< last query to the server, what a hit saves */
+    uint32_t wake_saved_ms;   /*!< saved on this wake by hits and pre-warmed connects */
+    uint32_t total_saved_ms;
+    float hit_ratio;          /*!< hits / lookups */
+} dns_cache_stats_t;
+
+/**
+ * @brief Get the IPv4 address of a host
+ *
+ * Served from RTC memory while the TTL of the last answer lasts, and refreshed in the background
+ * once the entry is near expiry. An expired entry is only used when the server does not answer.
+ *
+ * @param host: host name
+ * @param addr: output IPv4 address, network byte order
+ * @return
+ *      ESP_OK, ESP_ERR_NOT_FOUND if the name does not resolve, ESP_FAIL without an answer
+ */
+esp_err_t dns_cache_resolve(const char *host, uint32_t *addr);
+
+/**
+ * @brief Open a TCP connection to a host, from a pre-warm if one was started for it
+ *
+ * A pre-warm that does not complete within timeout_ms is abandoned, its task closes the socket.
+ *
+ * @param host: host name
+ * @param port: port number
+ * @param timeout_ms: longest wait for the connection, or for the pre-warm to complete
+ * @param fd: output connected socket, blocking
+ * @return
+ *      ESP_OK, ESP_ERR_TIMEOUT, or the dns_cache_resolve() error
+ */
+esp_err_t dns_cache_connect(const char *host, const char *port, uint32_t timeout_ms, int *fd);
+
+/**
+ * @brief Resolve a host and open a connection to it on a task of its own
+ *
+ * Meant for IP_EVENT_STA_GOT_IP, it does not block. The next dns_cache_connect() to the same
+ * host and port takes the connection. Only the first call of a boot starts a pre-warm.
+ *
+ * @param host: host name, up to DNS_CACHE_HOST_MAX_LEN - 1 characters
+ * @param port: port number
+ * @return
+ *      ESP_OK, ESP_ERR_INVALID_STATE if a pre-warm was already started, ESP_FAIL
+ */
+esp_err_t dns_cache_prewarm(const char *host, const char *port);
+
+/**
+ * @brief Get the statistics
+ *
+ */
+void dns_cache_get_stats(dns_cache_stats_t *stats);
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+/* Longest host name, RFC 1035 */
+#define DNS_MESSAGE_MAX_HOST 253
+
+/* UDP message limit without EDNS, a response longer than this is truncated by the server */
+#define DNS_MESSAGE_MAX_SIZE 512
+
+/**
+ * @brief Build an A query with recursion desired
+ *
+ * @param buf: output message
+ * @param size: size of buf, DNS_MESSAGE_MAX_SIZE always fits
+ * @param id: query ID, echoed by the response
+ * @param host: name to resolve
+ * @return
+ *      message length, 0 for an invalid name or a buffer too small
+ */
+size_t dns_message_query(uint8_t *buf, size_t size, uint16_t id, const char *host);
+
+/**
+ * @brief Parse the response to dns_message_query()
+ *
+ * Takes the first A record of the answer section. Its TTL is the lowest of the records in
+ * front of it, so an address reached through a CNAME expires with the CNAME.
+ *
+ * @param msg: response
+ * @param len: response length
+ * @param id: ID of the query
+ * @param addr: output IPv4 address, network byte order
+ * @param ttl_sec: output seconds the address may be cached
+ * @return
+ *      ESP_OK, ESP_ERR_NOT_FOUND for NXDOMAIN or an answer without an A record,
+ *      ESP_ERR_INVALID_RESPONSE for a malformed response or another query's, ESP_FAIL for a server error
+ */
+esp_err_t dns_message_parse(const uint8_t *msg, size_t len, uint16_t id, uint32_t *addr, uint32_t *ttl_sec);
@@ -0,0 +1,335 @@
+#include <string.h>
+
+#include "espnow_link.h"
+
+#define ESPNOW_LINK_MAGIC0 'S'
+#define ESPNOW_LINK_MAGIC1 'M'
+#define ESPNOW_LINK_VERSION 1
+#define ESPNOW_LINK_CRC_OFFSET 16
+
+static const uint8_t s_broadcast_mac[ESPNOW_LINK_MAC_LEN] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+/**
+ * @brief CRC-32 (IEEE 802.3), bitwise to keep the table out of RAM, chainable
+ *
+ */
+static uint32_t espnow_link_crc32(uint32_t crc, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+
+    crc = ~crc;
+    while (len--)
+    {
+        crc ^= *p++;
+        for (int i = 0; i < 8; i++)
+        {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+
+    return ~crc;
+}
+
+static uint32_t espnow_link_state_crc(const espnow_link_t *link)
+{
+    return espnow_link_crc32(0, (const uint8_t *)link + sizeof(link->crc), sizeof(*link) - sizeof(link->crc));
+}
+
+static void espnow_link_seal(espnow_link_t *link)
+{
+    link->crc = espnow_link_state_crc(link);
+}
+
+static void put_u16(uint8_t *p, uint16_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static uint16_t get_u16(const uint8_t *p)
+{
+    return p[0] | (uint16_t)p[1] << 8;
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+    return p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+bool espnow_link_init(espnow_link_t *link, uint32_t session)
+{
+    if (link->crc == espnow_link_state_crc(link) && link->num_peers <= ESPNOW_LINK_MAX_PEERS &&
+        link->next_seq != 0)
+    {
+        return true;
+    }
+
+    memset(link, 0, sizeof(*link));
+    link->session = session;
+    link->next_seq = 1;
+    espnow_link_seal(link);
+
+    return false;
+}
+
+size_t espnow_link_encode(const espnow_link_frame_t *frame, void *buf, size_t size)
+{
+    uint8_t *p = buf;
+    size_t len = ESPNOW_LINK_HEADER_SIZE + frame->len;
+
+    if (frame->len > ESPNOW_LINK_MAX_PAYLOAD || len > size)
+    {
+        return 0;
+    }
+
+    p[0] = ESPNOW_LINK_MAGIC0;
+    p[1] = ESPNOW_LINK_MAGIC1;
+    p[2] = ESPNOW_LINK_VERSION;
+    p[3] = frame->type;
+    put_u32(p + 4, frame->session);
+    put_u32(p + 8, frame->seq);
+    put_u16(p + 12, frame->len);
+    p[14] = frame->channel;
+    p[15] = 0;
+    put_u32(p + ESPNOW_LINK_CRC_OFFSET, 0);
+    if (frame->len > 0)
+    {
+        memcpy(p + ESPNOW_LINK_HEADER_SIZE, frame->payload, frame->len);
+    }
+    put_u32(p + ESPNOW_LINK_CRC_OFFSET, espnow_link_crc32(0, p, len));
+
+    return len;
+}
+
+bool espnow_link_decode(const void *buf, size_t len, espnow_link_frame_t *frame)
+{
+    uint8_t header[ESPNOW_LINK_HEADER_SIZE];
+    const uint8_t *p = buf;
+    uint32_t crc;
+
+    if (len < ESPNOW_LINK_HEADER_SIZE || p[0] != ESPNOW_LINK_MAGIC0 || p[1] != ESPNOW_LINK_MAGIC1 ||
+        p[2] != ESPNOW_LINK_VERSION)
+    {
+        return false;
+    }
+
+    frame->len = get_u16(p + 12);
+    if (ESPNOW_LINK_HEADER_SIZE + (size_t)frame->len != len)
+    {
+        return false;
+    }
+
+    // The CRC was computed with its own field zeroed
+    memcpy(header, p, sizeof(header));
+    put_u32(header + ESPNOW_LINK_CRC_OFFSET, 0);
+    crc = espnow_link_crc32(0, header, sizeof(header));
+    crc = espnow_link_crc32(crc, p + ESPNOW_LINK_HEADER_SIZE, frame->len);
+    if (crc != get_u32(p + ESPNOW_LINK_CRC_OFFSET))
+    {
+        return false;
+    }
+
+    frame->type = p[3];
+    frame->session = get_u32(p + 4);
+    frame->seq = get_u32(p + 8);
+    frame->channel = p[14];
+    frame->payload = p + ESPNOW_LINK_HEADER_SIZE;
+
+    return true;
+}
+
+/**
+ * @brief Receive until a frame of the given type, session and seq arrives or the window closes
+ *
+ * @param mac: expected sender, NULL for any, the sender is returned in from
+ * @return
+ *      true if the frame arrived
+ */
+static bool espnow_link_wait(const espnow_link_t *link, const espnow_link_radio_t *radio, uint8_t type,
+                             uint32_t seq, const uint8_t *mac, uint8_t from[ESPNOW_LINK_MAC_LEN],
+                             uint32_t window_ms)
+{
+    uint8_t buf[ESPNOW_LINK_MAX_FRAME];
+    espnow_link_frame_t frame;
+    uint32_t deadline = radio->now_ms(radio->ctx) + window_ms;
+    int32_t remaining;
+    size_t len;
+
+    while ((remaining = (int32_t)(deadline - radio->now_ms(radio->ctx))) > 0)
+    {
+        len = radio->recv(radio->ctx, from, buf, sizeof(buf), remaining);
+        if (len == 0)
+        {
+            break;
+        }
+
+        // Anything else on the channel, including stale acks of earlier attempts, is ignored
+        if (espnow_link_decode(buf, len, &frame) && frame.type == type && frame.session == link->session &&
+            frame.seq == seq && (mac == NULL || memcmp(mac, from, ESPNOW_LINK_MAC_LEN) == 0))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+esp_err_t espnow_link_pair(espnow_link_t *link, const espnow_link_radio_t *radio,
+                           const espnow_link_policy_t *policy, uint32_t nonce)
+{
+    uint8_t buf[ESPNOW_LINK_HEADER_SIZE];
+    uint8_t from[ESPNOW_LINK_MAC_LEN];
+    espnow_link_peer_t peers[ESPNOW_LINK_MAX_PEERS];
+    uint8_t num_peers = 0;
+    uint32_t deadline;
+    int32_t remaining;
+    size_t len;
+
+    for (uint8_t channel = 1; channel < 16 && num_peers == 0; channel++)
+    {
+        if (!(policy->channel_mask & (1 << channel)) || !radio->set_channel(radio->ctx, channel))
+        {
+            continue;
+        }
+
+        espnow_link_frame_t request = {
+            .type = ESPNOW_LINK_FRAME_PAIR_REQ,
+            .channel = channel,
+            .session = link->session,
+            .seq = nonce,
+        };
+        len = espnow_link_encode(&request, buf, sizeof(buf));
+
+        // Once anything answered, repeat the request for gateways that missed it
+        for (uint8_t attempt = 0; attempt == 0 || (num_peers > 0 && attempt <= policy->max_retries); attempt++)
+        {
+            if (!radio->send(radio->ctx, s_broadcast_mac, buf, len))
+            {
+                continue;
+            }
+
+            // Collect every gateway that answers within the window
+            deadline = radio->now_ms(radio->ctx) + policy->pair_window_ms;
+            while ((remaining = (int32_t)(deadline - radio->now_ms(radio->ctx))) > 0 &&
+                   espnow_link_wait(link, radio, ESPNOW_LINK_FRAME_PAIR_RESP, nonce, NULL, from, remaining))
+            {
+                bool known = false;
+                for (uint8_t i = 0; i < num_peers; i++)
+                {
+                    known |= memcmp(peers[i].mac, from, ESPNOW_LINK_MAC_LEN) == 0;
+                }
+                if (!known && num_peers < ESPNOW_LINK_MAX_PEERS)
+                {
+                    memcpy(peers[num_peers].mac, from, ESPNOW_LINK_MAC_LEN);
+                    peers[num_peers].channel = channel;
+                    peers[num_peers].misses = 0;
+                    num_peers++;
+                }
+            }
+        }
+    }
+
+    if (num_peers == 0)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    memcpy(link->peers, peers, num_peers * sizeof(peers[0]));
+    link->num_peers = num_peers;
+    link->active = 0;
+    link->stats.pairings++;
+    espnow_link_seal(link);
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Drop peers that missed too many frames in a row, keeping the order of the rest
+ *
+ */
+static void espnow_link_forget(espnow_link_t *link, uint8_t max_misses)
+{
+    uint8_t kept = 0;
+
+    for (uint8_t i = 0; i < link->num_peers; i++)
+    {
+        if (link->peers[i].misses < max_misses)
+        {
+            link->peers[kept++] = link->peers[i];
+        }
+    }
+    link->num_peers = kept;
+    link->active = 0;
+}
+
+esp_err_t espnow_link_send(espnow_link_t *link, const espnow_link_radio_t *radio,
+                           const espnow_link_policy_t *policy, const void *payload, size_t len)
+{
+    uint8_t buf[ESPNOW_LINK_MAX_FRAME];
+    uint8_t from[ESPNOW_LINK_MAC_LEN];
+    size_t frame_len;
+
+    if (len > ESPNOW_LINK_MAX_PAYLOAD)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (link->num_peers == 0)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    espnow_link_frame_t frame = {
+        .type = ESPNOW_LINK_FRAME_DATA,
+        .session = link->session,
+        .seq = link->next_seq++,
+        .len = len,
+        .payload = payload,
+    };
+    link->stats.frames++;
+
+    for (uint8_t i = 0; i < link->num_peers; i++)
+    {
+        uint8_t index = (link->active + i) % link->num_peers;
+        espnow_link_peer_t *peer = &link->peers[index];
+
+        frame.channel = peer->channel;
+        frame_len = espnow_link_encode(&frame, buf, sizeof(buf));
+        if (!radio->set_channel(radio->ctx, peer->channel))
+        {
+            peer->misses++;
+            continue;
+        }
+
+        for (uint8_t attempt = 0; attempt <= policy->max_retries; attempt++)
+        {
+            if (i > 0 || attempt > 0)
+            {
+                link->stats.retries++;
+            }
+            if (radio->send(radio->ctx, peer->mac, buf, frame_len) &&
+                espnow_link_wait(link, radio, ESPNOW_LINK_FRAME_ACK, frame.seq, peer->mac, from, policy->ack_timeout_ms))
+            {
+                peer->misses = 0;
+                link->active = index;
+                link->stats.acked++;
+                espnow_link_seal(link);
+                return ESP_OK;
+            }
+        }
+        peer->misses++;
+    }
+
+    espnow_link_forget(link, policy->max_misses);
+    link->stats.failed++;
+    espnow_link_seal(link);
+
+    return ESP_ERR_TIMEOUT;
+}
@@ -0,0 +1,181 @@
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "esp_event.h"
+#include "esp_log.h"
+#include "esp_now.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "nvs_flash.h"
+
+#include "espnow_link_radio.h"
+
+#define RX_QUEUE_LEN 4
+
+static const char *TAG = "espnow_link";
+
+typedef struct
+{
+    uint8_t mac[ESPNOW_LINK_MAC_LEN];
+    uint8_t len;
+    uint8_t data[ESPNOW_LINK_MAX_FRAME];
+} espnow_link_rx_t;
+
+static QueueHandle_t s_rx_queue;
+#ifdef CONFIG_SMART_MAILS_STATIC_ALLOC
+static uint8_t s_rx_queue_storage[RX_QUEUE_LEN * sizeof(espnow_link_rx_t)];
+static StaticQueue_t s_rx_queue_buffer;
+#endif
+
+/* Runs in the Wi-Fi task, frames are dropped rather than blocking it */
+static void espnow_link_recv_callback(const uint8_t *mac_addr, const uint8_t *data, int data_len)
+{
+    espnow_link_rx_t rx;
+
+    if (data_len <= 0 || data_len > ESPNOW_LINK_MAX_FRAME)
+    {
+        return;
+    }
+
+    memcpy(rx.mac, mac_addr, ESPNOW_LINK_MAC_LEN);
+    rx.len = data_len;
+    memcpy(rx.data, data, data_len);
+    xQueueSend(s_rx_queue, &rx, 0);
+}
+
+static bool espnow_link_radio_send(void *ctx, const uint8_t mac[ESPNOW_LINK_MAC_LEN], const void *data, size_t len)
+{
+    // Peers follow the current channel, see espnow_link_radio_set_channel()
+    if (!esp_now_is_peer_exist(mac))
+    {
+        esp_now_peer_info_t peer = {
+            .channel = 0,
+            .ifidx = WIFI_IF_STA,
+            .encrypt = false,
+        };
+        memcpy(peer.peer_addr, mac, ESPNOW_LINK_MAC_LEN);
+        if (esp_now_add_peer(&peer) != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to add peer");
+            return false;
+        }
+    }
+
+    return esp_now_send(mac, data, len) == ESP_OK;
+}
+
+static size_t espnow_link_radio_recv(void *ctx, uint8_t mac[ESPNOW_LINK_MAC_LEN], void *buf, size_t size, uint32_t timeout_ms)
+{
+    espnow_link_rx_t rx;
+
+    // Round up, an ack timeout shorter than a tick must not become a poll
+    if (xQueueReceive(s_rx_queue, &rx, (timeout_ms + portTICK_PERIOD_MS - 1) / portTICK_PERIOD_MS) != pdTRUE ||
+        rx.len > size)
+    {
+        return 0;
+    }
+
+    memcpy(mac, rx.mac, ESPNOW_LINK_MAC_LEN);
+    memcpy(buf, rx.data, rx.len);
+
+    return rx.len;
+}
+
+static bool espnow_link_radio_set_channel(void *ctx, uint8_t channel)
+{
+    return esp_wifi_set_channel(channel, WIFI_SECOND_CHAN_NONE) == ESP_OK;
+}
+
+static uint32_t espnow_link_radio_now_ms(void *ctx)
+{
+    return esp_timer_get_time() / 1000;
+}
+
+esp_err_t espnow_link_radio_start(espnow_link_radio_t *radio)
+{
+    esp_err_t ret;
+
+    // PHY calibration data lives in NVS
+    ret = nvs_flash_init();
+    if (ret != ESP_OK && ret != ESP_ERR_NVS_NO_FREE_PAGES && ret != ESP_ERR_NVS_NEW_VERSION_FOUND)
+    {
+        ESP_LOGE(TAG, "Failed to init nvs flash");
+        return ESP_FAIL;
+    }
+
+    if (s_rx_queue == NULL)
+    {
+#ifdef CONFIG_SMART_MAILS_STATIC_ALLOC
+        s_rx_queue = xQueueCreateStatic(RX_QUEUE_LEN, sizeof(espnow_link_rx_t), s_rx_queue_storage,
+                                        &s_rx_queue_buffer);
+#else
+        s_rx_queue = xQueueCreate(RX_QUEUE_LEN, sizeof(espnow_link_rx_t));
+#endif
+        if (s_rx_queue == NULL)
+        {
+            ESP_LOGE(TAG, "Failed to create rx queue");
+            return ESP_FAIL;
+        }
+    }
+    xQueueReset(s_rx_queue);
+
+    if (esp_event_loop_create_default() != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to create event loop");
+        return ESP_FAIL;
+    }
+
+    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+    cfg.nvs_enable = false;
+    if (esp_wifi_init(&cfg) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to init wifi");
+        goto err_loop;
+    }
+    if (esp_wifi_set_storage(WIFI_STORAGE_RAM) != ESP_OK ||
+        esp_wifi_set_mode(WIFI_MODE_STA) != ESP_OK ||
+        esp_wifi_start() != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to start wifi");
+        goto err_wifi;
+    }
+
+    if (esp_now_init() != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to init esp-now");
+        goto err_start;
+    }
+    if (esp_now_register_recv_cb(espnow_link_recv_callback) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to register esp-now receive callback");
+        esp_now_deinit();
+        goto err_start;
+    }
+
+    *radio = (espnow_link_radio_t){
+        .send = espnow_link_radio_send,
+        .recv = espnow_link_radio_recv,
+        .set_channel = espnow_link_radio_set_channel,
+        .now_ms = espnow_link_radio_now_ms,
+        .ctx = NULL,
+    };
+
+    return ESP_OK;
+
+err_start:
+    esp_wifi_stop();
+err_wifi:
+    esp_wifi_deinit();
+err_loop:
+    esp_event_loop_delete_default();
+    return ESP_FAIL;
+}
+
+void espnow_link_radio_stop(void)
+{
+    esp_now_deinit();
+    esp_wifi_stop();
+    esp_wifi_deinit();
+    esp_event_loop_delete_default();
+}
@@ -0,0 +1,186 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+/* Largest ESP-NOW frame, ESP_NOW_MAX_DATA_LEN */
+#define ESPNOW_LINK_MAX_FRAME 250
+#define ESPNOW_LINK_HEADER_SIZE 20
+#define ESPNOW_LINK_MAX_PAYLOAD (ESPNOW_LINK_MAX_FRAME - ESPNOW_LINK_HEADER_SIZE)
+#define ESPNOW_LINK_MAX_PEERS 4
+#define ESPNOW_LINK_MAC_LEN 6
+
+/**
+ * @brief Frame Type
+ *
+ * Every frame starts with a 20 byte little endian header:
+ * magic "SM", version, type, session, seq, payload length, channel, reserved, CRC-32 over
+ * the header with a zero CRC field and the payload. The gateway acknowledges a data frame
+ * by echoing session and seq in an ack frame, and drops a data frame whose session and
+ * seq it has already forwarded, so a retransmission after a lost ack is delivered once.
+ */
+typedef enum
+{
+    ESPNOW_LINK_FRAME_DATA = 1,  /*!< sensor to gateway, opaque payload */
+    ESPNOW_LINK_FRAME_ACK,       /*!< gateway to sensor, no payload */
+    ESPNOW_LINK_FRAME_PAIR_REQ,  /*!< broadcast by the sensor, seq is a nonce */
+    ESPNOW_LINK_FRAME_PAIR_RESP, /*!< gateway to sensor, echoes the nonce */
+} espnow_link_frame_type_t;
+
+/**
+ * @brief Decoded Frame Type
+ *
+ */
+typedef struct espnow_link_frame_s
+{
+    uint8_t type;    /*!< espnow_link_frame_type_t */
+    uint8_t channel; /*!< channel the frame was sent on */
+    uint16_t len;    /*!< payload length */
+    uint32_t session;
+    uint32_t seq;
+    const uint8_t *payload; /*!< points into the encoded frame */
+} espnow_link_frame_t;
+
+/**
+ * @brief Radio Operations Type
+ *
+ * Implemented on top of esp_now by espnow_link_radio_start(), or by a simulation.
+ */
+typedef struct espnow_link_radio_s
+{
+    bool (*send)(void *ctx, const uint8_t mac[ESPNOW_LINK_MAC_LEN], const void *data, size_t len);
+
+    /* Length of the received frame, 0 if nothing arrived within timeout_ms */
+    size_t (*recv)(void *ctx, uint8_t mac[ESPNOW_LINK_MAC_LEN], void *buf, size_t size, uint32_t timeout_ms);
+
+    bool (*set_channel)(void *ctx, uint8_t channel);
+
+    uint32_t (*now_ms)(void *ctx);
+
+    void *ctx;
+} espnow_link_radio_t;
+
+/**
+ * @brief Link Policy Type
+ *
+ */
+typedef struct espnow_link_policy_s
+{
+    uint32_t ack_timeout_ms;  /*!< wait for an ack before retransmitting */
+    uint32_t pair_window_ms;  /*!< listen for pair responses on each channel */
+    uint16_t channel_mask;    /*!< bit n set to scan channel n while pairing */
+    uint8_t max_retries;      /*!< retransmissions per peer and frame */
+    uint8_t max_misses;       /*!< forget a peer after this many unacknowledged frames in a row */
+} espnow_link_policy_t;
+
+/**
+ * @brief Gateway Peer Type
+ *
+ */
+typedef struct espnow_link_peer_s
+{
+    uint8_t mac[ESPNOW_LINK_MAC_LEN];
+    uint8_t channel;
+    uint8_t misses; /*!< unacknowledged frames in a row, 0 after every ack */
+} espnow_link_peer_t;
+
+/**
+ * @brief Link Statistics Type
+ *
+ */
+typedef struct espnow_link_stats_s
+{
+    uint32_t frames;      /*!< data frames handed to espnow_link_send() */
+    uint32_t acked;       /*!< data frames acknowledged by a gateway */
+    uint32_t retries;     /*!< retransmissions, failovers included */
+    uint32_t failed;      /*!< data frames no gateway acknowledged */
+    uint32_t pairings;    /*!< espnow_link_pair() calls that found a gateway */
+} espnow_link_stats_t;
+
+/**
+ * @brief Link Type
+ *
+ * Pairing table, sequence state and statistics. CRC checked, so it can live in RTC
+ * memory and a warm wake can send without pairing again.
+ */
+typedef struct espnow_link_s
+{
+    uint32_t crc;
+    uint32_t session;  /*!< picked when the state is reset, tells the gateway seq restarted */
+    uint32_t next_seq; /*!< seq of the next data frame, the first one is 1 */
+    uint8_t num_peers;
+    uint8_t active;    /*!< peer tried first, the last one that acknowledged */
+    espnow_link_peer_t peers[ESPNOW_LINK_MAX_PEERS];
+    espnow_link_stats_t stats;
+} espnow_link_t;
+
+/**
+ * @brief Check the link state, resetting it if it is invalid, e.g. after power on
+ *
+ * @param link: link state, typically in RTC memory
+ * @param session: new session id used on a reset, e.g. esp_random()
+ * @return
+ *      true if the state was intact
+ */
+bool espnow_link_init(espnow_link_t *link, uint32_t session);
+
+/**
+ * @brief Encode a frame
+ *
+ * @param frame: frame to encode, payload may be NULL when len is 0
+ * @param buf: output buffer
+ * @param size: size of buf
+ * @return
+ *      encoded length, 0 if it does not fit
+ */
+size_t espnow_link_encode(const espnow_link_frame_t *frame, void *buf, size_t size);
+
+/**
+ * @brief Decode and check a frame
+ *
+ * @param buf: received frame, frame->payload points into it
+ * @param len: received length
+ * @param frame: decoded frame
+ * @return
+ *      true if magic, version, length and CRC check out
+ */
+bool espnow_link_decode(const void *buf, size_t len, espnow_link_frame_t *frame);
+
+/**
+ * @brief Discover gateways by broadcasting a pair request on every channel of the mask
+ *
+ * Stops at the first channel any gateway answers on, where the request is repeated up to
+ * max_retries times for gateways that missed it, and replaces the pairing table with the
+ * responders. The table is kept if nobody answers.
+ *
+ * @param link: link state
+ * @param radio: radio operations
+ * @param policy: link policy
+ * @param nonce: echoed by the gateways, e.g. esp_random()
+ * @return
+ *      ESP_OK, or ESP_ERR_NOT_FOUND if no gateway answered
+ */
+esp_err_t espnow_link_pair(espnow_link_t *link, const espnow_link_radio_t *radio,
+                           const espnow_link_policy_t *policy, uint32_t nonce);
+
+/**
+ * @brief Send a payload as one data frame and wait for the ack
+ *
+ * The active peer is tried first, then the others. Each gets the frame up to
+ * max_retries more times before the next one is tried, all with the same seq. Gateways
+ * drop duplicates on their own, so a failover after a lost ack can forward a frame twice.
+ *
+ * @param link: link state
+ * @param radio: radio operations
+ * @param policy: link policy
+ * @param payload: payload
+ * @param len: payload length, up to ESPNOW_LINK_MAX_PAYLOAD
+ * @return
+ *      ESP_OK once acknowledged, ESP_ERR_NOT_FOUND if there is no peer,
+ *      ESP_ERR_INVALID_SIZE, or ESP_ERR_TIMEOUT if no peer acknowledged
+ */
+esp_err_t espnow_link_send(espnow_link_t *link, const espnow_link_radio_t *radio,
+                           const espnow_link_policy_t *policy, const void *payload, size_t len);
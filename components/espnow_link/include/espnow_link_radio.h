@@ -0,0 +1,23 @@
+#pragma once
+
+#include "esp_err.h"
+
+#include "espnow_link.h"
+
+/**
+ * @brief Bring up the radio for ESP-NOW only, in station mode without associating
+ *
+ * Nothing is kept in NVS and no netif is created. Stop it before a wifi_t driver is
+ * initialized, both own the Wi-Fi driver and the default event loop.
+ *
+ * @param radio: filled with the esp_now backed operations
+ * @return
+ *      ESP_OK or ESP_FAIL
+ */
+esp_err_t espnow_link_radio_start(espnow_link_radio_t *radio);
+
+/**
+ * @brief Tear down ESP-NOW and the Wi-Fi driver
+ *
+ */
+void espnow_link_radio_stop(void);
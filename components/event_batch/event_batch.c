@@ -0,0 +1,147 @@
+#include <string.h>
+
+#include "event_batch.h"
+
+/**
+ * @brief CRC-32 (IEEE 802.3), bitwise to keep the table out of RAM
+ *
+ */
+static uint32_t event_batch_crc32(const uint8_t *data, size_t len)
+{
+    uint32_t crc = 0xFFFFFFFF;
+
+    while (len--)
+    {
+        crc ^= *data++;
+        for (int i = 0; i < 8; i++)
+        {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+
+    return ~crc;
+}
+
+static uint32_t event_batch_ring_crc(const event_batch_ring_t *ring)
+{
+    const uint8_t *start = (const uint8_t *)ring + sizeof(ring->crc);
+
+    return event_batch_crc32(start, sizeof(*ring) - sizeof(ring->crc));
+}
+
+static void event_batch_seal(event_batch_ring_t *ring)
+{
+    ring->crc = event_batch_ring_crc(ring);
+}
+
+bool event_batch_init(event_batch_ring_t *ring)
+{
+    if (ring->crc == event_batch_ring_crc(ring) &&
+        ring->head < EVENT_BATCH_CAPACITY &&
+        ring->count <= EVENT_BATCH_CAPACITY)
+    {
+        return true;
+    }
+
+    memset(ring, 0, sizeof(*ring));
+    event_batch_seal(ring);
+
+    return false;
+}
+
+void event_batch_push(event_batch_ring_t *ring, const event_batch_event_t *event)
+{
+    if (ring->count == EVENT_BATCH_CAPACITY)
+    { // Full, drop the oldest event
+        ring->head = (ring->head + 1) % EVENT_BATCH_CAPACITY;
+        ring->count--;
+        ring->dropped++;
+    }
+
+    ring->events[(ring->head + ring->count) % EVENT_BATCH_CAPACITY] = *event;
+    ring->count++;
+
+    event_batch_seal(ring);
+}
+
+size_t event_batch_count(const event_batch_ring_t *ring)
+{
+    return ring->count;
+}
+
+bool event_batch_peek(const event_batch_ring_t *ring, size_t index, event_batch_event_t *event)
+{
+    if (index >= ring->count)
+    {
+        return false;
+    }
+
+    *event = ring->events[(ring->head + index) % EVENT_BATCH_CAPACITY];
+
+    return true;
+}
+
+void event_batch_consume(event_batch_ring_t *ring, size_t count)
+{
+    if (count > ring->count)
+    {
+        count = ring->count;
+    }
+
+    ring->head = (ring->head + count) % EVENT_BATCH_CAPACITY;
+    ring->count -= count;
+
+    event_batch_seal(ring);
+}
+
+bool event_batch_should_flush(const event_batch_ring_t *ring, const event_batch_policy_t *policy, uint32_t now)
+{
+    event_batch_event_t event;
+
+    if (ring->count == 0)
+    {
+        return false;
+    }
+    if (ring->count >= policy->max_events)
+    {
+        return true;
+    }
+
+    // The oldest event decides the age
+    event_batch_peek(ring, 0, &event);
+    if (now - event.timestamp >= policy->max_age_sec)
+    {
+        return true;
+    }
+
+    for (size_t i = 0; i < ring->count; i++)
+    {
+        event_batch_peek(ring, i, &event);
+        if (event.urgent)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+uint32_t event_batch_flush_due_in(const event_batch_ring_t *ring, const event_batch_policy_t *policy, uint32_t now)
+{
+    event_batch_event_t event;
+    uint32_t age;
+
+    if (ring->count == 0)
+    {
+        return UINT32_MAX;
+    }
+    if (event_batch_should_flush(ring, policy, now))
+    {
+        return 0;
+    }
+
+    event_batch_peek(ring, 0, &event);
+    age = now - event.timestamp;
+
+    return policy->max_age_sec - age;
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Pending events kept across deep sleep. Oldest events are overwritten when full */
+#define EVENT_BATCH_CAPACITY 32
+
+/**
+ * @brief Event Type
+ *
+ */
+typedef enum
+{
+    EVENT_BATCH_BOOT = 0, /*!< power on or reset, not a deep sleep wake */
+    EVENT_BATCH_MAIL,     /*!< mail detected in the mailbox */
+    EVENT_BATCH_EMPTY,    /*!< mailbox emptied */
+} event_batch_type_t;
+
+/**
+ * @brief Mailbox Event Type
+ *
+ */
+typedef struct event_batch_event_s
+{
+    uint32_t timestamp; /*!< system time in seconds */
+    uint8_t type;       /*!< event_batch_type_t */
+    uint8_t urgent;     /*!< flush on the next wake regardless of the policy */
+    uint16_t value;     /*!< type specific payload */
+} event_batch_event_t;
+
+/**
+ * @brief Event Ring Type
+ *
+ * Meant to live in RTC memory, so the contents are guarded by a CRC over everything
+ * after the crc field.
+ */
+typedef struct event_batch_ring_s
+{
+    uint32_t crc;
+    uint16_t head;     /*!< index of the oldest event */
+    uint16_t count;    /*!< number of pending events */
+    uint32_t dropped;  /*!< events overwritten before they were flushed */
+    event_batch_event_t events[EVENT_BATCH_CAPACITY];
+} event_batch_ring_t;
+
+/**
+ * @brief Flush Policy Type
+ *
+ */
+typedef struct event_batch_policy_s
+{
+    uint16_t max_events;  /*!< flush when this many events are pending */
+    uint32_t max_age_sec; /*!< flush when the oldest pending event is this old */
+} event_batch_policy_t;
+
+/**
+ * @brief Validate the ring, reset it if the CRC does not match
+ *
+ * @param ring: event ring
+ * @return
+ *      true if the previous contents were kept, false if the ring was reset
+ */
+bool event_batch_init(event_batch_ring_t *ring);
+
+/**
+ * @brief Append an event, overwriting the oldest one when the ring is full
+ *
+ * @param ring: event ring
+ * @param event: event to append
+ */
+void event_batch_push(event_batch_ring_t *ring, const event_batch_event_t *event);
+
+/**
+ * @brief Number of pending events
+ *
+ * @param ring: event ring
+ */
+size_t event_batch_count(const event_batch_ring_t *ring);
+
+/**
+ * @brief Get a pending event without removing it
+ *
+ * @param ring: event ring
+ * @param index: 0 is the oldest pending event
+ * @param event: output event
+ * @return
+ *      true if the event exists
+ */
+bool event_batch_peek(const event_batch_ring_t *ring, size_t index, event_batch_event_t *event);
+
+/**
+ * @brief Remove the oldest events, typically once their upload was acknowledged
+ *
+ * @param ring: event ring
+ * @param count: number of events to remove
+ */
+void event_batch_consume(event_batch_ring_t *ring, size_t count);
+
+/**
+ * @brief Decide whether the pending events should be uploaded now
+ *
+ * @param ring: event ring
+ * @param policy: flush policy
+ * @param now: system time in seconds
+ * @return
+ *      true if an event is urgent, max_events are pending or the oldest event is max_age_sec old
+ */
+bool event_batch_should_flush(const event_batch_ring_t *ring, const event_batch_policy_t *policy, uint32_t now);
+
+/**
+ * @brief Time until the pending events become due by age, used to schedule the next timer wake
+ *
+ * @param ring: event ring
+ * @param policy: flush policy
+ * @param now: system time in seconds
+ * @return
+ *      seconds until the oldest pending event is max_age_sec old, 0 if a flush is already due,
+ *      UINT32_MAX if nothing is pending
+ */
+uint32_t event_batch_flush_due_in(const event_batch_ring_t *ring, const event_batch_policy_t *policy, uint32_t now);
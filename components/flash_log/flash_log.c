@@ -0,0 +1,498 @@
+#include <string.h>
+
+#include "flash_log.h"
+
+#define FLASH_LOG_MAGIC 0x31474C46 // "FLG1"
+#define FLASH_LOG_ERASED 0xFFFFFFFF
+
+/* Records are padded so every write starts word aligned */
+#define FLASH_LOG_ALIGN(n) (((n) + 3) & ~(size_t)3)
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t sector_seq; /*!< increments every time a sector is reused */
+    uint32_t first_seq;  /*!< sequence number of the first record written to the sector */
+    uint32_t crc;
+} flash_log_sector_header_t;
+
+typedef struct
+{
+    uint32_t seq;      /*!< record sequence number, the acknowledged one for an ack record */
+    uint8_t type;
+    uint8_t len;       /*!< payload length, padding excluded */
+    uint16_t reserved; /*!< left erased */
+    uint32_t crc;      /*!< over the fields above and the payload */
+} flash_log_record_header_t;
+
+typedef enum
+{
+    FLASH_LOG_TYPE_DATA = 0x01,
+    FLASH_LOG_TYPE_ACK = 0x02,
+} flash_log_type_t;
+
+typedef enum
+{
+    FLASH_LOG_READ_OK = 0,
+    FLASH_LOG_READ_END, /*!< erased, nothing written here yet */
+    FLASH_LOG_READ_BAD, /*!< torn or corrupt, nothing after it can be trusted */
+} flash_log_read_t;
+
+/**
+ * @brief CRC-32 (IEEE 802.3), bitwise to keep the table out of RAM, chainable
+ *
+ */
+static uint32_t flash_log_crc32(uint32_t crc, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+
+    crc = ~crc;
+    while (len--)
+    {
+        crc ^= *p++;
+        for (int i = 0; i < 8; i++)
+        {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+
+    return ~crc;
+}
+
+static uint32_t flash_log_state_crc(const flash_log_t *log)
+{
+    const uint8_t *start = (const uint8_t *)&log->size;
+
+    return flash_log_crc32(0, start, sizeof(*log) - offsetof(flash_log_t, size));
+}
+
+static void flash_log_seal(flash_log_t *log)
+{
+    log->crc = flash_log_state_crc(log);
+}
+
+static uint32_t flash_log_num_sectors(const flash_log_t *log)
+{
+    return log->size / log->sector_size;
+}
+
+static uint32_t flash_log_record_size(size_t len)
+{
+    return FLASH_LOG_ALIGN(sizeof(flash_log_record_header_t) + len);
+}
+
+/**
+ * @brief Read a sector header
+ *
+ * @return
+ *      true if it is valid and belongs to the current round of the ring
+ */
+static bool flash_log_read_sector_header(const flash_log_t *log, uint32_t sector, flash_log_sector_header_t *header)
+{
+    if (!log->flash->read(log->flash->ctx, sector * log->sector_size, header, sizeof(*header)))
+    {
+        return false;
+    }
+    if (header->magic != FLASH_LOG_MAGIC ||
+        header->crc != flash_log_crc32(0, header, offsetof(flash_log_sector_header_t, crc)))
+    {
+        return false;
+    }
+
+    // Left over from before a reformat
+    return header->sector_seq <= log->head_sector_seq &&
+           log->head_sector_seq - header->sector_seq < flash_log_num_sectors(log);
+}
+
+static flash_log_read_t flash_log_read_record(const flash_log_t *log, uint32_t sector, uint32_t offset,
+                                              flash_log_record_header_t *header, uint8_t *data)
+{
+    uint32_t base = sector * log->sector_size;
+    uint32_t crc;
+
+    if (offset + sizeof(*header) > log->sector_size)
+    {
+        return FLASH_LOG_READ_END;
+    }
+    if (!log->flash->read(log->flash->ctx, base + offset, header, sizeof(*header)))
+    {
+        return FLASH_LOG_READ_BAD;
+    }
+    if (header->seq == FLASH_LOG_ERASED && header->type == 0xFF && header->len == 0xFF &&
+        header->crc == FLASH_LOG_ERASED)
+    {
+        return FLASH_LOG_READ_END;
+    }
+    if ((header->type != FLASH_LOG_TYPE_DATA && header->type != FLASH_LOG_TYPE_ACK) ||
+        header->len > FLASH_LOG_MAX_RECORD || offset + flash_log_record_size(header->len) > log->sector_size)
+    {
+        return FLASH_LOG_READ_BAD;
+    }
+    if (!log->flash->read(log->flash->ctx, base + offset + sizeof(*header), data, header->len))
+    {
+        return FLASH_LOG_READ_BAD;
+    }
+
+    crc = flash_log_crc32(0, header, offsetof(flash_log_record_header_t, crc));
+    crc = flash_log_crc32(crc, data, header->len);
+
+    return crc == header->crc ? FLASH_LOG_READ_OK : FLASH_LOG_READ_BAD;
+}
+
+static bool flash_log_write_record(flash_log_t *log, uint8_t type, uint32_t seq, const void *data, size_t len)
+{
+    uint8_t buf[FLASH_LOG_ALIGN(sizeof(flash_log_record_header_t) + FLASH_LOG_MAX_RECORD)];
+    flash_log_record_header_t header = {
+        .seq = seq,
+        .type = type,
+        .len = (uint8_t)len,
+        .reserved = 0xFFFF,
+    };
+    uint32_t size = flash_log_record_size(len);
+
+    header.crc = flash_log_crc32(0, &header, offsetof(flash_log_record_header_t, crc));
+    header.crc = flash_log_crc32(header.crc, data, len);
+
+    // One write, so a power loss tears at most this record
+    memset(buf, 0xFF, size);
+    memcpy(buf, &header, sizeof(header));
+    if (len)
+    {
+        memcpy(buf + sizeof(header), data, len);
+    }
+
+    if (!log->flash->write(log->flash->ctx, log->head_sector * log->sector_size + log->head_offset, buf, size))
+    {
+        // Whatever got programmed is garbage now, do not write after it
+        log->head_offset = log->sector_size;
+        flash_log_seal(log);
+        return false;
+    }
+    log->head_offset += size;
+
+    return true;
+}
+
+static bool flash_log_open_sector(flash_log_t *log, uint32_t sector, uint32_t sector_seq)
+{
+    flash_log_sector_header_t header = {
+        .magic = FLASH_LOG_MAGIC,
+        .sector_seq = sector_seq,
+        .first_seq = log->next_seq,
+    };
+
+    header.crc = flash_log_crc32(0, &header, offsetof(flash_log_sector_header_t, crc));
+
+    if (!log->flash->erase_sector(log->flash->ctx, sector * log->sector_size) ||
+        !log->flash->write(log->flash->ctx, sector * log->sector_size, &header, sizeof(header)))
+    {
+        return false;
+    }
+
+    log->head_sector = sector;
+    log->head_sector_seq = sector_seq;
+    log->head_offset = sizeof(header);
+
+    return true;
+}
+
+/**
+ * @brief Move the head to the next sector, dropping what the oldest sector still held
+ *
+ */
+static bool flash_log_advance(flash_log_t *log)
+{
+    uint32_t num_sectors = flash_log_num_sectors(log);
+    uint32_t next = (log->head_sector + 1) % num_sectors;
+    flash_log_sector_header_t header;
+    uint32_t new_tail = log->next_seq;
+    uint32_t lost_from;
+
+    if (flash_log_read_sector_header(log, next, &header))
+    {
+        // The first valid sector after the erased one becomes the tail
+        for (uint32_t i = 1; i < num_sectors; i++)
+        {
+            if (flash_log_read_sector_header(log, (next + i) % num_sectors, &header))
+            {
+                new_tail = header.first_seq;
+                break;
+            }
+        }
+
+        lost_from = log->acked_seq + 1 > log->tail_seq ? log->acked_seq + 1 : log->tail_seq;
+        if (new_tail > lost_from)
+        {
+            log->dropped += new_tail - lost_from;
+        }
+        log->tail_seq = new_tail;
+    }
+
+    if (!flash_log_open_sector(log, next, log->head_sector_seq + 1))
+    {
+        flash_log_seal(log);
+        return false;
+    }
+
+    // Checkpoint the commit pointer, its last ack record may be in the sector just erased
+    if (log->acked_seq)
+    {
+        flash_log_write_record(log, FLASH_LOG_TYPE_ACK, log->acked_seq, NULL, 0);
+    }
+    flash_log_seal(log);
+
+    return true;
+}
+
+/**
+ * @brief Whether the rest of a sector is still erased, i.e. safe to append to
+ *
+ */
+static bool flash_log_erased(const flash_log_t *log, uint32_t sector, uint32_t offset)
+{
+    uint32_t chunk[16];
+
+    while (offset < log->sector_size)
+    {
+        size_t len = log->sector_size - offset < sizeof(chunk) ? log->sector_size - offset : sizeof(chunk);
+
+        if (!log->flash->read(log->flash->ctx, sector * log->sector_size + offset, chunk, len))
+        {
+            return false;
+        }
+        for (size_t i = 0; i < len / sizeof(uint32_t); i++)
+        {
+            if (chunk[i] != FLASH_LOG_ERASED)
+            {
+                return false;
+            }
+        }
+        offset += len;
+    }
+
+    return true;
+}
+
+bool flash_log_mount(flash_log_t *log, const flash_log_flash_t *flash)
+{
+    flash_log_sector_header_t header;
+    flash_log_record_header_t record;
+    static uint8_t data[FLASH_LOG_MAX_RECORD]; // off the stack, mount is not reentrant anyway
+    flash_log_read_t result;
+    uint32_t num_sectors;
+    uint32_t max_seq = 0;
+    uint32_t head_first_seq = 1;
+    bool found = false;
+
+    if (flash->sector_size < 64 || flash->sector_size % 4 || flash->size % flash->sector_size ||
+        flash->size / flash->sector_size < 2)
+    {
+        return false;
+    }
+
+    memset(log, 0, sizeof(*log));
+    log->flash = flash;
+    log->size = flash->size;
+    log->sector_size = flash->sector_size;
+    log->next_seq = 1;
+    num_sectors = flash_log_num_sectors(log);
+
+    // The head is the sector with the highest sector sequence number
+    log->head_sector_seq = UINT32_MAX;
+    for (uint32_t s = 0; s < num_sectors; s++)
+    {
+        if (!flash->read(flash->ctx, s * flash->sector_size, &header, sizeof(header)) ||
+            header.magic != FLASH_LOG_MAGIC ||
+            header.crc != flash_log_crc32(0, &header, offsetof(flash_log_sector_header_t, crc)))
+        {
+            continue;
+        }
+        if (!found || header.sector_seq > log->head_sector_seq)
+        {
+            log->head_sector = s;
+            log->head_sector_seq = header.sector_seq;
+            head_first_seq = header.first_seq;
+            found = true;
+        }
+    }
+
+    if (!found)
+    {
+        log->tail_seq = 1;
+        if (!flash_log_open_sector(log, 0, 1))
+        {
+            return false;
+        }
+        flash_log_seal(log);
+        return true;
+    }
+
+    // Oldest first: the sectors after the head, wrapping around to the head itself
+    log->tail_seq = 0;
+    for (uint32_t i = 1; i <= num_sectors; i++)
+    {
+        uint32_t s = (log->head_sector + i) % num_sectors;
+        uint32_t offset = sizeof(header);
+
+        if (!flash_log_read_sector_header(log, s, &header))
+        {
+            continue;
+        }
+        if (log->tail_seq == 0)
+        {
+            log->tail_seq = header.first_seq;
+        }
+
+        while ((result = flash_log_read_record(log, s, offset, &record, data)) == FLASH_LOG_READ_OK)
+        {
+            if (record.type == FLASH_LOG_TYPE_DATA && record.seq > max_seq)
+            {
+                max_seq = record.seq;
+            }
+            if (record.type == FLASH_LOG_TYPE_ACK && record.seq > log->acked_seq)
+            {
+                log->acked_seq = record.seq;
+            }
+            offset += flash_log_record_size(record.len);
+        }
+
+        if (s == log->head_sector)
+        {
+            // Appending after a torn record or over partly programmed bits would corrupt the next one
+            log->head_offset = offset;
+            if (result == FLASH_LOG_READ_BAD || !flash_log_erased(log, s, offset))
+            {
+                log->head_offset = log->sector_size;
+            }
+        }
+    }
+
+    log->next_seq = max_seq + 1;
+    if (log->next_seq < head_first_seq)
+    {
+        log->next_seq = head_first_seq;
+    }
+    if (log->next_seq <= log->acked_seq)
+    {
+        log->next_seq = log->acked_seq + 1;
+    }
+    if (log->tail_seq == 0)
+    {
+        log->tail_seq = log->next_seq;
+    }
+    flash_log_seal(log);
+
+    return true;
+}
+
+bool flash_log_resume(flash_log_t *log, const flash_log_flash_t *flash)
+{
+    if (log->crc != flash_log_state_crc(log) || log->size != flash->size || log->sector_size != flash->sector_size)
+    {
+        return false;
+    }
+    log->flash = flash;
+
+    return true;
+}
+
+bool flash_log_append(flash_log_t *log, const void *data, size_t len, uint32_t *seq)
+{
+    if (len > FLASH_LOG_MAX_RECORD)
+    {
+        return false;
+    }
+    if (log->head_offset + flash_log_record_size(len) > log->sector_size && !flash_log_advance(log))
+    {
+        return false;
+    }
+    if (!flash_log_write_record(log, FLASH_LOG_TYPE_DATA, log->next_seq, data, len))
+    {
+        return false;
+    }
+
+    if (seq)
+    {
+        *seq = log->next_seq;
+    }
+    log->next_seq++;
+    flash_log_seal(log);
+
+    return true;
+}
+
+uint32_t flash_log_pending(const flash_log_t *log)
+{
+    uint32_t from = log->acked_seq + 1 > log->tail_seq ? log->acked_seq + 1 : log->tail_seq;
+
+    return log->next_seq > from ? log->next_seq - from : 0;
+}
+
+void flash_log_cursor_init(const flash_log_t *log, flash_log_cursor_t *cursor)
+{
+    uint32_t num_sectors = flash_log_num_sectors(log);
+
+    cursor->sector = (log->head_sector + 1) % num_sectors;
+    cursor->sectors_left = num_sectors;
+    cursor->offset = 0;
+}
+
+bool flash_log_next(const flash_log_t *log, flash_log_cursor_t *cursor, flash_log_record_t *record)
+{
+    flash_log_sector_header_t header;
+    flash_log_record_header_t record_header;
+
+    while (cursor->sectors_left > 0)
+    {
+        if (cursor->offset == 0)
+        {
+            cursor->offset = flash_log_read_sector_header(log, cursor->sector, &header) ? sizeof(header)
+                                                                                        : log->sector_size;
+        }
+
+        uint32_t limit = cursor->sector == log->head_sector ? log->head_offset : log->sector_size;
+        while (cursor->offset < limit &&
+               flash_log_read_record(log, cursor->sector, cursor->offset, &record_header, record->data) ==
+                   FLASH_LOG_READ_OK)
+        {
+            cursor->offset += flash_log_record_size(record_header.len);
+            if (record_header.type == FLASH_LOG_TYPE_DATA && record_header.seq > log->acked_seq)
+            {
+                record->seq = record_header.seq;
+                record->len = record_header.len;
+                return true;
+            }
+        }
+
+        cursor->sector = (cursor->sector + 1) % flash_log_num_sectors(log);
+        cursor->sectors_left--;
+        cursor->offset = 0;
+    }
+
+    return false;
+}
+
+bool flash_log_ack(flash_log_t *log, uint32_t seq)
+{
+    if (seq >= log->next_seq)
+    {
+        seq = log->next_seq - 1;
+    }
+    if (seq <= log->acked_seq)
+    {
+        return true;
+    }
+
+    if (log->head_offset + flash_log_record_size(0) > log->sector_size && !flash_log_advance(log))
+    {
+        return false;
+    }
+    if (!flash_log_write_record(log, FLASH_LOG_TYPE_ACK, seq, NULL, 0))
+    {
+        return false;
+    }
+    log->acked_seq = seq;
+    flash_log_seal(log);
+
+    return true;
+}
@@ -0,0 +1,59 @@
+#include <inttypes.h>
+
+#include "esp_log.h"
+#include "esp_partition.h"
+
+#include "flash_log_partition.h"
+
+static const char *TAG = "flash_log";
+
+static flash_log_flash_t s_flash;
+
+static bool flash_log_partition_read(void *ctx, uint32_t offset, void *buf, size_t len)
+{
+    return esp_partition_read(ctx, offset, buf, len) == ESP_OK;
+}
+
+static bool flash_log_partition_write(void *ctx, uint32_t offset, const void *buf, size_t len)
+{
+    return esp_partition_write(ctx, offset, buf, len) == ESP_OK;
+}
+
+static bool flash_log_partition_erase_sector(void *ctx, uint32_t offset)
+{
+    return esp_partition_erase_range(ctx, offset, SPI_FLASH_SEC_SIZE) == ESP_OK;
+}
+
+esp_err_t flash_log_partition_open(flash_log_t *log, const char *label)
+{
+    const esp_partition_t *partition;
+
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, FLASH_LOG_PARTITION_SUBTYPE, label);
+    if (partition == NULL)
+    {
+        ESP_LOGE(TAG, "No partition %s", label);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    s_flash = (flash_log_flash_t){
+        .read = flash_log_partition_read,
+        .write = flash_log_partition_write,
+        .erase_sector = flash_log_partition_erase_sector,
+        .ctx = (void *)partition,
+        .size = partition->size,
+        .sector_size = SPI_FLASH_SEC_SIZE,
+    };
+
+    if (flash_log_resume(log, &s_flash))
+    {
+        return ESP_OK;
+    }
+    if (!flash_log_mount(log, &s_flash))
+    {
+        ESP_LOGE(TAG, "Failed to mount %s", label);
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG, "Mounted %s, %" PRIu32 " records pending", label, flash_log_pending(log));
+
+    return ESP_OK;
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Largest record payload */
+#define FLASH_LOG_MAX_RECORD 248
+
+/**
+ * @brief Flash Operations Type
+ *
+ * NOR semantics: erase sets a whole sector to 0xFF, write can only clear bits.
+ * Offsets are relative to the start of the log area.
+ */
+typedef struct flash_log_flash_s
+{
+    bool (*read)(void *ctx, uint32_t offset, void *buf, size_t len);
+    bool (*write)(void *ctx, uint32_t offset, const void *buf, size_t len);
+    bool (*erase_sector)(void *ctx, uint32_t offset);
+    void *ctx;
+    uint32_t size;        /*!< log area size, a multiple of sector_size */
+    uint32_t sector_size; /*!< erase unit */
+} flash_log_flash_t;
+
+/**
+ * @brief Flash Log Type
+ *
+ * Append-only log over a ring of sectors, reused round robin so erases spread evenly.
+ * Every sector starts with a header carrying a sector sequence number, every record
+ * carries a record sequence number and a CRC, so a record torn by a power loss is
+ * recognized and the end of the log found again by flash_log_mount(). Acknowledged
+ * records are recorded by appending an ack record, the commit pointer.
+ *
+ * The state itself is CRC checked, so it can live in RTC memory and spare the mount
+ * scan on warm wakes, see flash_log_resume().
+ */
+typedef struct flash_log_s
+{
+    const flash_log_flash_t *flash; /*!< not covered by the CRC, attached on mount and resume */
+    uint32_t crc;
+    uint32_t size;            /*!< geometry the state was built for */
+    uint32_t sector_size;
+    uint32_t head_sector;     /*!< sector appended to */
+    uint32_t head_offset;     /*!< next write offset in the head sector */
+    uint32_t head_sector_seq; /*!< sector sequence number of the head sector */
+    uint32_t next_seq;        /*!< sequence number of the next record, the first one is 1 */
+    uint32_t tail_seq;        /*!< first record still in flash */
+    uint32_t acked_seq;       /*!< records up to here are acknowledged, 0 for none */
+    uint32_t dropped;         /*!< records overwritten before they were acknowledged, since the last mount */
+} flash_log_t;
+
+/**
+ * @brief Flash Log Record Type
+ *
+ */
+typedef struct flash_log_record_s
+{
+    uint32_t seq;
+    uint8_t len;
+    uint8_t data[FLASH_LOG_MAX_RECORD];
+} flash_log_record_t;
+
+/**
+ * @brief Read Cursor Type
+ *
+ */
+typedef struct flash_log_cursor_s
+{
+    uint16_t sector;
+    uint16_t sectors_left;
+    uint32_t offset;
+} flash_log_cursor_t;
+
+/**
+ * @brief Scan the flash and rebuild the state, formatting it if it holds no log
+ *
+ * @param log: flash log
+ * @param flash: flash operations, has to stay valid while the log is used
+ * @return
+ *      true on success, false on a flash error or bad geometry
+ */
+bool flash_log_mount(flash_log_t *log, const flash_log_flash_t *flash);
+
+/**
+ * @brief Reuse a state kept in RTC memory instead of scanning
+ *
+ * @param log: flash log
+ * @param flash: flash operations
+ * @return
+ *      true if the state is intact and matches the flash geometry, otherwise call flash_log_mount()
+ */
+bool flash_log_resume(flash_log_t *log, const flash_log_flash_t *flash);
+
+/**
+ * @brief Append a record, erasing the oldest sector when the head sector is full
+ *
+ * Unacknowledged records in the erased sector are counted in dropped.
+ *
+ * @param log: flash log
+ * @param data: payload
+ * @param len: payload length, up to FLASH_LOG_MAX_RECORD
+ * @param seq: output sequence number of the record, may be NULL
+ * @return
+ *      true on success
+ */
+bool flash_log_append(flash_log_t *log, const void *data, size_t len, uint32_t *seq);
+
+/**
+ * @brief Number of records not acknowledged yet
+ *
+ */
+uint32_t flash_log_pending(const flash_log_t *log);
+
+/**
+ * @brief Start reading at the oldest unacknowledged record
+ *
+ * @param log: flash log
+ * @param cursor: output cursor
+ */
+void flash_log_cursor_init(const flash_log_t *log, flash_log_cursor_t *cursor);
+
+/**
+ * @brief Read the next unacknowledged record
+ *
+ * @param log: flash log
+ * @param cursor: cursor
+ * @param record: output record
+ * @return
+ *      true if a record was read, false at the end of the log
+ */
+bool flash_log_next(const flash_log_t *log, flash_log_cursor_t *cursor, flash_log_record_t *record);
+
+/**
+ * @brief Acknowledge all records up to a sequence number, e.g. after the server took them
+ *
+ * @param log: flash log
+ * @param seq: last acknowledged record
+ * @return
+ *      true once the ack is durable
+ */
+bool flash_log_ack(flash_log_t *log, uint32_t seq);
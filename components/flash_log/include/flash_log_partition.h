@@ -0,0 +1,20 @@
+#pragma once
+
+#include "esp_err.h"
+
+#include "flash_log.h"
+
+/* Partition subtype of the log, see partitions.csv */
+#define FLASH_LOG_PARTITION_SUBTYPE 0x40
+
+/**
+ * @brief Open the log in a data partition
+ *
+ * A state kept in RTC memory is reused as is, otherwise the partition is scanned.
+ *
+ * @param log: flash log, typically in RTC memory
+ * @param label: partition label
+ * @return
+ *      ESP_OK, ESP_ERR_NOT_FOUND if there is no such partition, or ESP_FAIL
+ */
+esp_err_t flash_log_partition_open(flash_log_t *log, const char *label);
@@ -0,0 +1,167 @@
+#include <stdbool.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include "esp_attr.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+
+#include "heap_stats.h"
+#include "dlog.h"
+
+#ifdef CONFIG_HEAP_TRACING_STANDALONE
+#include "esp_heap_trace.h"
+
+/* Allocations traced per wake, those past the buffer are counted by the heap but not listed */
+#define HEAP_TRACE_RECORDS 64
+#endif
+
+#define HEAP_STATS_MAGIC 0x48505331 // "HPS1"
+#define HEAP_STATS_CAPS MALLOC_CAP_8BIT
+
+static const char *TAG = "heap_stats";
+
+typedef struct
+{
+    uint32_t crc; /*!< of everything after it */
+    uint32_t magic;
+    uint16_t head;  /*!< next row written */
+    uint16_t count; /*!< rows in use */
+    heap_stats_wake_t wakes[HEAP_STATS_WAKES];
+} heap_stats_ring_t;
+
+/* Survives resets other than power on, so the reset button can dump it */
+RTC_NOINIT_ATTR static heap_stats_ring_t s_ring;
+static heap_stats_wake_t s_wake;
+static bool s_started;
+
+#ifdef CONFIG_HEAP_TRACING_STANDALONE
+static heap_trace_record_t s_trace_records[HEAP_TRACE_RECORDS];
+#endif
+
+static uint32_t heap_stats_crc32(const uint8_t *data, size_t len)
+{
+    uint32_t crc = 0xFFFFFFFF;
+
+    while (len--)
+    {
+        crc ^= *data++;
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+
+    return ~crc;
+}
+
+static uint32_t heap_stats_ring_crc(void)
+{
+    return heap_stats_crc32((const uint8_t *)&s_ring + sizeof(s_ring.crc), sizeof(s_ring) - sizeof(s_ring.crc));
+}
+
+/* RTC memory is not cleared on power on, nor when an update moved the ring */
+static bool heap_stats_ring_valid(void)
+{
+    return s_ring.magic == HEAP_STATS_MAGIC && s_ring.head < HEAP_STATS_WAKES && s_ring.count <= HEAP_STATS_WAKES &&
+           s_ring.crc == heap_stats_ring_crc();
+}
+
+void heap_stats_begin_wake(uint32_t boot)
+{
+    if (!heap_stats_ring_valid())
+    {
+        memset(&s_ring, 0, sizeof(s_ring));
+        s_ring.magic = HEAP_STATS_MAGIC;
+        s_ring.crc = heap_stats_ring_crc();
+    }
+
+    memset(&s_wake, 0, sizeof(s_wake));
+    s_wake.boot = boot;
+    s_wake.free_start = heap_caps_get_free_size(HEAP_STATS_CAPS);
+    s_started = true;
+
+#ifdef CONFIG_HEAP_TRACING_STANDALONE
+    if (heap_trace_init_standalone(s_trace_records, HEAP_TRACE_RECORDS) != ESP_OK ||
+        heap_trace_start(HEAP_TRACE_ALL) != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Failed to start heap tracing");
+    }
+#endif
+}
+
+void heap_stats_end_wake(void)
+{
+    heap_stats_wake_t wake;
+    uint32_t lowest_free;
+    uint32_t lowest_block;
+
+    if (!s_started)
+    {
+        return;
+    }
+    s_started = false;
+
+#ifdef CONFIG_HEAP_TRACING_STANDALONE
+    heap_trace_stop();
+#endif
+
+    s_wake.free_end = heap_caps_get_free_size(HEAP_STATS_CAPS);
+    s_wake.min_free = heap_caps_get_minimum_free_size(HEAP_STATS_CAPS);
+    s_wake.largest_block = heap_caps_get_largest_free_block(HEAP_STATS_CAPS);
+
+    s_ring.wakes[s_ring.head] = s_wake;
+    s_ring.head = (s_ring.head + 1) % HEAP_STATS_WAKES;
+    if (s_ring.count < HEAP_STATS_WAKES)
+    {
+        s_ring.count++;
+    }
+    s_ring.crc = heap_stats_ring_crc();
+
+    lowest_free = s_wake.min_free;
+    lowest_block = s_wake.largest_block;
+    for (size_t age = 1; heap_stats_get(age, &wake) == ESP_OK; age++)
+    {
+        lowest_free = wake.min_free < lowest_free ? wake.min_free : lowest_free;
+        lowest_block = wake.largest_block < lowest_block ? wake.largest_block : lowest_block;
+    }
+
+    DLOGI(TAG, "Heap %" PRIu32 " free at boot, %" PRIu32 " at sleep, watermark %" PRIu32 " (lowest %" PRIu32
+               "), largest block %" PRIu32 " (lowest %" PRIu32 ") over %u wakes",
+          s_wake.free_start, s_wake.free_end, s_wake.min_free, lowest_free, s_wake.largest_block,
+          lowest_block, s_ring.count);
+
+#ifdef CONFIG_HEAP_TRACING_STANDALONE
+    // Wi-Fi, lwIP, mbedTLS and the event loop allocate too, the callers tell them apart
+    ESP_LOGI(TAG, "%zu allocations traced on this wake", heap_trace_get_count());
+    heap_trace_dump();
+#endif
+}
+
+esp_err_t heap_stats_get(size_t age, heap_stats_wake_t *wake)
+{
+    if (!heap_stats_ring_valid() || age >= s_ring.count)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    *wake = s_ring.wakes[(s_ring.head + HEAP_STATS_WAKES - 1 - age) % HEAP_STATS_WAKES];
+
+    return ESP_OK;
+}
+
+void heap_stats_dump(void)
+{
+    heap_stats_wake_t wake;
+
+    ESP_LOGI(TAG, "%6s %10s %10s %10s %10s", "boot", "at boot", "at sleep", "watermark", "largest");
+    for (size_t age = s_ring.count; age-- > 0;)
+    {
+        if (heap_stats_get(age, &wake) != ESP_OK)
+        {
+            continue;
+        }
+        ESP_LOGI(TAG, "%6" PRIu32 " %10" PRIu32 " %10" PRIu32 " %10" PRIu32 " %10" PRIu32, wake.boot,
+                 wake.free_start, wake.free_end, wake.min_free, wake.largest_block);
+    }
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+/* Number of wakes kept in RTC memory */
+#define HEAP_STATS_WAKES 16
+
+/**
+ * @brief Heap Statistics Type
+ *
+ * One wake, 8-bit capable internal heap. The heap starts over on every boot, so a watermark or
+ * largest block going down from wake to wake means the wake path itself allocates more.
+ */
+typedef struct heap_stats_wake_s
+{
+    uint32_t boot;          /*!< boot count of the wake */
+    uint32_t free_start;    /*!< free bytes when the wake began */
+    uint32_t free_end;      /*!< free bytes before deep sleep */
+    uint32_t min_free;      /*!< lowest free bytes during the wake, the watermark */
+    uint32_t largest_block; /*!< largest free block before deep sleep */
+} heap_stats_wake_t;
+
+/**
+ * @brief Record the free heap at the start of a wake
+ *
+ * With CONFIG_HEAP_TRACING_STANDALONE, every allocation until heap_stats_end_wake() is also traced.
+ *
+ * @param boot: boot count
+ */
+void heap_stats_begin_wake(uint32_t boot);
+
+/**
+ * @brief Record the watermark and largest free block of the wake in RTC memory and log them
+ *
+ */
+void heap_stats_end_wake(void);
+
+/**
+ * @brief Get a recorded wake
+ *
+ * @param age: 0 for the last wake ended, 1 for the one before and so on
+ * @param wake: output wake
+ * @return
+ *      ESP_OK, ESP_ERR_NOT_FOUND if fewer wakes were recorded
+ */
+esp_err_t heap_stats_get(size_t age, heap_stats_wake_t *wake);
+
+/**
+ * @brief Log the recorded wakes, oldest first
+ *
+ */
+void heap_stats_dump(void);
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief Debounce Result Type
+ *
+ */
+typedef enum
+{
+    MAIL_DEBOUNCE_NONE = 0,  /*!< level not settled yet, or unchanged */
+    MAIL_DEBOUNCE_DROP,      /*!< flap settled open, counted as a new mail drop */
+    MAIL_DEBOUNCE_COALESCED, /*!< flap settled open within the coalescing window of the last drop */
+    MAIL_DEBOUNCE_CLEARED,   /*!< flap settled closed */
+} mail_debounce_result_t;
+
+/**
+ * @brief Debounce Policy Type
+ *
+ */
+typedef struct mail_debounce_policy_s
+{
+    uint32_t settle_ms;   /*!< a level has to hold this long before it counts */
+    uint32_t coalesce_ms; /*!< drops within this long of the last counted drop are merged into it */
+} mail_debounce_policy_t;
+
+/**
+ * @brief Debounce State Type
+ *
+ * Meant to live in RTC memory, so it keeps counting across deep sleep. Times are in
+ * milliseconds of a monotonic clock that keeps running in deep sleep; only differences are used,
+ * so the counter may wrap.
+ */
+typedef struct mail_debounce_state_s
+{
+    uint8_t raw_level;      /*!< last sampled level */
+    uint8_t stable_level;   /*!< last settled level, 1 is flap open */
+    uint8_t has_drop;       /*!< last_drop_ms is valid */
+    uint32_t raw_since_ms;  /*!< time raw_level was first seen */
+    uint32_t last_drop_ms;  /*!< time of the last counted drop */
+    uint32_t drops;         /*!< counted drops */
+    uint32_t coalesced;     /*!< drops merged into a previous one */
+    uint32_t bounces;       /*!< level changes that did not settle */
+} mail_debounce_state_t;
+
+/**
+ * @brief Reset the state to a settled level, e.g. after power on
+ *
+ * @param state: debounce state
+ * @param level: current level
+ * @param now_ms: current time
+ */
+void mail_debounce_init(mail_debounce_state_t *state, int level, uint32_t now_ms);
+
+/**
+ * @brief Feed one level sample, either a recorded edge or a poll of the pin
+ *
+ * @param state: debounce state
+ * @param policy: debounce policy
+ * @param now_ms: time of the sample
+ * @param level: sampled level
+ * @return
+ *      what settled with this sample, MAIL_DEBOUNCE_NONE most of the time
+ */
+mail_debounce_result_t mail_debounce_feed(mail_debounce_state_t *state, const mail_debounce_policy_t *policy,
+                                          uint32_t now_ms, int level);
+
+/**
+ * @brief Account for an opening that was over before it could be sampled
+ *
+ * The wake source latches the edge, so a wake on an opening whose level is already back
+ * to closed on the first sample was a short flap, e.g. a letter pushed through the slot.
+ *
+ * @param state: debounce state
+ * @param policy: debounce policy
+ * @param now_ms: time of the wake
+ * @return
+ *      MAIL_DEBOUNCE_DROP or MAIL_DEBOUNCE_COALESCED, MAIL_DEBOUNCE_NONE if the flap was settled open
+ */
+mail_debounce_result_t mail_debounce_pulse(mail_debounce_state_t *state, const mail_debounce_policy_t *policy,
+                                           uint32_t now_ms);
+
+/**
+ * @brief Whether the sampled level still has to settle
+ *
+ * @param state: debounce state
+ * @return
+ *      true while the last sampled level differs from the settled one
+ */
+bool mail_debounce_pending(const mail_debounce_state_t *state);
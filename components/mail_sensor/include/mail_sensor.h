@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "driver/gpio.h"
+#include "esp_err.h"
+
+#include "mail_debounce.h"
+
+/**
+ * @brief Mail Sensor Configuration Type
+ *
+ */
+typedef struct mail_sensor_conf_s
+{
+    gpio_num_t gpio;                /*!< flap or door switch, RTC capable, externally pulled, high when open */
+    mail_debounce_policy_t policy;  /*!< debounce and coalescing windows */
+    uint32_t max_settle_ms;         /*!< give up polling a chattering switch after this long */
+} mail_sensor_conf_t;
+
+/**
+ * @brief Take the pin back from the RTC domain and restore the debounce state
+ *
+ * @param conf: sensor configuration
+ * @param cold: not a deep sleep wake, the state is reset to the current level
+ * @return
+ *      ESP_OK, or ESP_ERR_INVALID_ARG if the pin cannot wake the chip
+ */
+esp_err_t mail_sensor_init(const mail_sensor_conf_t *conf, bool cold);
+
+/**
+ * @brief Poll the pin until its level settles or max_settle_ms pass
+ *
+ * @param conf: sensor configuration
+ * @return
+ *      what settled, MAIL_DEBOUNCE_NONE if the level did not change or did not settle in time
+ */
+mail_debounce_result_t mail_sensor_settle(const mail_sensor_conf_t *conf);
+
+/**
+ * @brief Arm ext1 to wake on the opposite of the settled level
+ *
+ * A level that did not settle before sleep wakes the chip again right away and is
+ * debounced on that wake.
+ *
+ * @param conf: sensor configuration
+ * @return
+ *      ESP_OK on success
+ */
+esp_err_t mail_sensor_enable_wakeup(const mail_sensor_conf_t *conf);
+
+/**
+ * @brief Debounce state and counters kept across deep sleep
+ *
+ */
+const mail_debounce_state_t *mail_sensor_state(void);
@@ -0,0 +1,74 @@
+#include "mail_debounce.h"
+
+static mail_debounce_result_t mail_debounce_count_drop(mail_debounce_state_t *state,
+                                                       const mail_debounce_policy_t *policy, uint32_t now_ms)
+{
+    // The window runs from the last counted drop, so a flapping lid yields one drop per window
+    if (state->has_drop && now_ms - state->last_drop_ms < policy->coalesce_ms)
+    {
+        state->coalesced++;
+        return MAIL_DEBOUNCE_COALESCED;
+    }
+
+    state->has_drop = 1;
+    state->last_drop_ms = now_ms;
+    state->drops++;
+
+    return MAIL_DEBOUNCE_DROP;
+}
+
+void mail_debounce_init(mail_debounce_state_t *state, int level, uint32_t now_ms)
+{
+    *state = (mail_debounce_state_t){
+        .raw_level = level != 0,
+        .stable_level = level != 0,
+        .raw_since_ms = now_ms,
+    };
+}
+
+mail_debounce_result_t mail_debounce_feed(mail_debounce_state_t *state, const mail_debounce_policy_t *policy,
+                                          uint32_t now_ms, int level)
+{
+    level = level != 0;
+
+    if (level != state->raw_level)
+    {
+        // A change back before settling was a bounce
+        if (state->raw_level != state->stable_level)
+        {
+            state->bounces++;
+        }
+        state->raw_level = level;
+        state->raw_since_ms = now_ms;
+    }
+
+    if (state->raw_level == state->stable_level || now_ms - state->raw_since_ms < policy->settle_ms)
+    {
+        return MAIL_DEBOUNCE_NONE;
+    }
+
+    state->stable_level = state->raw_level;
+    if (!state->stable_level)
+    {
+        return MAIL_DEBOUNCE_CLEARED;
+    }
+
+    return mail_debounce_count_drop(state, policy, now_ms);
+}
+
+mail_debounce_result_t mail_debounce_pulse(mail_debounce_state_t *state, const mail_debounce_policy_t *policy,
+                                           uint32_t now_ms)
+{
+    // Only an opening pulse is a drop, a closed flap briefly lifting is not
+    if (state->stable_level || mail_debounce_pending(state))
+    {
+        return MAIL_DEBOUNCE_NONE;
+    }
+
+    return mail_debounce_count_drop(state, policy, now_ms);
+}
+
+bool mail_debounce_pending(const mail_debounce_state_t *state)
+{
+    return state->raw_level != state->stable_level;
+}
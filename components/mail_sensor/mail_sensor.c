@@ -0,0 +1,93 @@
+#include <inttypes.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/rtc_io.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_sleep.h"
+#include "esp_private/esp_clk.h"
+
+#include "mail_sensor.h"
+
+static const char *TAG = "mail_sensor";
+
+RTC_DATA_ATTR static mail_debounce_state_t s_debounce;
+
+/* The RTC timer keeps counting in deep sleep, esp_timer does not. The system time is stepped by SNTP,
+   from 1970 on the first sync, which would close or stretch the debounce windows */
+static uint32_t mail_sensor_now_ms(void)
+{
+    return (uint32_t)(esp_clk_rtc_time() / 1000);
+}
+
+esp_err_t mail_sensor_init(const mail_sensor_conf_t *conf, bool cold)
+{
+    if (!rtc_gpio_is_valid_gpio(conf->gpio))
+    {
+        ESP_LOGE(TAG, "GPIO %d cannot wake from deep sleep", conf->gpio);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // A wake source pin is left configured as RTC IO
+    rtc_gpio_deinit(conf->gpio);
+    gpio_set_direction(conf->gpio, GPIO_MODE_INPUT);
+
+    if (cold)
+    {
+        mail_debounce_init(&s_debounce, gpio_get_level(conf->gpio), mail_sensor_now_ms());
+    }
+
+    return ESP_OK;
+}
+
+mail_debounce_result_t mail_sensor_settle(const mail_sensor_conf_t *conf)
+{
+    mail_debounce_result_t result;
+    uint32_t start_ms = mail_sensor_now_ms();
+    uint32_t now_ms = start_ms;
+
+    result = mail_debounce_feed(&s_debounce, &conf->policy, now_ms, gpio_get_level(conf->gpio));
+    if (result == MAIL_DEBOUNCE_NONE && !mail_debounce_pending(&s_debounce) &&
+        esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_EXT1)
+    {
+        // Woken by an edge that is already gone
+        return mail_debounce_pulse(&s_debounce, &conf->policy, now_ms);
+    }
+
+    for (;;)
+    {
+        if (result != MAIL_DEBOUNCE_NONE || !mail_debounce_pending(&s_debounce))
+        {
+            return result;
+        }
+        if (now_ms - start_ms >= conf->max_settle_ms)
+        {
+            ESP_LOGW(TAG, "Level did not settle in %" PRIu32 " ms", conf->max_settle_ms);
+            return MAIL_DEBOUNCE_NONE;
+        }
+        vTaskDelay(1);
+
+        now_ms = mail_sensor_now_ms();
+        result = mail_debounce_feed(&s_debounce, &conf->policy, now_ms, gpio_get_level(conf->gpio));
+    }
+}
+
+esp_err_t mail_sensor_enable_wakeup(const mail_sensor_conf_t *conf)
+{
+    // ext1 rather than ext0: it does not keep the RTC peripherals powered in deep sleep
+    esp_sleep_ext1_wakeup_mode_t mode = s_debounce.stable_level ? ESP_EXT1_WAKEUP_ALL_LOW : ESP_EXT1_WAKEUP_ANY_HIGH;
+
+    if (esp_sleep_enable_ext1_wakeup(1ULL << conf->gpio, mode) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to arm ext1 wakeup on GPIO %d", conf->gpio);
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+const mail_debounce_state_t *mail_sensor_state(void)
+{
+    return &s_debounce;
+}
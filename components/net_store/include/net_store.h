@@ -0,0 +1,107 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define NET_STORE_MAX_NETWORKS 4
+#define NET_STORE_SSID_LEN 32
+#define NET_STORE_PASSWORD_LEN 64
+
+/**
+ * @brief Known Network Type
+ *
+ */
+typedef struct net_store_network_s
+{
+    char ssid[NET_STORE_SSID_LEN + 1];
+    char password[NET_STORE_PASSWORD_LEN + 1];
+    int8_t rssi;            /*!< at the last association, 0 if never associated */
+    uint8_t failures;       /*!< failed attempts since the last success, saturating */
+    uint32_t last_success;  /*!< system time in seconds, 0 if never connected */
+    uint32_t time_to_ip_ms; /*!< running average of full connects, 0 until the first one */
+} net_store_network_t;
+
+/**
+ * @brief Network Store Type
+ *
+ * Plain data, so it can be kept in RTC memory and written to NVS as a blob.
+ */
+typedef struct net_store_s
+{
+    uint8_t num_networks;
+    net_store_network_t networks[NET_STORE_MAX_NETWORKS];
+} net_store_t;
+
+/**
+ * @brief Ranking Policy Type
+ *
+ * A network is ranked by its chance of success per expected millisecond spent on it. The
+ * chance halves per failure since the last success, and halves again for a network that
+ * never connected, whose last success is older than stale_sec, or whose signal was weak.
+ * A successful attempt costs its average time to IP, a failed one the attempt timeout.
+ */
+typedef struct net_store_policy_s
+{
+    uint32_t attempt_timeout_ms;    /*!< what a failed attempt costs */
+    uint32_t default_time_to_ip_ms; /*!< for networks without a full connect yet */
+    uint32_t stale_sec;             /*!< a success older than this counts for less */
+    int8_t weak_rssi;               /*!< an association below this counts for less */
+} net_store_policy_t;
+
+/**
+ * @brief Find a network by SSID
+ *
+ * @return
+ *      index, or -1 if the SSID is not known
+ */
+int net_store_find(const net_store_t *store, const char *ssid);
+
+/**
+ * @brief Add a network or update its password
+ *
+ * A new network takes the place of the lowest ranked one when the store is full.
+ *
+ * @param store: network store
+ * @param policy: ranking policy
+ * @param now: system time in seconds
+ * @param ssid: SSID, up to NET_STORE_SSID_LEN characters
+ * @param password: password, up to NET_STORE_PASSWORD_LEN characters
+ * @return
+ *      true if the store changed
+ */
+bool net_store_add(net_store_t *store, const net_store_policy_t *policy, uint32_t now,
+                   const char *ssid, const char *password);
+
+/**
+ * @brief Record a successful connect
+ *
+ * @param store: network store
+ * @param index: network
+ * @param now: system time in seconds
+ * @param time_to_ip_ms: time of a full connect, 0 for a fast reconnect, which is not averaged
+ * @param rssi: signal of the association
+ * @return
+ *      true if the ranking changed, i.e. this network was not the last one to connect,
+ *      the point at which the store is worth writing to flash
+ */
+bool net_store_record_success(net_store_t *store, uint8_t index, uint32_t now, uint32_t time_to_ip_ms, int8_t rssi);
+
+/**
+ * @brief Record a failed attempt
+ *
+ */
+void net_store_record_failure(net_store_t *store, uint8_t index);
+
+/**
+ * @brief Order the networks for connect attempts, best first
+ *
+ * @param store: network store
+ * @param policy: ranking policy
+ * @param now: system time in seconds
+ * @param order: output network indexes
+ * @return
+ *      number of networks in order
+ */
+size_t net_store_rank(const net_store_t *store, const net_store_policy_t *policy, uint32_t now,
+                      uint8_t order[NET_STORE_MAX_NETWORKS]);
@@ -0,0 +1,145 @@
+#include <string.h>
+
+#include "net_store.h"
+
+/* Chances are in permille */
+#define NET_STORE_CERTAIN 1000
+
+int net_store_find(const net_store_t *store, const char *ssid)
+{
+    for (uint8_t i = 0; i < store->num_networks; i++)
+    {
+        if (strcmp(store->networks[i].ssid, ssid) == 0)
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Chance of success per second an attempt is expected to take, higher is better
+ *
+ */
+static uint64_t net_store_score(const net_store_network_t *network, const net_store_policy_t *policy, uint32_t now)
+{
+    uint32_t chance = NET_STORE_CERTAIN;
+    uint32_t time_to_ip_ms = network->time_to_ip_ms ? network->time_to_ip_ms : policy->default_time_to_ip_ms;
+    uint64_t cost_ms;
+
+    chance >>= network->failures < 10 ? network->failures : 10;
+    if (network->last_success == 0 || now - network->last_success > policy->stale_sec)
+    {
+        chance /= 2;
+    }
+    if (network->rssi != 0 && network->rssi < policy->weak_rssi)
+    {
+        chance /= 2;
+    }
+    if (chance == 0)
+    {
+        chance = 1;
+    }
+
+    cost_ms = ((uint64_t)chance * time_to_ip_ms + (uint64_t)(NET_STORE_CERTAIN - chance) * policy->attempt_timeout_ms) /
+              NET_STORE_CERTAIN;
+
+    return (uint64_t)chance * 1000000 / (cost_ms ? cost_ms : 1);
+}
+
+size_t net_store_rank(const net_store_t *store, const net_store_policy_t *policy, uint32_t now,
+                      uint8_t order[NET_STORE_MAX_NETWORKS])
+{
+    uint64_t scores[NET_STORE_MAX_NETWORKS];
+    size_t count = 0;
+
+    // Insertion sort, ties go to the more recent success
+    for (uint8_t i = 0; i < store->num_networks && i < NET_STORE_MAX_NETWORKS; i++)
+    {
+        uint64_t score = net_store_score(&store->networks[i], policy, now);
+        size_t pos = count;
+
+        while (pos > 0 && (scores[pos - 1] < score ||
+                           (scores[pos - 1] == score &&
+                            store->networks[order[pos - 1]].last_success < store->networks[i].last_success)))
+        {
+            scores[pos] = scores[pos - 1];
+            order[pos] = order[pos - 1];
+            pos--;
+        }
+        scores[pos] = score;
+        order[pos] = i;
+        count++;
+    }
+
+    return count;
+}
+
+bool net_store_add(net_store_t *store, const net_store_policy_t *policy, uint32_t now,
+                   const char *ssid, const char *password)
+{
+    uint8_t order[NET_STORE_MAX_NETWORKS];
+    net_store_network_t *network;
+    int index;
+
+    if (strlen(ssid) > NET_STORE_SSID_LEN || strlen(password) > NET_STORE_PASSWORD_LEN || ssid[0] == '\0')
+    {
+        return false;
+    }
+
+    index = net_store_find(store, ssid);
+    if (index >= 0)
+    {
+        network = &store->networks[index];
+        if (strcmp(network->password, password) == 0)
+        {
+            return false;
+        }
+    }
+    else if (store->num_networks < NET_STORE_MAX_NETWORKS)
+    {
+        network = &store->networks[store->num_networks++];
+    }
+    else
+    {
+        net_store_rank(store, policy, now, order);
+        network = &store->networks[order[NET_STORE_MAX_NETWORKS - 1]];
+    }
+
+    memset(network, 0, sizeof(*network));
+    strcpy(network->ssid, ssid);
+    strcpy(network->password, password);
+
+    return true;
+}
+
+bool net_store_record_success(net_store_t *store, uint8_t index, uint32_t now, uint32_t time_to_ip_ms, int8_t rssi)
+{
+    net_store_network_t *network = &store->networks[index];
+    bool latest = network->last_success != 0;
+
+    for (uint8_t i = 0; i < store->num_networks; i++)
+    {
+        latest &= i == index || store->networks[i].last_success <= network->last_success;
+    }
+
+    network->failures = 0;
+    network->rssi = rssi;
+    network->last_success = now ? now : 1;
+    if (time_to_ip_ms)
+    {
+        // Weight 1/4, a single slow DHCP server response should not reorder the networks
+        network->time_to_ip_ms = network->time_to_ip_ms ? (3 * network->time_to_ip_ms + time_to_ip_ms) / 4 : time_to_ip_ms;
+    }
+
+    return !latest;
+}
+
+void net_store_record_failure(net_store_t *store, uint8_t index)
+{
+    if (store->networks[index].failures < UINT8_MAX)
+    {
+        store->networks[index].failures++;
+    }
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+/**
+ * @brief Power Profile Type
+ *
+ */
+typedef enum
+{
+    POWER_PROFILE_PERFORMANCE = 0, /*!< fixed maximum CPU frequency, radio always on */
+    POWER_PROFILE_BALANCED,        /*!< frequency scaling, modem sleep between DTIM beacons */
+    POWER_PROFILE_ULTRA_LOW,       /*!< low maximum frequency, light sleep when idle, long listen interval */
+    POWER_PROFILE_MAX,
+} power_profile_t;
+
+/**
+ * @brief Wi-Fi Modem Sleep Type, maps to wifi_ps_type_t
+ *
+ */
+typedef enum
+{
+    POWER_MODEM_SLEEP_NONE = 0,
+    POWER_MODEM_SLEEP_MIN, /*!< wake for every DTIM beacon */
+    POWER_MODEM_SLEEP_MAX, /*!< wake every listen_interval beacons */
+} power_modem_sleep_t;
+
+/**
+ * @brief Power Profile Settings Type
+ *
+ */
+typedef struct power_profile_settings_s
+{
+    uint16_t max_freq_mhz;   /*!< CPU frequency while any task runs */
+    uint16_t min_freq_mhz;   /*!< CPU frequency while idle */
+    bool light_sleep;        /*!< automatic light sleep while idle, needs tickless idle */
+    uint8_t modem_sleep;     /*!< power_modem_sleep_t */
+    uint16_t listen_interval; /*!< beacon intervals, used with POWER_MODEM_SLEEP_MAX, 0 for the driver default */
+} power_profile_settings_t;
+
+/**
+ * @brief Power Mode Type, the modes esp_pm switches between
+ *
+ */
+typedef enum
+{
+    POWER_MODE_LIGHT_SLEEP = 0,
+    POWER_MODE_APB_MIN, /*!< idle, minimum frequency */
+    POWER_MODE_APB_MAX, /*!< a peripheral needs the 80 MHz APB clock */
+    POWER_MODE_CPU_MAX, /*!< a task is running */
+    POWER_MODE_MAX,
+} power_mode_t;
+
+/**
+ * @brief Power Statistics Type
+ *
+ * Time in each mode since boot, which for a deep sleep wake is the wake itself.
+ */
+typedef struct power_stats_s
+{
+    uint16_t freq_mhz[POWER_MODE_MAX]; /*!< CPU frequency of each mode, 0 if the mode was not reported */
+    int64_t time_us[POWER_MODE_MAX];
+    int64_t total_us;
+    uint32_t light_sleeps;        /*!< light sleeps entered */
+    uint32_t light_sleep_rejects; /*!< light sleeps aborted, e.g. by a pending interrupt */
+} power_stats_t;
+
+/**
+ * @brief Get the settings of a profile
+ *
+ * @param profile: power profile
+ * @return
+ *      settings, or NULL for an unknown profile
+ */
+const power_profile_settings_t *power_profile_settings(power_profile_t profile);
+
+/**
+ * @brief Get the name of a profile, for logs
+ *
+ */
+const char *power_profile_name(power_profile_t profile);
+
+/**
+ * @brief Get the name of a mode, as esp_pm prints it
+ *
+ */
+const char *power_mode_name(power_mode_t mode);
+
+/**
+ * @brief Parse the mode statistics of an esp_pm_dump_locks() dump
+ *
+ * @param dump: dump, NUL terminated
+ * @param stats: output statistics
+ * @return
+ *      true if any mode was found, which needs CONFIG_PM_PROFILING
+ */
+bool power_stats_parse(const char *dump, power_stats_t *stats);
+
+/**
+ * @brief Apply the frequency scaling and light sleep settings of a profile with esp_pm
+ *
+ * The Wi-Fi settings are applied by the wifi driver's set_power_profile().
+ *
+ * @param profile: power profile
+ * @return
+ *      ESP_OK, ESP_ERR_INVALID_ARG, or ESP_FAIL e.g. without CONFIG_PM_ENABLE
+ */
+esp_err_t power_profile_set(power_profile_t profile);
+
+/**
+ * @brief Get the time spent in each mode during this wake
+ *
+ * @param stats: output statistics
+ * @return
+ *      ESP_OK, or ESP_ERR_NOT_SUPPORTED without CONFIG_PM_PROFILING
+ */
+esp_err_t power_profile_get_stats(power_stats_t *stats);
@@ -0,0 +1,106 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "power_profile.h"
+
+static const power_profile_settings_t s_profiles[POWER_PROFILE_MAX] = {
+    [POWER_PROFILE_PERFORMANCE] = {
+        .max_freq_mhz = 240,
+        .min_freq_mhz = 240,
+        .light_sleep = false,
+        .modem_sleep = POWER_MODEM_SLEEP_NONE,
+    },
+    [POWER_PROFILE_BALANCED] = {
+        .max_freq_mhz = 160,
+        .min_freq_mhz = 40,
+        .light_sleep = false,
+        .modem_sleep = POWER_MODEM_SLEEP_MIN,
+    },
+    [POWER_PROFILE_ULTRA_LOW] = {
+        .max_freq_mhz = 80,
+        .min_freq_mhz = 40,
+        .light_sleep = true,
+        .modem_sleep = POWER_MODEM_SLEEP_MAX,
+        .listen_interval = 3,
+    },
+};
+
+static const char *s_profile_names[POWER_PROFILE_MAX] = {
+    [POWER_PROFILE_PERFORMANCE] = "performance",
+    [POWER_PROFILE_BALANCED] = "balanced",
+    [POWER_PROFILE_ULTRA_LOW] = "ultra-low",
+};
+
+/* As printed by esp_pm_dump_locks() */
+static const char *s_mode_names[POWER_MODE_MAX] = {
+    [POWER_MODE_LIGHT_SLEEP] = "SLEEP",
+    [POWER_MODE_APB_MIN] = "APB_MIN",
+    [POWER_MODE_APB_MAX] = "APB_MAX",
+    [POWER_MODE_CPU_MAX] = "CPU_MAX",
+};
+
+const power_profile_settings_t *power_profile_settings(power_profile_t profile)
+{
+    if ((unsigned)profile >= POWER_PROFILE_MAX)
+    {
+        return NULL;
+    }
+
+    return &s_profiles[profile];
+}
+
+const char *power_profile_name(power_profile_t profile)
+{
+    if ((unsigned)profile >= POWER_PROFILE_MAX)
+    {
+        return "unknown";
+    }
+
+    return s_profile_names[profile];
+}
+
+const char *power_mode_name(power_mode_t mode)
+{
+    if ((unsigned)mode >= POWER_MODE_MAX)
+    {
+        return "unknown";
+    }
+
+    return s_mode_names[mode];
+}
+
+bool power_stats_parse(const char *dump, power_stats_t *stats)
+{
+    char name[16];
+    unsigned freq_mhz;
+    long long time_us;
+    bool found = false;
+
+    memset(stats, 0, sizeof(*stats));
+
+    // Mode lines read "CPU_MAX   160M        1234567     80%", lock lines have no frequency
+    for (const char *line = dump; line != NULL; line = strchr(line, '\n') ? strchr(line, '\n') + 1 : NULL)
+    {
+        if (sscanf(line, "%15s %uM %lld", name, &freq_mhz, &time_us) == 3)
+        {
+            for (int mode = 0; mode < POWER_MODE_MAX; mode++)
+            {
+                if (strcmp(name, s_mode_names[mode]) == 0)
+                {
+                    stats->freq_mhz[mode] = freq_mhz;
+                    stats->time_us[mode] = time_us;
+                    stats->total_us += time_us;
+                    found = true;
+                }
+            }
+        }
+        else
+        {
+            sscanf(line, "light_sleep_counts:%" SCNu32 " light_sleep_reject_counts:%" SCNu32,
+                   &stats->light_sleeps, &stats->light_sleep_rejects);
+        }
+    }
+
+    return found;
+}
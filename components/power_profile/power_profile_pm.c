@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_pm.h"
+
+#include "power_profile.h"
+
+/* Room for the lock table and the mode statistics of esp_pm_dump_locks() */
+#define POWER_DUMP_SIZE 2048
+
+static const char *TAG = "power_profile";
+
+esp_err_t power_profile_set(power_profile_t profile)
+{
+    const power_profile_settings_t *settings = power_profile_settings(profile);
+
+    if (settings == NULL)
+    {
+        ESP_LOGE(TAG, "Unknown power profile %d", profile);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_pm_config_esp32_t pm_config = {
+        .max_freq_mhz = settings->max_freq_mhz,
+        .min_freq_mhz = settings->min_freq_mhz,
+        .light_sleep_enable = settings->light_sleep,
+    };
+    if (esp_pm_configure(&pm_config) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to configure power management");
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(TAG, "Power profile %s, %u to %u MHz, light sleep %s", power_profile_name(profile),
+             settings->min_freq_mhz, settings->max_freq_mhz, settings->light_sleep ? "on" : "off");
+
+    return ESP_OK;
+}
+
+esp_err_t power_profile_get_stats(power_stats_t *stats)
+{
+#ifdef CONFIG_PM_PROFILING
+    // Static, the dump is too large for the caller's stack
+    static char dump[POWER_DUMP_SIZE];
+    FILE *out;
+
+    memset(dump, 0, sizeof(dump));
+    out = fmemopen(dump, sizeof(dump) - 1, "w");
+    if (out == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to open dump buffer");
+        return ESP_FAIL;
+    }
+    esp_pm_dump_locks(out);
+    fclose(out);
+
+    if (!power_stats_parse(dump, stats))
+    {
+        ESP_LOGE(TAG, "No mode statistics in the dump");
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#define SLEEP_POLICY_HOURS 24
+/* Histogram fixed point, a bin holds the average mail events per day at that hour times this */
+#define SLEEP_POLICY_RATE_ONE 256
+
+/**
+ * @brief Sleep Policy Configuration Type
+ *
+ * Charges are in microamp seconds, 3.6e6 per mAh.
+ */
+typedef struct sleep_policy_conf_s
+{
+    uint32_t budget_uas;        /*!< daily energy budget */
+    uint32_t sleep_ua;          /*!< deep sleep current */
+    uint32_t radio_wake_uas;    /*!< first estimate of a wake that connects and uploads, then learned */
+    uint32_t boot_wake_uas;     /*!< first estimate of a wake that boots without Wi-Fi, then learned */
+    uint32_t stub_wake_uas;     /*!< a timer wake that ends in the wake stub */
+    uint32_t min_flush_age_sec; /*!< shortest wait of a pending event, in the busiest delivery hour */
+    uint32_t max_flush_age_sec; /*!< longest wait, in quiet hours or when the budget is spent */
+    uint32_t heartbeat_sec;     /*!< timer wake with the sensor wakeup armed */
+    uint32_t poll_sec;          /*!< timer wake with the sensor wakeup off, the wake stub checks the level */
+    uint16_t low_mv;            /*!< below, the budget shrinks in proportion */
+    uint16_t critical_mv;       /*!< at or below, no budget beyond the baseline, quiet hours are polled */
+} sleep_policy_conf_t;
+
+/**
+ * @brief Sleep Policy State Type
+ *
+ * Meant to live in RTC memory.
+ */
+typedef struct sleep_policy_state_s
+{
+    uint32_t magic;
+    int32_t utc_offset_sec;                /*!< local time minus UTC, from the last timezone setup */
+    uint32_t day;                          /*!< local day number of spent_uas */
+    uint32_t spent_uas;                    /*!< charge of the wakes accounted on that day */
+    uint32_t radio_wake_uas;               /*!< average charge of a Wi-Fi wake */
+    uint32_t boot_wake_uas;                /*!< average charge of a wake without Wi-Fi */
+    uint16_t battery_mv;                   /*!< last sample, 0 if never measured */
+    bool offset_valid;                     /*!< utc_offset_sec was set */
+    uint16_t rate[SLEEP_POLICY_HOURS];     /*!< mail events per day by local hour, SLEEP_POLICY_RATE_ONE fixed point */
+} sleep_policy_state_t;
+
+/**
+ * @brief Sleep Plan Type
+ *
+ * What to do until the next wake, for the local hour of the wake.
+ */
+typedef struct sleep_policy_plan_s
+{
+    uint32_t flush_max_age_sec; /*!< pending events wait at most this long for an upload */
+    uint32_t review_in_sec;     /*!< a later hour of the day has a shorter wait, plan again by then */
+    uint32_t heartbeat_sec;     /*!< longest sleep */
+    bool sensor_wakeup;         /*!< arm the mail sensor, otherwise the wake stub polls it every heartbeat */
+    uint8_t hour;               /*!< local hour, UTC before the timezone is known */
+    uint32_t budget_uas;        /*!< today's budget after the battery, baseline included */
+    uint32_t radio_wakes;       /*!< uploads left in the budget for the rest of the day */
+} sleep_policy_plan_t;
+
+/**
+ * @brief Validate the state, reset it if it does not look like one
+ *
+ * @param state: policy state
+ * @param conf: policy configuration, the first charge estimates
+ * @return
+ *      true if the previous contents were kept, false if the state was reset
+ */
+bool sleep_policy_init(sleep_policy_state_t *state, const sleep_policy_conf_t *conf);
+
+/**
+ * @brief Take the UTC offset of the local time set up by the timezone
+ *
+ * @param state: policy state
+ * @param now: system time in seconds
+ * @param local: now as local time, e.g. from localtime_r()
+ */
+void sleep_policy_set_local_time(sleep_policy_state_t *state, time_t now, const struct tm *local);
+
+/**
+ * @brief Count a mail event in the histogram of its local hour
+ *
+ * @param state: policy state
+ * @param now: system time in seconds
+ */
+void sleep_policy_record_mail(sleep_policy_state_t *state, uint32_t now);
+
+/**
+ * @brief Add the charge of a wake to the day's spending and to the learned wake charges
+ *
+ * @param state: policy state
+ * @param now: system time in seconds
+ * @param charge_uas: charge of the wake
+ * @param radio: the wake connected to Wi-Fi
+ */
+void sleep_policy_account(sleep_policy_state_t *state, uint32_t now, uint32_t charge_uas, bool radio);
+
+/**
+ * @brief Plan the sleep from the histogram, the day's spending and the battery voltage
+ *
+ * The radio wakes the budget has left for the rest of the day are shared among the remaining
+ * hours in proportion to their mail rate, so delivery hours get short flush ages and quiet hours long ones.
+ *
+ * @param state: policy state
+ * @param conf: policy configuration
+ * @param now: system time in seconds
+ * @param plan: output plan
+ */
+void sleep_policy_plan(sleep_policy_state_t *state, const sleep_policy_conf_t *conf, uint32_t now,
+                       sleep_policy_plan_t *plan);
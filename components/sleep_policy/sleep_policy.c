@@ -0,0 +1,229 @@
+#include <string.h>
+
+#include "sleep_policy.h"
+
+#define SLEEP_POLICY_MAGIC 0x534C5031 // "SLP1"
+#define SECONDS_PER_DAY (24 * 60 * 60)
+#define SECONDS_PER_HOUR (60 * 60)
+/* The histogram keeps 7/8 of its counts per day, about a week of history */
+#define RATE_DECAY_NUM 7
+#define RATE_DECAY_DEN 8
+/* An event adds what a daily event at the same hour converges to */
+#define RATE_EVENT (SLEEP_POLICY_RATE_ONE * (RATE_DECAY_DEN - RATE_DECAY_NUM) / RATE_DECAY_DEN)
+/* Hours with less mail than this per day are quiet, polled instead of armed on a critical battery */
+#define RATE_QUIET (SLEEP_POLICY_RATE_ONE / 8)
+/* Learned wake charges follow a new measurement by 1/8 */
+#define CHARGE_WEIGHT 8
+/* Without history every hour is taken to get a mail every 24 days */
+#define RATE_PRIOR (SLEEP_POLICY_RATE_ONE / SLEEP_POLICY_HOURS)
+/* Bisection steps for the wait scale */
+#define SCALE_STEPS 24
+
+/* Days since 1970-01-01 of a proleptic Gregorian date, month 1 to 12 */
+static int64_t sleep_policy_days_from_civil(int64_t year, int month, int day)
+{
+    year -= month <= 2;
+    int64_t era = (year >= 0 ? year : year - 399) / 400;
+    int64_t year_of_era = year - era * 400;
+    int64_t day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int64_t day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+
+    return era * 146097 + day_of_era - 719468;
+}
+
+static uint32_t sleep_policy_local(const sleep_policy_state_t *state, uint32_t now)
+{
+    return state->offset_valid ? now + state->utc_offset_sec : now;
+}
+
+/* Decay the histogram and start over the spending when the local day changes */
+static void sleep_policy_roll_day(sleep_policy_state_t *state, uint32_t now)
+{
+    uint32_t day = sleep_policy_local(state, now) / SECONDS_PER_DAY;
+
+    if (day == state->day)
+    {
+        return;
+    }
+
+    // A clock stepped back keeps the histogram
+    for (uint32_t i = 0; day > state->day && i < day - state->day && i < 64; i++)
+    {
+        for (int hour = 0; hour < SLEEP_POLICY_HOURS; hour++)
+        {
+            state->rate[hour] = state->rate[hour] * RATE_DECAY_NUM / RATE_DECAY_DEN;
+        }
+    }
+    state->day = day;
+    state->spent_uas = 0;
+}
+
+bool sleep_policy_init(sleep_policy_state_t *state, const sleep_policy_conf_t *conf)
+{
+    if (state->magic == SLEEP_POLICY_MAGIC && state->radio_wake_uas > 0 && state->boot_wake_uas > 0)
+    {
+        return true;
+    }
+
+    memset(state, 0, sizeof(*state));
+    state->magic = SLEEP_POLICY_MAGIC;
+    state->radio_wake_uas = conf->radio_wake_uas;
+    state->boot_wake_uas = conf->boot_wake_uas;
+
+    return false;
+}
+
+void sleep_policy_set_local_time(sleep_policy_state_t *state, time_t now, const struct tm *local)
+{
+    int64_t local_sec = sleep_policy_days_from_civil(local->tm_year + 1900, local->tm_mon + 1, local->tm_mday) *
+                            SECONDS_PER_DAY +
+                        local->tm_hour * SECONDS_PER_HOUR + local->tm_min * 60 + local->tm_sec;
+
+    state->utc_offset_sec = (int32_t)(local_sec - now);
+    state->offset_valid = true;
+}
+
+void sleep_policy_record_mail(sleep_policy_state_t *state, uint32_t now)
+{
+    int hour;
+
+    sleep_policy_roll_day(state, now);
+    hour = sleep_policy_local(state, now) % SECONDS_PER_DAY / SECONDS_PER_HOUR;
+    state->rate[hour] = state->rate[hour] > UINT16_MAX - RATE_EVENT ? UINT16_MAX : state->rate[hour] + RATE_EVENT;
+}
+
+void sleep_policy_account(sleep_policy_state_t *state, uint32_t now, uint32_t charge_uas, bool radio)
+{
+    uint32_t *average = radio ? &state->radio_wake_uas : &state->boot_wake_uas;
+
+    sleep_policy_roll_day(state, now);
+    state->spent_uas = state->spent_uas > UINT32_MAX - charge_uas ? UINT32_MAX : state->spent_uas + charge_uas;
+    *average = (uint32_t)(*average + ((int64_t)charge_uas - *average) / CHARGE_WEIGHT);
+    if (*average == 0)
+    {
+        *average = 1;
+    }
+}
+
+/* 1 above low_mv, 0 at critical_mv and below, 1 if never measured */
+static float sleep_policy_battery_factor(const sleep_policy_state_t *state, const sleep_policy_conf_t *conf)
+{
+    if (state->battery_mv == 0 || state->battery_mv >= conf->low_mv)
+    {
+        return 1.0f;
+    }
+    if (state->battery_mv <= conf->critical_mv)
+    {
+        return 0.0f;
+    }
+
+    return (float)(state->battery_mv - conf->critical_mv) / (conf->low_mv - conf->critical_mv);
+}
+
+/* Waits of the hours left today at a scale, and the uploads they are expected to take */
+static float sleep_policy_cost(const sleep_policy_conf_t *conf, const uint16_t *rates, int hour, uint32_t second,
+                               float scale, float *ages)
+{
+    float uploads = 0.0f;
+
+    for (int h = hour; h < SLEEP_POLICY_HOURS; h++)
+    {
+        float left = h == hour ? (float)((h + 1) * SECONDS_PER_HOUR - second) / SECONDS_PER_HOUR : 1.0f;
+        float mail = (float)rates[h] / SLEEP_POLICY_RATE_ONE;
+        float age = rates[h] ? scale / rates[h] : conf->max_flush_age_sec;
+
+        age = age < conf->min_flush_age_sec   ? conf->min_flush_age_sec
+              : age > conf->max_flush_age_sec ? conf->max_flush_age_sec
+                                              : age;
+        ages[h] = age;
+        // Mail arriving within a wait of the last one shares its upload
+        uploads += left * mail / (1.0f + mail * age / SECONDS_PER_HOUR);
+    }
+
+    return uploads;
+}
+
+void sleep_policy_plan(sleep_policy_state_t *state, const sleep_policy_conf_t *conf, uint32_t now,
+                       sleep_policy_plan_t *plan)
+{
+    float ages[SLEEP_POLICY_HOURS];
+    uint16_t rates[SLEEP_POLICY_HOURS];
+    float factor = sleep_policy_battery_factor(state, conf);
+    float weight = 0.0f;
+    float mail = 0.0f;
+    float available;
+    float uploads;
+    uint32_t second;
+    int hour;
+
+    sleep_policy_roll_day(state, now);
+    second = sleep_policy_local(state, now) % SECONDS_PER_DAY;
+    hour = second / SECONDS_PER_HOUR;
+
+    // What the rest of the day will spend whatever the plan, the day's sleep is charged up front
+    for (int h = hour; h < SLEEP_POLICY_HOURS; h++)
+    {
+        float left = h == hour ? (float)((h + 1) * SECONDS_PER_HOUR - second) / SECONDS_PER_HOUR : 1.0f;
+        mail += left * state->rate[h] / SLEEP_POLICY_RATE_ONE;
+        weight += left * state->rate[h];
+    }
+    plan->budget_uas = (uint32_t)(factor * conf->budget_uas);
+    available = (float)plan->budget_uas - state->spent_uas - (float)conf->sleep_ua * SECONDS_PER_DAY -
+                (float)SECONDS_PER_DAY / conf->heartbeat_sec * conf->stub_wake_uas - mail * state->boot_wake_uas;
+    uploads = available > 0.0f ? available / state->radio_wake_uas : 0.0f;
+    plan->radio_wakes = (uint32_t)uploads;
+
+    // Without any history every hour is taken as equally likely
+    if (weight <= 0.0f)
+    {
+        for (int h = 0; h < SLEEP_POLICY_HOURS; h++)
+        {
+            rates[h] = RATE_PRIOR;
+        }
+    }
+    else
+    {
+        memcpy(rates, state->rate, sizeof(rates));
+    }
+
+    // The wait of an hour is scale / rate, busy hours wait the least. Mail coalesces within a
+    // wait, so the shortest waits cost at most one upload per mail: take the smallest scale the
+    // uploads left pay for
+    if (sleep_policy_cost(conf, rates, hour, second, 0.0f, ages) > uploads)
+    {
+        float lo = 0.0f;
+        float hi = (float)conf->max_flush_age_sec * UINT16_MAX;
+
+        for (int i = 0; i < SCALE_STEPS; i++)
+        {
+            float mid = (lo + hi) / 2.0f;
+
+            if (sleep_policy_cost(conf, rates, hour, second, mid, ages) > uploads)
+            {
+                lo = mid;
+            }
+            else
+            {
+                hi = mid;
+            }
+        }
+        sleep_policy_cost(conf, rates, hour, second, hi, ages);
+    }
+
+    plan->hour = hour;
+    plan->flush_max_age_sec = (uint32_t)ages[hour];
+    // A shorter wait later today, or the new budget at midnight
+    plan->review_in_sec = SECONDS_PER_DAY - second;
+    for (int h = hour + 1; h < SLEEP_POLICY_HOURS; h++)
+    {
+        if (ages[h] < ages[hour])
+        {
+            plan->review_in_sec = h * SECONDS_PER_HOUR - second;
+            break;
+        }
+    }
+
+    // On a critical battery a chattering flap could boot the chip all night, quiet hours are polled
+    plan->sensor_wakeup = factor > 0.0f || state->rate[hour] >= RATE_QUIET;
+    plan->heartbeat_sec = plan->sensor_wakeup ? conf->heartbeat_sec : conf->poll_sec;
+}
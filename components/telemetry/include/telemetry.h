@@ -0,0 +1,103 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Phase timings a record can carry */
+#define TELEMETRY_MAX_PHASES 12
+
+/* Widest decimal rendering of a uint32_t */
+#define TELEMETRY_U32_DIGITS 10
+
+/* Everything but the events, every number at its widest */
+#define TELEMETRY_FIXED_MAX_SIZE                                                          \
+    (sizeof("{\"boot\":,\"cause\":,\"battery_mv\":,\"phases_ms\":[],\"events\":[]}") - 1 + \
+     3 * TELEMETRY_U32_DIGITS + TELEMETRY_MAX_PHASES * (TELEMETRY_U32_DIGITS + 1))
+
+/* One event, leading comma included */
+#define TELEMETRY_EVENT_MAX_SIZE (sizeof(",[,,]") - 1 + 3 * TELEMETRY_U32_DIGITS)
+
+/* Upper bound of a record with this many events, for sizing a static buffer */
+#define TELEMETRY_MAX_SIZE(events) (TELEMETRY_FIXED_MAX_SIZE + (events) * TELEMETRY_EVENT_MAX_SIZE)
+
+/**
+ * @brief Chunk sink, e.g. a write on an open connection
+ *
+ * @return
+ *      false to abort the record
+ */
+typedef bool (*telemetry_sink_t)(void *ctx, const char *data, size_t len);
+
+/**
+ * @brief Telemetry Header Type
+ *
+ */
+typedef struct telemetry_header_s
+{
+    uint32_t boot_count;
+    uint8_t wake_cause;       /*!< esp_sleep_wakeup_cause_t */
+    uint16_t battery_mv;      /*!< 0 if not measured, the field is left out */
+    const uint32_t *phase_us; /*!< phase boundaries of this wake in microseconds since boot, 0 if not reached */
+    uint8_t num_phases;       /*!< up to TELEMETRY_MAX_PHASES */
+} telemetry_header_t;
+
+/**
+ * @brief Telemetry Writer Type
+ *
+ * Renders one JSON record into a caller owned buffer: {"boot":1,"cause":2,"battery_mv":3,
+ * "phases_ms":[...],"events":[[timestamp,type,value],...]}. Nothing is allocated.
+ */
+typedef struct telemetry_writer_s
+{
+    char *buf;
+    size_t size;
+    size_t len;      /*!< bytes in buf not yet handed to the sink */
+    size_t total;    /*!< bytes of the record so far */
+    telemetry_sink_t sink;
+    void *sink_ctx;
+    uint16_t events; /*!< events written */
+    bool error;      /*!< buffer too small or the sink failed, the record is incomplete */
+} telemetry_writer_t;
+
+/**
+ * @brief Set up a writer
+ *
+ * Without a sink, buf has to hold the whole record, TELEMETRY_MAX_SIZE() guarantees it.
+ * With a sink, buf is a chunk buffer that is handed to the sink whenever it fills up,
+ * and has to hold at least TELEMETRY_EVENT_MAX_SIZE bytes.
+ *
+ * @param writer: writer
+ * @param buf: record or chunk buffer
+ * @param size: size of buf
+ * @param sink: chunk sink, NULL to keep the record in buf
+ * @param sink_ctx: passed to the sink
+ */
+void telemetry_writer_init(telemetry_writer_t *writer, char *buf, size_t size, telemetry_sink_t sink, void *sink_ctx);
+
+/**
+ * @brief Write the header and open the event list
+ *
+ * @param writer: writer
+ * @param header: record header
+ */
+void telemetry_begin(telemetry_writer_t *writer, const telemetry_header_t *header);
+
+/**
+ * @brief Append one event
+ *
+ * @param writer: writer
+ * @param timestamp: system time in seconds
+ * @param type: event type
+ * @param value: type specific payload
+ */
+void telemetry_add_event(telemetry_writer_t *writer, uint32_t timestamp, uint8_t type, uint16_t value);
+
+/**
+ * @brief Close the record and hand the rest to the sink
+ *
+ * @param writer: writer
+ * @return
+ *      true if the record is complete
+ */
+bool telemetry_end(telemetry_writer_t *writer);
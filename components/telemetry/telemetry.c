@@ -0,0 +1,125 @@
+#include <string.h>
+
+#include "telemetry.h"
+
+static void telemetry_flush(telemetry_writer_t *writer)
+{
+    if (writer->sink == NULL || writer->len == 0 || writer->error)
+    {
+        return;
+    }
+    if (!writer->sink(writer->sink_ctx, writer->buf, writer->len))
+    {
+        writer->error = true;
+    }
+    writer->len = 0;
+}
+
+/* Make room for a whole token, so tokens never straddle two chunks */
+static bool telemetry_reserve(telemetry_writer_t *writer, size_t n)
+{
+    if (writer->error)
+    {
+        return false;
+    }
+    if (writer->size - writer->len < n)
+    {
+        telemetry_flush(writer);
+    }
+    if (writer->error || writer->size - writer->len < n)
+    {
+        writer->error = true;
+        return false;
+    }
+
+    return true;
+}
+
+static void telemetry_put(telemetry_writer_t *writer, const char *s, size_t n)
+{
+    if (!telemetry_reserve(writer, n))
+    {
+        return;
+    }
+    memcpy(writer->buf + writer->len, s, n);
+    writer->len += n;
+    writer->total += n;
+}
+
+#define telemetry_put_literal(writer, s) telemetry_put((writer), (s), sizeof(s) - 1)
+
+static void telemetry_put_u32(telemetry_writer_t *writer, uint32_t value)
+{
+    char digits[TELEMETRY_U32_DIGITS];
+    size_t n = 0;
+
+    // Backwards into a scratch buffer, then one copy
+    do
+    {
+        digits[sizeof(digits) - 1 - n++] = '0' + value % 10;
+        value /= 10;
+    } while (value != 0);
+
+    telemetry_put(writer, digits + sizeof(digits) - n, n);
+}
+
+void telemetry_writer_init(telemetry_writer_t *writer, char *buf, size_t size, telemetry_sink_t sink, void *sink_ctx)
+{
+    *writer = (telemetry_writer_t){
+        .buf = buf,
+        .size = size,
+        .sink = sink,
+        .sink_ctx = sink_ctx,
+    };
+}
+
+void telemetry_begin(telemetry_writer_t *writer, const telemetry_header_t *header)
+{
+    uint8_t num_phases = header->num_phases < TELEMETRY_MAX_PHASES ? header->num_phases : TELEMETRY_MAX_PHASES;
+
+    telemetry_put_literal(writer, "{\"boot\":");
+    telemetry_put_u32(writer, header->boot_count);
+    telemetry_put_literal(writer, ",\"cause\":");
+    telemetry_put_u32(writer, header->wake_cause);
+    if (header->battery_mv)
+    {
+        telemetry_put_literal(writer, ",\"battery_mv\":");
+        telemetry_put_u32(writer, header->battery_mv);
+    }
+    telemetry_put_literal(writer, ",\"phases_ms\":[");
+    for (uint8_t i = 0; i < num_phases; i++)
+    {
+        if (i)
+        {
+            telemetry_put_literal(writer, ",");
+        }
+        telemetry_put_u32(writer, header->phase_us[i] / 1000);
+    }
+    telemetry_put_literal(writer, "],\"events\":[");
+}
+
+void telemetry_add_event(telemetry_writer_t *writer, uint32_t timestamp, uint8_t type, uint16_t value)
+{
+    if (writer->events++)
+    {
+        telemetry_put_literal(writer, ",[");
+    }
+    else
+    {
+        telemetry_put_literal(writer, "[");
+    }
+    telemetry_put_u32(writer, timestamp);
+    telemetry_put_literal(writer, ",");
+    telemetry_put_u32(writer, type);
+    telemetry_put_literal(writer, ",");
+    telemetry_put_u32(writer, value);
+    telemetry_put_literal(writer, "]");
+}
+
+bool telemetry_end(telemetry_writer_t *writer)
+{
+    telemetry_put_literal(writer, "]}");
+    telemetry_flush(writer);
+
+    return !writer->error;
+}
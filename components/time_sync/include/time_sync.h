@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief Time Sync State Type
+ *
+ * Meant to live in RTC memory. All zero means the clock was never synced.
+ */
+typedef struct time_sync_state_s
+{
+    int64_t last_sync_us; /*!< system time of the last sync, in microseconds since the epoch */
+    float drift_ppm;      /*!< measured RTC drift, positive when the RTC runs slow */
+    bool drift_valid;     /*!< drift_ppm holds at least one measurement */
+    uint32_t syncs;       /*!< completed SNTP syncs */
+    uint32_t skipped;     /*!< wakes that skipped SNTP because the clock was good enough */
+} time_sync_state_t;
+
+/**
+ * @brief Time Sync Policy Type
+ *
+ */
+typedef struct time_sync_policy_s
+{
+    uint32_t max_error_ms;      /*!< resync when the predicted clock error exceeds this */
+    uint32_t max_interval_sec;  /*!< resync at least this often, whatever the drift */
+    uint32_t default_drift_ppm; /*!< drift assumed until one has been measured */
+} time_sync_policy_t;
+
+/**
+ * @brief Predict the current clock error from the time since the last sync and the drift
+ *
+ * @param state: time sync state
+ * @param policy: time sync policy
+ * @param now_us: current system time in microseconds
+ * @return
+ *      predicted error in microseconds, INT64_MAX if the clock was never synced
+ */
+int64_t time_sync_predicted_error_us(const time_sync_state_t *state, const time_sync_policy_t *policy, int64_t now_us);
+
+/**
+ * @brief Decide whether this wake should run SNTP, counting a skip
+ *
+ * @param state: time sync state
+ * @param policy: time sync policy
+ * @param now_us: current system time in microseconds
+ * @return
+ *      true if the clock needs a sync
+ */
+bool time_sync_needed(time_sync_state_t *state, const time_sync_policy_t *policy, int64_t now_us);
+
+/**
+ * @brief Count a completed sync and feed it to the drift estimator
+ *
+ * @param state: time sync state
+ * @param local_us: system time the RTC would have shown at the sync
+ * @param synced_us: system time set by the sync
+ */
+void time_sync_update(time_sync_state_t *state, int64_t local_us, int64_t synced_us);
+
+/**
+ * @brief Ratio of wakes that skipped SNTP
+ *
+ * @param state: time sync state
+ * @return
+ *      skipped / (syncs + skipped), 0 before the first decision. Syncs that got no answer are left out
+ */
+float time_sync_skipped_ratio(const time_sync_state_t *state);
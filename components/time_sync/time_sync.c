@@ -0,0 +1,73 @@
+#include "time_sync.h"
+
+/* Samples over shorter intervals are dominated by SNTP jitter */
+#define TIME_SYNC_MIN_SAMPLE_US (10LL * 60 * 1000000)
+/* Anything above 1% is a clock jump, not drift */
+#define TIME_SYNC_MAX_DRIFT_PPM 10000.0f
+/* Weight of a new drift sample in the running estimate */
+#define TIME_SYNC_DRIFT_WEIGHT 0.25f
+
+int64_t time_sync_predicted_error_us(const time_sync_state_t *state, const time_sync_policy_t *policy, int64_t now_us)
+{
+    int64_t elapsed_us;
+    float drift_ppm;
+
+    if (state->last_sync_us == 0 || now_us < state->last_sync_us)
+    {
+        return INT64_MAX;
+    }
+
+    elapsed_us = now_us - state->last_sync_us;
+    drift_ppm = state->drift_valid ? state->drift_ppm : (float)policy->default_drift_ppm;
+    if (drift_ppm < 0)
+    {
+        drift_ppm = -drift_ppm;
+    }
+
+    return (int64_t)(elapsed_us * (double)drift_ppm / 1e6);
+}
+
+bool time_sync_needed(time_sync_state_t *state, const time_sync_policy_t *policy, int64_t now_us)
+{
+    bool needed;
+
+    needed = time_sync_predicted_error_us(state, policy, now_us) > 1000LL * policy->max_error_ms ||
+             now_us - state->last_sync_us > 1000000LL * policy->max_interval_sec;
+
+    // Syncs are counted once they complete
+    if (!needed)
+    {
+        state->skipped++;
+    }
+
+    return needed;
+}
+
+void time_sync_update(time_sync_state_t *state, int64_t local_us, int64_t synced_us)
+{
+    int64_t elapsed_us = synced_us - state->last_sync_us;
+    float sample_ppm;
+
+    // The first sync sets the clock, there is nothing to measure yet
+    if (state->last_sync_us != 0 && elapsed_us >= TIME_SYNC_MIN_SAMPLE_US)
+    {
+        sample_ppm = (float)((double)(synced_us - local_us) * 1e6 / elapsed_us);
+        if (sample_ppm > -TIME_SYNC_MAX_DRIFT_PPM && sample_ppm < TIME_SYNC_MAX_DRIFT_PPM)
+        {
+            state->drift_ppm = state->drift_valid
+                                   ? state->drift_ppm + TIME_SYNC_DRIFT_WEIGHT * (sample_ppm - state->drift_ppm)
+                                   : sample_ppm;
+            state->drift_valid = true;
+        }
+    }
+
+    state->last_sync_us = synced_us;
+    state->syncs++;
+}
+
+float time_sync_skipped_ratio(const time_sync_state_t *state)
+{
+    uint32_t total = state->syncs + state->skipped;
+
+    return total ? (float)state->skipped / total : 0.0f;
+}
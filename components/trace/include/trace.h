@@ -0,0 +1,41 @@
+#pragma once
+
+#include "esp_err.h"
+
+#include "trace_ring.h"
+
+/**
+ * @brief Start tracing a new wake in the RTC trace ring
+ *
+ */
+void trace_begin_wake(void);
+
+/**
+ * @brief Record a phase boundary of the current wake at esp_timer_get_time()
+ *
+ * @param phase: phase boundary
+ */
+void trace_mark(trace_phase_t phase);
+
+/**
+ * @brief Get the phase boundaries of the current wake marked so far
+ *
+ * @param stamps_us: output microseconds since boot per phase, 0 if not reached
+ */
+void trace_get_marks(uint32_t stamps_us[TRACE_PHASE_MAX]);
+
+/**
+ * @brief Get the p50 and p99 duration of a phase over the last wakes
+ *
+ * @param phase: phase
+ * @param stats: output statistics
+ * @return
+ *      ESP_OK, or ESP_ERR_NOT_FOUND if the phase was never reached
+ */
+esp_err_t trace_get_stats(trace_phase_t phase, trace_stats_t *stats);
+
+/**
+ * @brief Log p50 and p99 of every phase over the last wakes
+ *
+ */
+void trace_dump(void);
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Number of wakes kept in the ring */
+#define TRACE_RING_WAKES 16
+
+/**
+ * @brief Trace Phase Type
+ *
+ * Phase boundaries of a wake, in the order they are usually reached.
+ */
+typedef enum
+{
+    TRACE_PHASE_BOOT = 0,   /*!< app_main() reached */
+    TRACE_PHASE_NVS_INIT,   /*!< nvs_flash_init() done */
+    TRACE_PHASE_NETIF_INIT, /*!< esp_netif_init() done */
+    TRACE_PHASE_WIFI_START, /*!< esp_wifi_start() done */
+    TRACE_PHASE_ASSOCIATED, /*!< WIFI_EVENT_STA_CONNECTED */
+    TRACE_PHASE_GOT_IP,     /*!< IP_EVENT_STA_GOT_IP */
+    TRACE_PHASE_SNTP,       /*!< SNTP synced or skipped */
+    TRACE_PHASE_UPLOAD,     /*!< upload acknowledged */
+    TRACE_PHASE_SLEEP,      /*!< entering deep sleep */
+    TRACE_PHASE_MAX,
+} trace_phase_t;
+
+/**
+ * @brief Trace Ring Type
+ *
+ * Meant to live in RTC memory. One row of phase timestamps per wake, 0 when a phase was not reached.
+ */
+typedef struct trace_ring_s
+{
+    uint32_t magic;
+    uint16_t head;  /*!< row of the current wake */
+    uint16_t count; /*!< rows in use */
+    uint32_t stamps[TRACE_RING_WAKES][TRACE_PHASE_MAX]; /*!< microseconds since boot */
+} trace_ring_t;
+
+/**
+ * @brief Trace Statistics Type
+ *
+ * Duration of a phase, from the previous boundary reached in the same wake.
+ */
+typedef struct trace_stats_s
+{
+    uint16_t samples;
+    uint32_t p50_us;
+    uint32_t p99_us;
+} trace_stats_t;
+
+/**
+ * @brief Reset the ring unless it already holds valid data
+ *
+ * @param ring: trace ring
+ */
+void trace_ring_init(trace_ring_t *ring);
+
+/**
+ * @brief Start a new row, dropping the oldest wake when the ring is full
+ *
+ * @param ring: trace ring
+ */
+void trace_ring_begin_wake(trace_ring_t *ring);
+
+/**
+ * @brief Record a phase boundary of the current wake, the first mark of a phase wins
+ *
+ * @param ring: trace ring
+ * @param phase: phase boundary
+ * @param timestamp_us: microseconds since boot
+ */
+void trace_ring_mark(trace_ring_t *ring, trace_phase_t phase, uint32_t timestamp_us);
+
+/**
+ * @brief Compute the p50 and p99 duration of a phase over the wakes in the ring
+ *
+ * @param ring: trace ring
+ * @param phase: phase
+ * @param stats: output statistics
+ * @return
+ *      true if the phase was reached in at least one wake
+ */
+bool trace_ring_stats(const trace_ring_t *ring, trace_phase_t phase, trace_stats_t *stats);
+
+/**
+ * @brief Printable name of a phase
+ *
+ */
+const char *trace_phase_name(trace_phase_t phase);
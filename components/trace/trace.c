@@ -0,0 +1,66 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "trace.h"
+
+static const char *TAG = "trace";
+
+/* Survives resets other than power on, so the reset button can dump it */
+RTC_NOINIT_ATTR static trace_ring_t s_trace_ring;
+/* Marks before trace_begin_wake() would land in the previous wake's row */
+static bool s_tracing;
+
+void trace_begin_wake(void)
+{
+    trace_ring_init(&s_trace_ring);
+    trace_ring_begin_wake(&s_trace_ring);
+    s_tracing = true;
+}
+
+void trace_mark(trace_phase_t phase)
+{
+    if (!s_tracing)
+    {
+        return;
+    }
+
+    trace_ring_mark(&s_trace_ring, phase, (uint32_t)esp_timer_get_time());
+}
+
+void trace_get_marks(uint32_t stamps_us[TRACE_PHASE_MAX])
+{
+    if (!s_tracing)
+    {
+        memset(stamps_us, 0, sizeof(uint32_t) * TRACE_PHASE_MAX);
+        return;
+    }
+
+    memcpy(stamps_us, s_trace_ring.stamps[s_trace_ring.head], sizeof(uint32_t) * TRACE_PHASE_MAX);
+}
+
+esp_err_t trace_get_stats(trace_phase_t phase, trace_stats_t *stats)
+{
+    trace_ring_init(&s_trace_ring);
+
+    return trace_ring_stats(&s_trace_ring, phase, stats) ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+void trace_dump(void)
+{
+    trace_stats_t stats;
+
+    ESP_LOGI(TAG, "%-12s %7s %9s %9s", "phase", "samples", "p50 ms", "p99 ms");
+    for (int phase = 0; phase < TRACE_PHASE_MAX; phase++)
+    {
+        if (trace_get_stats(phase, &stats) != ESP_OK)
+        {
+            continue;
+        }
+        ESP_LOGI(TAG, "%-12s %7u %9.1f %9.1f", trace_phase_name(phase), stats.samples,
+                 stats.p50_us / 1000.0f, stats.p99_us / 1000.0f);
+    }
+}
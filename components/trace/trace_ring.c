@@ -0,0 +1,110 @@
+#include <string.h>
+
+#include "trace_ring.h"
+
+#define TRACE_RING_MAGIC 0x54524331 // "TRC1"
+
+static const char *const s_phase_names[TRACE_PHASE_MAX] = {
+    [TRACE_PHASE_BOOT] = "boot",
+    [TRACE_PHASE_NVS_INIT] = "nvs_init",
+    [TRACE_PHASE_NETIF_INIT] = "netif_init",
+    [TRACE_PHASE_WIFI_START] = "wifi_start",
+    [TRACE_PHASE_ASSOCIATED] = "associated",
+    [TRACE_PHASE_GOT_IP] = "got_ip",
+    [TRACE_PHASE_SNTP] = "sntp",
+    [TRACE_PHASE_UPLOAD] = "upload",
+    [TRACE_PHASE_SLEEP] = "sleep",
+};
+
+void trace_ring_init(trace_ring_t *ring)
+{
+    if (ring->magic == TRACE_RING_MAGIC && ring->head < TRACE_RING_WAKES && ring->count <= TRACE_RING_WAKES)
+    {
+        return;
+    }
+
+    memset(ring, 0, sizeof(*ring));
+    ring->magic = TRACE_RING_MAGIC;
+}
+
+void trace_ring_begin_wake(trace_ring_t *ring)
+{
+    if (ring->count > 0)
+    {
+        ring->head = (ring->head + 1) % TRACE_RING_WAKES;
+    }
+    if (ring->count < TRACE_RING_WAKES)
+    {
+        ring->count++;
+    }
+
+    memset(ring->stamps[ring->head], 0, sizeof(ring->stamps[ring->head]));
+}
+
+void trace_ring_mark(trace_ring_t *ring, trace_phase_t phase, uint32_t timestamp_us)
+{
+    if (ring->count == 0 || phase >= TRACE_PHASE_MAX || ring->stamps[ring->head][phase] != 0)
+    {
+        return;
+    }
+
+    // 0 marks a phase that was not reached
+    ring->stamps[ring->head][phase] = timestamp_us ? timestamp_us : 1;
+}
+
+bool trace_ring_stats(const trace_ring_t *ring, trace_phase_t phase, trace_stats_t *stats)
+{
+    uint32_t durations[TRACE_RING_WAKES];
+    uint16_t n = 0;
+
+    if (phase >= TRACE_PHASE_MAX)
+    {
+        return false;
+    }
+
+    for (uint16_t w = 0; w < ring->count; w++)
+    {
+        const uint32_t *row = ring->stamps[w];
+        uint32_t previous = 0;
+
+        if (row[phase] == 0)
+        {
+            continue;
+        }
+        // The previous boundary is the latest one reached before this phase
+        for (int p = 0; p < TRACE_PHASE_MAX; p++)
+        {
+            if (row[p] != 0 && row[p] < row[phase] && row[p] > previous)
+            {
+                previous = row[p];
+            }
+        }
+
+        // Insertion sort, the ring is small
+        uint32_t duration = row[phase] - previous;
+        uint16_t i = n++;
+        while (i > 0 && durations[i - 1] > duration)
+        {
+            durations[i] = durations[i - 1];
+            i--;
+        }
+        durations[i] = duration;
+    }
+
+    if (n == 0)
+    {
+        return false;
+    }
+
+    // Nearest rank
+    stats->samples = n;
+    stats->p50_us = durations[(50 * n + 99) / 100 - 1];
+    stats->p99_us = durations[(99 * n + 99) / 100 - 1];
+
+    return true;
+}
+
+const char *trace_phase_name(trace_phase_t phase)
+{
+    return phase < TRACE_PHASE_MAX ? s_phase_names[phase] : "unknown";
+}
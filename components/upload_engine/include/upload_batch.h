@@ -0,0 +1,105 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "backoff.h"
+#include "uploader.h"
+
+/* Longest path of a write below the root, NUL included */
+#define UPLOAD_PATH_MAX_LEN 48
+
+/**
+ * @brief Write Completion Type
+ *
+ * @param result: ESP_OK once the server acknowledged the write, ESP_ERR_INVALID_RESPONSE if it
+ *                refused it, ESP_ERR_INVALID_SIZE if it is malformed or can not fit a request,
+ *                ESP_FAIL if the attempts ran out
+ */
+typedef void (*upload_done_t)(void *ctx, esp_err_t result);
+
+/**
+ * @brief Upload Write Type
+ *
+ * One value to store at a path. The path doubles as the idempotency key: a retried request
+ * sets the same paths to the same values, so a request applied by the server whose response
+ * was lost does no harm.
+ */
+typedef struct upload_write_s
+{
+    char path[UPLOAD_PATH_MAX_LEN]; /*!< below the root, e.g. "backlog/r0000002a", "" merges an object into the root */
+    const char *value;              /*!< serialized JSON */
+    size_t len;
+    int64_t submitted_us;           /*!< for the time to acknowledgement */
+    upload_done_t done;             /*!< may be NULL */
+    void *ctx;
+} upload_write_t;
+
+/**
+ * @brief Upload Statistics Type
+ *
+ */
+typedef struct upload_stats_s
+{
+    uint32_t writes;         /*!< acknowledged */
+    uint32_t rejected;       /*!< refused by the server or too large, not retried */
+    uint32_t failed;         /*!< given up on after max_attempts */
+    uint32_t requests;       /*!< PATCH requests, retries included */
+    uint32_t retries;
+    uint32_t bytes_sent;     /*!< headers and bodies, without the TLS framing */
+    uint32_t bytes_received;
+    int64_t max_ack_us;      /*!< submit to acknowledgement of the slowest write */
+    int64_t total_ack_us;    /*!< summed over the acknowledged writes */
+} upload_stats_t;
+
+/**
+ * @brief Upload Batch Type
+ *
+ * Everything upload_batch_send() needs, so the same code runs on the engine task and on the host.
+ */
+typedef struct upload_batch_s
+{
+    uploader_t *uploader;
+    const char *root;              /*!< PATCH target, e.g. "/esp32project.json" */
+    char *body;                    /*!< request body buffer */
+    size_t body_size;              /*!< largest request body, more writes take more requests */
+    uint8_t max_attempts;          /*!< per request, the first one included */
+    backoff_policy_t retry;        /*!< milliseconds before a retry */
+    int64_t (*now_us)(void);
+    void (*delay_ms)(uint32_t ms);
+    uint32_t (*random)(void);
+    upload_stats_t stats;          /*!< accumulated by upload_batch_send() */
+} upload_batch_t;
+
+/**
+ * @brief Merge leading writes into one multi-path PATCH body: {"a/b":1,"c":{...}}
+ *
+ * A write with an empty path contributes the members of its object value instead.
+ *
+ * @param out: body buffer
+ * @param size: body buffer size
+ * @param writes: writes in order
+ * @param num: number of writes to consider
+ * @param len: output body length
+ * @return
+ *      number of writes merged, 0 if the first one does not fit or is malformed
+ */
+size_t upload_batch_build(char *out, size_t size, const upload_write_t *writes, size_t num, size_t *len);
+
+/**
+ * @brief Send the writes in as few PATCH requests as fit, on the uploader's keep-alive connection
+ *
+ * Multi-path updates are atomic, so a 4xx response to a merged request is split in halves until
+ * the refused write is found and dropped alone. Transport errors, 408, 429 and 5xx are retried
+ * with the same body. Once a request runs out of attempts, it and every later write fail.
+ * Every write completes, in order, before this returns.
+ *
+ * @param batch: batch configuration and statistics
+ * @param writes: writes in order
+ * @param num: number of writes
+ * @return
+ *      number of acknowledged writes
+ */
+size_t upload_batch_send(upload_batch_t *batch, upload_write_t *writes, size_t num);
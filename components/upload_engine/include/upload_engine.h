@@ -0,0 +1,95 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "backoff.h"
+#include "uploader.h"
+#include "upload_batch.h"
+
+/* Limits with CONFIG_SMART_MAILS_STATIC_ALLOC, where the engine has static storage */
+#define UPLOAD_ENGINE_STATIC_MAX_BODY (8 * 1024)
+#define UPLOAD_ENGINE_STATIC_MAX_WRITES 16
+/* Copies of the values submitted and not sent yet */
+#define UPLOAD_ENGINE_STATIC_VALUES (24 * 1024)
+
+/**
+ * @brief Upload Engine Type
+ *
+ */
+typedef struct upload_engine_s upload_engine_t;
+
+/**
+ * @brief Upload Engine Configuration Type
+ *
+ */
+typedef struct upload_engine_conf_s
+{
+    uploader_t *uploader;   /*!< shared, the engine only uses it while a flush is in progress */
+    const char *root;       /*!< PATCH target, e.g. "/esp32project.json" */
+    size_t max_body;        /*!< largest request body, the engine allocates it */
+    size_t max_writes;      /*!< writes held between flushes, more send early */
+    uint8_t max_attempts;   /*!< per request, the first one included */
+    backoff_policy_t retry; /*!< milliseconds before a retry */
+    uint32_t linger_ms;     /*!< send this long after the last write without a flush, 0 to wait for one */
+} upload_engine_conf_t;
+
+/**
+ * @brief Start the engine task
+ *
+ * Writes are queued to the task, which merges whatever is pending into multi-path PATCH
+ * requests on the uploader's keep-alive connection, see upload_batch_send().
+ *
+ * With CONFIG_SMART_MAILS_STATIC_ALLOC only one engine runs at a time, within the
+ * UPLOAD_ENGINE_STATIC_* limits, and its task is kept for the next start after a stop.
+ *
+ * @param conf: engine configuration, copied
+ * @return
+ *      engine instance or NULL
+ */
+upload_engine_t *upload_engine_start(const upload_engine_conf_t *conf);
+
+/**
+ * @brief Queue a write
+ *
+ * The value is copied, done is called on the engine task once the write completes. With
+ * CONFIG_SMART_MAILS_STATIC_ALLOC the copies of the values not sent yet share UPLOAD_ENGINE_STATIC_VALUES bytes.
+ *
+ * @param engine: engine instance
+ * @param path: below the root, the idempotency key of the write, "" to merge an object into the root
+ * @param value: serialized JSON
+ * @param len: value length
+ * @param done: completion, may be NULL
+ * @param ctx: passed to done
+ * @return
+ *      ESP_OK, ESP_ERR_INVALID_ARG for a path longer than UPLOAD_PATH_MAX_LEN, ESP_ERR_NO_MEM
+ */
+esp_err_t upload_engine_submit(upload_engine_t *engine, const char *path, const char *value, size_t len,
+                               upload_done_t done, void *ctx);
+
+/**
+ * @brief Send everything queued so far and wait until each write completed
+ *
+ * @param engine: engine instance
+ * @param timeout_ms: longest wait
+ * @return
+ *      ESP_OK once every write completed, whatever its result, ESP_ERR_TIMEOUT otherwise
+ */
+esp_err_t upload_engine_flush(upload_engine_t *engine, uint32_t timeout_ms);
+
+/**
+ * @brief Statistics since the engine started, consistent after upload_engine_flush() returned
+ *
+ */
+void upload_engine_get_stats(upload_engine_t *engine, upload_stats_t *stats);
+
+/**
+ * @brief Flush, end the task and free the engine, the uploader stays connected
+ *
+ * @param engine: engine instance
+ * @param timeout_ms: longest wait
+ * @return
+ *      ESP_OK, ESP_ERR_TIMEOUT if the task is still busy, it is then left running
+ */
+esp_err_t upload_engine_stop(upload_engine_t *engine, uint32_t timeout_ms);
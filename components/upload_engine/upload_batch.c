@@ -0,0 +1,178 @@
+#include <string.h>
+
+#include "upload_batch.h"
+
+size_t upload_batch_build(char *out, size_t size, const upload_write_t *writes, size_t num, size_t *len)
+{
+    const upload_write_t *write;
+    const char *value;
+    size_t value_len;
+    size_t path_len;
+    size_t pos = 1;
+    size_t need;
+    size_t merged;
+
+    if (size < sizeof("{}"))
+    {
+        return 0;
+    }
+    out[0] = '{';
+
+    for (merged = 0; merged < num; merged++)
+    {
+        write = &writes[merged];
+        path_len = strnlen(write->path, UPLOAD_PATH_MAX_LEN);
+        if (path_len == UPLOAD_PATH_MAX_LEN || strpbrk(write->path, "\"\\") != NULL || write->len == 0)
+        {
+            break;
+        }
+
+        if (path_len == 0)
+        { // The members of an object, without its braces
+            if (write->len < 2 || write->value[0] != '{' || write->value[write->len - 1] != '}')
+            {
+                break;
+            }
+            value = write->value + 1;
+            value_len = write->len - 2;
+            need = value_len;
+        }
+        else
+        {
+            value = write->value;
+            value_len = write->len;
+            need = path_len + 3 + value_len;
+        }
+        need += pos > 1 && need > 0;
+
+        // Room for the closing brace and a NUL
+        if (pos + need + 2 > size)
+        {
+            break;
+        }
+        if (need == 0)
+        {
+            continue;
+        }
+
+        if (pos > 1)
+        {
+            out[pos++] = ',';
+        }
+        if (path_len > 0)
+        {
+            out[pos++] = '"';
+            memcpy(out + pos, write->path, path_len);
+            pos += path_len;
+            out[pos++] = '"';
+            out[pos++] = ':';
+        }
+        memcpy(out + pos, value, value_len);
+        pos += value_len;
+    }
+
+    out[pos++] = '}';
+    out[pos] = '\0';
+    *len = pos;
+
+    return merged;
+}
+
+static void upload_batch_complete(upload_batch_t *batch, upload_write_t *write, esp_err_t result)
+{
+    int64_t ack_us;
+
+    switch (result)
+    {
+    case ESP_OK:
+        ack_us = batch->now_us() - write->submitted_us;
+        batch->stats.writes++;
+        batch->stats.total_ack_us += ack_us;
+        if (ack_us > batch->stats.max_ack_us)
+        {
+            batch->stats.max_ack_us = ack_us;
+        }
+        break;
+    case ESP_FAIL:
+        batch->stats.failed++;
+        break;
+    default:
+        batch->stats.rejected++;
+        break;
+    }
+
+    if (write->done != NULL)
+    {
+        write->done(write->ctx, result);
+    }
+}
+
+size_t upload_batch_send(upload_batch_t *batch, upload_write_t *writes, size_t num)
+{
+    uploader_stats_t before;
+    uploader_stats_t after;
+    size_t start = 0;
+    size_t limit = num;
+    size_t acked = 0;
+    size_t merged;
+    size_t len;
+    uint8_t attempt = 0;
+    int status = 0;
+    esp_err_t ret;
+
+    while (start < num)
+    {
+        merged = upload_batch_build(batch->body, batch->body_size, writes + start,
+                                    num - start < limit ? num - start : limit, &len);
+        if (merged == 0)
+        {
+            upload_batch_complete(batch, &writes[start++], ESP_ERR_INVALID_SIZE);
+            continue;
+        }
+
+        batch->uploader->get_stats(batch->uploader, &before);
+        ret = batch->uploader->request(batch->uploader, "PATCH", batch->root, batch->body, len, &status);
+        batch->uploader->get_stats(batch->uploader, &after);
+        batch->stats.requests++;
+        batch->stats.bytes_sent += after.bytes_sent - before.bytes_sent;
+        batch->stats.bytes_received += after.bytes_received - before.bytes_received;
+
+        if (ret == ESP_OK && status / 100 == 2)
+        {
+            for (size_t i = 0; i < merged; i++)
+            {
+                upload_batch_complete(batch, &writes[start++], ESP_OK);
+            }
+            acked += merged;
+            attempt = 0;
+            continue;
+        }
+
+        if (ret == ESP_OK && status / 100 == 4 && status != 408 && status != 429)
+        {
+            // Applied all or nothing, halve until the write that spoils the request is alone
+            attempt = 0;
+            if (merged > 1)
+            {
+                limit = merged / 2;
+                continue;
+            }
+            upload_batch_complete(batch, &writes[start++], ESP_ERR_INVALID_RESPONSE);
+            limit = num;
+            continue;
+        }
+
+        if (++attempt >= batch->max_attempts)
+        {
+            while (start < num)
+            {
+                upload_batch_complete(batch, &writes[start++], ESP_FAIL);
+            }
+            break;
+        }
+        batch->stats.retries++;
+        batch->delay_ms(backoff_delay(&batch->retry, attempt - 1, batch->random()));
+    }
+
+    return acked;
+}
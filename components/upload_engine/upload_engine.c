@@ -0,0 +1,360 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+
+#include "esp_log.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+
+#include "upload_engine.h"
+#include "dlog.h"
+
+/* The TLS handshake of a dropped connection runs on the engine task */
+#define UPLOAD_ENGINE_STACK_SIZE 8192
+#define UPLOAD_ENGINE_PRIORITY 5
+#define UPLOAD_ENGINE_QUEUE_LEN 8
+
+static const char *TAG = "upload_engine";
+
+typedef enum
+{
+    UPLOAD_MSG_WRITE = 0,
+    UPLOAD_MSG_FLUSH,
+    UPLOAD_MSG_STOP,
+} upload_msg_type_t;
+
+/**
+ * @brief Upload Engine Message Type
+ *
+ */
+typedef struct
+{
+    upload_msg_type_t type;
+    union
+    {
+        upload_write_t write; /*!< UPLOAD_MSG_WRITE, the value is a copy owned by the engine */
+        TaskHandle_t waiter;  /*!< UPLOAD_MSG_FLUSH and UPLOAD_MSG_STOP, notified when done */
+    };
+} upload_msg_t;
+
+struct upload_engine_s
+{
+    upload_engine_conf_t conf;
+    QueueHandle_t queue;
+    upload_batch_t batch;
+    upload_write_t *pending;
+    size_t num_pending;
+};
+
+#ifdef CONFIG_SMART_MAILS_STATIC_ALLOC
+/* One engine at a time, its task outlives upload_engine_stop() and serves the next start */
+static upload_engine_t s_engine;
+static bool s_running;
+static char s_body[UPLOAD_ENGINE_STATIC_MAX_BODY];
+static upload_write_t s_pending[UPLOAD_ENGINE_STATIC_MAX_WRITES];
+static uint8_t s_queue_storage[UPLOAD_ENGINE_QUEUE_LEN * sizeof(upload_msg_t)];
+static StaticQueue_t s_queue_buffer;
+static StackType_t s_task_stack[UPLOAD_ENGINE_STACK_SIZE];
+static StaticTask_t s_task_buffer;
+static TaskHandle_t s_task;
+
+/* Value copies are carved from the arena in order, it starts over once every copy was released */
+static char s_values[UPLOAD_ENGINE_STATIC_VALUES];
+static size_t s_values_used;
+static size_t s_values_live;
+static portMUX_TYPE s_values_lock = portMUX_INITIALIZER_UNLOCKED;
+#endif
+
+static char *upload_engine_copy_value(const char *value, size_t len)
+{
+    char *copy = NULL;
+
+#ifdef CONFIG_SMART_MAILS_STATIC_ALLOC
+    taskENTER_CRITICAL(&s_values_lock);
+    if (len <= sizeof(s_values) - s_values_used)
+    {
+        copy = s_values + s_values_used;
+        s_values_used += len;
+        s_values_live++;
+    }
+    taskEXIT_CRITICAL(&s_values_lock);
+#else
+    copy = malloc(len);
+#endif
+    if (copy != NULL)
+    {
+        memcpy(copy, value, len);
+    }
+
+    return copy;
+}
+
+static void upload_engine_free_value(const char *value)
+{
+#ifdef CONFIG_SMART_MAILS_STATIC_ALLOC
+    taskENTER_CRITICAL(&s_values_lock);
+    if (--s_values_live == 0)
+    {
+        s_values_used = 0;
+    }
+    taskEXIT_CRITICAL(&s_values_lock);
+#else
+    free((void *)value);
+#endif
+}
+
+static void upload_engine_delay_ms(uint32_t ms)
+{
+    vTaskDelay(pdMS_TO_TICKS(ms));
+}
+
+static void upload_engine_send(upload_engine_t *engine)
+{
+    uint32_t requests = engine->batch.stats.requests;
+    size_t acked;
+
+    if (engine->num_pending == 0)
+    {
+        return;
+    }
+
+    acked = upload_batch_send(&engine->batch, engine->pending, engine->num_pending);
+    if (acked < engine->num_pending)
+    {
+        ESP_LOGW(TAG, "%zu of %zu writes not acknowledged", engine->num_pending - acked, engine->num_pending);
+    }
+    DLOGI(TAG, "%zu writes in %lu requests", engine->num_pending,
+          (unsigned long)(engine->batch.stats.requests - requests));
+
+    for (size_t i = 0; i < engine->num_pending; i++)
+    {
+        upload_engine_free_value(engine->pending[i].value);
+    }
+    engine->num_pending = 0;
+}
+
+static void upload_engine_task(void *arg)
+{
+    upload_engine_t *engine = arg;
+    upload_msg_t msg;
+    TickType_t wait;
+
+    while (true)
+    {
+        // Writes that arrive while lingering go out with the pending ones
+        wait = engine->num_pending > 0 && engine->conf.linger_ms > 0 ? pdMS_TO_TICKS(engine->conf.linger_ms)
+                                                                     : portMAX_DELAY;
+        if (xQueueReceive(engine->queue, &msg, wait) != pdTRUE)
+        {
+            upload_engine_send(engine);
+            continue;
+        }
+
+        switch (msg.type)
+        {
+        case UPLOAD_MSG_WRITE:
+            if (engine->num_pending == engine->conf.max_writes)
+            {
+                upload_engine_send(engine);
+            }
+            engine->pending[engine->num_pending++] = msg.write;
+            break;
+        case UPLOAD_MSG_FLUSH:
+            upload_engine_send(engine);
+            xTaskNotifyGive(msg.waiter);
+            break;
+        case UPLOAD_MSG_STOP:
+            upload_engine_send(engine);
+            // The engine may be freed from here on
+            xTaskNotifyGive(msg.waiter);
+#ifdef CONFIG_SMART_MAILS_STATIC_ALLOC
+            // Waits for the writes of the next start
+            break;
+#else
+            vTaskDelete(NULL);
+            return;
+#endif
+        }
+    }
+}
+
+static void upload_engine_free(upload_engine_t *engine)
+{
+#ifdef CONFIG_SMART_MAILS_STATIC_ALLOC
+    s_running = false;
+#else
+    if (engine->queue != NULL)
+    {
+        vQueueDelete(engine->queue);
+    }
+    free(engine->pending);
+    free(engine->batch.body);
+    free(engine);
+#endif
+}
+
+static upload_engine_t *upload_engine_alloc(const upload_engine_conf_t *conf)
+{
+#ifdef CONFIG_SMART_MAILS_STATIC_ALLOC
+    upload_engine_t *engine = &s_engine;
+
+    if (s_running)
+    {
+        ESP_LOGE(TAG, "Engine already started");
+        return NULL;
+    }
+    if (conf->max_body > UPLOAD_ENGINE_STATIC_MAX_BODY || conf->max_writes > UPLOAD_ENGINE_STATIC_MAX_WRITES)
+    {
+        ESP_LOGE(TAG, "A %zu byte body and %zu writes exceed the static limits", conf->max_body, conf->max_writes);
+        return NULL;
+    }
+
+    // The queue is kept with the task, which may be waiting on it
+    memset(&engine->batch, 0, sizeof(engine->batch));
+    engine->batch.body = s_body;
+    engine->pending = s_pending;
+    engine->num_pending = 0;
+    if (engine->queue == NULL)
+    {
+        engine->queue = xQueueCreateStatic(UPLOAD_ENGINE_QUEUE_LEN, sizeof(upload_msg_t), s_queue_storage,
+                                           &s_queue_buffer);
+    }
+    s_running = true;
+#else
+    upload_engine_t *engine = calloc(1, sizeof(upload_engine_t));
+    if (engine == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to allocate engine");
+        return NULL;
+    }
+
+    engine->batch.body = malloc(conf->max_body);
+    engine->pending = calloc(conf->max_writes, sizeof(upload_write_t));
+    engine->queue = xQueueCreate(UPLOAD_ENGINE_QUEUE_LEN, sizeof(upload_msg_t));
+    if (engine->batch.body == NULL || engine->pending == NULL || engine->queue == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to allocate a %zu byte body and %zu writes", conf->max_body, conf->max_writes);
+        upload_engine_free(engine);
+        return NULL;
+    }
+#endif
+
+    return engine;
+}
+
+static bool upload_engine_create_task(upload_engine_t *engine)
+{
+#ifdef CONFIG_SMART_MAILS_STATIC_ALLOC
+    if (s_task == NULL)
+    {
+        s_task = xTaskCreateStatic(upload_engine_task, "upload_engine", UPLOAD_ENGINE_STACK_SIZE, engine,
+                                   UPLOAD_ENGINE_PRIORITY, s_task_stack, &s_task_buffer);
+    }
+    return s_task != NULL;
+#else
+    return xTaskCreate(upload_engine_task, "upload_engine", UPLOAD_ENGINE_STACK_SIZE, engine, UPLOAD_ENGINE_PRIORITY,
+                       NULL) == pdPASS;
+#endif
+}
+
+upload_engine_t *upload_engine_start(const upload_engine_conf_t *conf)
+{
+    upload_engine_t *engine = upload_engine_alloc(conf);
+    if (engine == NULL)
+    {
+        return NULL;
+    }
+
+    engine->conf = *conf;
+    engine->batch.uploader = conf->uploader;
+    engine->batch.root = conf->root;
+    engine->batch.body_size = conf->max_body;
+    engine->batch.max_attempts = conf->max_attempts;
+    engine->batch.retry = conf->retry;
+    engine->batch.now_us = esp_timer_get_time;
+    engine->batch.delay_ms = upload_engine_delay_ms;
+    engine->batch.random = esp_random;
+
+    if (!upload_engine_create_task(engine))
+    {
+        ESP_LOGE(TAG, "Failed to create task");
+        upload_engine_free(engine);
+        return NULL;
+    }
+
+    return engine;
+}
+
+esp_err_t upload_engine_submit(upload_engine_t *engine, const char *path, const char *value, size_t len,
+                               upload_done_t done, void *ctx)
+{
+    upload_msg_t msg = {.type = UPLOAD_MSG_WRITE};
+    char *copy;
+
+    if (strlen(path) >= UPLOAD_PATH_MAX_LEN)
+    {
+        ESP_LOGE(TAG, "Path %s too long", path);
+        return ESP_ERR_INVALID_ARG;
+    }
+    copy = upload_engine_copy_value(value, len);
+    if (copy == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to copy a %zu byte write", len);
+        return ESP_ERR_NO_MEM;
+    }
+
+    strcpy(msg.write.path, path);
+    msg.write.value = copy;
+    msg.write.len = len;
+    msg.write.submitted_us = esp_timer_get_time();
+    msg.write.done = done;
+    msg.write.ctx = ctx;
+
+    // Blocks while the task is busy sending, it empties the queue between requests
+    xQueueSend(engine->queue, &msg, portMAX_DELAY);
+
+    return ESP_OK;
+}
+
+static esp_err_t upload_engine_wait(upload_engine_t *engine, upload_msg_type_t type, uint32_t timeout_ms)
+{
+    upload_msg_t msg = {
+        .type = type,
+        .waiter = xTaskGetCurrentTaskHandle(),
+    };
+
+    if (xQueueSend(engine->queue, &msg, pdMS_TO_TICKS(timeout_ms)) != pdTRUE ||
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(timeout_ms)) == 0)
+    {
+        ESP_LOGE(TAG, "Writes still pending after %lu ms", (unsigned long)timeout_ms);
+        return ESP_ERR_TIMEOUT;
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t upload_engine_flush(upload_engine_t *engine, uint32_t timeout_ms)
+{
+    return upload_engine_wait(engine, UPLOAD_MSG_FLUSH, timeout_ms);
+}
+
+void upload_engine_get_stats(upload_engine_t *engine, upload_stats_t *stats)
+{
+    *stats = engine->batch.stats;
+}
+
+esp_err_t upload_engine_stop(upload_engine_t *engine, uint32_t timeout_ms)
+{
+    if (upload_engine_wait(engine, UPLOAD_MSG_STOP, timeout_ms) != ESP_OK)
+    {
+        return ESP_ERR_TIMEOUT;
+    }
+
+    upload_engine_free(engine);
+
+    return ESP_OK;
+}
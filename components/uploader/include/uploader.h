@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+/**
+ * @brief Uploader Type
+ *
+ */
+typedef struct uploader_s uploader_t;
+
+/**
+ * @brief Uploader Statistics Type
+ *
+ * Counters survive deep sleep.
+ */
+typedef struct uploader_stats_s
+{
+    uint32_t full_handshakes;    /*!< handshakes without a usable cached session */
+    uint32_t resumed_handshakes; /*!< abbreviated handshakes from a cached session */
+    int64_t last_handshake_us;   /*!< duration of the last TCP connect and handshake */
+    uint32_t requests;           /*!< requests sent */
+    uint32_t bytes_sent;         /*!< request headers and bodies, without the TLS framing */
+    uint32_t bytes_received;     /*!< response headers and bodies, without the TLS framing */
+} uploader_stats_t;
+
+/**
+ * @brief Response Body Sink Type
+ *
+ * Called with each piece of a response body as it arrives, return false to abort.
+ */
+typedef bool (*uploader_sink_t)(void *ctx, const char *data, size_t len);
+
+/**
+ * @brief Declare of Uploader Type
+ *
+ */
+struct uploader_s
+{
+    esp_err_t (*connect)(uploader_t *uploader);
+
+    esp_err_t (*request)(uploader_t *uploader, const char *method, const char *path,
+                         const char *body, size_t body_len, int *status);
+
+    /* GET a resource, streaming a 2xx body into sink. The server has to send a Content-Length */
+    esp_err_t (*fetch)(uploader_t *uploader, const char *path, uploader_sink_t sink, void *ctx, int *status);
+
+    esp_err_t (*disconnect)(uploader_t *uploader);
+
+    esp_err_t (*get_stats)(uploader_t *uploader, uploader_stats_t *stats);
+};
+
+/**
+ * @brief Uploader Configuration Type
+ *
+ */
+typedef struct uploader_conf_s
+{
+    char *host;
+    char *port;
+    bool skip_cert_verify;         /*!< accept any certificate, for a local stand-in server */
+    uint32_t session_lifetime_sec; /*!< drop a cached TLS session after this many seconds */
+} uploader_conf_t;
+
+/**
+ * @brief Install a new HTTPS uploader that resumes TLS sessions across deep sleep
+ *
+ * With CONFIG_SMART_MAILS_STATIC_ALLOC the instance is static, one per boot.
+ *
+ * @param config: uploader configuration
+ * @return
+ *      uploader instance or NULL
+ */
+uploader_t *uploader_new_tls(const uploader_conf_t *config);
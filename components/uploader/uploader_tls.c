@@ -0,0 +1,500 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_crt_bundle.h"
+
+#include "mbedtls/ssl.h"
+#include "mbedtls/net_sockets.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/ctr_drbg.h"
+
+#include "lwip/sockets.h"
+
+#include "uploader.h"
+#include "dns_cache.h"
+#include "dlog.h"
+
+#define SESSION_CACHE_SIZE 768
+#define REQUEST_HEADER_SIZE 256
+#define RESPONSE_BUFFER_SIZE 1024
+#define TCP_CONNECT_TIMEOUT_MS 5000
+
+static const char *TAG = "uploader_tls";
+
+/* Serialized TLS session (session ID and/or ticket), kept across deep sleep for the abbreviated handshake */
+typedef struct
+{
+    time_t saved_at;
+    size_t len;
+    unsigned char data[SESSION_CACHE_SIZE];
+} session_cache_t;
+
+RTC_DATA_ATTR static session_cache_t s_session_cache;
+RTC_DATA_ATTR static uploader_stats_t s_stats;
+
+typedef struct
+{
+    uploader_t parent;
+    uploader_conf_t config;
+    mbedtls_net_context net;
+    mbedtls_ssl_context ssl;
+    mbedtls_ssl_config ssl_conf;
+    mbedtls_entropy_context entropy;
+    mbedtls_ctr_drbg_context ctr_drbg;
+    bool connected;
+    char buffer[RESPONSE_BUFFER_SIZE];
+} tls_uploader_t;
+
+/**
+ * @brief Offer the cached session to the server
+ *
+ * @param start: creation time of the offered session
+ * @return
+ *      true if a session was offered
+ */
+static bool session_cache_offer(tls_uploader_t *uploader, mbedtls_time_t *start)
+{
+    mbedtls_ssl_session session;
+    time_t now = time(NULL);
+    bool offered = false;
+
+    if (s_session_cache.len == 0)
+    {
+        return false;
+    }
+    if (now < s_session_cache.saved_at || now - s_session_cache.saved_at > uploader->config.session_lifetime_sec)
+    {
+        DLOGI(TAG, "Cached session expired");
+        s_session_cache.len = 0;
+        return false;
+    }
+
+    mbedtls_ssl_session_init(&session);
+    if (mbedtls_ssl_session_load(&session, s_session_cache.data, s_session_cache.len) == 0 &&
+        mbedtls_ssl_set_session(&uploader->ssl, &session) == 0)
+    {
+        *start = session.MBEDTLS_PRIVATE(start);
+        offered = true;
+    }
+    else
+    {
+        ESP_LOGW(TAG, "Failed to load cached session");
+        s_session_cache.len = 0;
+    }
+    mbedtls_ssl_session_free(&session);
+
+    return offered;
+}
+
+/**
+ * @brief Store the negotiated session and tell whether it was resumed
+ *
+ * @param offered: a cached session was offered
+ * @param offered_start: creation time of the offered session
+ * @return
+ *      true if the server resumed the offered session
+ */
+static bool session_cache_store(tls_uploader_t *uploader, bool offered, mbedtls_time_t offered_start)
+{
+    mbedtls_ssl_session session;
+    size_t len;
+    bool resumed = false;
+    int ret;
+
+    mbedtls_ssl_session_init(&session);
+    if (mbedtls_ssl_get_session(&uploader->ssl, &session) != 0)
+    {
+        ESP_LOGW(TAG, "Failed to get session");
+        mbedtls_ssl_session_free(&session);
+        s_session_cache.len = 0;
+        return false;
+    }
+
+    // A new session gets a fresh start time, a resumed one keeps the original
+    resumed = offered && session.MBEDTLS_PRIVATE(start) == offered_start;
+
+    ret = mbedtls_ssl_session_save(&session, s_session_cache.data, sizeof(s_session_cache.data), &len);
+    if (ret == 0)
+    {
+        s_session_cache.len = len;
+        if (!resumed)
+        {
+            s_session_cache.saved_at = time(NULL);
+        }
+    }
+    else
+    {
+        ESP_LOGW(TAG, "Failed to save session -0x%x", -ret);
+        s_session_cache.len = 0;
+    }
+    mbedtls_ssl_session_free(&session);
+
+    return resumed;
+}
+
+static esp_err_t tls_write_all(tls_uploader_t *uploader, const unsigned char *data, size_t len)
+{
+    int ret;
+
+    while (len > 0)
+    {
+        ret = mbedtls_ssl_write(&uploader->ssl, data, len);
+        if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE)
+        {
+            continue;
+        }
+        if (ret <= 0)
+        {
+            ESP_LOGE(TAG, "Failed to write -0x%x", -ret);
+            return ESP_FAIL;
+        }
+        data += ret;
+        len -= ret;
+        s_stats.bytes_sent += ret;
+    }
+
+    return ESP_OK;
+}
+
+static int tls_read(tls_uploader_t *uploader, char *data, size_t len)
+{
+    int ret;
+
+    do
+    {
+        ret = mbedtls_ssl_read(&uploader->ssl, (unsigned char *)data, len);
+    } while (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE);
+    if (ret > 0)
+    {
+        s_stats.bytes_received += ret;
+    }
+
+    return ret;
+}
+
+static esp_err_t tls_uploader_disconnect(uploader_t *uploader);
+
+static esp_err_t tls_uploader_connect(uploader_t *uploader)
+{
+    int ret;
+    bool offered;
+    mbedtls_time_t offered_start = 0;
+    int64_t start_us = esp_timer_get_time();
+
+    tls_uploader_t *tls = __containerof(uploader, tls_uploader_t, parent);
+
+    if (tls->connected)
+    {
+        return ESP_OK;
+    }
+
+    mbedtls_net_init(&tls->net);
+    mbedtls_ssl_init(&tls->ssl);
+    mbedtls_ssl_config_init(&tls->ssl_conf);
+    mbedtls_entropy_init(&tls->entropy);
+    mbedtls_ctr_drbg_init(&tls->ctr_drbg);
+    tls->connected = true;
+
+    ret = mbedtls_ctr_drbg_seed(&tls->ctr_drbg, mbedtls_entropy_func, &tls->entropy, NULL, 0);
+    if (ret != 0)
+    {
+        ESP_LOGE(TAG, "Failed to seed drbg -0x%x", -ret);
+        goto fail;
+    }
+
+    ret = mbedtls_ssl_config_defaults(&tls->ssl_conf, MBEDTLS_SSL_IS_CLIENT,
+                                      MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT);
+    if (ret != 0)
+    {
+        ESP_LOGE(TAG, "Failed to set ssl config -0x%x", -ret);
+        goto fail;
+    }
+    if (tls->config.skip_cert_verify)
+    {
+        mbedtls_ssl_conf_authmode(&tls->ssl_conf, MBEDTLS_SSL_VERIFY_NONE);
+    }
+    else
+    {
+        mbedtls_ssl_conf_authmode(&tls->ssl_conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+        if (esp_crt_bundle_attach(&tls->ssl_conf) != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to attach certificate bundle");
+            goto fail;
+        }
+    }
+    mbedtls_ssl_conf_rng(&tls->ssl_conf, mbedtls_ctr_drbg_random, &tls->ctr_drbg);
+    mbedtls_ssl_conf_session_tickets(&tls->ssl_conf, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+
+    ret = mbedtls_ssl_setup(&tls->ssl, &tls->ssl_conf);
+    if (ret != 0)
+    {
+        ESP_LOGE(TAG, "Failed to setup ssl -0x%x", -ret);
+        goto fail;
+    }
+    ret = mbedtls_ssl_set_hostname(&tls->ssl, tls->config.host);
+    if (ret != 0)
+    {
+        ESP_LOGE(TAG, "Failed to set hostname -0x%x", -ret);
+        goto fail;
+    }
+
+    offered = session_cache_offer(tls, &offered_start);
+
+    // The address comes from RTC memory while its TTL lasts, the socket may already be open
+    if (dns_cache_connect(tls->config.host, tls->config.port, TCP_CONNECT_TIMEOUT_MS, &tls->net.fd) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to connect to %s:%s", tls->config.host, tls->config.port);
+        goto fail;
+    }
+    mbedtls_ssl_set_bio(&tls->ssl, &tls->net, mbedtls_net_send, mbedtls_net_recv, NULL);
+    // Header and body are separate records, Nagle would hold the body back for the server's
+    // delayed ACK on every request after the first on a kept-alive connection
+    setsockopt(tls->net.fd, IPPROTO_TCP, TCP_NODELAY, &(int){1}, sizeof(int));
+
+    while ((ret = mbedtls_ssl_handshake(&tls->ssl)) != 0)
+    {
+        if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE)
+        {
+            ESP_LOGE(TAG, "Failed handshake -0x%x", -ret);
+            // The server may have rejected the cached session, do not offer it again
+            s_session_cache.len = 0;
+            goto fail;
+        }
+    }
+
+    if (session_cache_store(tls, offered, offered_start))
+    {
+        s_stats.resumed_handshakes++;
+    }
+    else
+    {
+        s_stats.full_handshakes++;
+    }
+    s_stats.last_handshake_us = esp_timer_get_time() - start_us;
+
+    DLOGI(TAG, "Connected to %s in %lld ms (%lu resumed, %lu full)", tls->config.host,
+          s_stats.last_handshake_us / 1000,
+          (unsigned long)s_stats.resumed_handshakes, (unsigned long)s_stats.full_handshakes);
+
+    return ESP_OK;
+
+fail:
+    tls_uploader_disconnect(uploader);
+    return ESP_FAIL;
+}
+
+/**
+ * @brief Send a request and read the response, handing a 2xx body to sink if there is one
+ *
+ */
+static esp_err_t tls_uploader_exchange(uploader_t *uploader, const char *method, const char *path,
+                                       const char *body, size_t body_len, uploader_sink_t sink, void *ctx,
+                                       int *status)
+{
+    char header[REQUEST_HEADER_SIZE];
+    char *header_end;
+    const char *content_length;
+    size_t received = 0;
+    size_t body_received;
+    long body_expected = -1;
+    int len;
+    int ret;
+
+    tls_uploader_t *tls = __containerof(uploader, tls_uploader_t, parent);
+
+    if (tls_uploader_connect(uploader) != ESP_OK)
+    {
+        return ESP_FAIL;
+    }
+
+    len = snprintf(header, sizeof(header),
+                   "%s %s HTTP/1.1\r\n"
+                   "Host: %s\r\n"
+                   "Content-Type: application/json\r\n"
+                   "Content-Length: %u\r\n"
+                   "Connection: keep-alive\r\n"
+                   "\r\n",
+                   method, path, tls->config.host, (unsigned)body_len);
+    if (len < 0 || (size_t)len >= sizeof(header))
+    {
+        ESP_LOGE(TAG, "Request header too long");
+        return ESP_FAIL;
+    }
+
+    s_stats.requests++;
+    if (tls_write_all(tls, (const unsigned char *)header, len) != ESP_OK ||
+        tls_write_all(tls, (const unsigned char *)body, body_len) != ESP_OK)
+    {
+        tls_uploader_disconnect(uploader);
+        return ESP_FAIL;
+    }
+
+    // Read until the end of the response header
+    do
+    {
+        if (received == sizeof(tls->buffer) - 1)
+        {
+            ESP_LOGE(TAG, "Response header too long");
+            tls_uploader_disconnect(uploader);
+            return ESP_FAIL;
+        }
+        ret = tls_read(tls, tls->buffer + received, sizeof(tls->buffer) - 1 - received);
+        if (ret <= 0)
+        {
+            ESP_LOGE(TAG, "Failed to read response -0x%x", -ret);
+            tls_uploader_disconnect(uploader);
+            return ESP_FAIL;
+        }
+        received += ret;
+        tls->buffer[received] = '\0';
+    } while ((header_end = strstr(tls->buffer, "\r\n\r\n")) == NULL);
+
+    if (sscanf(tls->buffer, "HTTP/%*d.%*d %d", status) != 1)
+    {
+        ESP_LOGE(TAG, "Malformed response");
+        tls_uploader_disconnect(uploader);
+        return ESP_FAIL;
+    }
+
+    *header_end = '\0';
+    for (content_length = tls->buffer; (content_length = strchr(content_length, '\n')) != NULL;)
+    {
+        content_length++;
+        if (strncasecmp(content_length, "Content-Length:", 15) == 0)
+        {
+            body_expected = strtol(content_length + 15, NULL, 10);
+            break;
+        }
+    }
+
+    if (*status == 204 || *status == 304)
+    { // Never a body, whatever the header says
+        body_expected = 0;
+    }
+    if (*status / 100 != 2)
+    {
+        sink = NULL;
+    }
+    else if (sink != NULL && body_expected < 0)
+    {
+        ESP_LOGE(TAG, "No Content-Length, a truncated body would go unnoticed");
+        tls_uploader_disconnect(uploader);
+        return ESP_FAIL;
+    }
+
+    // Drain the body so the connection can be reused
+    body_received = received - (header_end + 4 - tls->buffer);
+    if (sink != NULL && body_received > 0 && !sink(ctx, header_end + 4, body_received))
+    {
+        tls_uploader_disconnect(uploader);
+        return ESP_FAIL;
+    }
+    while (body_expected < 0 || body_received < (size_t)body_expected)
+    {
+        ret = tls_read(tls, tls->buffer, sizeof(tls->buffer));
+        if (ret <= 0)
+        {
+            break;
+        }
+        body_received += ret;
+        if (sink != NULL && !sink(ctx, tls->buffer, ret))
+        {
+            tls_uploader_disconnect(uploader);
+            return ESP_FAIL;
+        }
+    }
+    if (body_expected < 0)
+    { // No length, the server closes the connection
+        tls_uploader_disconnect(uploader);
+    }
+    else if (sink != NULL && body_received < (size_t)body_expected)
+    {
+        ESP_LOGE(TAG, "Body truncated at %u of %ld bytes", (unsigned)body_received, body_expected);
+        tls_uploader_disconnect(uploader);
+        return ESP_FAIL;
+    }
+
+    DLOGI(TAG, "%s %s: %d", method, path, *status);
+
+    return ESP_OK;
+}
+
+static esp_err_t tls_uploader_request(uploader_t *uploader, const char *method, const char *path,
+                                      const char *body, size_t body_len, int *status)
+{
+    return tls_uploader_exchange(uploader, method, path, body, body_len, NULL, NULL, status);
+}
+
+static esp_err_t tls_uploader_fetch(uploader_t *uploader, const char *path, uploader_sink_t sink, void *ctx,
+                                    int *status)
+{
+    return tls_uploader_exchange(uploader, "GET", path, NULL, 0, sink, ctx, status);
+}
+
+static esp_err_t tls_uploader_disconnect(uploader_t *uploader)
+{
+    tls_uploader_t *tls = __containerof(uploader, tls_uploader_t, parent);
+
+    if (!tls->connected)
+    {
+        return ESP_OK;
+    }
+
+    mbedtls_ssl_close_notify(&tls->ssl);
+    mbedtls_net_free(&tls->net);
+    mbedtls_ssl_free(&tls->ssl);
+    mbedtls_ssl_config_free(&tls->ssl_conf);
+    mbedtls_ctr_drbg_free(&tls->ctr_drbg);
+    mbedtls_entropy_free(&tls->entropy);
+    tls->connected = false;
+
+    return ESP_OK;
+}
+
+static esp_err_t tls_uploader_get_stats(uploader_t *uploader, uploader_stats_t *stats)
+{
+    *stats = s_stats;
+
+    return ESP_OK;
+}
+
+uploader_t *uploader_new_tls(const uploader_conf_t *config)
+{
+#ifdef CONFIG_SMART_MAILS_STATIC_ALLOC
+    // One uploader per boot, a second would share the session and statistics anyway
+    static tls_uploader_t s_tls;
+    tls_uploader_t *tls = &s_tls;
+
+    if (tls->parent.connect != NULL)
+    {
+        ESP_LOGE(TAG, "Uploader already created");
+        return NULL;
+    }
+#else
+    tls_uploader_t *tls = calloc(1, sizeof(tls_uploader_t));
+    if (tls == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to allocate uploader");
+        return NULL;
+    }
+#endif
+
+    tls->config.host = config->host;
+    tls->config.port = config->port;
+    tls->config.skip_cert_verify = config->skip_cert_verify;
+    tls->config.session_lifetime_sec = config->session_lifetime_sec;
+
+    tls->parent.connect = tls_uploader_connect;
+    tls->parent.request = tls_uploader_request;
+    tls->parent.fetch = tls_uploader_fetch;
+    tls->parent.disconnect = tls_uploader_disconnect;
+    tls->parent.get_stats = tls_uploader_get_stats;
+
+    return &tls->parent;
+}
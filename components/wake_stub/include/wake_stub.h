@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "driver/gpio.h"
+#include "esp_err.h"
+
+/**
+ * @brief Wake Stub Statistics Type
+ *
+ * Times are measured with the RTC slow clock, a few microseconds per tick.
+ */
+typedef struct wake_stub_stats_s
+{
+    uint32_t stub_wakes;   /*!< timer wakes that went back to sleep from the stub, since power on */
+    uint32_t last_stub_us; /*!< the last of them, from the stub entry to sleep */
+    uint32_t max_stub_us;  /*!< the longest of them */
+    uint32_t boot_us;      /*!< from the stub entry of this wake to now, 0 if not a deep sleep wake */
+} wake_stub_stats_t;
+
+/**
+ * @brief Arm the deep sleep wake stub, right before entering deep sleep
+ *
+ * The stub runs from RTC memory before the bootloader. A timer wake that comes before
+ * boot_in_sec with the sensor still at level goes back to sleep from the stub, for another
+ * heartbeat or until boot_in_sec, whichever is sooner. Any other wake boots into app_main().
+ *
+ * @param gpio: mail sensor pin, RTC capable
+ * @param level: settled level the ext1 wakeup is armed against
+ * @param heartbeat_sec: longest sleep between sensor checks
+ * @param boot_in_sec: time until app_main() has to run, e.g. a flush is due
+ * @return
+ *      ESP_OK, or ESP_ERR_INVALID_ARG if the pin is not an RTC IO
+ */
+esp_err_t wake_stub_arm(gpio_num_t gpio, int level, uint32_t heartbeat_sec, uint32_t boot_in_sec);
+
+/**
+ * @brief Get the stub wake counters and the boot time of this wake
+ *
+ * @param stats: output statistics
+ */
+void wake_stub_get_stats(wake_stub_stats_t *stats);
@@ -0,0 +1,124 @@
+#include <stdbool.h>
+
+#include "driver/rtc_io.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_sleep.h"
+#include "esp_private/esp_clk.h"
+#include "soc/rtc.h"
+#include "soc/rtc_cntl_reg.h"
+#include "soc/rtc_io_reg.h"
+
+#include "wake_stub.h"
+
+#define WAKE_STUB_MAGIC 0x57414B45 // "WAKE"
+
+static const char *TAG = "wake_stub";
+
+/**
+ * @brief Wake Stub State Type
+ *
+ * RTC_DATA_ATTR places it in RTC slow memory. The ROM only jumps to the stub while the
+ * CRC of RTC fast memory, where the stub code lives, still matches, so the stub writes
+ * nothing but this state.
+ */
+typedef struct wake_stub_state_s
+{
+    uint32_t magic;           /*!< WAKE_STUB_MAGIC once armed */
+    uint32_t rtc_io;          /*!< RTC IO number of the sensor pin */
+    uint32_t level;           /*!< settled level of the sensor */
+    uint64_t heartbeat_ticks; /*!< longest sleep between sensor checks */
+    uint64_t boot_tick;       /*!< RTC time at which app_main() has to run */
+    uint64_t wake_tick;       /*!< RTC time of the last stub entry, 0 before the first */
+    uint32_t stub_wakes;
+    uint32_t last_stub_ticks;
+    uint32_t max_stub_ticks;
+} wake_stub_state_t;
+
+RTC_DATA_ATTR static wake_stub_state_t s_stub;
+
+/* rtc_time_get() lives in flash, which the stub can not use */
+static RTC_IRAM_ATTR uint64_t wake_stub_rtc_time(void)
+{
+    SET_PERI_REG_MASK(RTC_CNTL_TIME_UPDATE_REG, RTC_CNTL_TIME_UPDATE);
+    while (GET_PERI_REG_MASK(RTC_CNTL_TIME_UPDATE_REG, RTC_CNTL_TIME_VALID) == 0)
+    { // At most one slow clock period
+    }
+    SET_PERI_REG_MASK(RTC_CNTL_INT_CLR_REG, RTC_CNTL_TIME_VALID_INT_CLR);
+
+    return READ_PERI_REG(RTC_CNTL_TIME0_REG) | ((uint64_t)READ_PERI_REG(RTC_CNTL_TIME1_REG) << 32);
+}
+
+void RTC_IRAM_ATTR esp_wake_deep_sleep(void)
+{
+    uint64_t now = wake_stub_rtc_time();
+    uint32_t cause = REG_GET_FIELD(RTC_CNTL_WAKEUP_STATE_REG, RTC_CNTL_WAKEUP_CAUSE);
+    uint32_t level = (REG_GET_FIELD(RTC_GPIO_IN_REG, RTC_GPIO_IN_NEXT) >> s_stub.rtc_io) & 1;
+    uint64_t next;
+
+    s_stub.wake_tick = now;
+
+    // The sensor, a level change that raced the arming of ext1 and anything due need app_main()
+    if (s_stub.magic != WAKE_STUB_MAGIC || cause != RTC_TIMER_TRIG_EN || level != s_stub.level ||
+        now >= s_stub.boot_tick)
+    {
+        // Clears the cache MMU and waits for the flash to power up, only a boot needs either
+        esp_default_wake_deep_sleep();
+        return;
+    }
+
+    next = s_stub.boot_tick - now < s_stub.heartbeat_ticks ? s_stub.boot_tick : now + s_stub.heartbeat_ticks;
+    WRITE_PERI_REG(RTC_CNTL_SLP_TIMER0_REG, (uint32_t)next);
+    WRITE_PERI_REG(RTC_CNTL_SLP_TIMER1_REG, (uint32_t)(next >> 32));
+
+    s_stub.stub_wakes++;
+    s_stub.last_stub_ticks = (uint32_t)(wake_stub_rtc_time() - now);
+    if (s_stub.last_stub_ticks > s_stub.max_stub_ticks)
+    {
+        s_stub.max_stub_ticks = s_stub.last_stub_ticks;
+    }
+
+    // Same power domains and wakeup sources as the sleep esp_deep_sleep() set up
+    REG_WRITE(RTC_ENTRY_ADDR_REG, (uint32_t)&esp_wake_deep_sleep);
+    CLEAR_PERI_REG_MASK(RTC_CNTL_STATE0_REG, RTC_CNTL_SLEEP_EN);
+    SET_PERI_REG_MASK(RTC_CNTL_STATE0_REG, RTC_CNTL_SLEEP_EN);
+    while (true)
+    { // A few cycles until sleep starts
+    }
+}
+
+esp_err_t wake_stub_arm(gpio_num_t gpio, int level, uint32_t heartbeat_sec, uint32_t boot_in_sec)
+{
+    uint32_t period = esp_clk_slowclk_cal_get();
+    int rtc_io = rtc_io_number_get(gpio);
+
+    if (rtc_io < 0)
+    {
+        ESP_LOGE(TAG, "GPIO %d is not an RTC IO", gpio);
+        s_stub.magic = 0;
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    s_stub.rtc_io = rtc_io;
+    s_stub.level = level ? 1 : 0;
+    s_stub.heartbeat_ticks = rtc_time_us_to_slowclk(1000000ULL * heartbeat_sec, period);
+    s_stub.boot_tick = rtc_time_get() + rtc_time_us_to_slowclk(1000000ULL * boot_in_sec, period);
+    s_stub.wake_tick = 0;
+    s_stub.magic = WAKE_STUB_MAGIC;
+
+    return ESP_OK;
+}
+
+void wake_stub_get_stats(wake_stub_stats_t *stats)
+{
+    uint32_t period = esp_clk_slowclk_cal_get();
+
+    stats->stub_wakes = s_stub.stub_wakes;
+    stats->last_stub_us = (uint32_t)rtc_time_slowclk_to_us(s_stub.last_stub_ticks, period);
+    stats->max_stub_us = (uint32_t)rtc_time_slowclk_to_us(s_stub.max_stub_ticks, period);
+    stats->boot_us = 0;
+    if (s_stub.wake_tick != 0 && esp_sleep_get_wakeup_cause() != ESP_SLEEP_WAKEUP_UNDEFINED)
+    {
+        stats->boot_us = (uint32_t)rtc_time_slowclk_to_us(rtc_time_get() - s_stub.wake_tick, period);
+    }
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "wifi.h"
+
+/**
+ * @brief Simulated Wifi Configuration Type
+ *
+ * Latencies get a uniform +-jitter_pct and are added to the simulated clock.
+ */
+typedef struct wifi_sim_conf_s
+{
+    int64_t *clock_us;          /*!< simulated clock, advanced by every call */
+    uint32_t seed;              /*!< seed of the failure and jitter generator */
+    uint32_t init_ms;           /*!< nvs, netif and driver init */
+    uint32_t assoc_ms;          /*!< scan and association */
+    uint32_t fast_assoc_ms;     /*!< association with pinned BSSID and channel, no scan */
+    uint32_t dhcp_ms;           /*!< DHCP lease */
+    uint32_t fail_ms;           /*!< time lost on a failed association attempt */
+    uint32_t sntp_ms;           /*!< SNTP round trip */
+    uint32_t smartconfig_ms;    /*!< time spent in smartconfig before giving up */
+    uint32_t lease_sec;         /*!< DHCP lease time */
+    uint32_t sntp_max_error_ms; /*!< see wifi_conf_t */
+    int32_t drift_ppm;          /*!< simulated RTC drift */
+    uint8_t jitter_pct;         /*!< uniform jitter on every latency */
+    uint8_t fail_pct;           /*!< probability that an association attempt fails */
+    uint8_t fast_fail_pct;      /*!< probability that the cached BSSID, channel or lease no longer works */
+    bool fast_reconnect;
+    uint32_t connect_budget_ms; /*!< same as wifi_conf_t, counted from the first connect() after init() */
+    uint8_t num_networks;       /*!< known networks, 0 counts as 1 */
+    uint8_t present_network;    /*!< the known network in range, num_networks or more for none */
+    uint32_t no_ap_ms;          /*!< scan that finds a known network out of range */
+    int8_t rssi;                /*!< of the network in range */
+} wifi_sim_conf_t;
+
+/**
+ * @brief Install a new simulated Wifi driver
+ *
+ * The driver follows the fast reconnect, ranked known networks, retry and smartconfig
+ * fallback of the smartconfig driver, without a radio. The fast reconnect cache lives in the driver object, so one
+ * instance simulates the RTC memory of one device across wakes.
+ *
+ * @param config: simulation configuration
+ * @return
+ *      wifi instance or NULL
+ */
+wifi_t *wifi_new_sim(const wifi_sim_conf_t *config);
+
+/**
+ * @brief Move the simulated device, another known network or none is in range from now on
+ *
+ * @param wifi: simulated wifi instance
+ * @param present_network: see wifi_sim_conf_t
+ */
+void wifi_sim_move(wifi_t *wifi, uint8_t present_network);
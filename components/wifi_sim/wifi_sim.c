@@ -0,0 +1,372 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wifi_sim.h"
+#include "wifi_policy.h"
+#include "time_sync.h"
+#include "net_store.h"
+
+#ifndef __containerof
+#define __containerof(ptr, type, member) ((type *)((char *)(ptr) - offsetof(type, member)))
+#endif
+
+typedef struct
+{
+    wifi_t parent;
+    wifi_sim_conf_t config;
+    uint32_t rng;
+    int64_t budget_end_us;
+    bool cache_valid;
+    uint8_t cache_network;
+    uint32_t lease_expiry; /*!< simulated seconds */
+    bool sntp_pending;     /*!< started, the answer is taken by wait_sntp() */
+    int64_t sntp_done_us;
+    time_sync_state_t time_sync;
+    wifi_connect_info_t connect_info;
+    net_store_t networks;
+} wifi_sim_t;
+
+/**
+ * @brief xorshift32, deterministic for a given seed
+ *
+ */
+static uint32_t wifi_sim_random(wifi_sim_t *sim)
+{
+    sim->rng ^= sim->rng << 13;
+    sim->rng ^= sim->rng >> 17;
+    sim->rng ^= sim->rng << 5;
+
+    return sim->rng;
+}
+
+static bool wifi_sim_chance(wifi_sim_t *sim, uint8_t pct)
+{
+    return wifi_sim_random(sim) % 100 < pct;
+}
+
+static void wifi_sim_spend(wifi_sim_t *sim, uint32_t ms)
+{
+    int64_t us = 1000LL * ms;
+    int64_t jitter = us * sim->config.jitter_pct / 100;
+
+    if (jitter > 0)
+    {
+        us += (int64_t)(wifi_sim_random(sim) % (2 * jitter + 1)) - jitter;
+    }
+    *sim->config.clock_us += us;
+}
+
+static esp_err_t wifi_sim_init(wifi_t *wifi)
+{
+    wifi_sim_t *sim = __containerof(wifi, wifi_sim_t, parent);
+
+    wifi_sim_spend(sim, sim->config.init_ms);
+    sim->budget_end_us = 0;
+
+    return ESP_OK;
+}
+
+static uint32_t wifi_sim_now_sec(wifi_sim_t *sim)
+{
+    return (uint32_t)(*sim->config.clock_us / 1000000);
+}
+
+static bool wifi_sim_budget_spent(wifi_sim_t *sim)
+{
+    if (sim->budget_end_us && *sim->config.clock_us >= sim->budget_end_us)
+    {
+        *sim->config.clock_us = sim->budget_end_us;
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * @brief One known network, a few retries or NETWORK_TIMEOUT_MS, as smartconfig_try_network()
+ *
+ */
+static esp_err_t wifi_sim_try_network(wifi_sim_t *sim, uint8_t index)
+{
+    int64_t start_us = *sim->config.clock_us;
+    int64_t end_us = start_us + 1000LL * NETWORK_TIMEOUT_MS;
+    uint32_t delay_ms;
+
+    if (wifi_sim_budget_spent(sim))
+    {
+        return ESP_ERR_TIMEOUT;
+    }
+    if (index != sim->config.present_network)
+    {
+        // The driver gives up on the first scan that does not find it
+        wifi_sim_spend(sim, sim->config.no_ap_ms);
+        net_store_record_failure(&sim->networks, index);
+        return wifi_sim_budget_spent(sim) ? ESP_ERR_TIMEOUT : ESP_ERR_NOT_FOUND;
+    }
+    for (int retry = 0;; retry++)
+    {
+        if (!wifi_sim_chance(sim, sim->config.fail_pct))
+        {
+            wifi_sim_spend(sim, sim->config.assoc_ms);
+            wifi_sim_spend(sim, sim->config.dhcp_ms);
+            sim->cache_valid = true;
+            sim->cache_network = index;
+            sim->lease_expiry = wifi_sim_now_sec(sim) + sim->config.lease_sec / 2;
+            net_store_record_success(&sim->networks, index, wifi_sim_now_sec(sim),
+                                     (uint32_t)((*sim->config.clock_us - start_us) / 1000), sim->config.rssi);
+            return ESP_OK;
+        }
+        wifi_sim_spend(sim, sim->config.fail_ms);
+        if (!wifi_policy_retry(retry, NETWORK_MAX_RETRY, wifi_sim_random(sim), &delay_ms))
+        {
+            break;
+        }
+        *sim->config.clock_us += 1000LL * delay_ms;
+        if (*sim->config.clock_us >= end_us)
+        {
+            *sim->config.clock_us = end_us;
+            break;
+        }
+    }
+    net_store_record_failure(&sim->networks, index);
+
+    return wifi_sim_budget_spent(sim) ? ESP_ERR_TIMEOUT : ESP_FAIL;
+}
+
+/**
+ * @brief Cached BSSID, channel and lease, as fast_reconnect_connect()
+ *
+ */
+static esp_err_t wifi_sim_fast_connect(wifi_sim_t *sim, uint8_t index)
+{
+    if (index == sim->config.present_network && !wifi_sim_chance(sim, sim->config.fast_fail_pct))
+    {
+        wifi_sim_spend(sim, sim->config.fast_assoc_ms);
+        net_store_record_success(&sim->networks, index, wifi_sim_now_sec(sim), 0, sim->config.rssi);
+        return ESP_OK;
+    }
+
+    // Either a disconnect or the fast path timeout, whichever comes first
+    wifi_sim_spend(sim, sim->config.fail_ms < FAST_RECONNECT_TIMEOUT_MS ? sim->config.fail_ms
+                                                                       : FAST_RECONNECT_TIMEOUT_MS);
+    sim->cache_valid = false;
+
+    return ESP_FAIL;
+}
+
+/**
+ * @brief Smartconfig, nobody provisions a simulated device
+ *
+ */
+static esp_err_t wifi_sim_provision(wifi_sim_t *sim)
+{
+    wifi_sim_spend(sim, sim->config.smartconfig_ms);
+
+    return wifi_sim_budget_spent(sim) ? ESP_ERR_TIMEOUT : ESP_FAIL;
+}
+
+static esp_err_t wifi_sim_connect(wifi_t *wifi)
+{
+    wifi_sim_t *sim = __containerof(wifi, wifi_sim_t, parent);
+    wifi_connect_plan_t plan;
+    esp_err_t ret = ESP_FAIL;
+    int64_t start_us = *sim->config.clock_us;
+    int index = sim->cache_valid ? sim->cache_network : -1;
+
+    sim->connect_info.fast = false;
+
+    if (sim->budget_end_us == 0 && sim->config.connect_budget_ms)
+    {
+        sim->budget_end_us = start_us + 1000LL * sim->config.connect_budget_ms;
+    }
+    if (sim->budget_end_us && start_us >= sim->budget_end_us)
+    {
+        return ESP_ERR_TIMEOUT;
+    }
+
+    // Same order of attempts as smartconfig_connect()
+    switch (wifi_policy_fast_check(sim->config.fast_reconnect, sim->cache_valid, index, wifi_sim_now_sec(sim),
+                                   sim->lease_expiry))
+    {
+    case WIFI_FAST_UNKNOWN:
+    case WIFI_FAST_EXPIRED:
+        sim->cache_valid = false;
+        index = -1;
+        break;
+    case WIFI_FAST_OFF:
+        index = -1;
+        break;
+    case WIFI_FAST_USABLE:
+        break;
+    }
+
+    wifi_connect_plan_begin(&plan, index);
+    while (wifi_connect_plan_next(&plan, &sim->networks, wifi_sim_now_sec(sim), ret) != WIFI_CONNECT_DONE)
+    {
+        switch (plan.step)
+        {
+        case WIFI_CONNECT_FAST:
+            ret = wifi_sim_fast_connect(sim, plan.network);
+            sim->connect_info.fast = ret == ESP_OK;
+            break;
+        case WIFI_CONNECT_NETWORK:
+            ret = wifi_sim_try_network(sim, plan.network);
+            break;
+        case WIFI_CONNECT_SMARTCONFIG:
+            ret = wifi_sim_provision(sim);
+            break;
+        default:
+            ret = ESP_FAIL;
+            break;
+        }
+    }
+    if (plan.ret == ESP_OK)
+    {
+        sim->connect_info.time_to_ip_us = *sim->config.clock_us - start_us;
+    }
+
+    return plan.ret;
+}
+
+static esp_err_t wifi_sim_start(wifi_t *wifi)
+{
+    return ESP_OK;
+}
+
+static esp_err_t wifi_sim_stop(wifi_t *wifi)
+{
+    return ESP_OK;
+}
+
+static time_sync_policy_t wifi_sim_time_sync_policy(wifi_sim_t *sim)
+{
+    time_sync_policy_t policy = {
+        .max_error_ms = sim->config.sntp_max_error_ms,
+        .max_interval_sec = SNTP_MAX_INTERVAL_SEC,
+        .default_drift_ppm = SNTP_DEFAULT_DRIFT_PPM,
+    };
+
+    return policy;
+}
+
+static esp_err_t wifi_sim_init_sntp(wifi_t *wifi)
+{
+    wifi_sim_t *sim = __containerof(wifi, wifi_sim_t, parent);
+    time_sync_policy_t policy = wifi_sim_time_sync_policy(sim);
+    int64_t now_us = *sim->config.clock_us;
+
+    sim->sntp_pending = time_sync_needed(&sim->time_sync, &policy, now_us);
+
+    // SNTP runs in the background, the answer arrives one round trip later
+    sim->sntp_done_us = now_us + (sim->sntp_pending ? 1000LL * sim->config.sntp_ms : 0);
+
+    return ESP_OK;
+}
+
+static esp_err_t wifi_sim_wait_sntp(wifi_t *wifi, uint32_t timeout_ms)
+{
+    wifi_sim_t *sim = __containerof(wifi, wifi_sim_t, parent);
+    int64_t local_us;
+
+    if (!sim->sntp_pending)
+    {
+        return ESP_OK;
+    }
+    // Not awaited, the answer is lost to deep sleep as on the device
+    if (sim->sntp_done_us - *sim->config.clock_us > 1000LL * timeout_ms)
+    {
+        *sim->config.clock_us += 1000LL * timeout_ms;
+        sim->sntp_pending = false;
+        return ESP_ERR_TIMEOUT;
+    }
+    if (sim->sntp_done_us > *sim->config.clock_us)
+    {
+        *sim->config.clock_us = sim->sntp_done_us;
+    }
+    sim->sntp_pending = false;
+
+    // What a drifting RTC would have shown at that point
+    local_us = sim->sntp_done_us - (int64_t)((sim->sntp_done_us - sim->time_sync.last_sync_us) *
+                                             (double)sim->config.drift_ppm / 1e6);
+    time_sync_update(&sim->time_sync, local_us, sim->sntp_done_us);
+
+    return ESP_OK;
+}
+
+static esp_err_t wifi_sim_init_timezone(wifi_t *wifi)
+{
+    return ESP_OK;
+}
+
+static esp_err_t wifi_sim_get_connect_info(wifi_t *wifi, wifi_connect_info_t *info)
+{
+    wifi_sim_t *sim = __containerof(wifi, wifi_sim_t, parent);
+
+    *info = sim->connect_info;
+
+    return ESP_OK;
+}
+
+static esp_err_t wifi_sim_get_sntp_stats(wifi_t *wifi, wifi_sntp_stats_t *stats)
+{
+    wifi_sim_t *sim = __containerof(wifi, wifi_sim_t, parent);
+
+    time_sync_policy_t policy = wifi_sim_time_sync_policy(sim);
+
+    stats->syncs = sim->time_sync.syncs;
+    stats->skipped = sim->time_sync.skipped;
+    stats->skipped_ratio = time_sync_skipped_ratio(&sim->time_sync);
+    stats->drift_ppm = sim->time_sync.drift_valid ? sim->time_sync.drift_ppm : SNTP_DEFAULT_DRIFT_PPM;
+    stats->predicted_error_us = time_sync_predicted_error_us(&sim->time_sync, &policy, *sim->config.clock_us);
+
+    return ESP_OK;
+}
+
+static esp_err_t wifi_sim_set_power_profile(wifi_t *wifi, power_profile_t profile)
+{
+    // Latencies are configured as measured, whatever profile they were measured with
+    return (unsigned)profile < POWER_PROFILE_MAX ? ESP_OK : ESP_FAIL;
+}
+
+wifi_t *wifi_new_sim(const wifi_sim_conf_t *config)
+{
+    wifi_sim_t *sim = calloc(1, sizeof(wifi_sim_t));
+    if (sim == NULL)
+    {
+        return NULL;
+    }
+
+    sim->config = *config;
+    sim->rng = config->seed ? config->seed : 1;
+
+    // Provisioned one after the other, none connected yet
+    for (uint8_t i = 0; i < (config->num_networks ? config->num_networks : 1); i++)
+    {
+        char ssid[NET_STORE_SSID_LEN + 1];
+
+        snprintf(ssid, sizeof(ssid), "network %d", i);
+        net_store_add(&sim->networks, &wifi_policy_networks, 0, ssid, "password");
+    }
+
+    sim->parent.init = wifi_sim_init;
+    sim->parent.connect = wifi_sim_connect;
+    sim->parent.start = wifi_sim_start;
+    sim->parent.stop = wifi_sim_stop;
+    sim->parent.init_sntp = wifi_sim_init_sntp;
+    sim->parent.wait_sntp = wifi_sim_wait_sntp;
+    sim->parent.init_timezone = wifi_sim_init_timezone;
+    sim->parent.get_connect_info = wifi_sim_get_connect_info;
+    sim->parent.get_sntp_stats = wifi_sim_get_sntp_stats;
+    sim->parent.set_power_profile = wifi_sim_set_power_profile;
+
+    return &sim->parent;
+}
+
+void wifi_sim_move(wifi_t *wifi, uint8_t present_network)
+{
+    wifi_sim_t *sim = __containerof(wifi, wifi_sim_t, parent);
+
+    sim->config.present_network = present_network;
+}
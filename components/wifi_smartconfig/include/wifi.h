@@ -1,13 +1,41 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #include "esp_err.h"
 
+#include "power_profile.h"
+
 /**
  * @brief Wifi Type
  *
  */
 typedef struct wifi_s wifi_t;
 
+/**
+ * @brief Wifi Connection Info Type
+ *
+ */
+typedef struct wifi_connect_info_s
+{
+    bool fast;             /*!< connected with the cached BSSID, channel and IP lease */
+    int64_t time_to_ip_us; /*!< time from connect() until IP_EVENT_STA_GOT_IP */
+} wifi_connect_info_t;
+
+/**
+ * @brief Wifi SNTP Statistics Type
+ *
+ */
+typedef struct wifi_sntp_stats_s
+{
+    uint32_t syncs;             /*!< completed SNTP syncs */
+    uint32_t skipped;           /*!< wakes that skipped SNTP */
+    float skipped_ratio;        /*!< skipped / (syncs + skipped) */
+    float drift_ppm;            /*!< measured RTC drift, or the default until measured */
+    int64_t predicted_error_us; /*!< predicted clock error right now */
+} wifi_sntp_stats_t;
+
 /**
  * @brief Declare of Step motor Type
  *
@@ -27,7 +55,17 @@ struct wifi_s
 
     esp_err_t (*init_sntp)(wifi_t *wifi);
 
+    esp_err_t (*wait_sntp)(wifi_t *wifi, uint32_t timeout_ms);
+
     esp_err_t (*init_timezone)(wifi_t *wifi);
+
+    esp_err_t (*get_connect_info)(wifi_t *wifi, wifi_connect_info_t *info);
+
+    esp_err_t (*get_sntp_stats)(wifi_t *wifi, wifi_sntp_stats_t *stats);
+
+    /* Modem sleep and listen interval of the profile, after init(). The listen interval
+     * takes effect on the next connect(), frequency scaling is up to power_profile_set() */
+    esp_err_t (*set_power_profile)(wifi_t *wifi, power_profile_t profile);
 };
 
 /**
@@ -39,6 +77,11 @@ typedef struct wifi_conf_s
     char *aes_key;
     char *hostname;
     char *ntp_server;
+    bool fast_reconnect;        /*!< reuse the last BSSID, channel and IP lease on warm wakes */
+    uint32_t sntp_max_error_ms; /*!< skip SNTP while the predicted clock error stays below this */
+    uint32_t connect_budget_ms; /*!< connect() gives up with ESP_ERR_TIMEOUT this long after its first call, 0 never */
+    void (*got_ip)(void *ctx);  /*!< called on the event loop at IP_EVENT_STA_GOT_IP, before connect() returns, must not block. NULL for none */
+    void *got_ip_ctx;           /*!< passed to got_ip */
 } wifi_conf_t;
 
 /**
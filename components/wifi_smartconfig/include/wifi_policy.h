@@ -0,0 +1,121 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "net_store.h"
+
+/* Connect and SNTP policy, shared by the smartconfig driver and the simulated backend */
+#define MAXIMUM_RETRY 10 // after smartconfig handed over new credentials
+#define FAST_RECONNECT_TIMEOUT_MS 3000
+#define SNTP_MAX_INTERVAL_SEC (24 * 60 * 60)
+#define SNTP_DEFAULT_DRIFT_PPM 500
+
+/* Delay between reconnect attempts, doubled per attempt */
+#define RECONNECT_BASE_MS 500
+#define RECONNECT_MAX_MS (30 * 1000)
+#define RECONNECT_JITTER_PCT 25
+
+/* Known networks are tried best first, each shortly. Up to NETWORK_MAX_ROUNDS rounds while
+ * any of them is in range, smartconfig once none is */
+#define NETWORK_MAX_ROUNDS 3
+#define NETWORK_MAX_RETRY 2
+#define NETWORK_TIMEOUT_MS (8 * 1000)
+#define NETWORK_DEFAULT_TIME_TO_IP_MS 3000
+#define NETWORK_STALE_SEC (7 * 24 * 60 * 60)
+#define NETWORK_WEAK_RSSI (-80)
+
+/* Ranking of the known networks, from the settings above */
+extern const net_store_policy_t wifi_policy_networks;
+
+/**
+ * @brief Connect Step Type
+ *
+ */
+typedef enum
+{
+    WIFI_CONNECT_START,       /*!< before the first step */
+    WIFI_CONNECT_FAST,        /*!< cached BSSID, channel and lease of network, within FAST_RECONNECT_TIMEOUT_MS */
+    WIFI_CONNECT_NETWORK,     /*!< known network, NETWORK_MAX_RETRY retries within NETWORK_TIMEOUT_MS */
+    WIFI_CONNECT_SMARTCONFIG, /*!< provisioning, until the connect budget is spent */
+    WIFI_CONNECT_DONE,        /*!< connect() returns ret */
+} wifi_connect_step_t;
+
+/**
+ * @brief Connect Plan Type
+ *
+ * The order in which connect() tries the cached association, the known networks and smartconfig. A
+ * backend runs each step and hands its result to wifi_connect_plan_next(): ESP_OK, ESP_FAIL,
+ * ESP_ERR_NOT_FOUND for a network out of range, or ESP_ERR_TIMEOUT once the connect budget is spent.
+ */
+typedef struct wifi_connect_plan_s
+{
+    wifi_connect_step_t step; /*!< step to run */
+    uint8_t network;          /*!< network of a FAST or NETWORK step */
+    esp_err_t ret;            /*!< result of connect() once DONE */
+    int8_t fast_network;      /*!< network of the cached association, -1 for none */
+    uint8_t round;            /*!< rounds over the known networks started */
+    uint8_t next;             /*!< next position in order */
+    uint8_t num_networks;     /*!< networks ranked in order */
+    bool in_range;            /*!< a network of the round was found by the scan */
+    uint8_t order[NET_STORE_MAX_NETWORKS];
+} wifi_connect_plan_t;
+
+/**
+ * @brief Fast Reconnect Check Type
+ *
+ */
+typedef enum
+{
+    WIFI_FAST_OFF,     /*!< disabled, or nothing cached */
+    WIFI_FAST_UNKNOWN, /*!< the cached network is no longer known */
+    WIFI_FAST_EXPIRED, /*!< the cached lease reached T1 */
+    WIFI_FAST_USABLE,
+} wifi_fast_check_t;
+
+/**
+ * @brief Whether connect() may start with the cached association
+ *
+ * @param enabled: fast_reconnect of the configuration
+ * @param cached: an association is cached
+ * @param network: known network of the cached association, -1 if not known
+ * @param now: system time in seconds
+ * @param lease_expiry: system time in seconds at which the cached lease stops being used
+ */
+wifi_fast_check_t wifi_policy_fast_check(bool enabled, bool cached, int network, uint32_t now, uint32_t lease_expiry);
+
+/**
+ * @brief Delay before retrying esp_wifi_connect()
+ *
+ * @param attempt: 0 for the first retry
+ * @param max_retry: retries allowed, -1 for no limit
+ * @param random: random value for the jitter
+ * @param delay_ms: output delay
+ * @return
+ *      false once the retries are used up
+ */
+bool wifi_policy_retry(int attempt, int max_retry, uint32_t random, uint32_t *delay_ms);
+
+/**
+ * @brief Start a connect() plan
+ *
+ * @param plan: plan
+ * @param fast_network: network of a usable cached association, -1 to skip the fast path
+ */
+void wifi_connect_plan_begin(wifi_connect_plan_t *plan, int fast_network);
+
+/**
+ * @brief Take the result of the last step and get the next one
+ *
+ * Known networks are ranked again at the start of each round.
+ *
+ * @param plan: plan
+ * @param networks: known networks
+ * @param now: system time in seconds
+ * @param ret: result of the last step, ignored for the first
+ * @return
+ *      next step, plan->network and plan->ret apply to it
+ */
+wifi_connect_step_t wifi_connect_plan_next(wifi_connect_plan_t *plan, const net_store_t *networks, uint32_t now,
+                                           esp_err_t ret);
@@ -0,0 +1,117 @@
+#include <string.h>
+
+#include "wifi_policy.h"
+#include "backoff.h"
+
+static const backoff_policy_t s_reconnect_backoff = {
+    .base = RECONNECT_BASE_MS,
+    .max = RECONNECT_MAX_MS,
+    .jitter_pct = RECONNECT_JITTER_PCT,
+};
+
+const net_store_policy_t wifi_policy_networks = {
+    .attempt_timeout_ms = NETWORK_TIMEOUT_MS,
+    .default_time_to_ip_ms = NETWORK_DEFAULT_TIME_TO_IP_MS,
+    .stale_sec = NETWORK_STALE_SEC,
+    .weak_rssi = NETWORK_WEAK_RSSI,
+};
+
+wifi_fast_check_t wifi_policy_fast_check(bool enabled, bool cached, int network, uint32_t now, uint32_t lease_expiry)
+{
+    if (!enabled || !cached)
+    {
+        return WIFI_FAST_OFF;
+    }
+    if (network < 0)
+    {
+        return WIFI_FAST_UNKNOWN;
+    }
+    if (now >= lease_expiry)
+    {
+        return WIFI_FAST_EXPIRED;
+    }
+
+    return WIFI_FAST_USABLE;
+}
+
+bool wifi_policy_retry(int attempt, int max_retry, uint32_t random, uint32_t *delay_ms)
+{
+    if (max_retry >= 0 && attempt >= max_retry)
+    {
+        return false;
+    }
+
+    *delay_ms = backoff_delay(&s_reconnect_backoff, attempt, random);
+
+    return true;
+}
+
+void wifi_connect_plan_begin(wifi_connect_plan_t *plan, int fast_network)
+{
+    memset(plan, 0, sizeof(*plan));
+    plan->step = WIFI_CONNECT_START;
+    plan->ret = ESP_FAIL;
+    plan->fast_network = fast_network;
+}
+
+static wifi_connect_step_t wifi_connect_plan_done(wifi_connect_plan_t *plan, esp_err_t ret)
+{
+    plan->step = WIFI_CONNECT_DONE;
+    plan->ret = ret;
+
+    return plan->step;
+}
+
+wifi_connect_step_t wifi_connect_plan_next(wifi_connect_plan_t *plan, const net_store_t *networks, uint32_t now,
+                                           esp_err_t ret)
+{
+    switch (plan->step)
+    {
+    case WIFI_CONNECT_START:
+        if (plan->fast_network >= 0)
+        {
+            plan->step = WIFI_CONNECT_FAST;
+            plan->network = plan->fast_network;
+            return plan->step;
+        }
+        break;
+    case WIFI_CONNECT_FAST:
+        // A failed fast path falls back to a full connect
+        if (ret == ESP_OK)
+        {
+            return wifi_connect_plan_done(plan, ret);
+        }
+        break;
+    case WIFI_CONNECT_NETWORK:
+        if (ret == ESP_OK || ret == ESP_ERR_TIMEOUT)
+        {
+            return wifi_connect_plan_done(plan, ret);
+        }
+        plan->in_range |= ret == ESP_FAIL;
+        break;
+    case WIFI_CONNECT_SMARTCONFIG:
+        return wifi_connect_plan_done(plan, ret);
+    case WIFI_CONNECT_DONE:
+        return plan->step;
+    }
+
+    /* -------------- The known networks, best first ------------- */
+    while (plan->next >= plan->num_networks)
+    {
+        // Out of reach of every known network, e.g. at a new site, only provisioning helps
+        if ((plan->round > 0 && !plan->in_range) || plan->round == NETWORK_MAX_ROUNDS)
+        {
+            plan->step = WIFI_CONNECT_SMARTCONFIG;
+            return plan->step;
+        }
+        plan->num_networks = net_store_rank(networks, &wifi_policy_networks, now, plan->order);
+        plan->next = 0;
+        plan->round++;
+        plan->in_range = false;
+    }
+
+    plan->step = WIFI_CONNECT_NETWORK;
+    plan->network = plan->order[plan->next++];
+
+    return plan->step;
+}
@@ -1,7 +1,9 @@
 #include <stdlib.h>
 #include <stdbool.h>
+#include <inttypes.h>
 #include <string.h>
 #include <time.h>
+#include <sys/time.h>
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
@@ -9,6 +11,10 @@
 
 #include "esp_system.h"
 #include "esp_event.h"
+#include "esp_attr.h"
+#include "esp_timer.h"
+#include "esp_random.h"
+#include "esp_netif_net_stack.h"
 
 #include "esp_log.h"
 #include "esp_sntp.h"
@@ -18,37 +24,160 @@
 
 #include "lwip/err.h"
 #include "lwip/sys.h"
+#include "lwip/dhcp.h"
 
 #include "wifi.h"
+#include "wifi_policy.h"
+#include "config_store.h"
+#include "net_store.h"
+#include "time_sync.h"
+#include "trace.h"
+#include "dlog.h"
 
-#define MAXIMUM_RETRY 10
-#define NVS_NAMESPACE "WIFI"
 #define TIMEZONE_VALUE "TZ"
+#define STOP_TIMEOUT_MS 1000
 
 static const char *TAG = "wifi_smartconfig";
 
 /* FreeRTOS event group to signal when we are connected*/
 static EventGroupHandle_t s_wifi_event_group;
+#ifdef CONFIG_SMART_MAILS_STATIC_ALLOC
+static StaticEventGroup_t s_wifi_event_group_buffer;
+#endif
 
-/* The event group allows multiple bits for each event, but we only care about two events:
+/* The event group allows multiple bits for each event, but we only care about these events:
  * - we are connected to the AP with an IP
- * - we failed to connect after the maximum amount of retries */
+ * - we failed to connect after the maximum amount of retries
+ * - smartconfig is done
+ * - SNTP synced the time
+ * - the station stopped */
 #define WIFI_CONNECTED_BIT BIT0
 #define WIFI_FAIL_BIT BIT1
 #define ESPTOUCH_DONE_BIT BIT2
+#define TIME_SYNC_BIT BIT3
+#define WIFI_STOPPED_BIT BIT4
 
 /* forward declaration */
 static void connect_event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data);
 
 static int s_retry_num;
+static int s_max_retry;
 static bool s_connected;
+static bool s_reconnecting;
+static bool s_stopping;     // an attempt is being ended, its disconnect is not retried
+static bool s_provisioning; // smartconfig hands over the credentials
+static bool s_no_ap;        // the network of the attempt is out of range
+static esp_timer_handle_t s_reconnect_timer; /*!< created on the first retry, kept until deep sleep */
+static bool s_fast_path;
+static esp_netif_t *s_sta_netif;
+static int64_t s_connect_start_us;
+static wifi_connect_info_t s_connect_info;
+
+/* Last good association, kept across deep sleep for the fast reconnect path */
+typedef struct
+{
+    bool valid;
+    char ssid[NET_STORE_SSID_LEN + 1];
+    uint8_t bssid[6];
+    uint8_t channel;
+    esp_netif_ip_info_t ip_info;
+    esp_netif_dns_info_t dns;
+    time_t lease_expiry;
+} fast_reconnect_cache_t;
+
+RTC_DATA_ATTR static fast_reconnect_cache_t s_fast_cache;
+
+/* Last SNTP sync and measured RTC drift, to skip syncs while the clock is good enough */
+RTC_DATA_ATTR static time_sync_state_t s_time_sync;
+static int64_t s_sntp_start_local_us;
+static int64_t s_sntp_start_timer_us;
 
 typedef struct
 {
     wifi_t parent;
     wifi_conf_t config;
+    int64_t budget_end_us;    /*!< set by the first connect(), 0 before */
+    uint16_t listen_interval; /*!< of the power profile, 0 for the driver default */
 } smartconfig_t;
 
+/**
+ * @brief Retry esp_wifi_connect() from the esp_timer task
+ *
+ */
+static void reconnect_timer_callback(void *arg)
+{
+    if (esp_wifi_connect() != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Could not reconnect");
+        xEventGroupSetBits(s_wifi_event_group, WIFI_FAIL_BIT);
+    }
+}
+
+/**
+ * @brief Schedule the next esp_wifi_connect() without blocking the event loop, or fail the attempt
+ *
+ * @param attempt 0 for the first retry
+ * @param max_retry retries allowed, -1 for no limit
+ */
+static void reconnect_schedule(int attempt, int max_retry)
+{
+    uint32_t delay_ms;
+
+    if (!wifi_policy_retry(attempt, max_retry, esp_random(), &delay_ms))
+    {
+        xEventGroupSetBits(s_wifi_event_group, WIFI_FAIL_BIT);
+        return;
+    }
+    DLOGI(TAG, "Reconnect in %" PRIu32 " ms", delay_ms);
+    // esp_timer_create() allocates, a wake that connects at the first attempt never needs the timer
+    if (s_reconnect_timer == NULL)
+    {
+        const esp_timer_create_args_t reconnect_timer_args = {
+            .callback = reconnect_timer_callback,
+            .name = "reconnect",
+        };
+        if (esp_timer_create(&reconnect_timer_args, &s_reconnect_timer) != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to create reconnect timer");
+            xEventGroupSetBits(s_wifi_event_group, WIFI_FAIL_BIT);
+            return;
+        }
+    }
+    esp_timer_stop(s_reconnect_timer);
+    if (esp_timer_start_once(s_reconnect_timer, 1000ULL * delay_ms) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to schedule reconnect");
+        xEventGroupSetBits(s_wifi_event_group, WIFI_FAIL_BIT);
+    }
+}
+
+/**
+ * @brief Ticks left of the connect budget
+ *
+ * @param max_ms also cap the wait at this, 0 for no cap
+ */
+static TickType_t connect_budget_ticks(smartconfig_t *smartconfig, uint32_t max_ms)
+{
+    int64_t left_us;
+
+    if (smartconfig->budget_end_us == 0)
+    {
+        return max_ms ? pdMS_TO_TICKS(max_ms) : portMAX_DELAY;
+    }
+
+    left_us = smartconfig->budget_end_us - esp_timer_get_time();
+    if (left_us <= 0)
+    {
+        return 0;
+    }
+    if (max_ms && left_us > 1000LL * max_ms)
+    {
+        left_us = 1000LL * max_ms;
+    }
+
+    return pdMS_TO_TICKS(left_us / 1000);
+}
+
 /**
  * @brief Init wifi
  *
@@ -60,7 +189,7 @@ static esp_err_t smartconfig_init(wifi_t *wifi)
 
     smartconfig_t *smartconfig = __containerof(wifi, smartconfig_t, parent);
 
-    // Initialize NVS
+    // Initialize NVS. Still needed on warm wakes, the PHY calibration data lives there
     ret = nvs_flash_init();
     if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND)
     {
@@ -71,9 +200,15 @@ static esp_err_t smartconfig_init(wifi_t *wifi)
             return ESP_FAIL;
         }
     }
+    config_store_load();
+    trace_mark(TRACE_PHASE_NVS_INIT);
 
     // Create a new event group.
+#ifdef CONFIG_SMART_MAILS_STATIC_ALLOC
+    s_wifi_event_group = xEventGroupCreateStatic(&s_wifi_event_group_buffer);
+#else
     s_wifi_event_group = xEventGroupCreate();
+#endif
     if (s_wifi_event_group == NULL)
     {
         ESP_LOGE(TAG, "Failed to create event group");
@@ -93,20 +228,24 @@ static esp_err_t smartconfig_init(wifi_t *wifi)
         ESP_LOGE(TAG, "Failed to init netif");
         return ESP_FAIL;
     }
+    trace_mark(TRACE_PHASE_NETIF_INIT);
 
     // Creates default WIFI ST
-    esp_netif_t *sta_netif = esp_netif_create_default_wifi_sta();
-    assert(sta_netif);
+    s_sta_netif = esp_netif_create_default_wifi_sta();
+    assert(s_sta_netif);
 
-    // Set hostname
-    if (esp_netif_set_hostname(sta_netif, smartconfig->config.hostname))
+    // Set hostname, a provisioned one wins over the compiled in default
+    const char *hostname = config_store_get(CONFIG_STORE_HOSTNAME);
+    if (esp_netif_set_hostname(s_sta_netif, hostname[0] ? hostname : smartconfig->config.hostname))
     {
         ESP_LOGE(TAG, "Failed to set hostname");
         return ESP_FAIL;
     }
 
-    //  Init WiFi
+    //  Init WiFi. The credentials come from the config store, so the driver only reads its
+    //  own flash copy on a cold boot, to carry over credentials saved before the store existed
     wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+    cfg.nvs_enable = !config_store_warm() && !config_store_get(CONFIG_STORE_SSID)[0];
     if (esp_wifi_init(&cfg) != ESP_OK)
     {
         ESP_LOGE(TAG, "Failed to init wifi");
@@ -120,10 +259,10 @@ static esp_err_t smartconfig_init(wifi_t *wifi)
         return ESP_FAIL;
     }
 
-    // Set storage to flash
-    if (esp_wifi_set_storage(WIFI_STORAGE_FLASH) != ESP_OK)
+    // Keep the driver's config in RAM, the config store persists what has to survive
+    if (esp_wifi_set_storage(WIFI_STORAGE_RAM) != ESP_OK)
     {
-        ESP_LOGE(TAG, "Failed to set storage to flash");
+        ESP_LOGE(TAG, "Failed to set storage to ram");
         return ESP_FAIL;
     }
 
@@ -133,7 +272,7 @@ static esp_err_t smartconfig_init(wifi_t *wifi)
         ESP_LOGE(TAG, "Failed to register handler");
         return ESP_FAIL;
     }
-    if (esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &connect_event_handler, NULL) != ESP_OK)
+    if (esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &connect_event_handler, smartconfig) != ESP_OK)
     {
         ESP_LOGE(TAG, "Failed to register handler");
         return ESP_FAIL;
@@ -147,70 +286,323 @@ static esp_err_t smartconfig_init(wifi_t *wifi)
     return ESP_OK;
 }
 
-static esp_err_t smartconfig_connect(wifi_t *wifi)
+/**
+ * @brief Save the current association and DHCP lease for the next wake
+ *
+ * @param event IP_EVENT_STA_GOT_IP data
+ */
+static void fast_reconnect_save(const ip_event_got_ip_t *event)
+{
+    wifi_ap_record_t ap_info;
+    struct netif *lwip_netif;
+    struct dhcp *dhcp;
+
+    s_fast_cache.valid = false;
+
+    if (esp_wifi_sta_get_ap_info(&ap_info) != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Failed to get AP info, not caching association");
+        return;
+    }
+    lwip_netif = esp_netif_get_netif_impl(event->esp_netif);
+    dhcp = lwip_netif ? netif_dhcp_data(lwip_netif) : NULL;
+    if (dhcp == NULL || dhcp->offered_t0_lease == 0)
+    {
+        ESP_LOGW(TAG, "No DHCP lease, not caching association");
+        return;
+    }
+    if (esp_netif_get_dns_info(event->esp_netif, ESP_NETIF_DNS_MAIN, &s_fast_cache.dns) != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Failed to get DNS info, not caching association");
+        return;
+    }
+
+    memcpy(s_fast_cache.ssid, ap_info.ssid, sizeof(s_fast_cache.ssid));
+    memcpy(s_fast_cache.bssid, ap_info.bssid, sizeof(s_fast_cache.bssid));
+    s_fast_cache.channel = ap_info.primary;
+    s_fast_cache.ip_info = event->ip_info;
+    // Stop reusing the address at T1, when a DHCP client would renew it
+    s_fast_cache.lease_expiry = time(NULL) + dhcp->offered_t0_lease / 2;
+    s_fast_cache.valid = true;
+
+    DLOGI(TAG, "Cached BSSID " MACSTR " channel %d lease %" PRIu32 " s",
+          MAC2STR(s_fast_cache.bssid), s_fast_cache.channel, dhcp->offered_t0_lease);
+}
+
+/**
+ * @brief Station config of a known network
+ *
+ */
+static void smartconfig_network_config(smartconfig_t *smartconfig, const net_store_network_t *network,
+                                       wifi_config_t *wifi_config)
+{
+    bzero(wifi_config, sizeof(wifi_config_t));
+
+    // The store keeps them terminated, the driver's fields need not be
+    memcpy(wifi_config->sta.ssid, network->ssid, strlen(network->ssid));
+    memcpy(wifi_config->sta.password, network->password, strlen(network->password));
+    wifi_config->sta.listen_interval = smartconfig->listen_interval;
+}
+
+/**
+ * @brief Stop the station and wait until the events of the attempt are handled
+ *
+ * Retries scheduled by a late disconnect event would otherwise leak into the next attempt.
+ */
+static void smartconfig_stop_attempt(void)
+{
+    s_stopping = true;
+    esp_timer_stop(s_reconnect_timer);
+    xEventGroupClearBits(s_wifi_event_group, WIFI_STOPPED_BIT);
+    if (esp_wifi_stop() == ESP_OK)
+    {
+        xEventGroupWaitBits(s_wifi_event_group, WIFI_STOPPED_BIT, pdTRUE, pdFALSE, pdMS_TO_TICKS(STOP_TIMEOUT_MS));
+    }
+    esp_timer_stop(s_reconnect_timer);
+    s_stopping = false;
+    xEventGroupClearBits(s_wifi_event_group, WIFI_CONNECTED_BIT | WIFI_FAIL_BIT);
+}
+
+/**
+ * @brief Rank the network that just connected up, with the signal it connected at
+ *
+ * @param index: network, -1 to look it up by the SSID of the association
+ * @param time_to_ip_ms: time of a full connect, 0 for the fast path
+ */
+static void smartconfig_record_success(int index, uint32_t time_to_ip_ms)
+{
+    net_store_t *networks = config_store_networks();
+    wifi_ap_record_t ap_info;
+
+    if (esp_wifi_sta_get_ap_info(&ap_info) != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Failed to get AP info, not ranking the network");
+        return;
+    }
+    if (index < 0)
+    {
+        index = net_store_find(networks, (const char *)ap_info.ssid);
+    }
+    if (index < 0)
+    {
+        return;
+    }
+
+    // Flash is only written when the device moved to another network
+    config_store_commit_networks(net_store_record_success(networks, index, time(NULL), time_to_ip_ms, ap_info.rssi));
+}
+
+/**
+ * @brief Connect with the cached BSSID, channel and IP lease, without scan or DHCP
+ *
+ * @param network the known network the cache belongs to
+ */
+static esp_err_t fast_reconnect_connect(smartconfig_t *smartconfig, const net_store_network_t *network)
 {
+    esp_err_t err;
     EventBits_t bits;
+    wifi_config_t pinned_config;
 
-    smartconfig_t *smartconfig = __containerof(wifi, smartconfig_t, parent);
+    smartconfig_network_config(smartconfig, network, &pinned_config);
+    pinned_config.sta.bssid_set = true;
+    memcpy(pinned_config.sta.bssid, s_fast_cache.bssid, sizeof(pinned_config.sta.bssid));
+    pinned_config.sta.channel = s_fast_cache.channel;
+    pinned_config.sta.scan_method = WIFI_FAST_SCAN;
 
-    wifi_config_t wifi_config;
+    if (esp_wifi_set_config(WIFI_IF_STA, &pinned_config) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to set pinned config");
+        goto fallback;
+    }
 
-    if (esp_wifi_get_config(ESP_IF_WIFI_STA, &wifi_config) != ESP_OK)
+    // Reuse the cached lease instead of running DHCP
+    err = esp_netif_dhcpc_stop(s_sta_netif);
+    if (err != ESP_OK && err != ESP_ERR_ESP_NETIF_DHCP_ALREADY_STOPPED)
     {
-        ESP_LOGE(TAG, "Failed to get config");
-        return ESP_FAIL;
+        ESP_LOGE(TAG, "Failed to stop DHCP client");
+        goto fallback;
     }
-    if (strlen((const char *)wifi_config.sta.ssid))
+    if (esp_netif_set_ip_info(s_sta_netif, &s_fast_cache.ip_info) != ESP_OK ||
+        esp_netif_set_dns_info(s_sta_netif, ESP_NETIF_DNS_MAIN, &s_fast_cache.dns) != ESP_OK)
     {
-        ESP_LOGI(TAG, "Flash SSID: %s", wifi_config.sta.ssid);
-        ESP_LOGI(TAG, "Flash Password: %s", wifi_config.sta.password);
+        ESP_LOGE(TAG, "Failed to set cached IP info");
+        goto fallback;
     }
-    else
+
+    s_fast_path = true;
+    xEventGroupClearBits(s_wifi_event_group, WIFI_CONNECTED_BIT | WIFI_FAIL_BIT);
+
+    if (esp_wifi_start() != ESP_OK)
     {
-        ESP_LOGE(TAG, "Nothing in flash");
+        ESP_LOGE(TAG, "Failed to start wifi");
+        goto fallback;
     }
+    trace_mark(TRACE_PHASE_WIFI_START);
 
-    s_connected = false;
+    bits = xEventGroupWaitBits(s_wifi_event_group,
+                               WIFI_CONNECTED_BIT | WIFI_FAIL_BIT,
+                               pdTRUE,
+                               pdFALSE,
+                               connect_budget_ticks(smartconfig, FAST_RECONNECT_TIMEOUT_MS));
+    s_fast_path = false;
+
+    if (bits & WIFI_CONNECTED_BIT)
+    {
+        return ESP_OK;
+    }
+
+    smartconfig_stop_attempt();
+
+fallback:
+    s_fast_path = false;
+    s_fast_cache.valid = false;
+    esp_netif_dhcpc_start(s_sta_netif);
+
+    return ESP_FAIL;
+}
+
+/**
+ * @brief Connect to one known network, giving up after a few retries or NETWORK_TIMEOUT_MS
+ *
+ * @param index network in the config store
+ * @return
+ *      ESP_OK, ESP_FAIL to try the next one, ESP_ERR_NOT_FOUND if it is out of range,
+ *      or ESP_ERR_TIMEOUT once the connect budget is spent
+ */
+static esp_err_t smartconfig_try_network(smartconfig_t *smartconfig, uint8_t index)
+{
+    net_store_t *networks = config_store_networks();
+    const net_store_network_t *network = &networks->networks[index];
+    TickType_t ticks = connect_budget_ticks(smartconfig, NETWORK_TIMEOUT_MS);
+    int64_t start_us = esp_timer_get_time();
+    wifi_config_t wifi_config;
+    EventBits_t bits;
+
+    if (ticks == 0)
+    {
+        ESP_LOGW(TAG, "Connect budget spent");
+        return ESP_ERR_TIMEOUT;
+    }
+
+    smartconfig_network_config(smartconfig, network, &wifi_config);
+    if (esp_wifi_set_config(WIFI_IF_STA, &wifi_config) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to set config");
+        return ESP_FAIL;
+    }
+    DLOGI(TAG, "Trying %s, %d failures since the last success", network->ssid, network->failures);
 
-    /* -------------- Try to connect with stored settings ------------- */
     s_retry_num = 0;
+    s_max_retry = NETWORK_MAX_RETRY;
+    s_no_ap = false;
+    xEventGroupClearBits(s_wifi_event_group, WIFI_CONNECTED_BIT | WIFI_FAIL_BIT);
 
     if (esp_wifi_start() != ESP_OK)
     {
         ESP_LOGE(TAG, "Failed to start wifi");
         return ESP_FAIL;
     }
-
-    ESP_LOGI(TAG, "WIFI startet. Waiting for events.");
+    trace_mark(TRACE_PHASE_WIFI_START);
 
     /* Waiting until either the connection is established (WIFI_CONNECTED_BIT) or connection failed for the maximum
-     * number of re-tries (WIFI_FAIL_BIT). The bits are set by event_handler() (see above) */
+     * number of re-tries (WIFI_FAIL_BIT). The bits are set by event_handler() (see below) */
     bits = xEventGroupWaitBits(s_wifi_event_group,
                                WIFI_CONNECTED_BIT | WIFI_FAIL_BIT,
                                pdTRUE,
                                pdFALSE,
-                               portMAX_DELAY);
+                               ticks);
 
     if (bits & WIFI_CONNECTED_BIT)
     {
-        ESP_LOGI(TAG, "Connected to ap SSID: %s password: %s", wifi_config.sta.ssid, wifi_config.sta.password);
+        DLOGI(TAG, "Connected to ap SSID: %s", network->ssid);
+        smartconfig_record_success(index, (esp_timer_get_time() - start_us) / 1000);
         return ESP_OK;
     }
-    else if (bits & WIFI_FAIL_BIT)
+
+    DLOGI(TAG, "Failed to connect to SSID: %s", network->ssid);
+    smartconfig_stop_attempt();
+    net_store_record_failure(networks, index);
+    config_store_commit_networks(false);
+
+    if (connect_budget_ticks(smartconfig, 0) == 0)
     {
-        ESP_LOGI(TAG, "Failed to connect to SSID: %s, password:%s", wifi_config.sta.ssid, wifi_config.sta.password);
+        return ESP_ERR_TIMEOUT;
     }
-    else
+
+    return s_no_ap ? ESP_ERR_NOT_FOUND : ESP_FAIL;
+}
+
+/**
+ * @brief Save SSID and password, which come unterminated when they use the whole field
+ *
+ */
+static void smartconfig_store_credentials(const uint8_t ssid[32], const uint8_t password[64])
+{
+    char ssid_value[NET_STORE_SSID_LEN + 1] = {0};
+    char password_value[NET_STORE_PASSWORD_LEN + 1] = {0};
+
+    memcpy(ssid_value, ssid, NET_STORE_SSID_LEN);
+    memcpy(password_value, password, NET_STORE_PASSWORD_LEN);
+    config_store_set(CONFIG_STORE_SSID, ssid_value);
+    config_store_set(CONFIG_STORE_PASSWORD, password_value);
+
+    if (net_store_add(config_store_networks(), &wifi_policy_networks, time(NULL), ssid_value, password_value))
     {
-        ESP_LOGE(TAG, "Unexpected event");
+        config_store_commit_networks(true);
     }
+}
+
+/**
+ * @brief Carry over credentials the driver saved to flash before the config store existed
+ *
+ */
+static esp_err_t smartconfig_import_driver_config(void)
+{
+    wifi_config_t wifi_config;
+
+    if (config_store_networks()->num_networks > 0)
+    {
+        return ESP_OK;
+    }
+
+    bzero(&wifi_config, sizeof(wifi_config_t));
+    if (esp_wifi_get_config(WIFI_IF_STA, &wifi_config) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to get config");
+        return ESP_FAIL;
+    }
+    if (wifi_config.sta.ssid[0])
+    {
+        smartconfig_store_credentials(wifi_config.sta.ssid, wifi_config.sta.password);
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Get new credentials with smartconfig and connect with them
+ *
+ */
+static esp_err_t smartconfig_provision(smartconfig_t *smartconfig)
+{
+    EventBits_t bits;
 
-    /* -------------- Try to connect with smartconfig ------------- */
     s_retry_num = 0;
+    s_max_retry = MAXIMUM_RETRY;
+    s_provisioning = true;
+    xEventGroupClearBits(s_wifi_event_group, WIFI_CONNECTED_BIT | WIFI_FAIL_BIT | ESPTOUCH_DONE_BIT);
+
+    // Started without connecting, the credentials come from smartconfig
+    if (esp_wifi_start() != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to start wifi");
+        return ESP_FAIL;
+    }
 
     if (esp_smartconfig_set_type(SC_TYPE_ESPTOUCH_V2) != ESP_OK)
     {
         ESP_LOGE(TAG, "Failed to set smartconfig type");
+        smartconfig_stop_attempt();
         return ESP_FAIL;
     }
     smartconfig_start_config_t smart_cfg;
@@ -221,6 +613,7 @@ static esp_err_t smartconfig_connect(wifi_t *wifi)
     if (esp_smartconfig_start(&smart_cfg) != ESP_OK)
     {
         ESP_LOGE(TAG, "Failed to start smartconfig");
+        smartconfig_stop_attempt();
         return ESP_FAIL;
     }
 
@@ -230,35 +623,134 @@ static esp_err_t smartconfig_connect(wifi_t *wifi)
                                    WIFI_CONNECTED_BIT | WIFI_FAIL_BIT | ESPTOUCH_DONE_BIT,
                                    pdTRUE,
                                    pdFALSE,
-                                   portMAX_DELAY);
+                                   connect_budget_ticks(smartconfig, 0));
 
         if (bits & WIFI_CONNECTED_BIT)
         {
-            ESP_LOGI(TAG, "connected via smart config");
+            DLOGI(TAG, "connected via smart config");
+            smartconfig_record_success(-1, (esp_timer_get_time() - s_connect_start_us) / 1000);
         }
         else if (bits & ESPTOUCH_DONE_BIT)
         {
-            ESP_LOGI(TAG, "Touch done");
+            DLOGI(TAG, "Touch done");
             esp_smartconfig_stop();
+            s_provisioning = false;
             return ESP_OK;
         }
         else if (bits & WIFI_FAIL_BIT)
         {
-            ESP_LOGI(TAG, "Failed to connect via smart config");
+            DLOGI(TAG, "Failed to connect via smart config");
             esp_smartconfig_stop();
-            esp_wifi_stop();
+            smartconfig_stop_attempt();
+            s_provisioning = false;
             return ESP_FAIL;
         }
         else
         {
-            ESP_LOGE(TAG, "Unexpected event");
+            ESP_LOGW(TAG, "Connect budget spent during smart config");
             esp_smartconfig_stop();
-            esp_wifi_stop();
-            return ESP_FAIL;
+            smartconfig_stop_attempt();
+            s_provisioning = false;
+            return ESP_ERR_TIMEOUT;
         }
     } while (true);
 }
 
+static esp_err_t smartconfig_connect(wifi_t *wifi)
+{
+    wifi_connect_plan_t plan;
+    esp_err_t ret = ESP_FAIL;
+    int index = -1;
+
+    smartconfig_t *smartconfig = __containerof(wifi, smartconfig_t, parent);
+
+    net_store_t *networks = config_store_networks();
+
+    if (smartconfig_import_driver_config() != ESP_OK)
+    {
+        return ESP_FAIL;
+    }
+    if (networks->num_networks == 0)
+    {
+        ESP_LOGE(TAG, "Nothing stored");
+    }
+
+    s_connected = false;
+    s_reconnecting = false;
+    s_provisioning = false;
+    s_connect_start_us = esp_timer_get_time();
+    s_connect_info.fast = false;
+
+    // The budget covers all connect() calls of this wake, retries included
+    if (smartconfig->budget_end_us == 0 && smartconfig->config.connect_budget_ms)
+    {
+        smartconfig->budget_end_us = s_connect_start_us + 1000LL * smartconfig->config.connect_budget_ms;
+    }
+    if (connect_budget_ticks(smartconfig, 0) == 0)
+    {
+        ESP_LOGW(TAG, "Connect budget spent");
+        return ESP_ERR_TIMEOUT;
+    }
+
+    // The order of the attempts is shared with the simulated backend
+    if (s_fast_cache.valid)
+    {
+        index = net_store_find(networks, s_fast_cache.ssid);
+    }
+    switch (wifi_policy_fast_check(smartconfig->config.fast_reconnect, s_fast_cache.valid, index, time(NULL),
+                                   s_fast_cache.lease_expiry))
+    {
+    case WIFI_FAST_UNKNOWN:
+        DLOGI(TAG, "Cached network no longer known");
+        s_fast_cache.valid = false;
+        index = -1;
+        break;
+    case WIFI_FAST_EXPIRED:
+        DLOGI(TAG, "Cached lease expired");
+        s_fast_cache.valid = false;
+        index = -1;
+        break;
+    case WIFI_FAST_OFF:
+        index = -1;
+        break;
+    case WIFI_FAST_USABLE:
+        break;
+    }
+
+    wifi_connect_plan_begin(&plan, index);
+    while (wifi_connect_plan_next(&plan, networks, time(NULL), ret) != WIFI_CONNECT_DONE)
+    {
+        switch (plan.step)
+        {
+        case WIFI_CONNECT_FAST:
+            ret = fast_reconnect_connect(smartconfig, &networks->networks[plan.network]);
+            if (ret == ESP_OK)
+            {
+                s_connect_info.fast = true;
+                DLOGI(TAG, "Fast reconnect in %lld ms", s_connect_info.time_to_ip_us / 1000);
+                smartconfig_record_success(plan.network, 0);
+            }
+            else
+            {
+                ESP_LOGW(TAG, "Fast reconnect failed, falling back to full connect");
+                s_connected = false;
+            }
+            break;
+        case WIFI_CONNECT_NETWORK:
+            ret = smartconfig_try_network(smartconfig, plan.network);
+            break;
+        case WIFI_CONNECT_SMARTCONFIG:
+            ret = smartconfig_provision(smartconfig);
+            break;
+        default:
+            ret = ESP_FAIL;
+            break;
+        }
+    }
+
+    return plan.ret;
+}
+
 static esp_err_t smartconfig_start(wifi_t *wifi)
 {
     if (esp_wifi_start() != ESP_OK)
@@ -272,6 +764,7 @@ static esp_err_t smartconfig_start(wifi_t *wifi)
 
 static esp_err_t smartconfig_stop(wifi_t *wifi)
 {
+    esp_timer_stop(s_reconnect_timer);
     if (esp_wifi_stop() != ESP_OK)
     {
         ESP_LOGE(TAG, "Failed to stop wifi");
@@ -285,8 +778,11 @@ static void connect_event_handler(void *arg, esp_event_base_t event_base, int32_
 {
     if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START)
     {
-        ESP_LOGI(TAG, "WIFI_EVENT_STA_START");
-        if (esp_wifi_connect() != ESP_OK)
+        DLOGI(TAG, "WIFI_EVENT_STA_START");
+        if (s_provisioning)
+        { // Nothing to connect to before smartconfig found the credentials
+        }
+        else if (esp_wifi_connect() != ESP_OK)
         {
             ESP_LOGE(TAG, "Could not connect");
             esp_wifi_disconnect();
@@ -295,59 +791,80 @@ static void connect_event_handler(void *arg, esp_event_base_t event_base, int32_
     }
     else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_STOP)
     {
-        ESP_LOGI(TAG, "WIFI_EVENT_STA_STOP");
+        DLOGI(TAG, "WIFI_EVENT_STA_STOP");
+        xEventGroupSetBits(s_wifi_event_group, WIFI_STOPPED_BIT);
     }
     else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_CONNECTED)
     {
-        ESP_LOGI(TAG, "WIFI_EVENT_STA_CONNECTED");
+        DLOGI(TAG, "WIFI_EVENT_STA_CONNECTED");
+        trace_mark(TRACE_PHASE_ASSOCIATED);
         s_connected = true;
     }
     else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED)
     {
-        ESP_LOGI(TAG, "WIFI_EVENT_STA_DISCONNECTED");
-        if (s_connected)
-        { // WIFI was already connected. Perhaps router down? Try reconnecting
-            while (true)
+        wifi_event_sta_disconnected_t *event = (wifi_event_sta_disconnected_t *)event_data;
+        DLOGI(TAG, "WIFI_EVENT_STA_DISCONNECTED reason %d", event->reason);
+        if (s_stopping)
+        { // The attempt is over, connect() moves on
+        }
+        else if (s_fast_path)
+        { // Cached BSSID/channel did not work out. Let connect() fall back
+            xEventGroupSetBits(s_wifi_event_group, WIFI_FAIL_BIT);
+        }
+        else if (s_connected || s_reconnecting)
+        { // WIFI was already connected. Perhaps router down? Keep retrying, the connect budget ends the wake
+            if (s_connected)
             {
-                esp_wifi_connect();
-                vTaskDelay((1000 * 60) / portTICK_PERIOD_MS); // Wait 1 minute
+                s_connected = false;
+                s_reconnecting = true;
+                s_retry_num = 0;
             }
+            reconnect_schedule(s_retry_num++, -1);
+        }
+        else if (event->reason == WIFI_REASON_NO_AP_FOUND && !s_provisioning)
+        { // Not in range, e.g. the device moved. Retrying will not help, the next network might
+            s_no_ap = true;
+            xEventGroupSetBits(s_wifi_event_group, WIFI_FAIL_BIT);
         }
         else
         { // WIFI was not connected. So there is a problem
-            if (s_retry_num < MAXIMUM_RETRY)
-            {
-                ESP_LOGI(TAG, "retry to connect to the AP");
-                esp_wifi_connect();
-                s_retry_num++;
-            }
-            else
-            {
-                xEventGroupSetBits(s_wifi_event_group, WIFI_FAIL_BIT);
-            }
+            reconnect_schedule(s_retry_num++, s_max_retry);
         }
 
-        ESP_LOGI(TAG, "connect to the AP fail");
+        DLOGI(TAG, "connect to the AP fail");
     }
     else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP)
     {
-        ESP_LOGI(TAG, "IP_EVENT_STA_GOT_IP");
+        DLOGI(TAG, "IP_EVENT_STA_GOT_IP");
+        trace_mark(TRACE_PHASE_GOT_IP);
         ip_event_got_ip_t *event = (ip_event_got_ip_t *)event_data;
-        ESP_LOGI(TAG, "got ip:" IPSTR, IP2STR(&event->ip_info.ip));
+        DLOGI(TAG, "got ip:" IPSTR, IP2STR(&event->ip_info.ip));
+        s_connect_info.time_to_ip_us = esp_timer_get_time() - s_connect_start_us;
+        if (!s_fast_path)
+        {
+            fast_reconnect_save(event);
+        }
         s_retry_num = 0;
+        s_reconnecting = false;
+        // Registered with the driver for this event only
+        smartconfig_t *smartconfig = arg;
+        if (smartconfig->config.got_ip != NULL)
+        {
+            smartconfig->config.got_ip(smartconfig->config.got_ip_ctx);
+        }
         xEventGroupSetBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
     }
     else if (event_base == SC_EVENT && event_id == SC_EVENT_SCAN_DONE)
     {
-        ESP_LOGI(TAG, "SC_EVENT_SCAN_DONE");
+        DLOGI(TAG, "SC_EVENT_SCAN_DONE");
     }
     else if (event_base == SC_EVENT && event_id == SC_EVENT_FOUND_CHANNEL)
     {
-        ESP_LOGI(TAG, "SC_EVENT_FOUND_CHANNEL");
+        DLOGI(TAG, "SC_EVENT_FOUND_CHANNEL");
     }
     else if (event_base == SC_EVENT && event_id == SC_EVENT_GOT_SSID_PSWD)
     {
-        ESP_LOGI(TAG, "SC_EVENT_GOT_SSID_PSWD");
+        DLOGI(TAG, "SC_EVENT_GOT_SSID_PSWD");
 
         smartconfig_event_got_ssid_pswd_t *evt = (smartconfig_event_got_ssid_pswd_t *)event_data;
         wifi_config_t wifi_config;
@@ -362,17 +879,18 @@ static void connect_event_handler(void *arg, esp_event_base_t event_base, int32_
             memcpy(wifi_config.sta.bssid, evt->bssid, sizeof(wifi_config.sta.bssid));
         }
 
-        ESP_LOGI(TAG, "SSID: %s", wifi_config.sta.ssid);
-        ESP_LOGI(TAG, "PASSWORD: %s", wifi_config.sta.password);
+        DLOGI(TAG, "SSID: %s", wifi_config.sta.ssid);
+        DLOGI(TAG, "PASSWORD: %s", DLOG_SECRET(wifi_config.sta.password));
+
+        // New network, the cached association no longer applies
+        s_fast_cache.valid = false;
 
         ESP_ERROR_CHECK(esp_smartconfig_get_rvd_data(rvd_data, sizeof(rvd_data)));
-        ESP_LOGI(TAG, "RVD_DATA: %s", rvd_data);
+        DLOGI(TAG, "RVD_DATA: %s", rvd_data);
 
-        nvs_handle_t my_handle;
-        ESP_ERROR_CHECK(nvs_open(NVS_NAMESPACE, NVS_READWRITE, &my_handle));
-        ESP_ERROR_CHECK(nvs_set_str(my_handle, TIMEZONE_VALUE, (char *)rvd_data));
-        ESP_ERROR_CHECK(nvs_commit(my_handle));
-        nvs_close(my_handle);
+        // Written to NVS only where they differ from what is stored
+        smartconfig_store_credentials(evt->ssid, evt->password);
+        config_store_set(CONFIG_STORE_TIMEZONE, (const char *)rvd_data);
 
         ESP_ERROR_CHECK(esp_wifi_disconnect());
         ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
@@ -386,91 +904,200 @@ static void connect_event_handler(void *arg, esp_event_base_t event_base, int32_
     }
     else if (event_base == SC_EVENT && event_id == SC_EVENT_SEND_ACK_DONE)
     {
-        ESP_LOGI(TAG, "SC_EVENT_SEND_ACK_DONE");
+        DLOGI(TAG, "SC_EVENT_SEND_ACK_DONE");
         xEventGroupSetBits(s_wifi_event_group, ESPTOUCH_DONE_BIT);
     }
 }
 
+static int64_t system_time_us(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static time_sync_policy_t smartconfig_time_sync_policy(smartconfig_t *smartconfig)
+{
+    time_sync_policy_t policy = {
+        .max_error_ms = smartconfig->config.sntp_max_error_ms,
+        .max_interval_sec = SNTP_MAX_INTERVAL_SEC,
+        .default_drift_ppm = SNTP_DEFAULT_DRIFT_PPM,
+    };
+
+    return policy;
+}
+
 /**
  * @brief Callback function from time sync
  *
  */
 void sync_callback(struct timeval *tv)
 {
-    ESP_LOGI(TAG, "Syncing date/time: %s", ctime(&tv->tv_sec));
+    // What the RTC would show now had SNTP not corrected it
+    int64_t local_us = s_sntp_start_local_us + (esp_timer_get_time() - s_sntp_start_timer_us);
+
+    DLOGI(TAG, "Syncing date/time: %s", ctime(&tv->tv_sec));
+    time_sync_update(&s_time_sync, local_us, (int64_t)tv->tv_sec * 1000000 + tv->tv_usec);
+    DLOGI(TAG, "RTC drift %.1f ppm", s_time_sync.drift_ppm);
+    trace_mark(TRACE_PHASE_SNTP);
+    xEventGroupSetBits(s_wifi_event_group, TIME_SYNC_BIT);
 }
 
 static esp_err_t smartconfig_init_sntp(wifi_t *wifi)
 {
     smartconfig_t *smartconfig = __containerof(wifi, smartconfig_t, parent);
+    time_sync_policy_t policy = smartconfig_time_sync_policy(smartconfig);
 
-    ESP_LOGI(TAG, "Init SNTP");
+    s_sntp_start_local_us = system_time_us();
+    s_sntp_start_timer_us = esp_timer_get_time();
+
+    if (!time_sync_needed(&s_time_sync, &policy, s_sntp_start_local_us))
+    {
+        DLOGI(TAG, "Skip SNTP, predicted error %lld ms",
+              time_sync_predicted_error_us(&s_time_sync, &policy, s_sntp_start_local_us) / 1000);
+        trace_mark(TRACE_PHASE_SNTP);
+        xEventGroupSetBits(s_wifi_event_group, TIME_SYNC_BIT);
+        return ESP_OK;
+    }
+
+    DLOGI(TAG, "Init SNTP");
 
     sntp_setoperatingmode(SNTP_OPMODE_POLL);
-    sntp_setservername(0, smartconfig->config.ntp_server);
+    // sntp keeps the pointer, both strings outlive it
+    const char *ntp_server = config_store_get(CONFIG_STORE_NTP_SERVER);
+    sntp_setservername(0, ntp_server[0] ? ntp_server : smartconfig->config.ntp_server);
     sntp_set_time_sync_notification_cb(&sync_callback);
     sntp_init();
 
     return ESP_OK;
 }
 
-static esp_err_t smartconfig_init_timezone(wifi_t *wifi)
+static esp_err_t smartconfig_wait_sntp(wifi_t *wifi, uint32_t timeout_ms)
 {
-    esp_err_t err;
+    EventBits_t bits;
 
-    smartconfig_t *smartconfig = __containerof(wifi, smartconfig_t, parent);
+    bits = xEventGroupWaitBits(s_wifi_event_group,
+                               TIME_SYNC_BIT,
+                               pdFALSE,
+                               pdTRUE,
+                               pdMS_TO_TICKS(timeout_ms));
+    if (!(bits & TIME_SYNC_BIT))
+    {
+        ESP_LOGW(TAG, "Timed out waiting for SNTP");
+        return ESP_ERR_TIMEOUT;
+    }
 
-    ESP_LOGI(TAG, "Init timezone");
+    return ESP_OK;
+}
 
-    char *timezone_value;
-    size_t timezone_size = 0;
+static esp_err_t smartconfig_init_timezone(wifi_t *wifi)
+{
+    const char *timezone_value = config_store_get(CONFIG_STORE_TIMEZONE);
 
-    nvs_handle_t my_handle;
-    err = nvs_open(NVS_NAMESPACE, NVS_READONLY, &my_handle);
-    if (err != ESP_OK)
+    DLOGI(TAG, "Init timezone");
+
+    if (!timezone_value[0])
     {
-        ESP_LOGE(TAG, "Failed to open NVS %d", err);
+        ESP_LOGE(TAG, "No timezone stored");
         return ESP_FAIL;
     }
-    err = nvs_get_str(my_handle, TIMEZONE_VALUE, NULL, &timezone_size);
-    if (err != ESP_OK)
+    DLOGI(TAG, "Timezone %s", timezone_value);
+
+    // setenv() and tzset() allocate, skipped when the pipeline already set the same timezone
+    const char *current = getenv(TIMEZONE_VALUE);
+    if (current != NULL && strcmp(current, timezone_value) == 0)
     {
-        ESP_LOGE(TAG, "Failed to read size from NVS %d", err);
+        return ESP_OK;
+    }
+
+    // Set timezone
+    setenv(TIMEZONE_VALUE, timezone_value, 1);
+    tzset();
+
+    return ESP_OK;
+}
+
+static esp_err_t smartconfig_get_sntp_stats(wifi_t *wifi, wifi_sntp_stats_t *stats)
+{
+    smartconfig_t *smartconfig = __containerof(wifi, smartconfig_t, parent);
+    time_sync_policy_t policy = smartconfig_time_sync_policy(smartconfig);
+
+    stats->syncs = s_time_sync.syncs;
+    stats->skipped = s_time_sync.skipped;
+    stats->skipped_ratio = time_sync_skipped_ratio(&s_time_sync);
+    stats->drift_ppm = s_time_sync.drift_valid ? s_time_sync.drift_ppm : SNTP_DEFAULT_DRIFT_PPM;
+    stats->predicted_error_us = time_sync_predicted_error_us(&s_time_sync, &policy, system_time_us());
+
+    return ESP_OK;
+}
+
+static esp_err_t smartconfig_set_power_profile(wifi_t *wifi, power_profile_t profile)
+{
+    static const wifi_ps_type_t ps_types[] = {
+        [POWER_MODEM_SLEEP_NONE] = WIFI_PS_NONE,
+        [POWER_MODEM_SLEEP_MIN] = WIFI_PS_MIN_MODEM,
+        [POWER_MODEM_SLEEP_MAX] = WIFI_PS_MAX_MODEM,
+    };
+
+    smartconfig_t *smartconfig = __containerof(wifi, smartconfig_t, parent);
+    const power_profile_settings_t *settings = power_profile_settings(profile);
+
+    if (settings == NULL)
+    {
+        ESP_LOGE(TAG, "Unknown power profile %d", profile);
         return ESP_FAIL;
     }
-    timezone_value = (char *)malloc(timezone_size);
-    err = nvs_get_str(my_handle, TIMEZONE_VALUE, timezone_value, &timezone_size);
-    if (err != ESP_OK)
+
+    if (esp_wifi_set_ps(ps_types[settings->modem_sleep]) != ESP_OK)
     {
-        ESP_LOGE(TAG, "Failed to read value from NVS %d", err);
+        ESP_LOGE(TAG, "Failed to set modem sleep");
         return ESP_FAIL;
     }
-    nvs_close(my_handle);
+    smartconfig->listen_interval = settings->listen_interval;
 
-    ESP_LOGI(TAG, "NVS value %s", timezone_value);
-    ESP_LOGI(TAG, "NVS size %d", timezone_size);
+    return ESP_OK;
+}
 
-    // Set timezone
-    setenv(TIMEZONE_VALUE, timezone_value, 1);
-    tzset();
+static esp_err_t smartconfig_get_connect_info(wifi_t *wifi, wifi_connect_info_t *info)
+{
+    *info = s_connect_info;
 
     return ESP_OK;
 }
 
 wifi_t *wifi_new_smartconfig(const wifi_conf_t *config)
 {
+#ifdef CONFIG_SMART_MAILS_STATIC_ALLOC
+    // The driver state is file scope anyway, there is one instance per boot
+    static smartconfig_t s_smartconfig;
+    smartconfig_t *smartconfig = &s_smartconfig;
+
+    memset(smartconfig, 0, sizeof(*smartconfig));
+#else
     smartconfig_t *smartconfig = calloc(1, sizeof(smartconfig_t));
+#endif
 
     smartconfig->config.aes_key = config->aes_key;
     smartconfig->config.hostname = config->hostname;
     smartconfig->config.ntp_server = config->ntp_server;
+    smartconfig->config.fast_reconnect = config->fast_reconnect;
+    smartconfig->config.sntp_max_error_ms = config->sntp_max_error_ms;
+    smartconfig->config.connect_budget_ms = config->connect_budget_ms;
+    smartconfig->config.got_ip = config->got_ip;
+    smartconfig->config.got_ip_ctx = config->got_ip_ctx;
 
     smartconfig->parent.init = smartconfig_init;
     smartconfig->parent.connect = smartconfig_connect;
     smartconfig->parent.start = smartconfig_start;
     smartconfig->parent.stop = smartconfig_stop;
     smartconfig->parent.init_sntp = smartconfig_init_sntp;
+    smartconfig->parent.wait_sntp = smartconfig_wait_sntp;
     smartconfig->parent.init_timezone = smartconfig_init_timezone;
+    smartconfig->parent.get_connect_info = smartconfig_get_connect_info;
+    smartconfig->parent.get_sntp_stats = smartconfig_get_sntp_stats;
+    smartconfig->parent.set_power_profile = smartconfig_set_power_profile;
 
     return &smartconfig->parent;
 }
@@ -0,0 +1,155 @@
+// In-memory stand-in for the Realtime Database REST API, shared by server.js and tls-server.js.
+// GET, PUT, POST, PATCH (multi-path updates included) and DELETE on /<path>.json, print=silent.
+// Faults for exercising the firmware's retries:
+//   FAIL_PCT=20  answer that share of writes with a 503, without applying them
+//   DROP_PCT=20  apply that share of writes, then close the connection instead of answering
+var failPct = Number(process.env.FAIL_PCT || 0);
+var dropPct = Number(process.env.DROP_PCT || 0);
+
+var root = null;
+var pushes = 0;
+
+function keys(path) {
+  return path.replace(/\.json$/, '').split('/').filter(function (key) { return key.length > 0; });
+}
+
+function get(path) {
+  var node = root;
+  for (var i = 0; i < path.length; i++) {
+    if (node === null || typeof node !== 'object' || !(path[i] in node)) {
+      return null;
+    }
+    node = node[path[i]];
+  }
+  return node;
+}
+
+// null deletes, empty parents go with it like in the real database
+function set(path, value) {
+  if (path.length === 0) {
+    root = value;
+    return;
+  }
+  if (root === null || typeof root !== 'object') {
+    root = {};
+  }
+  var node = root;
+  var parents = [];
+  for (var i = 0; i < path.length - 1; i++) {
+    if (node[path[i]] === null || typeof node[path[i]] !== 'object') {
+      node[path[i]] = {};
+    }
+    parents.push(node);
+    node = node[path[i]];
+  }
+  if (value === null) {
+    delete node[path[path.length - 1]];
+    for (i = parents.length - 1; i >= 0 && Object.keys(node).length === 0; i--) {
+      delete parents[i][path[i]];
+      node = parents[i];
+    }
+  } else {
+    node[path[path.length - 1]] = value;
+  }
+}
+
+// One path of an update being a prefix of another is an error in the real database too
+function overlapping(paths) {
+  var sorted = paths.map(function (path) { return path.join('/') + '/'; }).sort();
+  for (var i = 1; i < sorted.length; i++) {
+    if (sorted[i].indexOf(sorted[i - 1]) === 0) {
+      return sorted[i - 1].slice(0, -1);
+    }
+  }
+  return null;
+}
+
+function invalid(paths) {
+  for (var i = 0; i < paths.length; i++) {
+    for (var j = 0; j < paths[i].length; j++) {
+      if (/[.$#\[\]]/.test(paths[i][j])) {
+        return paths[i][j];
+      }
+    }
+  }
+  return null;
+}
+
+// Returns [status, response body, a line for the console]
+function handle(method, path, body) {
+  var base = keys(path);
+  var unchanged = 0;
+  var paths;
+
+  if (invalid([base]) !== null) {
+    return [400, { error: 'Invalid path: ' + invalid([base]) }, ''];
+  }
+
+  switch (method) {
+    case 'GET':
+      return [200, get(base), ''];
+    case 'PUT':
+      unchanged = JSON.stringify(get(base)) === JSON.stringify(body);
+      set(base, body);
+      return [200, body, unchanged ? ', unchanged' : ''];
+    case 'POST':
+      var name = '-' + Date.now().toString(36) + (pushes++).toString(36);
+      set(base.concat(name), body);
+      return [200, { name: name }, ' as ' + name];
+    case 'PATCH':
+      if (body === null || typeof body !== 'object' || Array.isArray(body)) {
+        return [400, { error: 'Invalid data; couldn\'t parse JSON object.' }, ''];
+      }
+      paths = Object.keys(body).map(function (key) { return base.concat(keys(key)); });
+      if (invalid(paths) !== null) {
+        return [400, { error: 'Invalid path: ' + invalid(paths) }, ''];
+      }
+      var overlap = overlapping(paths);
+      if (overlap !== null) {
+        return [400, { error: 'Path ' + overlap + ' is an ancestor of another path in this update.' }, ''];
+      }
+      Object.keys(body).forEach(function (key, i) {
+        // The same value at the same path, e.g. a retry of a request whose response was lost
+        unchanged += JSON.stringify(get(paths[i])) === JSON.stringify(body[key]);
+        set(paths[i], body[key]);
+      });
+      return [200, body, ', ' + paths.length + ' paths, ' + unchanged + ' unchanged'];
+    case 'DELETE':
+      set(base, null);
+      return [200, null, ''];
+  }
+  return [405, { error: 'Method not allowed' }, ''];
+}
+
+function routes(app) {
+  app.all('/*.json', function (req, res) {
+    var socket = req.socket;
+    var length = Number(req.headers['content-length'] || 0);
+    var result;
+
+    socket.requests = (socket.requests || 0) + 1;
+    if (req.method !== 'GET' && Math.random() * 100 < failPct) {
+      console.log('%s %s: 503 injected', req.method, req.path);
+      res.status(503).json({ error: 'Injected failure' });
+      return;
+    }
+
+    result = handle(req.method, req.path, req.body === undefined ? null : req.body);
+    console.log('%s %s: %d, %d bytes, request %d on the connection%s', req.method, req.path, result[0], length,
+      socket.requests, result[2]);
+
+    if (req.method !== 'GET' && result[0] === 200 && Math.random() * 100 < dropPct) {
+      console.log('  applied, response dropped');
+      socket.destroy();
+      return;
+    }
+    // Like the real database, print=silent answers a write with an empty 204
+    if (req.method !== 'GET' && result[0] === 200 && req.query.print === 'silent') {
+      res.status(204).end();
+      return;
+    }
+    res.status(result[0]).json(result[1]);
+  });
+}
+
+module.exports = { handle: handle, routes: routes };
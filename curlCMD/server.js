@@ -1,12 +1,20 @@
-var app = require('express')();
+var express = require('express');
+var app = express();
 var bodyParser = require('body-parser');
+var rtdb = require('./rtdb');
 
 app.use(bodyParser.json()); // for parsing application/json
 app.use(bodyParser.urlencoded({ extended: true })); // for parsing application/x-www-form-urlencoded
 
+// Delta OTA patches, see host/delta_tool.c. Static files carry the Content-Length the firmware needs
+app.use('/ota', express.static('ota'));
+
 app.post('/data', function (req, res) {
   console.log(req.body);
   res.end();
 });
 
+// Plain HTTP stand-in for the Realtime Database, see host/upload_replay.c
+rtdb.routes(app);
+
 app.listen(3000);
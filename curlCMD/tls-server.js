@@ -0,0 +1,32 @@
+// Local TLS stand-in for the Realtime Database endpoint.
+// Generate a self-signed pair first:
+//   openssl req -x509 -newkey rsa:2048 -nodes -days 365 -subj "/CN=localhost" -keyout key.pem -out cert.pem
+var fs = require('fs');
+var https = require('https');
+var express = require('express');
+var app = express();
+var bodyParser = require('body-parser');
+var rtdb = require('./rtdb');
+
+var handshakes = { full: 0, resumed: 0 };
+
+app.use(bodyParser.json()); // for parsing application/json
+
+// Delta OTA patches, see host/delta_tool.c. Static files carry the Content-Length the firmware needs
+app.use('/ota', express.static('ota'));
+
+rtdb.routes(app);
+
+var server = https.createServer({
+  key: fs.readFileSync('key.pem'),
+  cert: fs.readFileSync('cert.pem'),
+  maxVersion: 'TLSv1.2',
+}, app);
+
+server.on('secureConnection', function (socket) {
+  var resumed = socket.isSessionReused();
+  handshakes[resumed ? 'resumed' : 'full']++;
+  console.log('%s handshake (%d full, %d resumed)', resumed ? 'resumed' : 'full', handshakes.full, handshakes.resumed);
+});
+
+server.listen(8443);
@@ -0,0 +1,181 @@
+// Replays recorded sensor edges through the mail debounce logic and prints what settled.
+//
+// Input lines are "<ms> <level>", one per edge, in time order; '#' starts a comment.
+// "<ms> wake" marks a deep sleep wake on an edge that was gone by the first sample.
+// Lines starting with '=' are the expected output, "= <ms> <result>" for every settled change and
+// "= drops <n> coalesced <n> bounces <n>" last. With the default policy, any difference exits non-zero.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mail_debounce.h"
+#include "wake_config.h"
+
+#define REPLAY_MAX_LINES 256
+#define REPLAY_LINE_LEN 64
+
+static const char *result_name[] = {
+    [MAIL_DEBOUNCE_NONE] = "none",
+    [MAIL_DEBOUNCE_DROP] = "drop",
+    [MAIL_DEBOUNCE_COALESCED] = "coalesced",
+    [MAIL_DEBOUNCE_CLEARED] = "cleared",
+};
+
+/* What the replay printed and what the file expects, in the "=" line format */
+static char s_actual[REPLAY_MAX_LINES][REPLAY_LINE_LEN];
+static char s_expected[REPLAY_MAX_LINES][REPLAY_LINE_LEN];
+static size_t s_num_actual;
+static size_t s_num_expected;
+
+static void replay_record(char lines[][REPLAY_LINE_LEN], size_t *count, const char *line)
+{
+    if (*count < REPLAY_MAX_LINES)
+    {
+        snprintf(lines[*count], REPLAY_LINE_LEN, "%s", line);
+    }
+    (*count)++;
+}
+
+static void replay_report(uint32_t ms, mail_debounce_result_t result)
+{
+    char line[REPLAY_LINE_LEN];
+
+    if (result != MAIL_DEBOUNCE_NONE)
+    {
+        printf("%10u ms  %s\n", ms, result_name[result]);
+        snprintf(line, sizeof(line), "%u %s", ms, result_name[result]);
+        replay_record(s_actual, &s_num_actual, line);
+    }
+}
+
+/* The expected lines with the '=' and the surrounding blanks stripped */
+static void replay_expect(const char *line)
+{
+    char expected[REPLAY_LINE_LEN];
+    size_t len;
+
+    line += strspn(line + 1, " \t") + 1;
+    snprintf(expected, sizeof(expected), "%s", line);
+    len = strcspn(expected, "\r\n");
+    while (len > 0 && (expected[len - 1] == ' ' || expected[len - 1] == '\t'))
+    {
+        len--;
+    }
+    expected[len] = '\0';
+    replay_record(s_expected, &s_num_expected, expected);
+}
+
+static int replay_check(const char *name)
+{
+    size_t count = s_num_actual > s_num_expected ? s_num_actual : s_num_expected;
+    int failed = 0;
+
+    if (count > REPLAY_MAX_LINES)
+    {
+        fprintf(stderr, "%s: more than %d results\n", name, REPLAY_MAX_LINES);
+        return 1;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        const char *actual = i < s_num_actual ? s_actual[i] : "(nothing)";
+        const char *expected = i < s_num_expected ? s_expected[i] : "(nothing)";
+
+        if (strcmp(actual, expected) != 0)
+        {
+            fprintf(stderr, "%s: result %zu is \"%s\", expected \"%s\"\n", name, i + 1, actual, expected);
+            failed = 1;
+        }
+    }
+
+    return failed;
+}
+
+int main(int argc, char **argv)
+{
+    mail_debounce_policy_t policy = {
+        .settle_ms = MAIL_SETTLE_MS,
+        .coalesce_ms = MAIL_COALESCE_MS,
+    };
+    mail_debounce_state_t state;
+    bool started = false;
+    char line[128];
+    char token[16];
+    uint32_t ms;
+    FILE *f = stdin;
+    int ret = 0;
+
+    if (argc > 1 && (f = fopen(argv[1], "r")) == NULL)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+    if (argc > 2)
+    {
+        policy.settle_ms = (uint32_t)strtoul(argv[2], NULL, 10);
+    }
+    if (argc > 3)
+    {
+        policy.coalesce_ms = (uint32_t)strtoul(argv[3], NULL, 10);
+    }
+
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        if (line[0] == '=')
+        {
+            replay_expect(line);
+            continue;
+        }
+        if (line[0] == '#' || sscanf(line, "%u %15s", &ms, token) != 2)
+        {
+            continue;
+        }
+        if (!started)
+        {
+            // The first line is the settled level at power on
+            mail_debounce_init(&state, atoi(token), ms);
+            started = true;
+            continue;
+        }
+
+        // The level held since the last edge settles as soon as settle_ms have passed
+        if (mail_debounce_pending(&state) && ms - state.raw_since_ms >= policy.settle_ms)
+        {
+            uint32_t settle_ms = state.raw_since_ms + policy.settle_ms;
+            replay_report(settle_ms, mail_debounce_feed(&state, &policy, settle_ms, state.raw_level));
+        }
+
+        if (strcmp(token, "wake") == 0)
+        {
+            replay_report(ms, mail_debounce_pulse(&state, &policy, ms));
+        }
+        else
+        {
+            replay_report(ms, mail_debounce_feed(&state, &policy, ms, atoi(token)));
+        }
+    }
+
+    if (started && mail_debounce_pending(&state))
+    {
+        ms = state.raw_since_ms + policy.settle_ms;
+        replay_report(ms, mail_debounce_feed(&state, &policy, ms, state.raw_level));
+    }
+
+    printf("drops %u, coalesced %u, bounces %u\n", state.drops, state.coalesced, state.bounces);
+    snprintf(line, sizeof(line), "drops %u coalesced %u bounces %u", state.drops, state.coalesced, state.bounces);
+    replay_record(s_actual, &s_num_actual, line);
+
+    // Without expectations, e.g. a new recording, or with another policy, the trace is all there is
+    if (s_num_expected > 0 && argc <= 2)
+    {
+        ret = replay_check(argc > 1 ? argv[1] : "stdin");
+        printf("%s\n", ret ? "FAILED" : "as expected");
+    }
+
+    if (f != stdin)
+    {
+        fclose(f);
+    }
+
+    return ret;
+}
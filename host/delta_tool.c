@@ -0,0 +1,598 @@
+// Delta OTA patches: build one between two firmware images and apply it with the firmware's
+// streaming engine, from a file or from a local HTTP stand-in, in the pieces the data arrives in.
+//
+//   delta_tool diff <old.bin> <new.bin> <patch>
+//   delta_tool apply <old.bin> <patch | http://host:port/path> <out.bin>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+#include "delta_patch.h"
+
+#define SEED_LEN 8          // shortest exact match the diff looks for
+#define HASH_BITS 20
+#define MAX_CHAIN 64        // candidates tried per position
+#define MAX_LONG_MATCH (18 + 255)
+#define APP_DESC_OFFSET 32  // esp_app_desc_t, after the image and first segment headers
+#define APP_DESC_MAGIC 0xABCD5432
+#define APP_ELF_SHA_OFFSET (APP_DESC_OFFSET + 144)
+
+typedef struct
+{
+    uint8_t *data;
+    size_t len;
+    size_t size;
+} buffer_t;
+
+static bool read_file(const char *path, buffer_t *buf)
+{
+    FILE *file = fopen(path, "rb");
+    long len;
+
+    if (file == NULL || fseek(file, 0, SEEK_END) != 0 || (len = ftell(file)) < 0)
+    {
+        fprintf(stderr, "cannot read %s\n", path);
+        return false;
+    }
+    rewind(file);
+    buf->data = malloc(len + 1);
+    buf->len = buf->size = len;
+    if (fread(buf->data, 1, len, file) != (size_t)len)
+    {
+        fprintf(stderr, "cannot read %s\n", path);
+        fclose(file);
+        return false;
+    }
+    fclose(file);
+
+    return true;
+}
+
+static bool write_file(const char *path, const void *data, size_t len)
+{
+    FILE *file = fopen(path, "wb");
+    bool ok = file != NULL && fwrite(data, 1, len, file) == len;
+
+    if (file != NULL)
+    {
+        fclose(file);
+    }
+    if (!ok)
+    {
+        fprintf(stderr, "cannot write %s\n", path);
+    }
+
+    return ok;
+}
+
+static void buffer_put(buffer_t *buf, const void *data, size_t len)
+{
+    if (buf->len + len > buf->size)
+    {
+        buf->size = (buf->len + len) * 2;
+        buf->data = realloc(buf->data, buf->size);
+    }
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+}
+
+static void buffer_put_byte(buffer_t *buf, uint8_t b)
+{
+    buffer_put(buf, &b, 1);
+}
+
+static void buffer_put_varint(buffer_t *buf, uint32_t v)
+{
+    while (v >= 0x80)
+    {
+        buffer_put_byte(buf, (v & 0x7F) | 0x80);
+        v >>= 7;
+    }
+    buffer_put_byte(buf, v);
+}
+
+static void buffer_put_u32(buffer_t *buf, uint32_t v)
+{
+    uint8_t p[4] = {v, v >> 8, v >> 16, v >> 24};
+
+    buffer_put(buf, p, sizeof(p));
+}
+
+static uint32_t hash_seed(const uint8_t *p)
+{
+    uint64_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return (uint32_t)((v * 0x9E3779B97F4A7C15ULL) >> (64 - HASH_BITS));
+}
+
+typedef struct
+{
+    const uint8_t *old;
+    size_t old_len;
+    int32_t *head;
+    int32_t *prev;
+} match_index_t;
+
+static void index_build(match_index_t *index, const uint8_t *old, size_t old_len)
+{
+    index->old = old;
+    index->old_len = old_len;
+    index->head = malloc(sizeof(int32_t) << HASH_BITS);
+    index->prev = malloc(sizeof(int32_t) * (old_len + 1));
+    memset(index->head, 0xFF, sizeof(int32_t) << HASH_BITS);
+
+    for (size_t i = 0; i + SEED_LEN <= old_len; i++)
+    {
+        uint32_t h = hash_seed(old + i);
+        index->prev[i] = index->head[h];
+        index->head[h] = (int32_t)i;
+    }
+}
+
+/* Longest exact match of new[0..] in the old image, 0 if shorter than a seed */
+static size_t index_search(const match_index_t *index, const uint8_t *new, size_t new_len, size_t *pos)
+{
+    size_t best = 0;
+    int chain = 0;
+
+    if (new_len < SEED_LEN)
+    {
+        return 0;
+    }
+    for (int32_t c = index->head[hash_seed(new)]; c >= 0 && chain < MAX_CHAIN; c = index->prev[c], chain++)
+    {
+        size_t n = 0;
+        size_t limit = index->old_len - c < new_len ? index->old_len - c : new_len;
+        while (n < limit && index->old[c + n] == new[n])
+        {
+            n++;
+        }
+        if (n > best)
+        {
+            best = n;
+            *pos = c;
+        }
+    }
+
+    return best >= SEED_LEN ? best : 0;
+}
+
+static void emit_control(buffer_t *ops, const uint8_t *old, const uint8_t *new, size_t lastscan, size_t lastpos,
+                         size_t lenf, size_t insert_len, int64_t seek)
+{
+    buffer_put_varint(ops, lenf);
+    buffer_put_varint(ops, insert_len);
+    buffer_put_varint(ops, (uint32_t)((seek << 1) ^ (seek >> 63)));
+    for (size_t i = 0; i < lenf; i++)
+    {
+        buffer_put_byte(ops, new[lastscan + i] - old[lastpos + i]);
+    }
+    buffer_put(ops, new + lastscan + lenf, insert_len);
+}
+
+/**
+ * @brief bsdiff's control loop, with hash chains instead of a suffix array
+ *
+ * Regions that mostly match an aligned part of the old image become add data, mostly
+ * zero since relinked code only changes in addresses, which the LZSS pass then squeezes.
+ */
+static void make_ops(const uint8_t *old, size_t old_len, const uint8_t *new, size_t new_len, buffer_t *ops)
+{
+    match_index_t index;
+    size_t scan = 0, len = 0, pos = 0;
+    size_t lastscan = 0, lastpos = 0;
+    int64_t lastoffset = 0;
+
+    index_build(&index, old, old_len);
+
+    while (scan < new_len)
+    {
+        int64_t oldscore = 0;
+        size_t scsc;
+
+        for (scsc = scan += len; scan < new_len; scan++)
+        {
+            len = index_search(&index, new + scan, new_len - scan, &pos);
+
+            for (; scsc < scan + len; scsc++)
+            {
+                if ((int64_t)scsc + lastoffset >= 0 && (int64_t)scsc + lastoffset < (int64_t)old_len &&
+                    old[scsc + lastoffset] == new[scsc])
+                {
+                    oldscore++;
+                }
+            }
+            if (((int64_t)len == oldscore && len != 0) || (int64_t)len > oldscore + SEED_LEN)
+            {
+                break;
+            }
+            if ((int64_t)scan + lastoffset >= 0 && (int64_t)scan + lastoffset < (int64_t)old_len &&
+                old[scan + lastoffset] == new[scan])
+            {
+                oldscore--;
+            }
+        }
+
+        if ((int64_t)len != oldscore || scan == new_len)
+        {
+            int64_t s = 0, sf = 0, sb = 0;
+            size_t lenf = 0, lenb = 0;
+
+            for (size_t i = 0; lastscan + i < scan && lastpos + i < old_len;)
+            {
+                if (old[lastpos + i] == new[lastscan + i])
+                {
+                    s++;
+                }
+                i++;
+                if (s * 2 - (int64_t)i > sf * 2 - (int64_t)lenf)
+                {
+                    sf = s;
+                    lenf = i;
+                }
+            }
+
+            if (scan < new_len)
+            {
+                s = 0;
+                for (size_t i = 1; scan >= lastscan + i && pos >= i; i++)
+                {
+                    if (old[pos - i] == new[scan - i])
+                    {
+                        s++;
+                    }
+                    if (s * 2 - (int64_t)i > sb * 2 - (int64_t)lenb)
+                    {
+                        sb = s;
+                        lenb = i;
+                    }
+                }
+            }
+
+            if (lastscan + lenf > scan - lenb)
+            {
+                size_t overlap = (lastscan + lenf) - (scan - lenb);
+                size_t lens = 0;
+                int64_t ss = 0;
+                s = 0;
+                for (size_t i = 0; i < overlap; i++)
+                {
+                    if (new[lastscan + lenf - overlap + i] == old[lastpos + lenf - overlap + i])
+                    {
+                        s++;
+                    }
+                    if (new[scan - lenb + i] == old[pos - lenb + i])
+                    {
+                        s--;
+                    }
+                    if (s > ss)
+                    {
+                        ss = s;
+                        lens = i + 1;
+                    }
+                }
+                lenf += lens - overlap;
+                lenb -= lens;
+            }
+
+            emit_control(ops, old, new, lastscan, lastpos, lenf, (scan - lenb) - (lastscan + lenf),
+                         (int64_t)(pos - lenb) - (int64_t)(lastpos + lenf));
+
+            lastscan = scan - lenb;
+            lastpos = pos - lenb;
+            lastoffset = (int64_t)pos - (int64_t)scan;
+        }
+    }
+
+    free(index.head);
+    free(index.prev);
+}
+
+/* LZSS as decoded by delta_patch_feed(), greedy with hash chains over the window */
+static void compress(const uint8_t *in, size_t len, buffer_t *out)
+{
+    int32_t *head = malloc(sizeof(int32_t) << 16);
+    int32_t *prev = malloc(sizeof(int32_t) * (len + 1));
+    size_t flags_at = 0;
+    int items = 8;
+
+    memset(head, 0xFF, sizeof(int32_t) << 16);
+
+    for (size_t i = 0; i < len;)
+    {
+        size_t best = 0, best_dist = 0;
+
+        if (i + DELTA_PATCH_MIN_MATCH <= len)
+        {
+            uint32_t h = (in[i] << 8 ^ in[i + 1] << 4 ^ in[i + 2]) & 0xFFFF;
+            int chain = 0;
+            for (int32_t c = head[h]; c >= 0 && i - c <= DELTA_PATCH_WINDOW_SIZE && chain < MAX_CHAIN;
+                 c = prev[c], chain++)
+            {
+                size_t n = 0;
+                while (i + n < len && n < MAX_LONG_MATCH && in[c + n] == in[i + n])
+                {
+                    n++;
+                }
+                if (n > best)
+                {
+                    best = n;
+                    best_dist = i - c;
+                }
+            }
+        }
+
+        if (items == 8)
+        {
+            flags_at = out->len;
+            buffer_put_byte(out, 0);
+            items = 0;
+        }
+
+        size_t step = best >= DELTA_PATCH_MIN_MATCH ? best : 1;
+        if (step == 1)
+        {
+            out->data[flags_at] |= 1 << items;
+            buffer_put_byte(out, in[i]);
+        }
+        else
+        {
+            size_t d = best_dist - 1;
+            size_t code = best - DELTA_PATCH_MIN_MATCH;
+            buffer_put_byte(out, d & 0xFF);
+            if (code < 15)
+            {
+                buffer_put_byte(out, (d >> 8) << 4 | code);
+            }
+            else
+            {
+                buffer_put_byte(out, (d >> 8) << 4 | 15);
+                buffer_put_byte(out, best - 18);
+            }
+        }
+        items++;
+
+        for (size_t n = 0; n < step; n++, i++)
+        {
+            if (i + DELTA_PATCH_MIN_MATCH <= len)
+            {
+                uint32_t h = (in[i] << 8 ^ in[i + 1] << 4 ^ in[i + 2]) & 0xFFFF;
+                prev[i] = head[h];
+                head[h] = (int32_t)i;
+            }
+        }
+    }
+
+    free(head);
+    free(prev);
+}
+
+static int cmd_diff(const char *old_path, const char *new_path, const char *patch_path)
+{
+    buffer_t old, new, ops = {0}, patch = {0};
+
+    if (!read_file(old_path, &old) || !read_file(new_path, &new))
+    {
+        return 1;
+    }
+
+    make_ops(old.data, old.len, new.data, new.len, &ops);
+
+    buffer_put_u32(&patch, DELTA_PATCH_MAGIC);
+    buffer_put_u32(&patch, old.len);
+    buffer_put_u32(&patch, delta_patch_crc32(0, old.data, old.len));
+    buffer_put_u32(&patch, new.len);
+    buffer_put_u32(&patch, delta_patch_crc32(0, new.data, new.len));
+    compress(ops.data, ops.len, &patch);
+
+    if (!write_file(patch_path, patch.data, patch.len))
+    {
+        return 1;
+    }
+
+    printf("new image %zu bytes, ops %zu bytes, patch %zu bytes (%.1f%% of the image)\n",
+           new.len, ops.len, patch.len, 100.0 * patch.len / new.len);
+
+    // The firmware asks for <prefix>/<first 8 bytes of the running ELF SHA-256>.patch
+    uint32_t magic;
+    if (old.len >= APP_ELF_SHA_OFFSET + 8 && (memcpy(&magic, old.data + APP_DESC_OFFSET, 4), magic == APP_DESC_MAGIC))
+    {
+        printf("serve as ota/");
+        for (int i = 0; i < 8; i++)
+        {
+            printf("%02x", old.data[APP_ELF_SHA_OFFSET + i]);
+        }
+        printf(".patch\n");
+    }
+
+    return 0;
+}
+
+typedef struct
+{
+    buffer_t old;
+    FILE *out;
+    size_t written;
+} apply_ctx_t;
+
+static bool apply_begin(void *ctx, const delta_patch_header_t *header)
+{
+    apply_ctx_t *apply = ctx;
+
+    if (header->old_size != apply->old.len || header->old_crc != delta_patch_crc32(0, apply->old.data, apply->old.len))
+    {
+        fprintf(stderr, "patch is for another image\n");
+        return false;
+    }
+
+    return true;
+}
+
+static bool apply_read_old(void *ctx, uint32_t offset, void *buf, size_t len)
+{
+    apply_ctx_t *apply = ctx;
+
+    if (offset + len > apply->old.len)
+    {
+        return false;
+    }
+    memcpy(buf, apply->old.data + offset, len);
+
+    return true;
+}
+
+static bool apply_write_new(void *ctx, const void *data, size_t len)
+{
+    apply_ctx_t *apply = ctx;
+
+    apply->written += len;
+    return fwrite(data, 1, len, apply->out) == len;
+}
+
+/* Plain HTTP GET, the body is returned in the pieces recv() hands out */
+static int http_open(const char *url, size_t *body_len, uint8_t *buf, size_t size)
+{
+    char host[128], port[8] = "80";
+    const char *path;
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM}, *res;
+    char request[512];
+    size_t received = 0;
+    char *end;
+    int status;
+    int fd;
+
+    if (sscanf(url, "http://%127[^:/]", host) != 1 || (path = strchr(url + 7, '/')) == NULL)
+    {
+        return -1;
+    }
+    sscanf(url + 7 + strlen(host), ":%7[0-9]", port);
+    if (getaddrinfo(host, port, &hints, &res) != 0)
+    {
+        return -1;
+    }
+    fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (fd < 0 || connect(fd, res->ai_addr, res->ai_addrlen) != 0)
+    {
+        freeaddrinfo(res);
+        return -1;
+    }
+    freeaddrinfo(res);
+
+    snprintf(request, sizeof(request), "GET %s HTTP/1.0\r\nHost: %s\r\n\r\n", path, host);
+    if (send(fd, request, strlen(request), 0) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    do
+    {
+        ssize_t n = recv(fd, buf + received, size - 1 - received, 0);
+        if (n <= 0)
+        {
+            close(fd);
+            return -1;
+        }
+        received += n;
+        buf[received] = '\0';
+    } while ((end = strstr((char *)buf, "\r\n\r\n")) == NULL && received < size - 1);
+
+    if (end == NULL || sscanf((char *)buf, "HTTP/%*d.%*d %d", &status) != 1 || status != 200)
+    {
+        fprintf(stderr, "GET %s failed\n", url);
+        close(fd);
+        return -1;
+    }
+
+    *body_len = received - ((uint8_t *)end + 4 - buf);
+    memmove(buf, end + 4, *body_len);
+
+    return fd;
+}
+
+static int cmd_apply(const char *old_path, const char *source, const char *out_path)
+{
+    static delta_patch_t patch;
+    apply_ctx_t apply = {0};
+    delta_patch_io_t io = {
+        .begin = apply_begin,
+        .read_old = apply_read_old,
+        .write_new = apply_write_new,
+        .ctx = &apply,
+    };
+    uint8_t buf[1460];
+    size_t total = 0, pieces = 0;
+    delta_patch_status_t status = DELTA_PATCH_MORE;
+
+    if (!read_file(old_path, &apply.old) || (apply.out = fopen(out_path, "wb")) == NULL)
+    {
+        return 1;
+    }
+    delta_patch_init(&patch, &io);
+
+    if (strncmp(source, "http://", 7) == 0)
+    {
+        size_t len;
+        int fd = http_open(source, &len, buf, sizeof(buf));
+        if (fd < 0)
+        {
+            return 1;
+        }
+        // Whatever came with the response header first, then each recv() as it arrives
+        ssize_t n = len > 0 ? (ssize_t)len : recv(fd, buf, sizeof(buf), 0);
+        for (; status == DELTA_PATCH_MORE && n > 0; n = recv(fd, buf, sizeof(buf), 0))
+        {
+            status = delta_patch_feed(&patch, buf, n);
+            total += n;
+            pieces++;
+        }
+        close(fd);
+    }
+    else
+    {
+        FILE *file = fopen(source, "rb");
+        if (file == NULL)
+        {
+            fprintf(stderr, "cannot read %s\n", source);
+            return 1;
+        }
+        // Odd piece sizes, so tokens and varints get split
+        for (size_t n; status == DELTA_PATCH_MORE && (n = fread(buf, 1, 1 + rand() % 300, file)) > 0;)
+        {
+            status = delta_patch_feed(&patch, buf, n);
+            total += n;
+            pieces++;
+        }
+        fclose(file);
+    }
+    fclose(apply.out);
+
+    printf("%s: %zu patch bytes in %zu pieces, %zu image bytes written, %zu bytes of patch state\n",
+           status == DELTA_PATCH_DONE ? "done" : status == DELTA_PATCH_MORE ? "truncated" : "failed",
+           total, pieces, apply.written, sizeof(patch));
+
+    return status == DELTA_PATCH_DONE ? 0 : 1;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc == 5 && strcmp(argv[1], "diff") == 0)
+    {
+        return cmd_diff(argv[2], argv[3], argv[4]);
+    }
+    if (argc == 5 && strcmp(argv[1], "apply") == 0)
+    {
+        return cmd_apply(argv[2], argv[3], argv[4]);
+    }
+
+    fprintf(stderr, "usage: %s diff <old.bin> <new.bin> <patch>\n"
+                    "       %s apply <old.bin> <patch | http://host:port/path> <out.bin>\n",
+            argv[0], argv[0]);
+    return 1;
+}
@@ -0,0 +1,194 @@
+// Deferred log decoder: prints the records of the dlog ring, from a console dump (DLOG lines)
+// or from uploaded log entries ("log" fields), with the formats and tags of the firmware ELF file.
+//   dlog_decode build/smart-mails.elf [dump.txt]
+
+#include <elf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dlog_ring.h"
+
+#define LINE_MAX_LEN 512
+
+static uint8_t *s_elf;
+static size_t s_elf_size;
+
+static uint8_t *read_file(FILE *file, size_t *size)
+{
+    uint8_t *data = NULL;
+    size_t capacity = 0;
+    size_t n;
+
+    *size = 0;
+    do
+    {
+        if (*size == capacity)
+        {
+            capacity = capacity ? 2 * capacity : 65536;
+            data = realloc(data, capacity + 1);
+        }
+        n = fread(data + *size, 1, capacity - *size, file);
+        *size += n;
+    } while (n > 0);
+    data[*size] = '\0';
+
+    return data;
+}
+
+/* Firmware strings live in the sections loaded from flash or into DRAM */
+static const char *elf_string(uint32_t addr)
+{
+    const Elf32_Ehdr *ehdr = (const Elf32_Ehdr *)s_elf;
+    const Elf32_Shdr *shdr;
+
+    for (int i = 0; i < ehdr->e_shnum; i++)
+    {
+        shdr = (const Elf32_Shdr *)(s_elf + ehdr->e_shoff + (size_t)i * ehdr->e_shentsize);
+        if (shdr->sh_type != SHT_PROGBITS || addr < shdr->sh_addr || addr >= shdr->sh_addr + shdr->sh_size ||
+            shdr->sh_offset + shdr->sh_size > s_elf_size)
+        {
+            continue;
+        }
+
+        const char *s = (const char *)s_elf + shdr->sh_offset + (addr - shdr->sh_addr);
+        if (memchr(s, '\0', shdr->sh_addr + shdr->sh_size - addr) != NULL)
+        {
+            return s;
+        }
+    }
+
+    return NULL;
+}
+
+static bool elf_load(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    const Elf32_Ehdr *ehdr;
+
+    if (file == NULL)
+    {
+        perror(path);
+        return false;
+    }
+    s_elf = read_file(file, &s_elf_size);
+    fclose(file);
+
+    ehdr = (const Elf32_Ehdr *)s_elf;
+    if (s_elf_size < sizeof(*ehdr) || memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0 ||
+        ehdr->e_ident[EI_CLASS] != ELFCLASS32 || ehdr->e_ident[EI_DATA] != ELFDATA2LSB ||
+        ehdr->e_shoff + (size_t)ehdr->e_shnum * ehdr->e_shentsize > s_elf_size)
+    {
+        fprintf(stderr, "%s: not a 32 bit little endian ELF file\n", path);
+        return false;
+    }
+
+    return true;
+}
+
+static size_t hex_decode(const char *hex, uint8_t *out, size_t size)
+{
+    size_t n = 0;
+    unsigned byte;
+
+    while (n < size && sscanf(hex, "%2x", &byte) == 1 && strspn(hex, "0123456789abcdefABCDEF") >= 2)
+    {
+        out[n++] = (uint8_t)byte;
+        hex += 2;
+    }
+
+    return n;
+}
+
+static void decode_stream(const uint8_t *data, size_t len)
+{
+    dlog_record_t record;
+    char text[LINE_MAX_LEN];
+    const char *format;
+    const char *tag;
+    size_t offset = 0;
+    size_t size;
+
+    while ((size = dlog_record_parse(data + offset, len - offset, &record)) > 0)
+    {
+        offset += size;
+        if (record.format == 0)
+        {
+            dlog_record_format(&record, DLOG_WAKE_FORMAT, text, sizeof(text));
+            printf("--- %s\n", text);
+            continue;
+        }
+
+        format = elf_string(record.format);
+        tag = elf_string(record.tag);
+        if (format == NULL)
+        {
+            printf("[%10.3f] format 0x%08x not in the ELF file, built from other sources?\n",
+                   record.timestamp_us / 1e6, record.format);
+            continue;
+        }
+        dlog_record_format(&record, format, text, sizeof(text));
+        printf("[%10.3f] %s: %s\n", record.timestamp_us / 1e6, tag != NULL ? tag : "?", text);
+    }
+
+    if (offset < len)
+    {
+        printf("%zu trailing bytes\n", len - offset);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    FILE *input = stdin;
+    uint8_t *text;
+    size_t text_size;
+    uint8_t *dump;
+    size_t dump_len = 0;
+    uint8_t *stream;
+    size_t stream_len;
+    const char *p;
+
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s firmware.elf [dump.txt]\n", argv[0]);
+        return 1;
+    }
+    if (!elf_load(argv[1]))
+    {
+        return 1;
+    }
+    if (argc > 2 && (input = fopen(argv[2], "r")) == NULL)
+    {
+        perror(argv[2]);
+        return 1;
+    }
+    text = read_file(input, &text_size);
+    dump = malloc(text_size / 2 + 1);
+    stream = malloc(text_size / 2 + 1);
+
+    // Each uploaded entry is a stream of its own, the DLOG lines of a console dump are one stream
+    for (char *line = strtok((char *)text, "\n"); line != NULL; line = strtok(NULL, "\n"))
+    {
+        if ((p = strstr(line, "DLOG ")) != NULL)
+        {
+            dump_len += hex_decode(p + 5, dump + dump_len, text_size / 2 - dump_len);
+            continue;
+        }
+        for (p = line; (p = strstr(p, "\"log\":\"")) != NULL; p += 7)
+        {
+            stream_len = hex_decode(p + 7, stream, text_size / 2);
+            decode_stream(stream, stream_len);
+        }
+    }
+    if (dump_len > 0)
+    {
+        decode_stream(dump, dump_len);
+    }
+
+    free(stream);
+    free(dump);
+    free(text);
+    free(s_elf);
+
+    return 0;
+}
@@ -0,0 +1,308 @@
+// ESP-NOW reporting over a simulated lossy link: pairing, ack and retry, failover between
+// gateways and duplicate suppression, with the radio-on time per report.
+//
+//   espnow_bench [reports] [seed]
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "espnow_link.h"
+#include "wake_config.h"
+
+#define SIM_MAX_GATEWAYS 2
+#define SIM_RX_QUEUE 8
+#define SIM_AIRTIME_MS 1    // a full frame at the 1 Mbps ESP-NOW rate
+#define SIM_TURNAROUND_MS 2 // gateway receive to ack
+#define SIM_RADIO_START_MS 40 // esp_wifi_init() and esp_wifi_start() with RTC calibration data
+#define SIM_EVENT_SIZE 8      // one packed event_batch_event_t
+#define SIM_REPAIR_EVERY 100  // reports between pairing attempts with an empty table, the daily sync wake
+
+typedef struct
+{
+    uint8_t mac[ESPNOW_LINK_MAC_LEN];
+    uint8_t channel;
+    bool up;
+    uint32_t session;
+    uint32_t last_seq; /*!< last forwarded seq of the session */
+    uint32_t forwarded;
+    uint32_t duplicates; /*!< retransmissions recognized and not forwarded again */
+} sim_gateway_t;
+
+typedef struct
+{
+    uint32_t arrive_ms;
+    uint8_t mac[ESPNOW_LINK_MAC_LEN];
+    size_t len;
+    uint8_t data[ESPNOW_LINK_MAX_FRAME];
+} sim_rx_t;
+
+typedef struct
+{
+    uint32_t clock_ms;
+    uint8_t channel;
+    uint8_t loss_pct; /*!< per frame, each direction */
+    sim_gateway_t gateways[SIM_MAX_GATEWAYS];
+    int num_gateways;
+    sim_rx_t rx[SIM_RX_QUEUE];
+    int rx_count;
+} sim_link_t;
+
+typedef struct
+{
+    const char *name;
+    uint8_t loss_pct;
+    int num_gateways;
+    bool first_fails; /*!< the first gateway goes down halfway */
+} scenario_t;
+
+static uint32_t s_rng = 1;
+
+static uint32_t sim_random(void)
+{
+    s_rng ^= s_rng << 13;
+    s_rng ^= s_rng >> 17;
+    s_rng ^= s_rng << 5;
+
+    return s_rng;
+}
+
+static bool sim_lost(const sim_link_t *link)
+{
+    return sim_random() % 100 < link->loss_pct;
+}
+
+static void sim_reply(sim_link_t *link, const sim_gateway_t *gateway, const espnow_link_frame_t *request, uint8_t type)
+{
+    espnow_link_frame_t reply = {
+        .type = type,
+        .channel = gateway->channel,
+        .session = request->session,
+        .seq = request->seq,
+    };
+
+    if (sim_lost(link) || link->rx_count == SIM_RX_QUEUE)
+    {
+        return;
+    }
+
+    sim_rx_t *rx = &link->rx[link->rx_count++];
+    rx->arrive_ms = link->clock_ms + SIM_TURNAROUND_MS + SIM_AIRTIME_MS;
+    memcpy(rx->mac, gateway->mac, ESPNOW_LINK_MAC_LEN);
+    rx->len = espnow_link_encode(&reply, rx->data, sizeof(rx->data));
+}
+
+/* What a gateway does with a frame: forward new data once, ack every copy, answer pairing */
+static void sim_gateway_receive(sim_link_t *link, sim_gateway_t *gateway, const void *data, size_t len)
+{
+    espnow_link_frame_t frame;
+
+    if (!espnow_link_decode(data, len, &frame))
+    {
+        return;
+    }
+
+    switch (frame.type)
+    {
+    case ESPNOW_LINK_FRAME_PAIR_REQ:
+        sim_reply(link, gateway, &frame, ESPNOW_LINK_FRAME_PAIR_RESP);
+        break;
+    case ESPNOW_LINK_FRAME_DATA:
+        if (frame.session != gateway->session || frame.seq > gateway->last_seq)
+        {
+            gateway->session = frame.session;
+            gateway->last_seq = frame.seq;
+            gateway->forwarded++;
+        }
+        else
+        {
+            gateway->duplicates++;
+        }
+        sim_reply(link, gateway, &frame, ESPNOW_LINK_FRAME_ACK);
+        break;
+    default:
+        break;
+    }
+}
+
+static bool sim_send(void *ctx, const uint8_t mac[ESPNOW_LINK_MAC_LEN], const void *data, size_t len)
+{
+    static const uint8_t broadcast[ESPNOW_LINK_MAC_LEN] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+    sim_link_t *link = ctx;
+
+    link->clock_ms += SIM_AIRTIME_MS;
+    for (int i = 0; i < link->num_gateways; i++)
+    {
+        sim_gateway_t *gateway = &link->gateways[i];
+        if (gateway->up && gateway->channel == link->channel && !sim_lost(link) &&
+            (memcmp(mac, broadcast, ESPNOW_LINK_MAC_LEN) == 0 || memcmp(mac, gateway->mac, ESPNOW_LINK_MAC_LEN) == 0))
+        {
+            sim_gateway_receive(link, gateway, data, len);
+        }
+    }
+
+    return true;
+}
+
+static size_t sim_recv(void *ctx, uint8_t mac[ESPNOW_LINK_MAC_LEN], void *buf, size_t size, uint32_t timeout_ms)
+{
+    sim_link_t *link = ctx;
+    int first = -1;
+
+    for (int i = 0; i < link->rx_count; i++)
+    {
+        if (link->rx[i].arrive_ms <= link->clock_ms + timeout_ms &&
+            (first < 0 || link->rx[i].arrive_ms < link->rx[first].arrive_ms))
+        {
+            first = i;
+        }
+    }
+    if (first < 0)
+    {
+        link->clock_ms += timeout_ms;
+        return 0;
+    }
+
+    sim_rx_t rx = link->rx[first];
+    link->rx[first] = link->rx[--link->rx_count];
+    if (rx.arrive_ms > link->clock_ms)
+    {
+        link->clock_ms = rx.arrive_ms;
+    }
+    if (rx.len > size)
+    {
+        return 0;
+    }
+    memcpy(mac, rx.mac, ESPNOW_LINK_MAC_LEN);
+    memcpy(buf, rx.data, rx.len);
+
+    return rx.len;
+}
+
+static bool sim_set_channel(void *ctx, uint8_t channel)
+{
+    sim_link_t *link = ctx;
+
+    // Whatever was in flight on the old channel is gone
+    link->channel = channel;
+    link->rx_count = 0;
+
+    return true;
+}
+
+static uint32_t sim_now_ms(void *ctx)
+{
+    return ((sim_link_t *)ctx)->clock_ms;
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void run_scenario(const scenario_t *scenario, uint32_t reports, uint32_t seed)
+{
+    static const espnow_link_policy_t policy = {
+        .ack_timeout_ms = ESPNOW_ACK_TIMEOUT_MS,
+        .pair_window_ms = ESPNOW_PAIR_WINDOW_MS,
+        .channel_mask = ESPNOW_CHANNEL_MASK,
+        .max_retries = ESPNOW_MAX_RETRIES,
+        .max_misses = ESPNOW_MAX_MISSES,
+    };
+    sim_link_t link = {.loss_pct = scenario->loss_pct, .num_gateways = scenario->num_gateways};
+    espnow_link_radio_t radio = {
+        .send = sim_send,
+        .recv = sim_recv,
+        .set_channel = sim_set_channel,
+        .now_ms = sim_now_ms,
+        .ctx = &link,
+    };
+    espnow_link_t state = {0};
+    uint8_t payload[2 * SIM_EVENT_SIZE] = {0};
+    uint32_t *on_ms = malloc(reports * sizeof(uint32_t));
+    uint32_t forwarded = 0, duplicates = 0;
+    uint64_t total_ms = 0;
+    uint32_t pair_ms;
+    uint32_t last_pair = 0;
+
+    s_rng = seed;
+    for (int i = 0; i < link.num_gateways; i++)
+    {
+        link.gateways[i] = (sim_gateway_t){.mac = {0x24, 0x0A, 0xC4, 0, 0, i + 1}, .channel = 6, .up = true};
+    }
+
+    espnow_link_init(&state, sim_random());
+    link.clock_ms = 0;
+    espnow_link_pair(&state, &radio, &policy, sim_random());
+    pair_ms = link.clock_ms;
+
+    for (uint32_t r = 0; r < reports; r++)
+    {
+        if (scenario->first_fails && r == reports / 2)
+        {
+            link.gateways[0].up = false;
+        }
+
+        uint32_t start_ms = link.clock_ms;
+        link.clock_ms += SIM_RADIO_START_MS;
+        link.rx_count = 0;
+        if (espnow_link_send(&state, &radio, &policy, payload, sizeof(payload)) == ESP_ERR_NOT_FOUND &&
+            r - last_pair >= SIM_REPAIR_EVERY)
+        {
+            espnow_link_pair(&state, &radio, &policy, sim_random());
+            last_pair = r;
+        }
+        on_ms[r] = link.clock_ms - start_ms;
+        total_ms += on_ms[r];
+    }
+
+    for (int i = 0; i < link.num_gateways; i++)
+    {
+        forwarded += link.gateways[i].forwarded;
+        duplicates += link.gateways[i].duplicates;
+    }
+    qsort(on_ms, reports, sizeof(uint32_t), compare_u32);
+
+    printf("%-22s acked %5.1f%%  forwarded %5" PRIu32 "  dups filtered %4" PRIu32 "  retries %5" PRIu32
+           "  peers %d  pairings %2" PRIu32 "  pair %4" PRIu32 " ms  on mean %5.1f p95 %4" PRIu32 " max %4" PRIu32 " ms\n",
+           scenario->name, 100.0 * state.stats.acked / reports, forwarded, duplicates, state.stats.retries,
+           state.num_peers, state.stats.pairings, pair_ms, (double)total_ms / reports, on_ms[reports * 95 / 100], on_ms[reports - 1]);
+    if (forwarded < state.stats.acked)
+    {
+        printf("  LOST: %" PRIu32 " acked frames were never forwarded\n", state.stats.acked - forwarded);
+    }
+
+    free(on_ms);
+}
+
+int main(int argc, char **argv)
+{
+    static const scenario_t scenarios[] = {
+        {"clean", 0, 1, false},
+        {"10% loss", 10, 1, false},
+        {"30% loss", 30, 1, false},
+        {"30% loss, 2 gateways", 30, 2, false},
+        {"gateway fails", 5, 2, true},
+        {"only gateway fails", 5, 1, true},
+    };
+    uint32_t reports = argc > 1 ? strtoul(argv[1], NULL, 0) : 10000;
+    uint32_t seed = argc > 2 ? strtoul(argv[2], NULL, 0) : 1;
+
+    if (reports == 0 || seed == 0)
+    {
+        fprintf(stderr, "usage: %s [reports] [seed]\n", argv[0]);
+        return 1;
+    }
+
+    printf("%" PRIu32 " reports of %d bytes, ack timeout %d ms, %d retries, radio start %d ms\n",
+           reports, 2 * SIM_EVENT_SIZE, ESPNOW_ACK_TIMEOUT_MS, ESPNOW_MAX_RETRIES, SIM_RADIO_START_MS);
+    for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++)
+    {
+        run_scenario(&scenarios[i], reports, seed);
+    }
+
+    return 0;
+}
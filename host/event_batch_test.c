@@ -0,0 +1,184 @@
+// Host test of the event ring and flush policy: overflow, CRC reset, peek/consume and the flush thresholds.
+// Exits non-zero on the first failed check.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "event_batch.h"
+
+#define CHECK(cond)                                                                   \
+    do                                                                                \
+    {                                                                                 \
+        if (!(cond))                                                                  \
+        {                                                                             \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            exit(1);                                                                  \
+        }                                                                             \
+    } while (0)
+
+static const event_batch_policy_t policy = {
+    .max_events = 4,
+    .max_age_sec = 600,
+};
+
+static void push_mail(event_batch_ring_t *ring, uint32_t timestamp, uint16_t value)
+{
+    event_batch_event_t event = {
+        .timestamp = timestamp,
+        .type = EVENT_BATCH_MAIL,
+        .value = value,
+    };
+
+    event_batch_push(ring, &event);
+}
+
+static void fresh_ring(event_batch_ring_t *ring)
+{
+    // Garbage, as RTC memory after power on
+    memset(ring, 0xA5, sizeof(*ring));
+    CHECK(!event_batch_init(ring));
+    CHECK(event_batch_count(ring) == 0);
+    CHECK(ring->dropped == 0);
+}
+
+static void test_init_keeps_valid_ring(void)
+{
+    event_batch_ring_t ring;
+
+    fresh_ring(&ring);
+    push_mail(&ring, 100, 1);
+    push_mail(&ring, 101, 2);
+    CHECK(event_batch_init(&ring));
+    CHECK(event_batch_count(&ring) == 2);
+}
+
+static void test_crc_mismatch_resets(void)
+{
+    event_batch_ring_t ring;
+    event_batch_event_t event;
+
+    fresh_ring(&ring);
+    push_mail(&ring, 100, 1);
+    push_mail(&ring, 101, 2);
+
+    // A flipped bit in an event is caught, not only one in the indices
+    ring.events[1].value ^= 0x40;
+    CHECK(!event_batch_init(&ring));
+    CHECK(event_batch_count(&ring) == 0);
+    CHECK(!event_batch_peek(&ring, 0, &event));
+}
+
+static void test_push_overflow(void)
+{
+    event_batch_ring_t ring;
+    event_batch_event_t event;
+
+    fresh_ring(&ring);
+    for (uint16_t i = 0; i < EVENT_BATCH_CAPACITY + 5; i++)
+    {
+        push_mail(&ring, 1000 + i, i);
+    }
+
+    CHECK(event_batch_count(&ring) == EVENT_BATCH_CAPACITY);
+    CHECK(ring.dropped == 5);
+    // The oldest events were overwritten, the newest are kept in order
+    CHECK(event_batch_peek(&ring, 0, &event) && event.value == 5);
+    CHECK(event_batch_peek(&ring, EVENT_BATCH_CAPACITY - 1, &event) && event.value == EVENT_BATCH_CAPACITY + 4);
+    CHECK(!event_batch_peek(&ring, EVENT_BATCH_CAPACITY, &event));
+    // Still sealed after wrapping
+    CHECK(event_batch_init(&ring));
+    CHECK(event_batch_count(&ring) == EVENT_BATCH_CAPACITY);
+}
+
+static void test_peek_consume(void)
+{
+    event_batch_ring_t ring;
+    event_batch_event_t event;
+
+    fresh_ring(&ring);
+    for (uint16_t i = 0; i < 6; i++)
+    {
+        push_mail(&ring, 100 + i, i);
+    }
+
+    CHECK(event_batch_peek(&ring, 2, &event) && event.value == 2 && event.timestamp == 102);
+    // Peeking does not remove
+    CHECK(event_batch_count(&ring) == 6);
+
+    event_batch_consume(&ring, 4);
+    CHECK(event_batch_count(&ring) == 2);
+    CHECK(event_batch_peek(&ring, 0, &event) && event.value == 4);
+    CHECK(event_batch_init(&ring));
+
+    // Across the end of the array
+    for (uint16_t i = 6; i < EVENT_BATCH_CAPACITY + 2; i++)
+    {
+        push_mail(&ring, 100 + i, i);
+    }
+    CHECK(ring.dropped == 0);
+    event_batch_consume(&ring, EVENT_BATCH_CAPACITY - 3);
+    CHECK(event_batch_count(&ring) == 1);
+    CHECK(event_batch_peek(&ring, 0, &event) && event.value == EVENT_BATCH_CAPACITY + 1);
+
+    // More than pending empties the ring
+    event_batch_consume(&ring, 10);
+    CHECK(event_batch_count(&ring) == 0);
+    CHECK(event_batch_init(&ring));
+}
+
+static void test_should_flush(void)
+{
+    event_batch_ring_t ring;
+    event_batch_event_t urgent = {
+        .timestamp = 1000,
+        .type = EVENT_BATCH_BOOT,
+        .urgent = 1,
+    };
+
+    fresh_ring(&ring);
+    CHECK(!event_batch_should_flush(&ring, &policy, 1000));
+    CHECK(event_batch_flush_due_in(&ring, &policy, 1000) == UINT32_MAX);
+
+    // By age of the oldest event, at exactly max_age_sec
+    push_mail(&ring, 1000, 0);
+    CHECK(!event_batch_should_flush(&ring, &policy, 1000));
+    CHECK(event_batch_flush_due_in(&ring, &policy, 1000) == 600);
+    CHECK(!event_batch_should_flush(&ring, &policy, 1599));
+    CHECK(event_batch_flush_due_in(&ring, &policy, 1599) == 1);
+    CHECK(event_batch_should_flush(&ring, &policy, 1600));
+    CHECK(event_batch_flush_due_in(&ring, &policy, 1600) == 0);
+
+    // A newer event does not reset the age
+    push_mail(&ring, 1500, 1);
+    CHECK(event_batch_flush_due_in(&ring, &policy, 1500) == 100);
+
+    // By count, at exactly max_events
+    push_mail(&ring, 1501, 2);
+    CHECK(!event_batch_should_flush(&ring, &policy, 1502));
+    push_mail(&ring, 1502, 3);
+    CHECK(event_batch_should_flush(&ring, &policy, 1502));
+    CHECK(event_batch_flush_due_in(&ring, &policy, 1502) == 0);
+
+    // An urgent event anywhere in the ring
+    fresh_ring(&ring);
+    push_mail(&ring, 1000, 0);
+    event_batch_push(&ring, &urgent);
+    CHECK(event_batch_should_flush(&ring, &policy, 1001));
+    event_batch_consume(&ring, 2);
+    CHECK(!event_batch_should_flush(&ring, &policy, 1001));
+}
+
+int main(void)
+{
+    test_init_keeps_valid_ring();
+    test_crc_mismatch_resets();
+    test_push_overflow();
+    test_peek_consume();
+    test_should_flush();
+
+    printf("event_batch: all checks passed\n");
+
+    return 0;
+}
@@ -0,0 +1,419 @@
+// Flash log on a file-backed flash image: inspect and drive an image, or torture the format
+// with power cuts in the middle of writes and erases and check what a remount recovers.
+// torture starts from erased flash, so a seed replays the same run, and exits 1 on the first
+// lost, duplicated or corrupt record.
+//
+//   flash_log_tool <image> dump
+//   flash_log_tool <image> append <records>
+//   flash_log_tool <image> drain <batch>
+//   flash_log_tool <image> torture <iterations> [seed]
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "flash_log.h"
+
+#define IMAGE_SIZE (64 * 1024)
+#define SECTOR_SIZE 4096
+
+typedef struct
+{
+    FILE *file;
+    int64_t cut_after;  /*!< bytes until the power fails, -1 never */
+    bool power_lost;
+    uint32_t writes;
+    uint32_t erases;
+} image_t;
+
+static uint32_t s_rng = 1;
+
+static uint32_t tool_random(void)
+{
+    s_rng ^= s_rng << 13;
+    s_rng ^= s_rng >> 17;
+    s_rng ^= s_rng << 5;
+
+    return s_rng;
+}
+
+static bool image_read(void *ctx, uint32_t offset, void *buf, size_t len)
+{
+    image_t *image = ctx;
+
+    return !image->power_lost && fseek(image->file, offset, SEEK_SET) == 0 && fread(buf, 1, len, image->file) == len;
+}
+
+/* NOR: programming only clears bits. A power cut stops in the middle of the data */
+static bool image_write(void *ctx, uint32_t offset, const void *buf, size_t len)
+{
+    image_t *image = ctx;
+    uint8_t cells[512];
+    const uint8_t *data = buf;
+    size_t n = len;
+
+    if (image->power_lost || len > sizeof(cells) || !image_read(ctx, offset, cells, len))
+    {
+        return false;
+    }
+    if (image->cut_after >= 0 && (int64_t)len > image->cut_after)
+    {
+        n = (size_t)image->cut_after;
+        image->power_lost = true;
+    }
+    for (size_t i = 0; i < n; i++)
+    {
+        cells[i] &= data[i];
+    }
+    // The byte being programmed when the power failed holds some of its bits
+    if (image->power_lost && n < len)
+    {
+        cells[n] &= data[n] | (uint8_t)tool_random();
+        n++;
+    }
+    if (fseek(image->file, offset, SEEK_SET) != 0 || fwrite(cells, 1, n, image->file) != n)
+    {
+        return false;
+    }
+    image->writes++;
+    if (image->cut_after >= 0)
+    {
+        image->cut_after -= n;
+    }
+
+    return !image->power_lost;
+}
+
+static bool image_erase_sector(void *ctx, uint32_t offset)
+{
+    image_t *image = ctx;
+    uint8_t erased[SECTOR_SIZE];
+    size_t n = SECTOR_SIZE;
+
+    if (image->power_lost)
+    {
+        return false;
+    }
+    // An interrupted erase leaves part of the sector as it was
+    if (image->cut_after >= 0 && image->cut_after < 64)
+    {
+        n = tool_random() % SECTOR_SIZE;
+        image->power_lost = true;
+    }
+    memset(erased, 0xFF, n);
+    if (fseek(image->file, offset, SEEK_SET) != 0 || fwrite(erased, 1, n, image->file) != n)
+    {
+        return false;
+    }
+    image->erases++;
+    if (image->cut_after >= 0)
+    {
+        image->cut_after -= 64;
+    }
+
+    return !image->power_lost;
+}
+
+static bool image_open(image_t *image, const char *path, bool erase)
+{
+    uint8_t erased[SECTOR_SIZE];
+
+    memset(image, 0, sizeof(*image));
+    image->cut_after = -1;
+    image->file = erase ? NULL : fopen(path, "r+b");
+    if (image->file != NULL)
+    {
+        return true;
+    }
+
+    // A fresh image reads as erased flash
+    image->file = fopen(path, "w+b");
+    if (image->file == NULL)
+    {
+        perror(path);
+        return false;
+    }
+    memset(erased, 0xFF, sizeof(erased));
+    for (int i = 0; i < IMAGE_SIZE / SECTOR_SIZE; i++)
+    {
+        fwrite(erased, 1, sizeof(erased), image->file);
+    }
+
+    return true;
+}
+
+static void record_fill(uint32_t seq, uint8_t *data, uint8_t *len)
+{
+    *len = 8 + seq % 64;
+    for (uint8_t i = 0; i < *len; i++)
+    {
+        data[i] = (uint8_t)(seq * 31 + i);
+    }
+}
+
+static bool record_check(const flash_log_record_t *record)
+{
+    uint8_t data[FLASH_LOG_MAX_RECORD];
+    uint8_t len;
+
+    record_fill(record->seq, data, &len);
+
+    return record->len == len && memcmp(record->data, data, len) == 0;
+}
+
+static void dump_state(const flash_log_t *log)
+{
+    printf("head sector %" PRIu32 " offset %" PRIu32 " sector seq %" PRIu32 "\n", log->head_sector, log->head_offset,
+           log->head_sector_seq);
+    printf("next %" PRIu32 " tail %" PRIu32 " acked %" PRIu32 " pending %" PRIu32 "\n", log->next_seq, log->tail_seq,
+           log->acked_seq, flash_log_pending(log));
+}
+
+static int cmd_dump(flash_log_t *log)
+{
+    flash_log_cursor_t cursor;
+    flash_log_record_t record;
+
+    dump_state(log);
+    flash_log_cursor_init(log, &cursor);
+    while (flash_log_next(log, &cursor, &record))
+    {
+        printf("%8" PRIu32 " %3u bytes%s\n", record.seq, record.len, record_check(&record) ? "" : " (not generated here)");
+    }
+
+    return 0;
+}
+
+static int cmd_append(flash_log_t *log, uint32_t count)
+{
+    uint8_t data[FLASH_LOG_MAX_RECORD];
+    uint8_t len;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        record_fill(log->next_seq, data, &len);
+        if (!flash_log_append(log, data, len, NULL))
+        {
+            fprintf(stderr, "append failed\n");
+            return 1;
+        }
+    }
+    dump_state(log);
+
+    return 0;
+}
+
+static int cmd_drain(flash_log_t *log, uint32_t batch)
+{
+    flash_log_cursor_t cursor;
+    flash_log_record_t record;
+    uint32_t n = 0;
+    uint32_t batches = 0;
+
+    flash_log_cursor_init(log, &cursor);
+    while (flash_log_next(log, &cursor, &record))
+    {
+        if (++n == batch)
+        {
+            flash_log_ack(log, record.seq);
+            batches++;
+            n = 0;
+        }
+    }
+    if (n)
+    {
+        flash_log_ack(log, log->next_seq - 1);
+        batches++;
+    }
+    printf("%" PRIu32 " batches\n", batches);
+    dump_state(log);
+
+    return 0;
+}
+
+/**
+ * @brief Random appends and acks, the power failing at a random byte, then a remount
+ *
+ * After every remount: all records appended before the cut and not acked are there and intact,
+ * in order and once each, unless the log counted them as dropped, and no ack that completed is lost.
+ */
+static int cmd_torture(image_t *image, const flash_log_flash_t *flash, uint32_t iterations)
+{
+    flash_log_t log;
+    flash_log_t rtc;
+    uint8_t data[FLASH_LOG_MAX_RECORD];
+    uint8_t len;
+    uint32_t last_ok = 0;
+    uint32_t durable_ack = 0;
+    uint64_t appended = 0;
+    uint64_t dropped = 0;
+    uint32_t dropped_before;
+    uint32_t cuts = 0;
+
+    if (!flash_log_mount(&log, flash))
+    {
+        return 1;
+    }
+    last_ok = log.next_seq - 1;
+    durable_ack = log.acked_seq;
+
+    for (uint32_t it = 0; it < iterations; it++)
+    {
+        image->cut_after = tool_random() % 4 == 0 ? (int64_t)(tool_random() % 2048) : -1;
+        dropped_before = log.dropped;
+
+        // A burst of operations, like one wake
+        for (int op = 0; op < 32 && !image->power_lost; op++)
+        {
+            if (tool_random() % 8 == 0)
+            {
+                uint32_t seq = log.acked_seq + 1 + tool_random() % (log.next_seq - log.acked_seq);
+                if (flash_log_ack(&log, seq))
+                {
+                    durable_ack = log.acked_seq;
+                }
+                continue;
+            }
+            record_fill(log.next_seq, data, &len);
+            uint32_t seq;
+            if (flash_log_append(&log, data, len, &seq))
+            {
+                last_ok = seq;
+                appended++;
+            }
+        }
+
+        // Overwritten by a full log, counted before a remount resets the count
+        dropped += log.dropped - dropped_before;
+
+        if (image->power_lost)
+        {
+            // RTC memory is gone too
+            cuts++;
+            image->power_lost = false;
+            image->cut_after = -1;
+            if (!flash_log_mount(&log, flash))
+            {
+                fprintf(stderr, "iteration %" PRIu32 ": mount failed\n", it);
+                return 1;
+            }
+        }
+        else
+        {
+            // Deep sleep, the state comes back from RTC memory
+            rtc = log;
+            if (!flash_log_resume(&rtc, flash))
+            {
+                fprintf(stderr, "iteration %" PRIu32 ": resume failed\n", it);
+                return 1;
+            }
+            log = rtc;
+        }
+
+        if (log.acked_seq < durable_ack)
+        {
+            fprintf(stderr, "iteration %" PRIu32 ": ack %" PRIu32 " lost, now %" PRIu32 "\n", it, durable_ack,
+                    log.acked_seq);
+            return 1;
+        }
+        durable_ack = log.acked_seq;
+
+        // Unacked records below the tail are only allowed as many as the log dropped
+        if (log.tail_seq > log.acked_seq + 1 && log.tail_seq - (log.acked_seq + 1) > dropped)
+        {
+            fprintf(stderr, "iteration %" PRIu32 ": records %" PRIu32 "..%" PRIu32 " lost, %" PRIu64 " dropped\n", it,
+                    log.acked_seq + 1, log.tail_seq - 1, dropped);
+            return 1;
+        }
+
+        // Everything from the oldest surviving unacked record up to the last good append
+        flash_log_cursor_t cursor;
+        flash_log_record_t record;
+        uint32_t expect = log.acked_seq + 1 > log.tail_seq ? log.acked_seq + 1 : log.tail_seq;
+        flash_log_cursor_init(&log, &cursor);
+        while (flash_log_next(&log, &cursor, &record))
+        {
+            if (record.seq != expect || !record_check(&record))
+            {
+                fprintf(stderr, "iteration %" PRIu32 ": got record %" PRIu32 ", expected %" PRIu32 "%s\n", it,
+                        record.seq, expect,
+                        !record_check(&record) ? " (corrupt)" : record.seq < expect ? " (duplicate)" : " (lost)");
+                return 1;
+            }
+            expect++;
+        }
+        if (expect <= last_ok)
+        {
+            fprintf(stderr, "iteration %" PRIu32 ": records %" PRIu32 "..%" PRIu32 " lost\n", it, expect, last_ok);
+            return 1;
+        }
+        last_ok = log.next_seq - 1;
+    }
+
+    printf("%" PRIu32 " iterations, %" PRIu32 " power cuts, %" PRIu64 " records, %" PRIu64 " dropped\n", iterations,
+           cuts, appended, dropped);
+    printf("%" PRIu32 " writes, %" PRIu32 " erases (%.1f per sector)\n", image->writes, image->erases,
+           (double)image->erases / (IMAGE_SIZE / SECTOR_SIZE));
+    dump_state(&log);
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    image_t image;
+    flash_log_t log;
+    int ret;
+
+    if (argc < 3)
+    {
+        fprintf(stderr, "usage: %s <image> dump | append <n> | drain <batch> | torture <iterations> [seed]\n", argv[0]);
+        return 2;
+    }
+    if (!image_open(&image, argv[1], strcmp(argv[2], "torture") == 0))
+    {
+        return 1;
+    }
+
+    const flash_log_flash_t flash = {
+        .read = image_read,
+        .write = image_write,
+        .erase_sector = image_erase_sector,
+        .ctx = &image,
+        .size = IMAGE_SIZE,
+        .sector_size = SECTOR_SIZE,
+    };
+
+    if (strcmp(argv[2], "torture") == 0)
+    {
+        s_rng = argc > 4 ? (uint32_t)strtoul(argv[4], NULL, 10) : 1;
+        ret = cmd_torture(&image, &flash, argc > 3 ? (uint32_t)strtoul(argv[3], NULL, 10) : 1000);
+    }
+    else if (!flash_log_mount(&log, &flash))
+    {
+        fprintf(stderr, "mount failed\n");
+        ret = 1;
+    }
+    else if (strcmp(argv[2], "dump") == 0)
+    {
+        ret = cmd_dump(&log);
+    }
+    else if (strcmp(argv[2], "append") == 0 && argc > 3)
+    {
+        ret = cmd_append(&log, (uint32_t)strtoul(argv[3], NULL, 10));
+    }
+    else if (strcmp(argv[2], "drain") == 0 && argc > 3)
+    {
+        ret = cmd_drain(&log, (uint32_t)strtoul(argv[3], NULL, 10));
+    }
+    else
+    {
+        fprintf(stderr, "unknown command %s\n", argv[2]);
+        ret = 2;
+    }
+
+    fclose(image.file);
+
+    return ret;
+}
@@ -0,0 +1,1072 @@
+// Fleet load generator: N virtual mailboxes run the wake logic of app_main() on simulated clocks
+// (event batching, flush deadlines, spills to the flash backlog, the daily sync, failed-wake
+// backoff and Wi-Fi connect times from wifi_sim) and upload to a real collector. Simulated time
+// runs --speedup times faster than real time, but every upload is a real multi-path PATCH built
+// by the firmware's telemetry and upload_batch code, so the collector sees the fleet's request mix.
+// Devices report over Wi-Fi only, as without an ESP-NOW gateway in range.
+//
+//   fleet_sim [--devices 1000] [--hours 24] [--speedup 3600] [--host localhost] [--port 3000]
+//             [--threads 64] [--keep-alive none|wake|persistent] [--skew-ppm 150]
+//             [--clock-offset-sec 0] [--sleep-jitter-pct 5] [--stagger-sec 0]
+//             [--outage start_min:minutes]... [--mails-per-day 4] [--bucket-min 60] [--seed 1]
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <getopt.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+extern "C" {
+#include "flash_log.h"
+#include "telemetry.h"
+#include "upload_batch.h"
+#include "wake_model.h"
+}
+
+#define FLEET_START_EPOCH 1700000000LL
+#define FLEET_ROOT "/esp32project.json?print=silent"
+#define FLEET_RESPONSE_SIZE 1024
+#define FLEET_RECORD_EVENTS (FLASH_LOG_MAX_RECORD / sizeof(event_batch_event_t)) // SPILL_RECORD_EVENTS
+
+enum class keep_alive_mode
+{
+    none,       // a connection per request, like curl
+    wake,       // a connection per wake, like the firmware
+    persistent, // kept across wakes until the collector closes it
+};
+
+struct fleet_options
+{
+    uint32_t devices = 1000;
+    double hours = 24;
+    double speedup = 3600;
+    std::string host = "localhost";
+    std::string port = "3000";
+    unsigned threads = 64;
+    keep_alive_mode keep_alive = keep_alive_mode::wake;
+    uint32_t skew_ppm = 150;          // RTC drift, drawn per device from +-skew_ppm
+    uint32_t clock_offset_sec = 0;    // wall clock error at the first boot, drawn from +-clock_offset_sec
+    uint32_t sleep_jitter_pct = 5;    // spread of every sleep
+    uint32_t stagger_sec = 0;         // first boots spread over this long, 0 powers the fleet on at once
+    std::vector<std::pair<int64_t, int64_t>> outages; // collector unreachable, simulated us from the start
+    double mails_per_day = 4;
+    uint32_t bucket_sec = 3600;
+    uint32_t seed = 1;
+};
+
+static std::vector<uint32_t> percentiles_sorted(std::vector<uint32_t> values)
+{
+    std::sort(values.begin(), values.end());
+    return values;
+}
+
+static double percentile_ms(const std::vector<uint32_t> &sorted, double pct)
+{
+    if (sorted.empty())
+    {
+        return 0;
+    }
+    size_t index = (size_t)(pct * sorted.size() / 100 + 0.999999);
+
+    return sorted[index > 0 ? index - 1 : 0] / 1000.0;
+}
+
+struct fleet_bucket
+{
+    uint32_t wakes = 0;   // wakes that brought the radio up
+    uint32_t uploads = 0; // wakes whose every write was acknowledged
+    uint32_t failed = 0;
+    uint32_t outage = 0;  // failed because the collector was down
+    uint32_t requests = 0;
+    uint32_t errors = 0;  // transport errors and non-2xx answers
+    std::vector<uint32_t> latency_us;
+};
+
+/**
+ * @brief Collector-side view of the fleet, shared by the workers
+ *
+ */
+struct fleet_metrics
+{
+    std::mutex lock;
+    std::vector<fleet_bucket> buckets;
+    std::vector<uint32_t> request_us;
+    std::vector<uint32_t> connect_us;
+    std::vector<uint32_t> ack_us; // first write queued to the last acknowledged, per upload
+    std::vector<uint32_t> lag_us; // wake started after its due time, the workers can not keep up
+    uint64_t bytes_sent = 0;
+    uint64_t bytes_received = 0;
+    uint64_t writes = 0;
+    uint32_t stub_wakes = 0;
+    uint32_t connections = 0;
+    uint32_t stale = 0; // kept-alive connections the collector had closed
+    uint32_t transport_errors = 0;
+    uint32_t status_4xx = 0;
+    uint32_t status_5xx = 0;
+    uint32_t retries = 0;
+
+    fleet_bucket &bucket(size_t index)
+    {
+        if (index >= buckets.size())
+        {
+            buckets.resize(index + 1);
+        }
+        return buckets[index];
+    }
+};
+
+static std::chrono::steady_clock::time_point s_real_start;
+
+static int64_t real_now_us(void)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - s_real_start)
+        .count();
+}
+
+static void fleet_delay_ms(uint32_t ms)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+static thread_local uint32_t t_rng = 1;
+
+static uint32_t xorshift(uint32_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+
+    return *state;
+}
+
+static uint32_t fleet_random(void)
+{
+    return xorshift(&t_rng);
+}
+
+/**
+ * @brief HTTP/1.1 uploader over a plain socket, recording every request in the metrics
+ *
+ */
+struct fleet_uploader
+{
+    uploader_t parent; // first, the vtable casts back
+    const fleet_options *options;
+    fleet_metrics *metrics;
+    size_t bucket; // of the wake in progress
+    int fd;
+    uploader_stats_t stats;
+};
+
+static esp_err_t fleet_uploader_disconnect(uploader_t *uploader)
+{
+    fleet_uploader *up = reinterpret_cast<fleet_uploader *>(uploader);
+
+    if (up->fd >= 0)
+    {
+        close(up->fd);
+        up->fd = -1;
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t fleet_uploader_connect(uploader_t *uploader)
+{
+    fleet_uploader *up = reinterpret_cast<fleet_uploader *>(uploader);
+    struct addrinfo hints = {};
+    struct addrinfo *res;
+    struct timeval timeout = {UPLOAD_TIMEOUT_MS / 1000, 0};
+    int nodelay = 1;
+    int64_t start_us = real_now_us();
+
+    if (up->fd >= 0)
+    {
+        return ESP_OK;
+    }
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(up->options->host.c_str(), up->options->port.c_str(), &hints, &res) != 0)
+    {
+        return ESP_FAIL;
+    }
+    up->fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (up->fd < 0 || connect(up->fd, res->ai_addr, res->ai_addrlen) != 0)
+    {
+        freeaddrinfo(res);
+        fleet_uploader_disconnect(uploader);
+        return ESP_FAIL;
+    }
+    freeaddrinfo(res);
+    setsockopt(up->fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    setsockopt(up->fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(up->fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    std::lock_guard<std::mutex> guard(up->metrics->lock);
+    up->metrics->connections++;
+    up->metrics->connect_us.push_back((uint32_t)(real_now_us() - start_us));
+
+    return ESP_OK;
+}
+
+static bool fleet_send_all(fleet_uploader *up, const char *data, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0)
+    {
+        n = send(up->fd, data, len, MSG_NOSIGNAL);
+        if (n <= 0)
+        {
+            return false;
+        }
+        data += n;
+        len -= n;
+        up->stats.bytes_sent += n;
+    }
+
+    return true;
+}
+
+/**
+ * @brief One request and response on the open connection
+ *
+ * @param answered: output, some of the response arrived
+ * @param close_after: output, the collector closes the connection after this response
+ */
+static bool fleet_exchange(fleet_uploader *up, const char *method, const char *path, const char *body,
+                           size_t body_len, int *status, bool *answered, bool *close_after)
+{
+    char buf[FLEET_RESPONSE_SIZE];
+    char *header_end;
+    const char *line;
+    long body_expected = 0;
+    size_t received = 0;
+    size_t body_received;
+    ssize_t n;
+    int len;
+
+    *answered = false;
+    *close_after = false;
+    len = snprintf(buf, sizeof(buf),
+                   "%s %s HTTP/1.1\r\n"
+                   "Host: %s\r\n"
+                   "Content-Type: application/json\r\n"
+                   "Content-Length: %zu\r\n"
+                   "Connection: %s\r\n"
+                   "\r\n",
+                   method, path, up->options->host.c_str(), body_len,
+                   up->options->keep_alive == keep_alive_mode::none ? "close" : "keep-alive");
+    up->stats.requests++;
+    if (!fleet_send_all(up, buf, len) || !fleet_send_all(up, body, body_len))
+    {
+        return false;
+    }
+
+    do
+    {
+        n = received < sizeof(buf) - 1 ? recv(up->fd, buf + received, sizeof(buf) - 1 - received, 0) : -1;
+        if (n <= 0)
+        {
+            return false;
+        }
+        *answered = true;
+        received += n;
+        up->stats.bytes_received += n;
+        buf[received] = '\0';
+    } while ((header_end = strstr(buf, "\r\n\r\n")) == NULL);
+
+    if (sscanf(buf, "HTTP/%*d.%*d %d", status) != 1)
+    {
+        return false;
+    }
+    *header_end = '\0';
+    for (line = buf; (line = strchr(line, '\n')) != NULL;)
+    {
+        line++;
+        if (strncasecmp(line, "Content-Length:", 15) == 0)
+        {
+            body_expected = strtol(line + 15, NULL, 10);
+        }
+        else if (strncasecmp(line, "Connection: close", 17) == 0)
+        {
+            *close_after = true;
+        }
+    }
+
+    body_received = received - (header_end + 4 - buf);
+    while (body_received < (size_t)body_expected && (n = recv(up->fd, buf, sizeof(buf), 0)) > 0)
+    {
+        body_received += n;
+        up->stats.bytes_received += n;
+    }
+
+    return body_received >= (size_t)body_expected;
+}
+
+static esp_err_t fleet_uploader_request(uploader_t *uploader, const char *method, const char *path,
+                                        const char *body, size_t body_len, int *status)
+{
+    fleet_uploader *up = reinterpret_cast<fleet_uploader *>(uploader);
+    fleet_metrics *metrics = up->metrics;
+    bool answered;
+    bool close_after;
+    bool reused;
+    int64_t start_us;
+
+    // A kept-alive connection the collector closed while idle fails before any answer, the
+    // request is resent once on a new connection. Safe, a PATCH of the same paths is idempotent
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        reused = up->fd >= 0;
+        start_us = real_now_us();
+        if (fleet_uploader_connect(uploader) != ESP_OK)
+        {
+            break;
+        }
+        if (fleet_exchange(up, method, path, body, body_len, status, &answered, &close_after))
+        {
+            std::lock_guard<std::mutex> guard(metrics->lock);
+            uint32_t latency_us = (uint32_t)(real_now_us() - start_us);
+            fleet_bucket &bucket = metrics->bucket(up->bucket);
+            metrics->request_us.push_back(latency_us);
+            bucket.latency_us.push_back(latency_us);
+            bucket.requests++;
+            bucket.errors += *status / 100 != 2;
+            metrics->status_4xx += *status / 100 == 4;
+            metrics->status_5xx += *status / 100 == 5;
+            if (close_after || up->options->keep_alive == keep_alive_mode::none)
+            {
+                fleet_uploader_disconnect(uploader);
+            }
+            return ESP_OK;
+        }
+        fleet_uploader_disconnect(uploader);
+        if (!reused || answered)
+        {
+            break;
+        }
+        std::lock_guard<std::mutex> guard(metrics->lock);
+        metrics->stale++;
+    }
+
+    std::lock_guard<std::mutex> guard(metrics->lock);
+    fleet_bucket &bucket = metrics->bucket(up->bucket);
+    bucket.requests++;
+    bucket.errors++;
+    metrics->transport_errors++;
+
+    return ESP_FAIL;
+}
+
+static esp_err_t fleet_uploader_fetch(uploader_t *uploader, const char *path, uploader_sink_t sink, void *ctx,
+                                      int *status)
+{
+    return ESP_FAIL;
+}
+
+static esp_err_t fleet_uploader_get_stats(uploader_t *uploader, uploader_stats_t *stats)
+{
+    *stats = reinterpret_cast<fleet_uploader *>(uploader)->stats;
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Flash Backlog Record Type
+ *
+ */
+struct fleet_record
+{
+    uint32_t seq;
+    std::vector<event_batch_event_t> events;
+};
+
+/**
+ * @brief One mailbox: the RTC state of app_main() and a clock that drifts
+ *
+ */
+struct fleet_device
+{
+    uint32_t id;
+    uint32_t rng;
+    int64_t clock_us;        // true time
+    int64_t next_mail_us;    // true time
+    int32_t drift_ppm;
+    int64_t wall_offset_us;  // wall clock error at sync_us
+    int64_t sync_us;
+    bool cold = true;
+    uint32_t boot_count = 0;
+    wake_policy_state_t wake = {}; // retry_after on the wall clock
+    uint32_t boot_at = 0;          // wall clock, earlier timer wakes end in the wake stub
+    uint32_t last_sync = 0;        // wall clock
+    event_batch_ring_t ring;
+    std::vector<fleet_record> backlog;
+    uint32_t next_seq = 1;
+    wifi_t *wifi = nullptr;
+    fleet_uploader uploader;
+
+    int64_t wall_us(void) const
+    {
+        return clock_us + wall_offset_us + (clock_us - sync_us) * drift_ppm / 1000000;
+    }
+
+    uint32_t wall(void) const
+    {
+        return (uint32_t)(wall_us() / 1000000);
+    }
+};
+
+/**
+ * @brief The fleet, its schedule and the workers
+ *
+ */
+struct fleet_sim
+{
+    fleet_options options;
+    fleet_metrics metrics;
+    std::vector<std::unique_ptr<fleet_device>> devices;
+    int64_t start_us; // simulated
+    int64_t end_us;
+
+    std::mutex lock;
+    std::condition_variable wakeup;
+    std::priority_queue<std::pair<int64_t, uint32_t>, std::vector<std::pair<int64_t, uint32_t>>,
+                        std::greater<std::pair<int64_t, uint32_t>>>
+        schedule; // real due time, device
+    size_t active = 0;
+
+    int64_t real_due_us(const fleet_device &device) const
+    {
+        return (int64_t)((device.clock_us - start_us) / options.speedup);
+    }
+
+    size_t bucket_of(const fleet_device &device) const
+    {
+        return (size_t)((device.clock_us - start_us) / 1000000 / options.bucket_sec);
+    }
+
+    bool collector_down(int64_t clock_us) const
+    {
+        for (const auto &outage : options.outages)
+        {
+            if (clock_us - start_us >= outage.first && clock_us - start_us < outage.second)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+static int64_t mail_interval_us(fleet_device &device, double mails_per_day)
+{
+    uint32_t mean_sec = (uint32_t)(86400 / mails_per_day);
+
+    // Uniform in [0, 2 * mean], like wake_bench
+    return (int64_t)(xorshift(&device.rng) % (2 * mean_sec + 1)) * 1000000;
+}
+
+/* Same as spill_events() */
+static void fleet_spill(fleet_device &device)
+{
+    event_batch_event_t event;
+
+    while (event_batch_count(&device.ring) > 0)
+    {
+        fleet_record record = {device.next_seq++, {}};
+        while (record.events.size() < FLEET_RECORD_EVENTS && event_batch_peek(&device.ring, record.events.size(), &event))
+        {
+            record.events.push_back(event);
+        }
+        event_batch_consume(&device.ring, record.events.size());
+        device.backlog.push_back(std::move(record));
+    }
+}
+
+static void fleet_write_record(telemetry_writer_t *writer, std::string &value, const fleet_device &device,
+                               const uint32_t *phase_us)
+{
+    telemetry_header_t header = {};
+
+    header.boot_count = device.boot_count;
+    header.wake_cause = device.cold ? 0 : 4;
+    header.phase_us = phase_us;
+    header.num_phases = 2;
+    telemetry_writer_init(writer, value.data(), value.size(), NULL, NULL);
+    telemetry_begin(writer, &header);
+}
+
+static void fleet_done(void *ctx, esp_err_t result)
+{
+    *static_cast<esp_err_t *>(ctx) = result;
+}
+
+/**
+ * @brief Upload the backlog and the ring like stage_upload(), for real
+ *
+ * @return
+ *      true once every write was acknowledged
+ */
+static bool fleet_upload(fleet_sim &sim, fleet_device &device, const uint32_t *phase_us)
+{
+    static thread_local std::vector<char> body(UPLOAD_MAX_BODY);
+    std::vector<std::string> values;
+    std::vector<upload_write_t> writes;
+    std::vector<size_t> batch_records; // records per backlog write
+    std::vector<esp_err_t> results;
+    telemetry_writer_t writer;
+    event_batch_event_t event;
+    size_t record = 0;
+    size_t ring_count = 0;
+    int64_t start_us = real_now_us();
+
+    values.reserve(DRAIN_MAX_BATCHES + 1);
+    for (int batch = 0; batch < DRAIN_MAX_BATCHES && record < device.backlog.size(); batch++)
+    {
+        size_t count = 0;
+        size_t first = record;
+
+        values.emplace_back(TELEMETRY_MAX_SIZE(DRAIN_BATCH_EVENTS), '\0');
+        fleet_write_record(&writer, values.back(), device, phase_us);
+        while (record < device.backlog.size() && count + device.backlog[record].events.size() <= DRAIN_BATCH_EVENTS)
+        {
+            for (const auto &e : device.backlog[record].events)
+            {
+                telemetry_add_event(&writer, e.timestamp, e.type, e.value);
+            }
+            count += device.backlog[record++].events.size();
+        }
+        telemetry_end(&writer);
+        values.back().resize(writer.total);
+
+        upload_write_t write = {};
+        snprintf(write.path, sizeof(write.path), "backlog/r%08x", (unsigned)device.backlog[first].seq);
+        writes.push_back(write);
+        batch_records.push_back(record - first);
+    }
+
+    values.emplace_back(TELEMETRY_MAX_SIZE(EVENT_BATCH_CAPACITY), '\0');
+    fleet_write_record(&writer, values.back(), device, phase_us);
+    while (event_batch_peek(&device.ring, ring_count, &event))
+    {
+        telemetry_add_event(&writer, event.timestamp, event.type, event.value);
+        ring_count++;
+    }
+    telemetry_end(&writer);
+    values.back().resize(writer.total);
+    writes.push_back(upload_write_t{});
+
+    results.assign(writes.size(), ESP_ERR_TIMEOUT);
+    for (size_t i = 0; i < writes.size(); i++)
+    {
+        writes[i].value = values[i].data();
+        writes[i].len = values[i].size();
+        writes[i].submitted_us = start_us;
+        writes[i].done = fleet_done;
+        writes[i].ctx = &results[i];
+    }
+
+    upload_batch_t batch = {};
+    batch.uploader = &device.uploader.parent;
+    batch.root = FLEET_ROOT;
+    batch.body = body.data();
+    batch.body_size = body.size();
+    batch.max_attempts = UPLOAD_MAX_ATTEMPTS;
+    batch.retry = backoff_policy_t{UPLOAD_RETRY_BASE_MS, UPLOAD_RETRY_MAX_MS, 20};
+    batch.now_us = real_now_us;
+    batch.delay_ms = fleet_delay_ms;
+    batch.random = fleet_random;
+
+    device.uploader.bucket = sim.bucket_of(device);
+    upload_batch_send(&batch, writes.data(), writes.size());
+    if (sim.options.keep_alive != keep_alive_mode::persistent)
+    {
+        device.uploader.parent.disconnect(&device.uploader.parent);
+    }
+
+    // The device waits out the real exchange
+    device.clock_us += real_now_us() - start_us;
+
+    // Records are acknowledged up to the first batch that failed, the ring only with its write
+    size_t acked_records = 0;
+    for (size_t i = 0; i < batch_records.size() && results[i] == ESP_OK; i++)
+    {
+        acked_records += batch_records[i];
+    }
+    device.backlog.erase(device.backlog.begin(), device.backlog.begin() + acked_records);
+    if (results.back() == ESP_OK)
+    {
+        event_batch_consume(&device.ring, ring_count);
+    }
+
+    std::lock_guard<std::mutex> guard(sim.metrics.lock);
+    sim.metrics.writes += batch.stats.writes;
+    sim.metrics.retries += batch.stats.retries;
+    sim.metrics.bytes_sent += batch.stats.bytes_sent;
+    sim.metrics.bytes_received += batch.stats.bytes_received;
+    if (batch.stats.writes == writes.size())
+    {
+        sim.metrics.ack_us.push_back((uint32_t)batch.stats.max_ack_us);
+    }
+
+    return batch.stats.writes == writes.size();
+}
+
+/**
+ * @brief One wake and the sleep after it, following app_main() and enter_deep_sleep()
+ *
+ */
+static void fleet_wake(fleet_sim &sim, fleet_device &device)
+{
+    const fleet_options &options = sim.options;
+    bool mail = device.clock_us >= device.next_mail_us;
+    bool sync_due;
+    bool failed = false;
+    int64_t stage_end_us;
+    int64_t sleep_us;
+    uint32_t boot_in;
+    uint32_t sync_in;
+    uint32_t sleep_sec;
+    uint32_t phase_us[2];
+    esp_err_t ret;
+
+    if (mail)
+    {
+        device.next_mail_us = device.clock_us + mail_interval_us(device, options.mails_per_day);
+    }
+    sync_due = device.wall() - device.last_sync >= SYNC_INTERVAL_SEC;
+
+    // The wake stub sends a timer wake before the boot wake_policy_boot_in() armed back to sleep
+    if (!device.cold && !mail && device.wall() < device.boot_at)
+    {
+        device.clock_us += STUB_WAKE_US;
+        std::lock_guard<std::mutex> guard(sim.metrics.lock);
+        sim.metrics.stub_wakes++;
+    }
+    else
+    {
+        int64_t wake_start_us = device.clock_us;
+
+        device.clock_us += 1000LL * BOOT_MS;
+        device.boot_count++;
+        if (device.cold || mail)
+        {
+            event_batch_event_t event = {};
+            event.timestamp = device.wall();
+            event.type = device.cold ? EVENT_BATCH_BOOT : EVENT_BATCH_MAIL;
+            event.urgent = device.cold;
+            event_batch_push(&device.ring, &event);
+        }
+        if (event_batch_count(&device.ring) >= EVENT_SPILL_THRESHOLD)
+        {
+            fleet_spill(device);
+        }
+        if (device.cold)
+        {
+            wake_policy_reset(&device.wake);
+        }
+
+        if (wake_policy_decide(&device.wake, &device.ring, &flush_policy, device.wall(),
+                               !device.backlog.empty() || sync_due) != WAKE_POLICY_RADIO)
+        {
+            device.clock_us += 1000LL * SKIP_WAKE_MS;
+        }
+        else
+        {
+            std::unique_lock<std::mutex> guard(sim.metrics.lock);
+            fleet_bucket &bucket = sim.metrics.bucket(sim.bucket_of(device));
+            bucket.wakes++;
+            guard.unlock();
+
+            stage_end_us = device.clock_us + 1000LL * (device.cold ? PROVISIONING_BUDGET_MS : CONNECT_TIMEOUT_MS);
+            device.wifi->init(device.wifi);
+            do
+            {
+                ret = device.wifi->connect(device.wifi);
+            } while (ret == ESP_FAIL && device.clock_us < stage_end_us);
+            failed = ret != ESP_OK || device.clock_us > stage_end_us;
+
+            if (failed)
+            {
+                device.clock_us = stage_end_us;
+            }
+            else
+            {
+                device.wifi->init_sntp(device.wifi);
+                device.wifi->wait_sntp(device.wifi, device.cold ? TIME_SYNC_TIMEOUT_MS : TIME_RESYNC_TIMEOUT_MS);
+                // The wall clock is stepped once its predicted error is out of bounds
+                if (std::llabs(device.wall_us() - device.clock_us) > 1000LL * SNTP_MAX_ERROR_MS)
+                {
+                    device.wall_offset_us = (int64_t)(xorshift(&device.rng) % (2 * SNTP_MAX_ERROR_MS + 1)) * 1000 -
+                                            1000LL * SNTP_MAX_ERROR_MS;
+                    device.sync_us = device.clock_us;
+                }
+                phase_us[0] = 1000 * BOOT_MS;
+                phase_us[1] = (uint32_t)(device.clock_us - wake_start_us);
+
+                if (sim.collector_down(device.clock_us))
+                {
+                    device.clock_us += 1000LL * UPLOAD_TIMEOUT_MS;
+                    failed = true;
+                    guard.lock();
+                    sim.metrics.bucket(sim.bucket_of(device)).outage++;
+                    guard.unlock();
+                }
+                else
+                {
+                    failed = !fleet_upload(sim, device, phase_us);
+                }
+            }
+            device.wifi->stop(device.wifi);
+
+            guard.lock();
+            fleet_bucket &done = sim.metrics.bucket(sim.bucket_of(device));
+            done.uploads += !failed;
+            done.failed += failed;
+            guard.unlock();
+
+            wake_policy_done(&device.wake, !failed, device.wall(), xorshift(&device.rng));
+            if (failed)
+            {
+                fleet_spill(device);
+            }
+            else
+            {
+                device.last_sync = device.wall();
+            }
+        }
+        device.cold = false;
+    }
+
+    // Same schedule as enter_deep_sleep(), on a slow clock that drifts, plus the sensor wake
+    sync_in = device.wall() - device.last_sync < SYNC_INTERVAL_SEC ? device.last_sync + SYNC_INTERVAL_SEC - device.wall()
+                                                                   : 0;
+    boot_in = wake_policy_boot_in(&device.wake, &device.ring, &flush_policy, device.wall(),
+                                  device.backlog.empty() ? sync_in : 0);
+    device.boot_at = boot_in < UINT32_MAX - device.wall() ? device.wall() + boot_in : UINT32_MAX;
+    sleep_sec = wake_policy_sleep_sec(boot_in, HEARTBEAT_SEC);
+    sleep_us = (int64_t)(1e6 * sleep_sec * (1 + device.drift_ppm / 1e6) *
+                         (1 + ((int32_t)(xorshift(&device.rng) % (2 * options.sleep_jitter_pct + 1)) -
+                               (int32_t)options.sleep_jitter_pct) / 100.0));
+    if (device.next_mail_us - device.clock_us < sleep_us)
+    {
+        sleep_us = std::max<int64_t>(device.next_mail_us - device.clock_us, 0);
+    }
+    device.clock_us += sleep_us;
+}
+
+static void fleet_worker(fleet_sim &sim, uint32_t seed)
+{
+    std::unique_lock<std::mutex> lock(sim.lock);
+
+    t_rng = seed ? seed : 1;
+    while (true)
+    {
+        if (sim.schedule.empty())
+        {
+            if (sim.active == 0)
+            {
+                return;
+            }
+            sim.wakeup.wait(lock);
+            continue;
+        }
+
+        auto [due_us, id] = sim.schedule.top();
+        int64_t now_us = real_now_us();
+        if (due_us > now_us)
+        {
+            sim.wakeup.wait_for(lock, std::chrono::microseconds(due_us - now_us));
+            continue;
+        }
+        sim.schedule.pop();
+        lock.unlock();
+
+        fleet_device &device = *sim.devices[id];
+        {
+            std::lock_guard<std::mutex> guard(sim.metrics.lock);
+            sim.metrics.lag_us.push_back((uint32_t)std::min<int64_t>(now_us - due_us, UINT32_MAX));
+        }
+        fleet_wake(sim, device);
+
+        lock.lock();
+        if (device.clock_us < sim.end_us)
+        {
+            sim.schedule.push({sim.real_due_us(device), id});
+            sim.wakeup.notify_one();
+        }
+        else if (--sim.active == 0)
+        {
+            sim.wakeup.notify_all();
+        }
+    }
+}
+
+static void fleet_report(fleet_sim &sim, double elapsed_sec)
+{
+    fleet_metrics &m = sim.metrics;
+    const fleet_options &o = sim.options;
+    double bucket_real_sec = o.bucket_sec / o.speedup;
+    uint32_t requests = 0;
+    uint32_t wakes = 0;
+    uint32_t uploads = 0;
+    uint32_t failed = 0;
+
+    printf("\n%10s %7s %7s %6s %6s %7s %7s %8s %8s %8s %8s\n", "sim min", "wakes", "uploads", "failed", "outage",
+           "reqs", "errors", "req/s", "p50 ms", "p99 ms", "max ms");
+    for (size_t i = 0; i < m.buckets.size(); i++)
+    {
+        fleet_bucket &b = m.buckets[i];
+        std::vector<uint32_t> sorted = percentiles_sorted(b.latency_us);
+        printf("%10zu %7u %7u %6u %6u %7u %7u %8.1f %8.1f %8.1f %8.1f\n", i * o.bucket_sec / 60, b.wakes, b.uploads,
+               b.failed, b.outage, b.requests, b.errors, b.requests / bucket_real_sec, percentile_ms(sorted, 50),
+               percentile_ms(sorted, 99), percentile_ms(sorted, 100));
+        requests += b.requests;
+        wakes += b.wakes;
+        uploads += b.uploads;
+        failed += b.failed;
+    }
+
+    std::vector<uint32_t> request_us = percentiles_sorted(m.request_us);
+    std::vector<uint32_t> connect_us = percentiles_sorted(m.connect_us);
+    std::vector<uint32_t> ack_us = percentiles_sorted(m.ack_us);
+    std::vector<uint32_t> lag_us = percentiles_sorted(m.lag_us);
+
+    printf("\n%u radio wakes, %u stub wakes, %u uploads, %u failed\n", wakes, m.stub_wakes, uploads, failed);
+    printf("throughput: %.1f req/s, %.1f writes/s, %.1f KB/s sent, %.1f KB/s received over %.1f s\n",
+           requests / elapsed_sec, m.writes / elapsed_sec, m.bytes_sent / 1024.0 / elapsed_sec,
+           m.bytes_received / 1024.0 / elapsed_sec, elapsed_sec);
+    printf("%-16s %8s %8s %8s %8s %8s\n", "ms", "p50", "p90", "p99", "p99.9", "max");
+    printf("%-16s %8.1f %8.1f %8.1f %8.1f %8.1f\n", "request", percentile_ms(request_us, 50),
+           percentile_ms(request_us, 90), percentile_ms(request_us, 99), percentile_ms(request_us, 99.9),
+           percentile_ms(request_us, 100));
+    printf("%-16s %8.1f %8.1f %8.1f %8.1f %8.1f\n", "connect", percentile_ms(connect_us, 50),
+           percentile_ms(connect_us, 90), percentile_ms(connect_us, 99), percentile_ms(connect_us, 99.9),
+           percentile_ms(connect_us, 100));
+    printf("%-16s %8.1f %8.1f %8.1f %8.1f %8.1f\n", "time to ack", percentile_ms(ack_us, 50),
+           percentile_ms(ack_us, 90), percentile_ms(ack_us, 99), percentile_ms(ack_us, 99.9),
+           percentile_ms(ack_us, 100));
+    printf("%-16s %8.1f %8.1f %8.1f %8.1f %8.1f\n", "scheduling lag", percentile_ms(lag_us, 50),
+           percentile_ms(lag_us, 90), percentile_ms(lag_us, 99), percentile_ms(lag_us, 99.9),
+           percentile_ms(lag_us, 100));
+    printf("%u connections, %u stale keep-alive, %u transport errors, %u 4xx, %u 5xx, %u retries\n",
+           m.connections, m.stale, m.transport_errors, m.status_4xx, m.status_5xx, m.retries);
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [--devices N] [--hours H] [--speedup X] [--host H] [--port P] [--threads N]\n"
+            "       [--keep-alive none|wake|persistent] [--skew-ppm PPM] [--clock-offset-sec S]\n"
+            "       [--sleep-jitter-pct P] [--stagger-sec S] [--outage START_MIN:MINUTES]...\n"
+            "       [--mails-per-day N] [--bucket-min M] [--seed N]\n",
+            name);
+}
+
+static bool parse_options(int argc, char **argv, fleet_options &options)
+{
+    static const struct option longopts[] = {
+        {"devices", required_argument, NULL, 'n'},
+        {"hours", required_argument, NULL, 'H'},
+        {"speedup", required_argument, NULL, 'x'},
+        {"host", required_argument, NULL, 'h'},
+        {"port", required_argument, NULL, 'p'},
+        {"threads", required_argument, NULL, 't'},
+        {"keep-alive", required_argument, NULL, 'k'},
+        {"skew-ppm", required_argument, NULL, 's'},
+        {"clock-offset-sec", required_argument, NULL, 'c'},
+        {"sleep-jitter-pct", required_argument, NULL, 'j'},
+        {"stagger-sec", required_argument, NULL, 'g'},
+        {"outage", required_argument, NULL, 'o'},
+        {"mails-per-day", required_argument, NULL, 'm'},
+        {"bucket-min", required_argument, NULL, 'b'},
+        {"seed", required_argument, NULL, 'r'},
+        {NULL, 0, NULL, 0},
+    };
+    unsigned start_min;
+    unsigned minutes;
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "", longopts, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            options.devices = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'H':
+            options.hours = strtod(optarg, NULL);
+            break;
+        case 'x':
+            options.speedup = strtod(optarg, NULL);
+            break;
+        case 'h':
+            options.host = optarg;
+            break;
+        case 'p':
+            options.port = optarg;
+            break;
+        case 't':
+            options.threads = (unsigned)strtoul(optarg, NULL, 0);
+            break;
+        case 'k':
+            if (strcmp(optarg, "none") == 0)
+            {
+                options.keep_alive = keep_alive_mode::none;
+            }
+            else if (strcmp(optarg, "wake") == 0)
+            {
+                options.keep_alive = keep_alive_mode::wake;
+            }
+            else if (strcmp(optarg, "persistent") == 0)
+            {
+                options.keep_alive = keep_alive_mode::persistent;
+            }
+            else
+            {
+                return false;
+            }
+            break;
+        case 's':
+            options.skew_ppm = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'c':
+            options.clock_offset_sec = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'j':
+            options.sleep_jitter_pct = std::min<uint32_t>((uint32_t)strtoul(optarg, NULL, 0), 99);
+            break;
+        case 'g':
+            options.stagger_sec = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'o':
+            if (sscanf(optarg, "%u:%u", &start_min, &minutes) != 2)
+            {
+                return false;
+            }
+            options.outages.push_back({60000000LL * start_min, 60000000LL * (start_min + minutes)});
+            break;
+        case 'm':
+            options.mails_per_day = strtod(optarg, NULL);
+            break;
+        case 'b':
+            options.bucket_sec = 60 * (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            options.seed = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        default:
+            return false;
+        }
+    }
+
+    return optind == argc && options.devices > 0 && options.hours > 0 && options.speedup > 0 &&
+           options.threads > 0 && options.mails_per_day > 0 && options.bucket_sec > 0;
+}
+
+int main(int argc, char **argv)
+{
+    fleet_sim sim;
+    fleet_options &options = sim.options;
+    std::vector<std::thread> workers;
+    uint32_t rng;
+
+    if (!parse_options(argc, argv, options))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    rng = options.seed ? options.seed : 1;
+    sim.start_us = FLEET_START_EPOCH * 1000000;
+    sim.end_us = sim.start_us + (int64_t)(options.hours * 3600e6);
+
+    for (uint32_t i = 0; i < options.devices; i++)
+    {
+        auto device = std::make_unique<fleet_device>();
+        int64_t offset_us = 0;
+
+        device->id = i;
+        device->rng = xorshift(&rng) | 1;
+        device->drift_ppm = options.skew_ppm ? (int32_t)(xorshift(&rng) % (2 * options.skew_ppm + 1)) -
+                                                   (int32_t)options.skew_ppm
+                                             : 0;
+        if (options.clock_offset_sec)
+        {
+            offset_us = (int64_t)(xorshift(&rng) % (2 * options.clock_offset_sec + 1)) * 1000000 -
+                        1000000LL * options.clock_offset_sec;
+        }
+        device->clock_us = sim.start_us + (options.stagger_sec ? (int64_t)(xorshift(&rng) % options.stagger_sec) *
+                                                                    1000000
+                                                              : 0);
+        device->wall_offset_us = offset_us;
+        device->sync_us = device->clock_us;
+        device->next_mail_us = device->clock_us + mail_interval_us(*device, options.mails_per_day);
+        memset(&device->ring, 0, sizeof(device->ring));
+        event_batch_init(&device->ring);
+
+        wifi_sim_conf_t wifi_conf = wake_model_good_ap(device->rng);
+        wifi_conf.clock_us = &device->clock_us;
+        wifi_conf.drift_ppm = device->drift_ppm;
+        device->wifi = wifi_new_sim(&wifi_conf);
+
+        device->uploader.parent.connect = fleet_uploader_connect;
+        device->uploader.parent.request = fleet_uploader_request;
+        device->uploader.parent.fetch = fleet_uploader_fetch;
+        device->uploader.parent.disconnect = fleet_uploader_disconnect;
+        device->uploader.parent.get_stats = fleet_uploader_get_stats;
+        device->uploader.options = &options;
+        device->uploader.metrics = &sim.metrics;
+        device->uploader.fd = -1;
+
+        sim.devices.push_back(std::move(device));
+    }
+
+    static const char *modes[] = {"none", "wake", "persistent"};
+    printf("%u devices, %.1f h at %.0fx (%.1f s), keep-alive %s, %u threads, drift +-%u ppm, clock offset +-%u s, "
+           "sleep jitter +-%u%%, %zu outages, collector %s:%s\n",
+           options.devices, options.hours, options.speedup, options.hours * 3600 / options.speedup,
+           modes[(int)options.keep_alive], options.threads, options.skew_ppm, options.clock_offset_sec,
+           options.sleep_jitter_pct, options.outages.size(), options.host.c_str(), options.port.c_str());
+
+    s_real_start = std::chrono::steady_clock::now();
+    for (auto &device : sim.devices)
+    {
+        sim.schedule.push({sim.real_due_us(*device), device->id});
+    }
+    sim.active = sim.devices.size();
+    for (unsigned i = 0; i < options.threads; i++)
+    {
+        workers.emplace_back(fleet_worker, std::ref(sim), xorshift(&rng));
+    }
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+
+    fleet_report(sim, real_now_us() / 1e6);
+
+    for (auto &device : sim.devices)
+    {
+        device->uploader.parent.disconnect(&device->uploader.parent);
+        free(device->wifi);
+    }
+
+    return 0;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+/* Wake timings, flush policy and Wi-Fi model of app_main(), shared by wake_bench and fleet_sim */
+
+#include "backoff.h"
+#include "event_batch.h"
+#include "wifi_sim.h"
+#include "wake_config.h"
+#include "wake_policy.h"
+
+#define BOOT_MS 130             // ROM, bootloader and app start until app_main(), with the boot profile of sdkconfig
+#define STUB_WAKE_US 1000       // ROM and the wake stub, for a timer wake with nothing due
+#define SKIP_WAKE_MS 5          // app_main() when nothing is due
+
+static const event_batch_policy_t flush_policy = {
+    .max_events = FLUSH_MAX_EVENTS,
+    .max_age_sec = FLUSH_MAX_AGE_SEC,
+};
+
+/* An AP in range with the latencies measured on the bench, fast reconnect on */
+static inline wifi_sim_conf_t wake_model_good_ap(uint32_t seed)
+{
+    wifi_sim_conf_t conf = {
+        .seed = seed,
+        .init_ms = 150,
+        .assoc_ms = 1200,
+        .fast_assoc_ms = 250,
+        .dhcp_ms = 400,
+        .fail_ms = 2000,
+        .sntp_ms = 80,
+        .smartconfig_ms = 5 * 60 * 1000,
+        .lease_sec = 24 * 60 * 60,
+        .sntp_max_error_ms = SNTP_MAX_ERROR_MS,
+        .drift_ppm = 150,
+        .jitter_pct = 30,
+        .fail_pct = 2,
+        .fast_fail_pct = 2,
+        .fast_reconnect = true,
+        .connect_budget_ms = CONNECT_TIMEOUT_MS,
+        .no_ap_ms = 2000,
+        .rssi = -60,
+    };
+
+    return conf;
+}
@@ -0,0 +1,434 @@
+// Sleep policy benchmark: replays synthetic mail traces through the adaptive sleep policy of
+// app_main() and the fixed flush age it replaces, and projects the battery life of each.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sleep_policy.h"
+#include "wake_model.h"
+
+#define START_TIME 1704067200 // 2024-01-01 00:00 UTC, a Monday
+#define SECONDS_PER_DAY (24 * 60 * 60)
+#define MAX_DAYS (30 * 365)
+#define RADIO_MS_MIN 1400     // connect, time sync and upload of a wake on a good AP
+#define RADIO_MS_MAX 2600
+#define BOOT_WAKE_MS 150      // boot, sensor settle and ESP-NOW-less sleep
+#define CPU_MA 40.0
+#define RADIO_MA 120.0
+#define SLEEP_MA 0.010
+#define MAX_PENDING EVENT_BATCH_CAPACITY
+
+typedef struct
+{
+    uint8_t start_hour;
+    uint8_t end_hour;
+    uint8_t pct;      /*!< chance of a delivery in the window on a day it applies */
+    uint8_t weekdays; /*!< bit 0 is Monday */
+} window_t;
+
+typedef struct
+{
+    const char *name;
+    int32_t utc_offset_sec;
+    window_t windows[3];
+} scenario_t;
+
+typedef struct
+{
+    uint32_t time;
+    bool mail; /*!< a drop, otherwise the mailbox was emptied */
+} mail_event_t;
+
+typedef struct
+{
+    bool adaptive;
+    sleep_policy_state_t state;
+    sleep_policy_plan_t plan;
+    double capacity_uas;
+    double charge_uas;
+    uint32_t last_sync;
+    uint32_t next_timer;
+    uint32_t boot_at;                   /*!< the wake stub boots into app_main() from then on */
+    bool sensor_wakeup;
+    bool level_changed;                 /*!< an edge the sensor wakeup was not armed for */
+    uint32_t arrivals[MAX_PENDING];     /*!< when each pending event happened */
+    uint32_t detected[MAX_PENDING];     /*!< its ring timestamp, later when polled */
+    bool mails[MAX_PENDING];
+    size_t num_pending;
+    size_t num_unseen;                  /*!< pending events not seen by a wake yet */
+    uint32_t wakes;
+    uint32_t radio_wakes;
+    uint32_t stub_wakes;
+    bool first_year;
+    double first_year_uas;
+    uint32_t *latencies;
+    uint32_t num_latencies;
+    uint32_t max_latencies;
+} device_t;
+
+static uint32_t s_rng = 1;
+
+static const sleep_policy_conf_t s_conf = {
+    .budget_uas = ENERGY_BUDGET_UAH_PER_DAY * 3600,
+    .sleep_ua = SLEEP_UA,
+    .radio_wake_uas = RADIO_WAKE_UAS,
+    .boot_wake_uas = BOOT_WAKE_UAS,
+    .stub_wake_uas = STUB_WAKE_UAS,
+    .min_flush_age_sec = FLUSH_MIN_AGE_SEC,
+    .max_flush_age_sec = FLUSH_QUIET_AGE_SEC,
+    .heartbeat_sec = HEARTBEAT_SEC,
+    .poll_sec = SENSOR_POLL_SEC,
+    .low_mv = BATTERY_LOW_MV,
+    .critical_mv = BATTERY_CRITICAL_MV,
+};
+
+static uint32_t bench_random(void)
+{
+    s_rng ^= s_rng << 13;
+    s_rng ^= s_rng >> 17;
+    s_rng ^= s_rng << 5;
+
+    return s_rng;
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static uint32_t percentile(uint32_t *values, uint32_t n, uint32_t pct)
+{
+    if (n == 0)
+    {
+        return 0;
+    }
+    qsort(values, n, sizeof(*values), compare_u32);
+
+    return values[(pct * n + 99) / 100 - 1];
+}
+
+/* Open circuit voltage of a 1S Li-ion cell by state of charge */
+static uint16_t battery_mv(const device_t *device)
+{
+    static const struct
+    {
+        float soc;
+        float mv;
+    } curve[] = {{0.0f, 3000}, {0.05f, 3350}, {0.10f, 3500}, {0.20f, 3600}, {0.50f, 3750}, {0.90f, 4000}, {1.0f, 4150}};
+    float soc = 1.0f - (float)(device->charge_uas / device->capacity_uas);
+
+    for (size_t i = 1; i < sizeof(curve) / sizeof(curve[0]); i++)
+    {
+        if (soc <= curve[i].soc)
+        {
+            float x = (soc - curve[i - 1].soc) / (curve[i].soc - curve[i - 1].soc);
+            return (uint16_t)(curve[i - 1].mv + (x < 0.0f ? 0.0f : x) * (curve[i].mv - curve[i - 1].mv));
+        }
+    }
+
+    return (uint16_t)curve[sizeof(curve) / sizeof(curve[0]) - 1].mv;
+}
+
+static void charge(device_t *device, double uas)
+{
+    device->charge_uas += uas;
+    if (device->first_year)
+    {
+        device->first_year_uas += uas;
+    }
+}
+
+/* What the wake costs, the policy only sees its own estimate through sleep_policy_account() */
+static uint32_t wake_charge(bool radio)
+{
+    uint32_t radio_ms = RADIO_MS_MIN + bench_random() % (RADIO_MS_MAX - RADIO_MS_MIN);
+
+    if (!radio)
+    {
+        return (uint32_t)(BOOT_WAKE_MS * CPU_MA);
+    }
+
+    return (uint32_t)(BOOT_WAKE_MS * CPU_MA + radio_ms * RADIO_MA);
+}
+
+/**
+ * @brief One boot into app_main(): battery, plan, flush decision, then the sleep plan
+ *
+ */
+static void bench_full_wake(device_t *device, const scenario_t *scenario, uint32_t now)
+{
+    event_batch_policy_t policy = flush_policy;
+    uint32_t boot_in = UINT32_MAX;
+    uint32_t wake_uas;
+    bool radio = false;
+    uint32_t heartbeat_sec = HEARTBEAT_SEC;
+
+    device->wakes++;
+    if (device->adaptive)
+    {
+        device->state.battery_mv = battery_mv(device);
+        sleep_policy_plan(&device->state, &s_conf, now, &device->plan);
+        policy.max_age_sec = device->plan.flush_max_age_sec;
+    }
+
+    // Events the wake sees, a polled edge is timestamped on the wake that found it
+    for (size_t i = device->num_pending - device->num_unseen; i < device->num_pending; i++)
+    {
+        device->detected[i] = now;
+        if (device->adaptive && device->mails[i])
+        {
+            sleep_policy_record_mail(&device->state, now);
+        }
+    }
+    device->num_unseen = 0;
+    device->level_changed = false;
+
+    if (device->num_pending >= policy.max_events ||
+        (device->num_pending > 0 && now - device->detected[0] >= policy.max_age_sec) ||
+        now - device->last_sync >= SYNC_INTERVAL_SEC)
+    {
+        radio = true;
+    }
+
+    wake_uas = wake_charge(radio);
+    charge(device, wake_uas);
+    if (radio)
+    {
+        device->radio_wakes++;
+        for (size_t i = 0; i < device->num_pending; i++)
+        {
+            if (device->mails[i] && device->first_year && device->num_latencies < device->max_latencies)
+            {
+                device->latencies[device->num_latencies++] = now - device->arrivals[i];
+            }
+        }
+        device->num_pending = 0;
+        if (device->adaptive)
+        {
+            // What init_timezone() hands the policy after the time sync
+            time_t local_time = (time_t)now + scenario->utc_offset_sec;
+            struct tm local;
+
+            gmtime_r(&local_time, &local);
+            sleep_policy_set_local_time(&device->state, now, &local);
+        }
+        device->last_sync = now;
+    }
+
+    device->sensor_wakeup = true;
+    if (device->adaptive)
+    {
+        sleep_policy_account(&device->state, now, wake_uas, radio);
+        sleep_policy_plan(&device->state, &s_conf, now, &device->plan);
+        policy.max_age_sec = device->plan.flush_max_age_sec;
+        heartbeat_sec = device->plan.heartbeat_sec;
+        device->sensor_wakeup = device->plan.sensor_wakeup;
+        if (device->num_pending > 0)
+        {
+            boot_in = device->plan.review_in_sec;
+        }
+    }
+
+    // full_boot_due_in()
+    if (device->num_pending > 0)
+    {
+        uint32_t age = now - device->detected[0];
+        uint32_t due_in = age >= policy.max_age_sec ? 0 : policy.max_age_sec - age;
+        boot_in = due_in < boot_in ? due_in : boot_in;
+    }
+    if (device->last_sync + SYNC_INTERVAL_SEC - now < boot_in)
+    {
+        boot_in = device->last_sync + SYNC_INTERVAL_SEC - now;
+    }
+
+    boot_in = boot_in == 0 ? 1 : boot_in;
+    device->boot_at = now + boot_in;
+    device->next_timer = now + (boot_in < heartbeat_sec ? boot_in : heartbeat_sec);
+}
+
+/* Timer wake, the wake stub goes back to sleep unless a boot is due or the level changed */
+static void bench_timer_wake(device_t *device, const scenario_t *scenario, uint32_t now)
+{
+    uint32_t heartbeat_sec = device->adaptive ? device->plan.heartbeat_sec : HEARTBEAT_SEC;
+
+    if (device->level_changed || now >= device->boot_at)
+    {
+        bench_full_wake(device, scenario, now);
+        return;
+    }
+
+    device->stub_wakes++;
+    charge(device, STUB_WAKE_US / 1000.0 * CPU_MA);
+    device->next_timer = now + (device->boot_at - now < heartbeat_sec ? device->boot_at - now : heartbeat_sec);
+}
+
+static void bench_event(device_t *device, const scenario_t *scenario, const mail_event_t *event)
+{
+    if (device->num_pending == MAX_PENDING)
+    {
+        return;
+    }
+
+    device->arrivals[device->num_pending] = event->time;
+    device->detected[device->num_pending] = event->time;
+    device->mails[device->num_pending] = event->mail;
+    device->num_pending++;
+    device->num_unseen++;
+
+    // Armed, the edge boots the chip. Otherwise the stub finds the level changed on its next wake
+    if (device->sensor_wakeup)
+    {
+        bench_full_wake(device, scenario, event->time);
+    }
+    else
+    {
+        device->level_changed = true;
+    }
+}
+
+/* A day of deliveries, each followed by the mailbox being emptied in the evening */
+static size_t bench_day_events(const scenario_t *scenario, uint32_t day, mail_event_t *events)
+{
+    uint32_t day_start = START_TIME + day * SECONDS_PER_DAY - scenario->utc_offset_sec;
+    size_t count = 0;
+    bool mail = false;
+
+    for (size_t i = 0; i < sizeof(scenario->windows) / sizeof(scenario->windows[0]); i++)
+    {
+        const window_t *window = &scenario->windows[i];
+        uint32_t length = (window->end_hour - window->start_hour) * 3600;
+
+        if (length == 0 || !(window->weekdays & (1 << (day % 7))) || bench_random() % 100 >= window->pct)
+        {
+            continue;
+        }
+        events[count].time = day_start + window->start_hour * 3600 + bench_random() % length;
+        events[count].mail = true;
+        count++;
+        mail = true;
+    }
+    if (mail && bench_random() % 100 < 70)
+    {
+        events[count].time = day_start + 19 * 3600 + bench_random() % (2 * 3600);
+        events[count].mail = false;
+        count++;
+    }
+
+    // Windows may be listed in any order
+    for (size_t i = 1; i < count; i++)
+    {
+        for (size_t j = i; j > 0 && events[j].time < events[j - 1].time; j--)
+        {
+            mail_event_t swap = events[j];
+            events[j] = events[j - 1];
+            events[j - 1] = swap;
+        }
+    }
+
+    return count;
+}
+
+static void bench_run(const scenario_t *scenario, bool adaptive, uint32_t capacity_mah, uint32_t seed)
+{
+    device_t device = {
+        .adaptive = adaptive,
+        .capacity_uas = capacity_mah * 3600.0 * 1000.0,
+        .sensor_wakeup = true,
+        .first_year = true,
+        .max_latencies = 8 * 365,
+    };
+    mail_event_t events[4];
+    uint32_t days = 0;
+    uint32_t first_year_radio = 0;
+    uint32_t last_time = START_TIME;
+
+    s_rng = seed;
+    device.latencies = calloc(device.max_latencies, sizeof(uint32_t));
+    sleep_policy_init(&device.state, &s_conf);
+    device.last_sync = START_TIME - SYNC_INTERVAL_SEC;
+    device.next_timer = START_TIME;
+    device.boot_at = START_TIME;
+
+    while (device.charge_uas < device.capacity_uas && days < MAX_DAYS)
+    {
+        size_t count = bench_day_events(scenario, days, events);
+        uint32_t day_end = START_TIME + (days + 1) * SECONDS_PER_DAY - scenario->utc_offset_sec;
+        size_t next = 0;
+
+        while (true)
+        {
+            uint32_t event_time = next < count ? events[next].time : day_end;
+            uint32_t now = device.next_timer <= event_time ? device.next_timer : event_time;
+
+            if (now >= day_end)
+            {
+                break;
+            }
+
+            // Deep sleep in between
+            charge(&device, (now - last_time) * SLEEP_MA * 1000.0);
+            last_time = now;
+
+            if (device.next_timer <= event_time)
+            {
+                bench_timer_wake(&device, scenario, now);
+            }
+            else
+            {
+                bench_event(&device, scenario, &events[next++]);
+            }
+        }
+
+        days++;
+        if (days == 365)
+        {
+            device.first_year = false;
+            first_year_radio = device.radio_wakes;
+        }
+    }
+    if (device.first_year)
+    {
+        first_year_radio = device.radio_wakes;
+    }
+
+    uint32_t year_days = days < 365 ? days : 365;
+    uint32_t n = device.num_latencies;
+    printf("%-14s %-8s | %7.1f %7.2f | %6.0f %6.0f %6.0f | %6.2f %s\n", scenario->name, adaptive ? "adaptive" : "fixed",
+           (double)first_year_radio / year_days, device.first_year_uas / year_days / 3600.0 / 1000.0,
+           percentile(device.latencies, n, 50) / 60.0, percentile(device.latencies, n, 90) / 60.0,
+           percentile(device.latencies, n, 100) / 60.0, days / 365.0, days >= MAX_DAYS ? "(capped)" : "");
+
+    free(device.latencies);
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t capacity_mah = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 10) : 1000;
+    uint32_t seed = argc > 2 ? (uint32_t)strtoul(argv[2], NULL, 10) : 1;
+
+    const scenario_t scenarios[] = {
+        {.name = "morning post", .utc_offset_sec = 3600, .windows = {{10, 12, 90, 0x3F}}},
+        {.name = "two rounds", .utc_offset_sec = 3600, .windows = {{9, 10, 80, 0x1F}, {14, 16, 60, 0x1F}}},
+        {.name = "night courier", .utc_offset_sec = -5 * 3600, .windows = {{2, 4, 70, 0x7F}}},
+        {.name = "any time", .utc_offset_sec = 0, .windows = {{0, 24, 95, 0x7F}, {0, 24, 50, 0x7F}}},
+        {.name = "rare", .utc_offset_sec = 3600, .windows = {{11, 12, 15, 0x3F}}},
+    };
+
+    printf("%u mAh, %u uAh/day budget, flush age fixed %u min, adaptive %u to %u min\n", capacity_mah,
+           ENERGY_BUDGET_UAH_PER_DAY, FLUSH_MAX_AGE_SEC / 60, FLUSH_MIN_AGE_SEC / 60, FLUSH_QUIET_AGE_SEC / 60);
+    printf("%-14s %-8s | %7s %7s | %6s %6s %6s | %6s\n", "scenario", "policy", "up/day", "mAh/day", "lat50",
+           "lat90", "latmax", "years");
+    for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++)
+    {
+        bench_run(&scenarios[i], false, capacity_mah, seed);
+        bench_run(&scenarios[i], true, capacity_mah, seed);
+    }
+
+    return 0;
+}
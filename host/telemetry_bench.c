@@ -0,0 +1,145 @@
+// Telemetry serializer benchmark: bytes and time per record, against the snprintf() version
+// it replaced, in buffer mode and streamed through a small chunk buffer.
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define bench_cycles() __rdtsc()
+#else
+#define bench_cycles() 0ULL
+#endif
+
+#include "telemetry.h"
+
+#define EVENTS_PER_RECORD 8
+#define NUM_PHASES 9
+#define CHUNK_SIZE 64
+
+typedef struct
+{
+    uint32_t timestamp;
+    uint8_t type;
+    uint16_t value;
+} bench_event_t;
+
+static char s_record[TELEMETRY_MAX_SIZE(EVENTS_PER_RECORD)];
+static char s_chunk[CHUNK_SIZE];
+static uint32_t s_phase_us[NUM_PHASES];
+static bench_event_t s_events[EVENTS_PER_RECORD];
+static volatile size_t s_sink_bytes;
+
+static bool bench_sink(void *ctx, const char *data, size_t len)
+{
+    s_sink_bytes += len;
+
+    return true;
+}
+
+static size_t bench_telemetry(uint32_t boot, telemetry_sink_t sink)
+{
+    telemetry_writer_t writer;
+    telemetry_header_t header = {
+        .boot_count = boot,
+        .wake_cause = 7,
+        .battery_mv = 3712,
+        .phase_us = s_phase_us,
+        .num_phases = NUM_PHASES,
+    };
+
+    if (sink)
+    {
+        telemetry_writer_init(&writer, s_chunk, sizeof(s_chunk), sink, NULL);
+    }
+    else
+    {
+        telemetry_writer_init(&writer, s_record, sizeof(s_record), NULL, NULL);
+    }
+    telemetry_begin(&writer, &header);
+    for (int i = 0; i < EVENTS_PER_RECORD; i++)
+    {
+        telemetry_add_event(&writer, s_events[i].timestamp, s_events[i].type, s_events[i].value);
+    }
+    if (!telemetry_end(&writer))
+    {
+        fprintf(stderr, "record incomplete\n");
+        exit(1);
+    }
+
+    return writer.total;
+}
+
+static size_t bench_snprintf(uint32_t boot, telemetry_sink_t sink)
+{
+    int len;
+
+    len = snprintf(s_record, sizeof(s_record), "{\"boot\":%" PRIu32 ",\"cause\":%d,\"battery_mv\":%d,\"phases_ms\":[",
+                   boot, 7, 3712);
+    for (int i = 0; i < NUM_PHASES; i++)
+    {
+        len += snprintf(s_record + len, sizeof(s_record) - len, "%s%" PRIu32, i ? "," : "", s_phase_us[i] / 1000);
+    }
+    len += snprintf(s_record + len, sizeof(s_record) - len, "],\"events\":[");
+    for (int i = 0; i < EVENTS_PER_RECORD; i++)
+    {
+        len += snprintf(s_record + len, sizeof(s_record) - len, "%s[%" PRIu32 ",%d,%d]", i ? "," : "",
+                        s_events[i].timestamp, s_events[i].type, s_events[i].value);
+    }
+    len += snprintf(s_record + len, sizeof(s_record) - len, "]}");
+
+    return len;
+}
+
+static double bench_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void bench_run(const char *name, size_t (*serialize)(uint32_t, telemetry_sink_t), telemetry_sink_t sink,
+                      uint32_t records)
+{
+    size_t bytes = 0;
+    double start_ns = bench_now_ns();
+    unsigned long long start_cycles = bench_cycles();
+
+    for (uint32_t i = 0; i < records; i++)
+    {
+        bytes += serialize(i, sink);
+    }
+
+    unsigned long long cycles = bench_cycles() - start_cycles;
+    double ns = bench_now_ns() - start_ns;
+
+    printf("%-22s %8.1f %10.1f %12.1f\n", name, (double)bytes / records, ns / records, (double)cycles / records);
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t records = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 10) : 1000000;
+
+    // A typical wake: a few hundred ms per phase, recent timestamps, small values
+    for (int i = 0; i < NUM_PHASES; i++)
+    {
+        s_phase_us[i] = 180000 + 250000 * i;
+    }
+    for (int i = 0; i < EVENTS_PER_RECORD; i++)
+    {
+        s_events[i] = (bench_event_t){.timestamp = 1760000000 + 600 * i, .type = 1 + i % 2, .value = i};
+    }
+
+    printf("%d events per record, worst case %zu bytes\n", EVENTS_PER_RECORD, sizeof(s_record));
+    printf("%-22s %8s %10s %12s\n", "serializer", "bytes", "ns/record", "cycles/rec");
+    bench_run("snprintf", bench_snprintf, NULL, records);
+    bench_run("telemetry, buffer", bench_telemetry, NULL, records);
+    bench_run("telemetry, 64 B chunks", bench_telemetry, bench_sink, records);
+
+    return 0;
+}
@@ -0,0 +1,348 @@
+// Uploads one wake's worth of telemetry writes to the local stand-in server twice: once as a
+// PUT per write on a fresh connection, the way psTest.txt does it with curl, and once through
+// upload_batch_send(), merged into multi-path PATCH requests on one keep-alive connection.
+// Start curlCMD/server.js first, FAIL_PCT and DROP_PCT there exercise the retries.
+//
+//   upload_replay [host] [port] [writes] [events per write]
+
+#include <inttypes.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "telemetry.h"
+#include "upload_batch.h"
+#include "wake_config.h"
+
+#define REPLAY_ROOT "/esp32project"
+#define REPLAY_MAX_WRITES 64
+#define REPLAY_MAX_EVENTS 64
+#define REPLAY_RESPONSE_SIZE 1024
+
+typedef struct
+{
+    uploader_t parent;
+    const char *host;
+    const char *port;
+    bool keep_alive; /*!< false closes the connection after every request */
+    int fd;
+    uint32_t connections;
+    uploader_stats_t stats;
+} http_uploader_t;
+
+static int64_t replay_now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void replay_delay_ms(uint32_t ms)
+{
+    usleep(ms * 1000);
+}
+
+static uint32_t replay_random(void)
+{
+    return (uint32_t)rand();
+}
+
+static esp_err_t http_uploader_disconnect(uploader_t *uploader)
+{
+    http_uploader_t *http = (http_uploader_t *)uploader;
+
+    if (http->fd >= 0)
+    {
+        close(http->fd);
+        http->fd = -1;
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t http_uploader_connect(uploader_t *uploader)
+{
+    http_uploader_t *http = (http_uploader_t *)uploader;
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM}, *res;
+
+    if (http->fd >= 0)
+    {
+        return ESP_OK;
+    }
+    if (getaddrinfo(http->host, http->port, &hints, &res) != 0)
+    {
+        return ESP_FAIL;
+    }
+    http->fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (http->fd < 0 || connect(http->fd, res->ai_addr, res->ai_addrlen) != 0)
+    {
+        freeaddrinfo(res);
+        http_uploader_disconnect(uploader);
+        return ESP_FAIL;
+    }
+    freeaddrinfo(res);
+    // Header and body are separate sends, like the firmware's TLS records
+    setsockopt(http->fd, IPPROTO_TCP, TCP_NODELAY, &(int){1}, sizeof(int));
+    http->connections++;
+
+    return ESP_OK;
+}
+
+static esp_err_t http_send_all(http_uploader_t *http, const char *data, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0)
+    {
+        n = send(http->fd, data, len, MSG_NOSIGNAL);
+        if (n <= 0)
+        {
+            return ESP_FAIL;
+        }
+        data += n;
+        len -= n;
+        http->stats.bytes_sent += n;
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t http_uploader_request(uploader_t *uploader, const char *method, const char *path,
+                                       const char *body, size_t body_len, int *status)
+{
+    http_uploader_t *http = (http_uploader_t *)uploader;
+    char buf[REPLAY_RESPONSE_SIZE];
+    char *header_end;
+    const char *content_length;
+    long body_expected = 0;
+    size_t received = 0;
+    size_t body_received;
+    ssize_t n;
+    int len;
+
+    if (http_uploader_connect(uploader) != ESP_OK)
+    {
+        return ESP_FAIL;
+    }
+
+    len = snprintf(buf, sizeof(buf),
+                   "%s %s HTTP/1.1\r\n"
+                   "Host: %s\r\n"
+                   "Content-Type: application/json\r\n"
+                   "Content-Length: %zu\r\n"
+                   "Connection: %s\r\n"
+                   "\r\n",
+                   method, path, http->host, body_len, http->keep_alive ? "keep-alive" : "close");
+    http->stats.requests++;
+    if (http_send_all(http, buf, len) != ESP_OK || http_send_all(http, body, body_len) != ESP_OK)
+    {
+        http_uploader_disconnect(uploader);
+        return ESP_FAIL;
+    }
+
+    do
+    {
+        n = received < sizeof(buf) - 1 ? recv(http->fd, buf + received, sizeof(buf) - 1 - received, 0) : -1;
+        if (n <= 0)
+        { // A dropped connection, the request may or may not have been applied
+            http_uploader_disconnect(uploader);
+            return ESP_FAIL;
+        }
+        received += n;
+        http->stats.bytes_received += n;
+        buf[received] = '\0';
+    } while ((header_end = strstr(buf, "\r\n\r\n")) == NULL);
+
+    if (sscanf(buf, "HTTP/%*d.%*d %d", status) != 1)
+    {
+        http_uploader_disconnect(uploader);
+        return ESP_FAIL;
+    }
+    *header_end = '\0';
+    for (content_length = buf; (content_length = strchr(content_length, '\n')) != NULL;)
+    {
+        content_length++;
+        if (strncasecmp(content_length, "Content-Length:", 15) == 0)
+        {
+            body_expected = strtol(content_length + 15, NULL, 10);
+            break;
+        }
+    }
+
+    body_received = received - (header_end + 4 - buf);
+    while (body_received < (size_t)body_expected && (n = recv(http->fd, buf, sizeof(buf), 0)) > 0)
+    {
+        body_received += n;
+        http->stats.bytes_received += n;
+    }
+    if (!http->keep_alive || body_received < (size_t)body_expected)
+    {
+        http_uploader_disconnect(uploader);
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t http_uploader_fetch(uploader_t *uploader, const char *path, uploader_sink_t sink, void *ctx,
+                                     int *status)
+{
+    return ESP_FAIL;
+}
+
+static esp_err_t http_uploader_get_stats(uploader_t *uploader, uploader_stats_t *stats)
+{
+    *stats = ((http_uploader_t *)uploader)->stats;
+
+    return ESP_OK;
+}
+
+static void http_uploader_init(http_uploader_t *http, const char *host, const char *port, bool keep_alive)
+{
+    memset(http, 0, sizeof(*http));
+    http->host = host;
+    http->port = port;
+    http->keep_alive = keep_alive;
+    http->fd = -1;
+    http->parent.connect = http_uploader_connect;
+    http->parent.request = http_uploader_request;
+    http->parent.fetch = http_uploader_fetch;
+    http->parent.disconnect = http_uploader_disconnect;
+    http->parent.get_stats = http_uploader_get_stats;
+}
+
+/* Backlog batches like the firmware drains them, then the ring merged into the root */
+static size_t replay_writes(upload_write_t *writes, char *values, size_t num, size_t events, uint32_t run)
+{
+    static const uint32_t phase_us[] = {0, 180000, 1450000, 1520000};
+    char *value = values;
+
+    for (size_t i = 0; i < num; i++)
+    {
+        telemetry_writer_t writer;
+        telemetry_header_t header = {
+            .boot_count = run,
+            .wake_cause = 2,
+            .phase_us = phase_us,
+            .num_phases = sizeof(phase_us) / sizeof(phase_us[0]),
+        };
+
+        telemetry_writer_init(&writer, value, TELEMETRY_MAX_SIZE(REPLAY_MAX_EVENTS), NULL, NULL);
+        telemetry_begin(&writer, &header);
+        for (size_t e = 0; e < events; e++)
+        {
+            telemetry_add_event(&writer, 1700000000 + run * 3600 + (uint32_t)(i * events + e), 1, (uint16_t)e);
+        }
+        telemetry_end(&writer);
+
+        memset(&writes[i], 0, sizeof(writes[i]));
+        if (i + 1 < num)
+        {
+            snprintf(writes[i].path, sizeof(writes[i].path), "backlog/r%08" PRIx32, run * 1000 + (uint32_t)i);
+        }
+        writes[i].value = value;
+        writes[i].len = writer.total;
+        writes[i].submitted_us = replay_now_us();
+        value += writer.total;
+    }
+
+    return num;
+}
+
+static void replay_print(const char *name, const upload_stats_t *stats, uint32_t connections, int64_t elapsed_us)
+{
+    printf("%-24s %8" PRIu32 " %8" PRIu32 " %8" PRIu32 " %8" PRIu32 " %10" PRIu32 " %10" PRIu32 " %9.1f %9.1f %8.1f\n",
+           name, stats->writes, stats->rejected + stats->failed,
+           stats->requests, connections, stats->bytes_sent, stats->bytes_received,
+           stats->writes ? stats->total_ack_us / 1e3 / stats->writes : 0.0, stats->max_ack_us / 1e3,
+           elapsed_us / 1e3);
+}
+
+int main(int argc, char **argv)
+{
+    static upload_write_t writes[REPLAY_MAX_WRITES];
+    static char values[REPLAY_MAX_WRITES * TELEMETRY_MAX_SIZE(REPLAY_MAX_EVENTS)];
+    static char body[UPLOAD_MAX_BODY];
+    const char *host = argc > 1 ? argv[1] : "localhost";
+    const char *port = argc > 2 ? argv[2] : "3000";
+    size_t num = argc > 3 ? strtoul(argv[3], NULL, 0) : 10;
+    size_t events = argc > 4 ? strtoul(argv[4], NULL, 0) : 8;
+    http_uploader_t http;
+    upload_batch_t batch = {
+        .root = REPLAY_ROOT ".json?print=silent",
+        .body = body,
+        .body_size = sizeof(body),
+        .max_attempts = UPLOAD_MAX_ATTEMPTS,
+        .retry = {.base = UPLOAD_RETRY_BASE_MS, .max = UPLOAD_RETRY_MAX_MS, .jitter_pct = 20},
+        .now_us = replay_now_us,
+        .delay_ms = replay_delay_ms,
+        .random = replay_random,
+    };
+    upload_stats_t put_stats = {0};
+    uploader_stats_t before;
+    uploader_stats_t after;
+    char path[UPLOAD_PATH_MAX_LEN + sizeof(REPLAY_ROOT "/.json?print=silent")];
+    int64_t start_us;
+    int64_t ack_us;
+    int status;
+
+    num = num < 1 ? 1 : num > REPLAY_MAX_WRITES ? REPLAY_MAX_WRITES : num;
+    events = events > REPLAY_MAX_EVENTS ? REPLAY_MAX_EVENTS : events;
+    srand((unsigned)time(NULL));
+
+    printf("%zu writes of %zu events to %s:%s\n", num, events, host, port);
+    printf("%-24s %8s %8s %8s %8s %10s %10s %9s %9s %8s\n", "", "acked", "failed", "requests", "conns",
+           "sent", "received", "ack ms", "max ms", "total ms");
+
+    // One PUT per write and a connection each, nothing is retried
+    http_uploader_init(&http, host, port, false);
+    replay_writes(writes, values, num, events, 1);
+    start_us = replay_now_us();
+    for (size_t i = 0; i < num; i++)
+    {
+        snprintf(path, sizeof(path), REPLAY_ROOT "%s%.*s.json?print=silent", writes[i].path[0] ? "/" : "",
+                 (int)sizeof(writes[i].path), writes[i].path);
+        http.parent.get_stats(&http.parent, &before);
+        // The root write is merged in with PATCH, PUT would replace the backlog
+        if (http.parent.request(&http.parent, writes[i].path[0] ? "PUT" : "PATCH", path, writes[i].value,
+                                writes[i].len, &status) == ESP_OK && status / 100 == 2)
+        {
+            ack_us = replay_now_us() - writes[i].submitted_us;
+            put_stats.writes++;
+            put_stats.total_ack_us += ack_us;
+            put_stats.max_ack_us = ack_us > put_stats.max_ack_us ? ack_us : put_stats.max_ack_us;
+        }
+        else
+        {
+            put_stats.failed++;
+        }
+        http.parent.get_stats(&http.parent, &after);
+        put_stats.requests++;
+        put_stats.bytes_sent += after.bytes_sent - before.bytes_sent;
+        put_stats.bytes_received += after.bytes_received - before.bytes_received;
+    }
+    replay_print("PUT per write", &put_stats, http.connections, replay_now_us() - start_us);
+
+    // Merged into PATCH requests on one connection, retried with the same paths
+    http_uploader_init(&http, host, port, true);
+    batch.uploader = &http.parent;
+    replay_writes(writes, values, num, events, 2);
+    start_us = replay_now_us();
+    upload_batch_send(&batch, writes, num);
+    http.parent.disconnect(&http.parent);
+    replay_print("multi-path PATCH", &batch.stats, http.connections, replay_now_us() - start_us);
+    if (batch.stats.retries > 0)
+    {
+        printf("%" PRIu32 " retries\n", batch.stats.retries);
+    }
+
+    return 0;
+}
@@ -0,0 +1,292 @@
+// Wake-cycle benchmark: runs simulated wakes through the event batching, wake budgets and
+// the connect, retry and fallback logic of the smartconfig driver, on the simulated backend.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wake_model.h"
+
+#define UPLOAD_MS 600           // TLS handshake and one PUT
+#define MAIL_EVENTS_PER_DAY 4
+#define POLL_SEC 10             // the old polling interval, for comparison
+#define CPU_MA 40.0             // awake, radio off
+#define RADIO_MA 120.0          // awake, radio on
+#define SLEEP_MA 0.010          // deep sleep
+
+typedef struct
+{
+    const char *name;
+    wifi_sim_conf_t wifi;
+    uint32_t poll_sec; /*!< 0 wakes on the mail sensor, otherwise the sensor is polled this often */
+    bool moves;        /*!< half way through, the device moves into range of its last known network */
+} scenario_t;
+
+typedef struct
+{
+    uint32_t wakes;
+    uint32_t radio_wakes;
+    uint32_t stub_wakes;
+    uint32_t failed_wakes;
+    uint32_t fast_connects;
+    double charge_mas; // mA * s
+    double seconds;
+    uint32_t *awake_ms;
+    uint32_t *radio_awake_ms;
+    uint32_t *time_to_ip_ms;
+    uint32_t connects;
+} bench_result_t;
+
+static uint32_t s_rng = 1;
+
+/* RTC state of app_main() and the wake stub, reset per scenario */
+static wake_policy_state_t s_wake_state;
+static int64_t s_boot_at_us; // timer wakes before this end in the wake stub
+
+static uint32_t bench_random(void)
+{
+    s_rng ^= s_rng << 13;
+    s_rng ^= s_rng >> 17;
+    s_rng ^= s_rng << 5;
+
+    return s_rng;
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static uint32_t percentile(uint32_t *values, uint32_t n, uint32_t pct)
+{
+    if (n == 0)
+    {
+        return 0;
+    }
+    qsort(values, n, sizeof(*values), compare_u32);
+
+    return values[(pct * n + 99) / 100 - 1];
+}
+
+/**
+ * @brief One wake, following app_main(): batch, decide, then run the pipeline stages within their budgets
+ *
+ * @return
+ *      awake time in microseconds, radio-on time in *radio_us
+ */
+static int64_t bench_wake(wifi_t *wifi, int64_t *clock_us, event_batch_ring_t *ring, bool cold, bool mail,
+                          bool *failed, int64_t *radio_us, bench_result_t *result)
+{
+    int64_t wake_start_us = *clock_us;
+    int64_t budget_end_us;
+    int64_t stage_end_us;
+    int64_t radio_start_us;
+    wifi_connect_info_t connect_info;
+    esp_err_t ret;
+
+    *failed = false;
+    *radio_us = 0;
+
+    // esp_wake_deep_sleep() sends a timer wake before the boot wake_policy_boot_in() armed back to sleep
+    if (!cold && !mail && *clock_us < s_boot_at_us)
+    {
+        *clock_us += STUB_WAKE_US;
+        result->stub_wakes++;
+        return *clock_us - wake_start_us;
+    }
+    *clock_us += 1000LL * BOOT_MS;
+
+    if (cold || mail)
+    {
+        event_batch_event_t event = {
+            .timestamp = (uint32_t)(*clock_us / 1000000),
+            .type = cold ? EVENT_BATCH_BOOT : EVENT_BATCH_MAIL,
+            .urgent = cold,
+        };
+        event_batch_push(ring, &event);
+    }
+
+    if (cold)
+    {
+        wake_policy_reset(&s_wake_state);
+    }
+    if (wake_policy_decide(&s_wake_state, ring, &flush_policy, (uint32_t)(*clock_us / 1000000), false) !=
+        WAKE_POLICY_RADIO)
+    {
+        *clock_us += 1000LL * SKIP_WAKE_MS;
+        return *clock_us - wake_start_us;
+    }
+
+    budget_end_us = *clock_us + 1000LL * (cold ? PROVISIONING_BUDGET_MS + WAKE_BUDGET_MS : WAKE_BUDGET_MS);
+    stage_end_us = *clock_us + 1000LL * (cold ? PROVISIONING_BUDGET_MS : CONNECT_TIMEOUT_MS);
+    radio_start_us = *clock_us;
+
+    wifi->init(wifi);
+    do
+    {
+        ret = wifi->connect(wifi);
+    } while (ret == ESP_FAIL && *clock_us < stage_end_us);
+
+    if (ret != ESP_OK || *clock_us > stage_end_us)
+    {
+        *clock_us = stage_end_us < budget_end_us ? stage_end_us : budget_end_us;
+        *failed = true;
+    }
+    else
+    {
+        wifi->get_connect_info(wifi, &connect_info);
+        result->time_to_ip_ms[result->connects++] = (uint32_t)(connect_info.time_to_ip_us / 1000);
+        result->fast_connects += connect_info.fast;
+
+        wifi->init_sntp(wifi);
+        wifi->wait_sntp(wifi, cold ? TIME_SYNC_TIMEOUT_MS : TIME_RESYNC_TIMEOUT_MS);
+
+        *clock_us += 1000LL * UPLOAD_MS;
+        if (*clock_us > budget_end_us)
+        {
+            *clock_us = budget_end_us;
+            *failed = true;
+        }
+        else
+        {
+            event_batch_consume(ring, event_batch_count(ring));
+        }
+    }
+
+    wifi->stop(wifi);
+    *radio_us = *clock_us - radio_start_us;
+
+    wake_policy_done(&s_wake_state, !*failed, (uint32_t)(*clock_us / 1000000), bench_random());
+
+    return *clock_us - wake_start_us;
+}
+
+/* Uniform in [0, 2 * mean], mail arrivals do not need a better model */
+static int64_t bench_mail_interval_us(void)
+{
+    return (int64_t)(bench_random() % (2 * 24 * 60 * 60 / MAIL_EVENTS_PER_DAY)) * 1000000;
+}
+
+static void bench_run(const scenario_t *scenario, uint32_t days)
+{
+    // Sensor wakes are far rarer than one a minute
+    uint32_t max_wakes = days * 24 * 60 * 60 / (scenario->poll_sec ? scenario->poll_sec : 60) + 16;
+    int64_t clock_us = 1700000000LL * 1000000; // wall clock, so SNTP sees a set clock
+    int64_t next_mail_us = clock_us + bench_mail_interval_us();
+    int64_t sleep_us;
+    uint32_t boot_in;
+    uint32_t sleep_sec;
+    bool mail;
+    event_batch_ring_t ring;
+    wifi_sim_conf_t wifi_conf = scenario->wifi;
+    bench_result_t result = {0};
+    int64_t awake_us;
+    int64_t radio_us;
+    bool failed;
+
+    wifi_conf.clock_us = &clock_us;
+    wifi_t *wifi = wifi_new_sim(&wifi_conf);
+
+    memset(&ring, 0, sizeof(ring));
+    event_batch_init(&ring);
+
+    result.awake_ms = calloc(max_wakes, sizeof(uint32_t));
+    result.radio_awake_ms = calloc(max_wakes, sizeof(uint32_t));
+    result.time_to_ip_ms = calloc(max_wakes, sizeof(uint32_t));
+
+    for (uint32_t i = 0; i < max_wakes && result.seconds < days * 86400.0; i++)
+    {
+        if (scenario->moves && result.seconds >= days * 43200.0)
+        {
+            wifi_sim_move(wifi, wifi_conf.num_networks - 1);
+        }
+        mail = clock_us >= next_mail_us;
+        if (mail)
+        {
+            next_mail_us = clock_us + bench_mail_interval_us();
+        }
+        awake_us = bench_wake(wifi, &clock_us, &ring, i == 0, mail, &failed, &radio_us, &result);
+
+        // Same schedule as enter_deep_sleep(), plus the sensor wake or the poll
+        boot_in = wake_policy_boot_in(&s_wake_state, &ring, &flush_policy, (uint32_t)(clock_us / 1000000), UINT32_MAX);
+        s_boot_at_us = clock_us + 1000000LL * boot_in;
+        sleep_sec = wake_policy_sleep_sec(boot_in, HEARTBEAT_SEC);
+        if (scenario->poll_sec)
+        {
+            sleep_sec = scenario->poll_sec;
+        }
+        sleep_us = 1000000LL * sleep_sec;
+        if (!scenario->poll_sec && next_mail_us - clock_us < sleep_us)
+        {
+            sleep_us = next_mail_us > clock_us ? next_mail_us - clock_us : 0;
+        }
+
+        result.wakes++;
+        result.awake_ms[i] = (uint32_t)(awake_us / 1000);
+        if (radio_us > 0)
+        {
+            result.radio_awake_ms[result.radio_wakes++] = (uint32_t)(awake_us / 1000);
+        }
+        result.failed_wakes += failed;
+        result.charge_mas += (awake_us - radio_us) / 1e6 * CPU_MA + radio_us / 1e6 * RADIO_MA +
+                             sleep_us / 1e6 * SLEEP_MA;
+        result.seconds += (awake_us + sleep_us) / 1e6;
+
+        clock_us += sleep_us;
+    }
+
+    printf("%-22s %6.0f %7u %7u %6u %5u %6.1f%% | %6u %6u %6u | %6u %6u %6u | %7.2f\n",
+           scenario->name, result.seconds / 86400.0, result.wakes, result.stub_wakes, result.radio_wakes,
+           result.failed_wakes,
+           result.connects ? 100.0 * result.fast_connects / result.connects : 0.0,
+           percentile(result.awake_ms, result.wakes, 50),
+           percentile(result.radio_awake_ms, result.radio_wakes, 50),
+           percentile(result.radio_awake_ms, result.radio_wakes, 99),
+           percentile(result.time_to_ip_ms, result.connects, 50),
+           percentile(result.time_to_ip_ms, result.connects, 99),
+           percentile(result.time_to_ip_ms, result.connects, 100),
+           result.charge_mas / 3600.0 / (result.seconds / 86400.0));
+
+    free(result.awake_ms);
+    free(result.radio_awake_ms);
+    free(result.time_to_ip_ms);
+    free(wifi);
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t days = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 10) : 365;
+    s_rng = argc > 2 ? (uint32_t)strtoul(argv[2], NULL, 10) : 1;
+
+    const wifi_sim_conf_t good_ap = wake_model_good_ap(s_rng);
+    scenario_t scenarios[] = {
+        {.name = "good AP, full connect", .wifi = good_ap},
+        {.name = "good AP, fast", .wifi = good_ap},
+        {.name = "flaky AP, full connect", .wifi = good_ap},
+        {.name = "flaky AP, fast", .wifi = good_ap},
+        {.name = "short lease, fast", .wifi = good_ap},
+        {.name = "good AP, fast, polled", .wifi = good_ap, .poll_sec = POLL_SEC},
+        {.name = "AP down", .wifi = good_ap},
+        {.name = "moved, 3 networks", .wifi = good_ap, .moves = true},
+    };
+    scenarios[0].wifi.fast_reconnect = false;
+    scenarios[2].wifi.fast_reconnect = false;
+    scenarios[2].wifi.fail_pct = scenarios[3].wifi.fail_pct = 30;
+    scenarios[3].wifi.fast_fail_pct = 20;
+    scenarios[4].wifi.lease_sec = 10 * 60;
+    scenarios[6].wifi.fail_pct = scenarios[6].wifi.fast_fail_pct = 100;
+    scenarios[7].wifi.num_networks = 3;
+
+    printf("%-22s %6s %7s %7s %6s %5s %7s | %6s %6s %6s | %6s %6s %6s | %7s\n",
+           "scenario", "days", "wakes", "stub", "radio", "fail", "fast",
+           "awk50", "rad50", "rad99", "ip50", "ip99", "ipmax", "mAh/day");
+    for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++)
+    {
+        bench_run(&scenarios[i], days);
+    }
+
+    return 0;
+}
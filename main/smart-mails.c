@@ -2,6 +2,8 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <inttypes.h>
+#include <time.h>
 #include <driver/gpio.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
@@ -15,6 +17,8 @@
 #include "nvs_flash.h"
 #include "esp_netif.h"
 #include "esp_sleep.h"
+#include "esp_timer.h"
+#include "esp_random.h"
 #include "esp_http_client.h"
 #include "esp_smartconfig.h"
 #include "lwip/err.h"
@@ -22,57 +26,1021 @@
 #include "my_data.h"
 
 #include "wifi.h"
+#include "event_batch.h"
+#include "uploader.h"
+#include "wake_pipeline.h"
+#include "wake_policy.h"
+#include "trace.h"
+#include "wake_config.h"
+#include "mail_sensor.h"
+#include "telemetry.h"
+#include "flash_log_partition.h"
+#include "espnow_link_radio.h"
+#include "delta_ota.h"
+#include "power_profile.h"
+#include "wake_stub.h"
+#include "dlog.h"
+#include "upload_engine.h"
+#include "dns_cache.h"
+#include "heap_stats.h"
+#include "sleep_policy.h"
+#include "battery.h"
+
+#define MAIL_SENSOR_GPIO GPIO_NUM_4
+#define BATTERY_ADC_CHANNEL ADC_CHANNEL_7 // GPIO35, behind a 1:2 divider
+#define RTDB_HOST "ori-projects-default-rtdb.europe-west1.firebasedatabase.app"
+#define RTDB_PATH "/esp32project.json?print=silent" // every write of a wake is PATCHed here, answered with a 204
+#define RTDB_BACKLOG_KEY "backlog/r%08" PRIx32       // a child per drained batch, named after its first record
+#define RTDB_LOG_KEY "logs/%08" PRIx32 "-%08" PRIx32 // dlog session and stream position, see host/dlog_decode
+
+#define VALID_TIME_EPOCH 1577836800 // 2020-01-01, anything earlier was never synced
 
 RTC_DATA_ATTR static int boot_count = 0;
+RTC_DATA_ATTR static event_batch_ring_t event_ring;
+RTC_DATA_ATTR static flash_log_t event_log;
+RTC_DATA_ATTR static wake_policy_state_t wake_state;
+RTC_DATA_ATTR static uint32_t last_sync = 0;  // system time of the last successful wake pipeline
+RTC_DATA_ATTR static uint32_t pair_after = 0; // system time, no gateway search before
+RTC_DATA_ATTR static espnow_link_t espnow_link;
+RTC_DATA_ATTR static sleep_policy_state_t sleep_state;
+
+#define OTA_PROBATION_MAGIC 0x4F544150 // "OTAP"
+
+/* An update kept on its first boot until it uploads once. Survives the panic and watchdog resets
+   it is meant to catch */
+typedef struct
+{
+    uint32_t magic;
+    uint32_t failures; /*!< radio wakes and crashes since the update, none of them uploaded */
+} ota_probation_t;
+
+RTC_NOINIT_ATTR static ota_probation_t ota_probation;
 
 static const char *TAG = "main";
 
+// The age follows the sleep plan of the wake
+static event_batch_policy_t flush_policy = {
+    .max_events = FLUSH_MAX_EVENTS,
+    .max_age_sec = FLUSH_MAX_AGE_SEC,
+};
+
+static const sleep_policy_conf_t sleep_conf = {
+    .budget_uas = ENERGY_BUDGET_UAH_PER_DAY * 3600,
+    .sleep_ua = SLEEP_UA,
+    .radio_wake_uas = RADIO_WAKE_UAS,
+    .boot_wake_uas = BOOT_WAKE_UAS,
+    .stub_wake_uas = STUB_WAKE_UAS,
+    .min_flush_age_sec = FLUSH_MIN_AGE_SEC,
+    .max_flush_age_sec = FLUSH_QUIET_AGE_SEC,
+    .heartbeat_sec = HEARTBEAT_SEC,
+    .poll_sec = SENSOR_POLL_SEC,
+    .low_mv = BATTERY_LOW_MV,
+    .critical_mv = BATTERY_CRITICAL_MV,
+};
+
+static const battery_conf_t battery_conf = {
+    .channel = BATTERY_ADC_CHANNEL,
+    .divider_num = 2,
+    .divider_den = 1,
+    .samples = 8,
+};
+
+static const espnow_link_policy_t espnow_policy = {
+    .ack_timeout_ms = ESPNOW_ACK_TIMEOUT_MS,
+    .pair_window_ms = ESPNOW_PAIR_WINDOW_MS,
+    .channel_mask = ESPNOW_CHANNEL_MASK,
+    .max_retries = ESPNOW_MAX_RETRIES,
+    .max_misses = ESPNOW_MAX_MISSES,
+};
+
+static const mail_sensor_conf_t mail_sensor_conf = {
+    .gpio = MAIL_SENSOR_GPIO,
+    .policy = {
+        .settle_ms = MAIL_SETTLE_MS,
+        .coalesce_ms = MAIL_COALESCE_MS,
+    },
+    .max_settle_ms = MAIL_MAX_SETTLE_MS,
+};
+
+static void prewarm_upload(void *ctx);
+
+static wifi_conf_t wifi_conf = {
+    .aes_key = "ESP32EXAMPLECODE",
+    .hostname = "ESP32",
+    .ntp_server = "pool.ntp.org",
+    .fast_reconnect = true,
+    .sntp_max_error_ms = SNTP_MAX_ERROR_MS,
+    .connect_budget_ms = CONNECT_TIMEOUT_MS,
+    .got_ip = UPLOAD_PREWARM ? prewarm_upload : NULL,
+};
+
+static uploader_conf_t uploader_conf = {
+    .host = RTDB_HOST,
+    .port = "443",
+    .skip_cert_verify = false,
+    .session_lifetime_sec = 12 * 60 * 60,
+};
+
+static upload_engine_conf_t upload_engine_conf = {
+    .root = RTDB_PATH,
+    .max_body = UPLOAD_MAX_BODY,
+    .max_writes = DRAIN_MAX_BATCHES + 2, // the backlog, the ring and the log
+    .max_attempts = UPLOAD_MAX_ATTEMPTS,
+    .retry = {.base = UPLOAD_RETRY_BASE_MS, .max = UPLOAD_RETRY_MAX_MS, .jitter_pct = 20},
+};
+
+_Static_assert(TRACE_PHASE_MAX <= TELEMETRY_MAX_PHASES, "telemetry record too small for the trace phases");
+
+/* Events per flash log record, a record is a packed array of ring events */
+#define SPILL_RECORD_EVENTS (FLASH_LOG_MAX_RECORD / sizeof(event_batch_event_t))
+/* Events per ESP-NOW frame, the payload is a packed little endian array of ring events */
+#define ESPNOW_REPORT_EVENTS (ESPNOW_LINK_MAX_PAYLOAD / sizeof(event_batch_event_t))
+#define BODY_MAX_EVENTS (EVENT_BATCH_CAPACITY > DRAIN_BATCH_EVENTS ? EVENT_BATCH_CAPACITY : DRAIN_BATCH_EVENTS)
+/* Hex encoded log ring and its envelope */
+#define LOG_BODY_SIZE (64 + 2 * DLOG_RING_SIZE)
+
+_Static_assert(SPILL_RECORD_EVENTS <= DRAIN_BATCH_EVENTS, "a drain batch must hold at least one record");
+
+#ifdef CONFIG_SMART_MAILS_STATIC_ALLOC
+_Static_assert(UPLOAD_MAX_BODY <= UPLOAD_ENGINE_STATIC_MAX_BODY && DRAIN_MAX_BATCHES + 2 <= UPLOAD_ENGINE_STATIC_MAX_WRITES,
+               "upload engine configuration exceeds its static limits");
+/* Every write of a wake is queued before the flush: the backlog batches, the ring and the log */
+_Static_assert(DRAIN_MAX_BATCHES * TELEMETRY_MAX_SIZE(DRAIN_BATCH_EVENTS) + TELEMETRY_MAX_SIZE(EVENT_BATCH_CAPACITY) +
+                       LOG_BODY_SIZE <=
+                   UPLOAD_ENGINE_STATIC_VALUES,
+               "upload engine value arena too small for a wake");
+#endif
+
+static esp_sleep_wakeup_cause_t wake_cause;
+static bool event_log_ready;
+static bool ota_verify;  // first boot of an updated image, kept if its local setup works
+static bool ota_due;     // look for an update on this wake
+static bool ota_applied; // an update is ready to boot
+static power_profile_t power_profile = WAKE_POWER_PROFILE;
+static sleep_policy_plan_t sleep_plan;
+static wifi_t *smartconfig;
+static uploader_t *uploader;
+static upload_engine_t *upload_engine;
+static size_t uploaded_count;
+
+/**
+ * @brief Drain Batch Type
+ *
+ * A drained batch is acknowledged in the flash log only once it and every earlier one were uploaded.
+ */
+typedef struct
+{
+    uint32_t last_seq;
+    size_t count;
+    esp_err_t result;
+} drain_batch_t;
+
+static drain_batch_t drain_batches[DRAIN_MAX_BATCHES];
+static size_t num_drain_batches;
+static size_t ring_count;
+static esp_err_t ring_result;
+static uint32_t log_end;
+static esp_err_t log_result;
+
+static void record_event(event_batch_type_t type, bool urgent, uint16_t value)
+{
+    event_batch_event_t event = {
+        .timestamp = (uint32_t)time(NULL),
+        .type = type,
+        .urgent = urgent,
+        .value = value,
+    };
+    event_batch_push(&event_ring, &event);
+}
+
+static void sample_mail_sensor(void)
+{
+    const mail_debounce_state_t *state = mail_sensor_state();
+
+    // Coalesced drops only bump the counter, the next drop event carries it
+    switch (mail_sensor_settle(&mail_sensor_conf))
+    {
+    case MAIL_DEBOUNCE_DROP:
+        record_event(EVENT_BATCH_MAIL, false, (uint16_t)state->drops);
+        if (time(NULL) >= VALID_TIME_EPOCH)
+        {
+            sleep_policy_record_mail(&sleep_state, (uint32_t)time(NULL));
+        }
+        break;
+    case MAIL_DEBOUNCE_CLEARED:
+        record_event(EVENT_BATCH_EMPTY, false, (uint16_t)state->drops);
+        break;
+    default:
+        break;
+    }
+}
+
+static void spill_events(void)
+{
+    event_batch_event_t events[SPILL_RECORD_EVENTS];
+    size_t count;
+
+    if (!event_log_ready)
+    {
+        return;
+    }
+
+    // Oldest first, events leave the ring only once their record is in flash
+    while (event_batch_count(&event_ring) > 0)
+    {
+        for (count = 0; count < SPILL_RECORD_EVENTS && event_batch_peek(&event_ring, count, &events[count]); count++)
+        {
+        }
+        if (!flash_log_append(&event_log, events, count * sizeof(event_batch_event_t), NULL))
+        {
+            ESP_LOGE(TAG, "Failed to spill %zu events", count);
+            return;
+        }
+        event_batch_consume(&event_ring, count);
+        DLOGI(TAG, "Spilled %zu events to flash", count);
+    }
+}
+
+static esp_err_t espnow_report(void)
+{
+    event_batch_event_t events[ESPNOW_REPORT_EVENTS];
+    espnow_link_radio_t radio;
+    uint32_t now = (uint32_t)time(NULL);
+    int64_t start_us = esp_timer_get_time();
+    esp_err_t ret = ESP_OK;
+    size_t count;
+
+    // Without a gateway the search is repeated once a sync interval, not on every wake
+    if (espnow_link.num_peers == 0 && now < pair_after)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    if (espnow_link_radio_start(&radio) != ESP_OK)
+    {
+        return ESP_FAIL;
+    }
+
+    if (espnow_link.num_peers == 0)
+    {
+        ret = espnow_link_pair(&espnow_link, &radio, &espnow_policy, esp_random());
+        if (ret != ESP_OK)
+        {
+            pair_after = now + SYNC_INTERVAL_SEC;
+        }
+    }
+
+    // Events leave the ring only once the gateway acknowledged them
+    while (ret == ESP_OK && event_batch_count(&event_ring) > 0)
+    {
+        for (count = 0; count < ESPNOW_REPORT_EVENTS && event_batch_peek(&event_ring, count, &events[count]); count++)
+        {
+        }
+        ret = espnow_link_send(&espnow_link, &radio, &espnow_policy, events, count * sizeof(event_batch_event_t));
+        if (ret == ESP_OK)
+        {
+            event_batch_consume(&event_ring, count);
+        }
+    }
+
+    espnow_link_radio_stop();
+    DLOGI(TAG, "ESP-NOW report %s, radio on for %lld ms, %d gateways",
+          esp_err_to_name(ret), (esp_timer_get_time() - start_us) / 1000, espnow_link.num_peers);
+
+    return ret;
+}
+
+// Sized for the larger of a full ring and a drain batch, so nothing is allocated
+static char body[TELEMETRY_MAX_SIZE(BODY_MAX_EVENTS)];
+
+static void telemetry_start(telemetry_writer_t *writer)
+{
+    uint32_t phase_us[TRACE_PHASE_MAX];
+
+    trace_get_marks(phase_us);
+    telemetry_header_t header = {
+        .boot_count = boot_count,
+        .wake_cause = wake_cause,
+        .battery_mv = sleep_state.battery_mv,
+        .phase_us = phase_us,
+        .num_phases = TRACE_PHASE_MAX,
+    };
+
+    telemetry_writer_init(writer, body, sizeof(body), NULL, NULL);
+    telemetry_begin(writer, &header);
+}
+
+static void upload_done(void *ctx, esp_err_t result)
+{
+    *(esp_err_t *)ctx = result;
+}
+
+static esp_err_t submit_event_log(void)
+{
+    static flash_log_record_t record;
+    flash_log_cursor_t cursor;
+    flash_log_cursor_t rewind;
+    telemetry_writer_t writer;
+    const event_batch_event_t *events;
+    char key[UPLOAD_PATH_MAX_LEN];
+    size_t count;
+    uint32_t first_seq;
+    uint32_t last_seq;
+
+    num_drain_batches = 0;
+    flash_log_cursor_init(&event_log, &cursor);
+    for (int batch = 0; batch < DRAIN_MAX_BATCHES; batch++)
+    {
+        telemetry_start(&writer);
+        count = 0;
+        first_seq = 0;
+        last_seq = 0;
+
+        // Whole records only, the ack can not split one
+        rewind = cursor;
+        while (flash_log_next(&event_log, &cursor, &record))
+        {
+            size_t num_events = record.len / sizeof(event_batch_event_t);
+            if (count + num_events > DRAIN_BATCH_EVENTS)
+            {
+                cursor = rewind;
+                break;
+            }
+
+            events = (const event_batch_event_t *)record.data;
+            for (size_t i = 0; i < num_events; i++)
+            {
+                telemetry_add_event(&writer, events[i].timestamp, events[i].type, events[i].value);
+            }
+            count += num_events;
+            first_seq = first_seq ? first_seq : record.seq;
+            last_seq = record.seq;
+            rewind = cursor;
+        }
+        if (last_seq == 0)
+        {
+            break;
+        }
+        if (!telemetry_end(&writer))
+        {
+            ESP_LOGE(TAG, "Telemetry record does not fit");
+            return ESP_FAIL;
+        }
+
+        // A batch starts at the oldest unacknowledged record, so a retry on a later wake
+        // overwrites what a lost acknowledgement left behind instead of adding a duplicate
+        snprintf(key, sizeof(key), RTDB_BACKLOG_KEY, first_seq);
+        drain_batches[batch].last_seq = last_seq;
+        drain_batches[batch].count = count;
+        drain_batches[batch].result = ESP_ERR_TIMEOUT;
+        if (upload_engine_submit(upload_engine, key, body, writer.total, upload_done,
+                                 &drain_batches[batch].result) != ESP_OK)
+        {
+            return ESP_FAIL;
+        }
+        num_drain_batches++;
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t acknowledge_event_log(void)
+{
+    uint32_t acked_seq = 0;
+    size_t acked_count = 0;
+    size_t batch;
+
+    // In order, a record is only acknowledged with everything before it
+    for (batch = 0; batch < num_drain_batches && drain_batches[batch].result == ESP_OK; batch++)
+    {
+        acked_seq = drain_batches[batch].last_seq;
+        acked_count += drain_batches[batch].count;
+    }
+    if (acked_seq != 0)
+    {
+        if (!flash_log_ack(&event_log, acked_seq))
+        {
+            ESP_LOGE(TAG, "Failed to acknowledge record %" PRIu32, acked_seq);
+            return ESP_FAIL;
+        }
+        DLOGI(TAG, "Drained %zu logged events up to record %" PRIu32, acked_count, acked_seq);
+    }
+    if (batch < num_drain_batches)
+    {
+        ESP_LOGE(TAG, "Failed to upload %zu logged events", drain_batches[batch].count);
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t submit_events(void)
+{
+    telemetry_writer_t writer;
+    event_batch_event_t event;
+
+    ring_count = 0;
+    telemetry_start(&writer);
+    while (event_batch_peek(&event_ring, ring_count, &event))
+    {
+        telemetry_add_event(&writer, event.timestamp, event.type, event.value);
+        ring_count++;
+    }
+    if (!telemetry_end(&writer))
+    {
+        ESP_LOGE(TAG, "Telemetry record does not fit");
+        return ESP_FAIL;
+    }
+
+    // The fields of the record replace those at the root, children like the backlog stay
+    ring_result = ESP_ERR_TIMEOUT;
+    return upload_engine_submit(upload_engine, "", body, writer.total, upload_done, &ring_result);
+}
+
+static void submit_logs(void)
+{
+    // Hex encoded ring, the body is built without formatting any record
+    static char log_body[LOG_BODY_SIZE];
+    char key[UPLOAD_PATH_MAX_LEN];
+    size_t exported;
+    int len;
+
+    log_result = ESP_ERR_NOT_FOUND;
+    len = snprintf(log_body, sizeof(log_body), "{\"boot\":%d,\"dropped\":%" PRIu32 ",\"log\":\"",
+                   boot_count, dlog_dropped());
+    exported = dlog_export_hex(log_body + len, sizeof(log_body) - len - 2, &log_end);
+    if (exported == 0)
+    {
+        return;
+    }
+    strcat(log_body, "\"}");
+
+    // Until it is consumed, the log is exported from the same position and overwrites its last upload
+    snprintf(key, sizeof(key), RTDB_LOG_KEY, dlog_session(), log_end - (uint32_t)exported);
+    log_result = ESP_ERR_TIMEOUT;
+    if (upload_engine_submit(upload_engine, key, log_body, strlen(log_body), upload_done, &log_result) != ESP_OK)
+    {
+        log_result = ESP_FAIL;
+    }
+}
+
+/* On the event loop, while connect() is still returning and the time sync runs */
+static void prewarm_upload(void *ctx)
+{
+    dns_cache_prewarm(uploader_conf.host, uploader_conf.port);
+}
+
+static esp_err_t stage_connect(void *ctx)
+{
+    esp_err_t ret;
+    wifi_connect_info_t connect_info;
+
+    smartconfig = wifi_new_smartconfig(&wifi_conf);
+    if (smartconfig->init(smartconfig) != ESP_OK)
+    {
+        return ESP_FAIL;
+    }
+    smartconfig->set_power_profile(smartconfig, power_profile);
+
+    // Retries back off inside connect(), the budget ends them with ESP_ERR_TIMEOUT
+    do
+    {
+        ret = smartconfig->connect(smartconfig);
+    } while (ret == ESP_FAIL);
+    if (ret != ESP_OK)
+    {
+        return ret;
+    }
+
+    if (smartconfig->get_connect_info(smartconfig, &connect_info) == ESP_OK)
+    {
+        DLOGI(TAG, "%s connect, time to IP: %lld ms",
+              connect_info.fast ? "Warm" : "Cold", connect_info.time_to_ip_us / 1000);
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t stage_time_sync(void *ctx)
+{
+    esp_err_t ret;
+    wifi_sntp_stats_t sntp_stats;
+    bool clock_set = time(NULL) >= VALID_TIME_EPOCH;
+
+    // Starts SNTP only when the predicted clock error is out of bounds, returns at once otherwise
+    smartconfig->init_sntp(smartconfig);
+
+    // A clock that was never set, e.g. after a power on, is worth the whole stage. One that was
+    // only gets a short wait for the drift sample, and the wake goes on without it
+    ret = smartconfig->wait_sntp(smartconfig, clock_set ? TIME_RESYNC_TIMEOUT_MS : TIME_SYNC_TIMEOUT_MS);
+    if (clock_set)
+    {
+        ret = ESP_OK;
+    }
+
+    // The sleep plan works in local hours
+    if (smartconfig->init_timezone(smartconfig) == ESP_OK && time(NULL) >= VALID_TIME_EPOCH)
+    {
+        time_t now = time(NULL);
+        struct tm local;
+
+        localtime_r(&now, &local);
+        sleep_policy_set_local_time(&sleep_state, now, &local);
+    }
+
+    if (smartconfig->get_sntp_stats(smartconfig, &sntp_stats) == ESP_OK)
+    {
+        DLOGI(TAG, "SNTP skipped %" PRIu32 "/%" PRIu32 " (%.0f%%), drift %.1f ppm",
+              sntp_stats.skipped, sntp_stats.syncs + sntp_stats.skipped,
+              sntp_stats.skipped_ratio * 100, sntp_stats.drift_ppm);
+    }
+
+    return ret;
+}
+
+static esp_err_t stage_prepare(void *ctx)
+{
+    uploader = uploader_new_tls(&uploader_conf);
+    if (uploader == NULL)
+    {
+        return ESP_FAIL;
+    }
+    upload_engine_conf.uploader = uploader;
+    upload_engine = upload_engine_start(&upload_engine_conf);
+    if (upload_engine == NULL)
+    {
+        return ESP_FAIL;
+    }
+
+    // The backlog is read from flash and serialized while the other core connects. The engine
+    // holds the writes until the upload flushes them. Its records carry the phases reached so far
+    if (event_log_ready && submit_event_log() != ESP_OK)
+    {
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+/* What is left of a deadline on esp_timer, 0 once it passed */
+static uint32_t remaining_ms(int64_t deadline_us)
+{
+    int64_t left_us = deadline_us - esp_timer_get_time();
+
+    return left_us > 0 ? (uint32_t)(left_us / 1000) : 0;
+}
+
+static esp_err_t stage_upload(void *ctx)
+{
+    // Flush and stop share the stage timeout, so the stage returns before the pipeline gives up on it
+    int64_t deadline_us = esp_timer_get_time() + 1000LL * UPLOAD_TIMEOUT_MS;
+    upload_stats_t stats;
+    dns_cache_stats_t dns_stats;
+    esp_err_t ret = ESP_OK;
+
+    // The backlog, the ring and the log go out together, in as few PATCH requests as fit. The ring
+    // and the log are serialized last, so they carry the whole connect
+    if (submit_events() != ESP_OK)
+    {
+        return ESP_FAIL;
+    }
+    submit_logs();
+    if (upload_engine_flush(upload_engine, remaining_ms(deadline_us)) != ESP_OK)
+    {
+        return ESP_ERR_TIMEOUT;
+    }
+    upload_engine_get_stats(upload_engine, &stats);
+    upload_engine_stop(upload_engine, remaining_ms(deadline_us));
+
+    DLOGI(TAG, "%lu writes in %lu requests (%lu retries), %lu bytes sent, %lu received, acknowledged in %lld ms",
+          (unsigned long)stats.writes, (unsigned long)stats.requests, (unsigned long)stats.retries,
+          (unsigned long)stats.bytes_sent, (unsigned long)stats.bytes_received, stats.max_ack_us / 1000);
+    dns_cache_get_stats(&dns_stats);
+    DLOGI(TAG, "DNS cache hit %lu/%lu (%.0f%%), %lu pre-warmed, %lu ms saved this wake",
+          (unsigned long)dns_stats.hits, (unsigned long)dns_stats.lookups, dns_stats.hit_ratio * 100,
+          (unsigned long)dns_stats.prewarmed, (unsigned long)dns_stats.wake_saved_ms);
+
+    // The log is optional, it only goes once it was uploaded
+    if (log_result == ESP_OK)
+    {
+        dlog_consume(log_end);
+    }
+    if (event_log_ready)
+    {
+        ret = acknowledge_event_log();
+    }
+    if (ring_result != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to upload %zu events", ring_count);
+        return ESP_FAIL;
+    }
+    uploaded_count = ring_count;
+
+    return ret;
+}
+
+static esp_err_t stage_acknowledge(void *ctx)
+{
+    // Acknowledged, drop what was sent
+    event_batch_consume(&event_ring, uploaded_count);
+    trace_mark(TRACE_PHASE_UPLOAD);
+
+    return ESP_OK;
+}
+
+static esp_err_t stage_update(void *ctx)
+{
+    esp_err_t ret;
+
+    // Still the connection of the upload
+    if (!ota_due)
+    {
+        uploader->disconnect(uploader);
+        return ESP_OK;
+    }
+
+    ret = delta_ota_update(uploader, OTA_PATH_PREFIX);
+    uploader->disconnect(uploader);
+    if (ret == ESP_ERR_NOT_FOUND)
+    { // Up to date
+        return ESP_OK;
+    }
+    ota_applied = ret == ESP_OK;
+
+    return ret;
+}
+
+enum
+{
+    STAGE_CONNECT = 0,
+    STAGE_TIME_SYNC,
+    STAGE_UPLOAD,
+    STAGE_ACKNOWLEDGE,
+    STAGE_UPDATE,
+    STAGE_MAX,
+};
+
+static wake_stage_t wake_stages[STAGE_MAX] = {
+    [STAGE_CONNECT] = {.name = "connect", .run = stage_connect, .timeout_ms = CONNECT_TIMEOUT_MS},
+    [STAGE_TIME_SYNC] = {.name = "time_sync", .run = stage_time_sync, .timeout_ms = TIME_SYNC_TIMEOUT_MS, .optional = true},
+    [STAGE_UPLOAD] = {.name = "upload", .run = stage_upload, .timeout_ms = UPLOAD_TIMEOUT_MS, .after_background = true},
+    [STAGE_ACKNOWLEDGE] = {.name = "acknowledge", .run = stage_acknowledge, .timeout_ms = 1000},
+    [STAGE_UPDATE] = {.name = "update", .run = stage_update, .timeout_ms = OTA_TIMEOUT_MS, .optional = true},
+};
+
+static const wake_stage_t prepare_stage = {.name = "prepare", .run = stage_prepare};
+
+// Wi-Fi and lwIP run on core 0 (CONFIG_ESP32_WIFI_TASK_PINNED_TO_CORE_0), the upload is prepared on core 1
+static wake_pipeline_conf_t wake_pipeline_conf = {
+    .stages = wake_stages,
+    .num_stages = STAGE_MAX,
+    .budget_ms = WAKE_BUDGET_MS,
+    .core = PRO_CPU_NUM,
+    .background = &prepare_stage,
+    .background_core = APP_CPU_NUM,
+    .abort_ms = WAKE_ABORT_MS,
+};
+
+static void log_power_stats(void)
+{
+    power_stats_t stats;
+
+    if (power_profile_get_stats(&stats) != ESP_OK || stats.total_us == 0)
+    {
+        return;
+    }
+
+    DLOGI(TAG, "Power profile %s, %" PRIu32 " light sleeps (%" PRIu32 " rejected)",
+          power_profile_name(power_profile), stats.light_sleeps, stats.light_sleep_rejects);
+    for (int mode = 0; mode < POWER_MODE_MAX; mode++)
+    {
+        if (stats.freq_mhz[mode] > 0)
+        {
+            DLOGI(TAG, "  %-8s %3u MHz %7lld ms %3lld%%", power_mode_name(mode), stats.freq_mhz[mode],
+                  stats.time_us[mode] / 1000, stats.time_us[mode] * 100 / stats.total_us);
+        }
+    }
+}
+
+/* Flush age, heartbeat and sensor wakeup for the local hour, from the mail history, the spending and the battery */
+static void plan_sleep(void)
+{
+    sleep_policy_plan(&sleep_state, &sleep_conf, (uint32_t)time(NULL), &sleep_plan);
+    flush_policy.max_age_sec = sleep_plan.flush_max_age_sec;
+}
+
+/* Charge of this wake from its awake and radio time, for the daily budget */
+static void account_wake(void)
+{
+    uint32_t stamps_us[TRACE_PHASE_MAX];
+    int64_t awake_us = esp_timer_get_time();
+    int64_t radio_us = 0;
+
+    trace_get_marks(stamps_us);
+    if (stamps_us[TRACE_PHASE_WIFI_START] > 0)
+    {
+        radio_us = awake_us - stamps_us[TRACE_PHASE_WIFI_START];
+    }
+
+    sleep_policy_account(&sleep_state, (uint32_t)time(NULL),
+                         (uint32_t)((awake_us * WAKE_CPU_UA + radio_us * (WAKE_RADIO_UA - WAKE_CPU_UA)) / 1000000),
+                         radio_us > 0);
+}
+
+/* Seconds until a wake has to run app_main(), earlier timer wakes end in the wake stub */
+static uint32_t full_boot_due_in(uint32_t now)
+{
+    uint32_t due_in = UINT32_MAX;
+    uint32_t sync_in = now - last_sync < SYNC_INTERVAL_SEC ? last_sync + SYNC_INTERVAL_SEC - now : 0;
+
+    if (event_log_ready && flash_log_pending(&event_log) > 0)
+    {
+        due_in = 0;
+    }
+    if (sync_in < due_in)
+    {
+        due_in = sync_in;
+    }
+    // A delivery hour ahead may want pending events sooner
+    if (event_batch_count(&event_ring) > 0 && sleep_plan.review_in_sec < due_in)
+    {
+        due_in = sleep_plan.review_in_sec;
+    }
+
+    return wake_policy_boot_in(&wake_state, &event_ring, &flush_policy, now, due_in);
+}
+
+static void enter_deep_sleep(void)
+{
+    uint32_t now = (uint32_t)time(NULL);
+    uint32_t boot_in;
+    uint32_t sleep_sec;
+
+    account_wake();
+    plan_sleep();
+
+    // Heartbeat, or earlier when something comes due
+    boot_in = full_boot_due_in(now);
+    sleep_sec = wake_policy_sleep_sec(boot_in, sleep_plan.heartbeat_sec);
+
+    trace_mark(TRACE_PHASE_SLEEP);
+    DLOGI(TAG, "Hour %u: flush within %" PRIu32 " s, %" PRIu32 " of %" PRIu32 " uAh spent, %" PRIu32
+               " uploads left, battery %u mV%s",
+          sleep_plan.hour, sleep_plan.flush_max_age_sec, sleep_state.spent_uas / 3600, sleep_plan.budget_uas / 3600,
+          sleep_plan.radio_wakes, sleep_state.battery_mv, sleep_plan.sensor_wakeup ? "" : ", sensor polled");
+    DLOGI(TAG, "Entering deep sleep for %" PRIu32 " seconds, next boot in %" PRIu32 " s, %" PRIu32 " drops counted",
+          sleep_sec, boot_in, mail_sensor_state()->drops);
+    if (smartconfig != NULL)
+    {
+        smartconfig->stop(smartconfig);
+    }
+    heap_stats_end_wake();
+    // Without the ext1 wakeup the stub checks the level on every heartbeat
+    if (sleep_plan.sensor_wakeup)
+    {
+        mail_sensor_enable_wakeup(&mail_sensor_conf);
+    }
+    wake_stub_arm(MAIL_SENSOR_GPIO, mail_sensor_state()->stable_level, sleep_plan.heartbeat_sec, boot_in);
+    esp_deep_sleep(1000000LL * sleep_sec);
+}
+
+static bool reset_was_crash(void)
+{
+    esp_reset_reason_t reason = esp_reset_reason();
+
+    return reason == ESP_RST_PANIC || reason == ESP_RST_INT_WDT || reason == ESP_RST_TASK_WDT ||
+           reason == ESP_RST_WDT;
+}
+
+static bool ota_on_probation(void)
+{
+    return ota_probation.magic == OTA_PROBATION_MAGIC;
+}
+
+// Another radio wake or crash without an upload, the update is given up after OTA_MAX_FAILED_WAKES in a row
+static void ota_probation_failed(void)
+{
+    ota_probation.failures++;
+    ESP_LOGW(TAG, "Update on probation, %" PRIu32 " of %d failed wakes", ota_probation.failures,
+             OTA_MAX_FAILED_WAKES);
+    if (ota_probation.failures >= OTA_MAX_FAILED_WAKES)
+    {
+        ota_probation.magic = 0;
+        delta_ota_rollback();
+    }
+}
+
+// The first boot of an update keeps it once the local setup works, the network is not needed for that
+static void ota_self_check(esp_err_t log_ret)
+{
+    // The partition is there but the image cannot read it
+    if (log_ret != ESP_OK && log_ret != ESP_ERR_NOT_FOUND)
+    {
+        ESP_LOGE(TAG, "Self-check failed, event log: %s", esp_err_to_name(log_ret));
+        delta_ota_rollback();
+        return;
+    }
+
+    delta_ota_confirm();
+    ota_probation.magic = OTA_PROBATION_MAGIC;
+    ota_probation.failures = 0;
+}
+
 void app_main()
 {
+    wake_stub_stats_t stub_stats;
+
+    // First, so the boot time does not include app_main()
+    wake_stub_get_stats(&stub_stats);
+
+    // An updated image finds RTC memory laid out by the previous one, only CRC checked state survives
+    ota_verify = delta_ota_pending_verify();
+    if (ota_verify)
+    {
+        ESP_LOGW(TAG, "First boot of an updated image");
+        boot_count = 0;
+        wake_policy_reset(&wake_state);
+        last_sync = 0;
+        pair_after = 0;
+    }
+    else if (ota_on_probation() && reset_was_crash())
+    {
+        ota_probation_failed();
+    }
 
     ++boot_count;
-    ESP_LOGI(TAG, "Boot count: %d", boot_count);
+    heap_stats_begin_wake(boot_count);
+    dlog_begin_wake();
+    DLOGI(TAG, "Boot count: %d", boot_count);
+    if (stub_stats.boot_us > 0)
+    {
+        DLOGI(TAG, "Booted in %" PRIu32 " us, %" PRIu32 " stub wakes in %" PRIu32 " us (max %" PRIu32 " us)",
+              stub_stats.boot_us, stub_stats.stub_wakes, stub_stats.last_stub_us, stub_stats.max_stub_us);
+    }
 
-    esp_err_t ret;
+    if (!event_batch_init(&event_ring))
+    {
+        ESP_LOGW(TAG, "Event ring reset");
+    }
 
-    static wifi_conf_t wifi_conf = {
-        .aes_key = "ESP32EXAMPLECODE",
-        .hostname = "ESP32",
-        .ntp_server = "pool.ntp.org",
-    };
-    wifi_t *smartconfig = wifi_new_smartconfig(&wifi_conf);
+    // Reuses the RTC state on warm wakes, scans the partition otherwise
+    esp_err_t log_ret = flash_log_partition_open(&event_log, EVENT_LOG_PARTITION);
+    event_log_ready = log_ret == ESP_OK;
+    if (!event_log_ready)
+    {
+        ESP_LOGW(TAG, "No event log, pending events are kept in RTC memory only");
+    }
+
+    if (!espnow_link_init(&espnow_link, esp_random()))
+    {
+        ESP_LOGW(TAG, "ESP-NOW link reset, gateways are searched again");
+        pair_after = 0;
+    }
+
+    if (!sleep_policy_init(&sleep_state, &sleep_conf))
+    {
+        ESP_LOGW(TAG, "Sleep policy reset, the mail history starts over");
+    }
+    // Before the radio draws the battery down
+    if (battery_read_mv(&battery_conf, &sleep_state.battery_mv) != ESP_OK)
+    {
+        ESP_LOGW(TAG, "No battery reading, the last one is used");
+    }
 
-    switch (esp_sleep_get_wakeup_cause())
+    wake_cause = esp_sleep_get_wakeup_cause();
+    mail_sensor_init(&mail_sensor_conf, wake_cause == ESP_SLEEP_WAKEUP_UNDEFINED);
+
+    // Before the radio, an AP outage on the first wake should not revert a good update
+    if (ota_verify)
     {
+        ota_self_check(log_ret);
+    }
 
+    switch (wake_cause)
+    {
+
+    case ESP_SLEEP_WAKEUP_EXT1:
+    {
+        DLOGI(TAG, "ESP_SLEEP_WAKEUP_EXT1");
+        sample_mail_sensor();
+        break;
+    }
     case ESP_SLEEP_WAKEUP_TIMER:
     {
-        printf("ESP_SLEEP_WAKEUP_TIMER\n");
+        DLOGI(TAG, "ESP_SLEEP_WAKEUP_TIMER");
+        // The stub only lets a timer wake through when something is due or the level changed
+        // without waking the chip, i.e. raced the arming of the wakeup
+        sample_mail_sensor();
         break;
     }
     default:
     {
-        printf("Not a deep sleep reset\n");
+        DLOGI(TAG, "Not a deep sleep reset");
+        record_event(EVENT_BATCH_BOOT, true, boot_count);
+        wake_policy_reset(&wake_state);
+        pair_after = 0;
+
+        // Reset button doubles as the trace and log dump request
+        trace_dump();
+        heap_stats_dump();
+        dlog_dump();
+
+        // Leave room for smartconfig provisioning, which needs the radio on all the time
+        power_profile = POWER_PROFILE_PERFORMANCE;
+        wake_stages[STAGE_CONNECT].timeout_ms = PROVISIONING_BUDGET_MS;
+        wifi_conf.connect_budget_ms = PROVISIONING_BUDGET_MS;
+        wake_pipeline_conf.budget_ms = PROVISIONING_BUDGET_MS + WAKE_BUDGET_MS;
     }
     }
 
-    if (smartconfig->init(smartconfig) == ESP_OK)
+    // Events go to the gateway over ESP-NOW, the Wi-Fi path is left to periodic sync and provisioning
+    if (wake_cause != ESP_SLEEP_WAKEUP_UNDEFINED && event_batch_count(&event_ring) > 0)
     {
+        espnow_report();
+    }
 
-        do
-        {
-            ret = smartconfig->connect(smartconfig);
-        } while (ret != ESP_OK);
+    // Move events to flash before the ring overwrites them
+    if (event_batch_count(&event_ring) >= EVENT_SPILL_THRESHOLD)
+    {
+        spill_events();
+    }
 
-        smartconfig->init_sntp(smartconfig);
+    // The daily sync also looks for an update, an image still on probation does not
+    bool sync_due = (uint32_t)time(NULL) - last_sync >= SYNC_INTERVAL_SEC;
+    ota_due = sync_due && !ota_on_probation();
+    if (ota_due)
+    {
+        wake_pipeline_conf.budget_ms += OTA_TIMEOUT_MS;
+    }
 
-        smartconfig->init_timezone(smartconfig);
+    plan_sleep();
+
+    // Nothing due yet, or backing off after failed wakes: back to sleep without starting the radio
+    switch (wake_policy_decide(&wake_state, &event_ring, &flush_policy, (uint32_t)time(NULL),
+                               (event_log_ready && flash_log_pending(&event_log) > 0) || sync_due || ota_verify))
+    {
+    case WAKE_POLICY_SLEEP:
+        DLOGI(TAG, "%zu events pending", event_batch_count(&event_ring));
+        enter_deep_sleep();
+        break;
+    case WAKE_POLICY_BACKOFF:
+        DLOGI(TAG, "Backing off for %" PRIu32 " s after %" PRIu32 " failed wakes",
+              wake_state.retry_after - (uint32_t)time(NULL), wake_state.failed_wakes);
+        enter_deep_sleep();
+        break;
+    case WAKE_POLICY_RADIO:
+        break;
+    }
+
+    // Only wakes that bring up the radio are traced
+    trace_begin_wake();
+    trace_mark(TRACE_PHASE_BOOT);
+
+    // ESP-NOW reporting above runs at the default fixed frequency, its ack windows are short
+    power_profile_set(power_profile);
+
+    int64_t start_us = esp_timer_get_time();
+    esp_err_t ret = wake_pipeline_run(&wake_pipeline_conf);
+    DLOGI(TAG, "Wake pipeline %s after %lld ms", esp_err_to_name(ret), (esp_timer_get_time() - start_us) / 1000);
+    log_power_stats();
+
+    wake_policy_done(&wake_state, ret == ESP_OK, (uint32_t)time(NULL), esp_random());
+    if (ret == ESP_OK)
+    {
+        last_sync = (uint32_t)time(NULL);
+    }
+    else if (!wake_pipeline_idle())
+    {
+        // A stage that did not return may still upload or acknowledge, the ring stays in RTC memory
+        ESP_LOGE(TAG, "Pipeline still running, %zu events left in the ring", event_batch_count(&event_ring));
+    }
+    else
+    {
+        // The backoff may outlast the ring, keep what is pending in flash
+        spill_events();
     }
 
-    vTaskDelay((1000 * 60) / portTICK_PERIOD_MS); // Wait 1 minute
+    // The first upload ends the probation of an update
+    if (ota_on_probation())
+    {
+        if (ret == ESP_OK)
+        {
+            DLOGI(TAG, "Update uploaded after %" PRIu32 " failed wakes, probation over", ota_probation.failures);
+            ota_probation.magic = 0;
+        }
+        else
+        {
+            ota_probation_failed();
+        }
+    }
+
+    // Otherwise the update boots on the next wake
+    if (ota_applied && wake_pipeline_idle())
+    {
+        DLOGI(TAG, "Restarting into the update");
+        spill_events();
+        esp_restart();
+    }
 
-    const int deep_sleep_sec = 10;
-    ESP_LOGI(TAG, "Entering deep sleep for %d seconds", deep_sleep_sec);
-    smartconfig->stop(smartconfig);
-    esp_deep_sleep(1000000LL * deep_sleep_sec);
-}
\ No newline at end of file
+    enter_deep_sleep();
+}
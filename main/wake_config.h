@@ -0,0 +1,72 @@
+#pragma once
+
+/* Wake timing and flush policy, shared by app_main() and the host wake-cycle benchmark */
+/* The mail sensor wakes the chip, the timer is only a heartbeat and the flush deadline */
+#define HEARTBEAT_SEC (6 * 60 * 60)
+#define WAKE_BUDGET_MS (30 * 1000)
+#define PROVISIONING_BUDGET_MS (5 * 60 * 1000)
+#define CONNECT_TIMEOUT_MS (20 * 1000)
+#define TIME_SYNC_TIMEOUT_MS (5 * 1000)
+/* A resync of a clock that is already set is awaited this long, its answer would be lost to deep sleep */
+#define TIME_RESYNC_TIMEOUT_MS (2 * 1000)
+#define UPLOAD_TIMEOUT_MS (10 * 1000)
+/* A stage still running after a failure gets this long to return before the wake goes to sleep without it */
+#define WAKE_ABORT_MS (2 * 1000)
+#define SNTP_MAX_ERROR_MS 1000
+/* Writes of a wake are merged into multi-path PATCH requests of at most this many bytes */
+#define UPLOAD_MAX_BODY (8 * 1024)
+#define UPLOAD_MAX_ATTEMPTS 3
+#define UPLOAD_RETRY_BASE_MS 250
+#define UPLOAD_RETRY_MAX_MS 2000
+/* Resolve the upload host and open its TCP connection as soon as the IP arrives */
+#define UPLOAD_PREWARM true
+/* Frequency scaling, light sleep and modem sleep of Wi-Fi wakes, provisioning runs at full power */
+#define WAKE_POWER_PROFILE POWER_PROFILE_BALANCED
+
+#define FLUSH_MAX_EVENTS 8
+#define FLUSH_MAX_AGE_SEC (30 * 60)
+
+/* Adaptive sleep: flush ages follow the hourly mail history within a daily energy budget, see
+ * components/sleep_policy. FLUSH_MAX_AGE_SEC is the fixed policy host/wake_bench compares against */
+#define ENERGY_BUDGET_UAH_PER_DAY 1000
+#define FLUSH_MIN_AGE_SEC (5 * 60)
+#define FLUSH_QUIET_AGE_SEC (4 * 60 * 60)
+#define SENSOR_POLL_SEC (10 * 60)
+#define BATTERY_LOW_MV 3500
+#define BATTERY_CRITICAL_MV 3300
+/* Charge estimates of a wake, the policy learns the actual averages from them */
+#define WAKE_CPU_UA 40000
+#define WAKE_RADIO_UA 120000
+#define SLEEP_UA 10
+#define RADIO_WAKE_UAS (2 * WAKE_RADIO_UA)
+#define BOOT_WAKE_UAS (WAKE_CPU_UA / 5)
+#define STUB_WAKE_UAS (WAKE_CPU_UA / 1000)
+
+/* Wakes that could not flush back off, doubling up to the heartbeat */
+#define SLEEP_BACKOFF_BASE_SEC (5 * 60)
+#define SLEEP_BACKOFF_JITTER_PCT 20
+
+#define MAIL_SETTLE_MS 50
+#define MAIL_COALESCE_MS (60 * 1000)
+#define MAIL_MAX_SETTLE_MS 1000
+
+/* Events outlive the RTC ring in the flash log, spilled when the ring fills or a flush fails */
+#define EVENT_LOG_PARTITION "evlog"
+#define EVENT_SPILL_THRESHOLD 24
+#define DRAIN_BATCH_EVENTS 64
+#define DRAIN_MAX_BATCHES 8
+
+/* ESP-NOW reports to a paired gateway, the Wi-Fi path is left to periodic sync and provisioning */
+#define ESPNOW_ACK_TIMEOUT_MS 20
+#define ESPNOW_MAX_RETRIES 3
+#define ESPNOW_MAX_MISSES 3
+#define ESPNOW_PAIR_WINDOW_MS 100
+#define ESPNOW_CHANNEL_MASK 0x3FFE // channels 1 to 13
+#define SYNC_INTERVAL_SEC (24 * 60 * 60)
+
+/* Delta OTA, looked for on the daily sync */
+#define OTA_PATH_PREFIX "/ota"
+#define OTA_TIMEOUT_MS (120 * 1000)
+/* An update is kept after a local self-check, and rolled back if this many radio wakes or crashes in a row
+   follow it without an upload, about half a day of backoff */
+#define OTA_MAX_FAILED_WAKES 8
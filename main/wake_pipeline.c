@@ -0,0 +1,272 @@
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/event_groups.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "wake_pipeline.h"
+#include "dlog.h"
+
+#define WAKE_PIPELINE_DONE_BIT BIT21
+#define WAKE_PIPELINE_BACKGROUND_BIT BIT22
+#define WAKE_PIPELINE_FAIL_BIT BIT23
+#define WAKE_PIPELINE_STACK_SIZE 8192
+#define WAKE_PIPELINE_PRIORITY 5
+
+static const char *TAG = "wake_pipeline";
+
+/* FreeRTOS event group to signal stage completion, one bit per stage */
+static EventGroupHandle_t s_pipeline_event_group;
+/* Set by the caller on a failure, the stages that did not start yet are skipped */
+static volatile bool s_abort;
+/* Done bits of the tasks the last run created */
+static EventBits_t s_tasks;
+
+#ifdef CONFIG_SMART_MAILS_STATIC_ALLOC
+static StaticEventGroup_t s_pipeline_event_group_buffer;
+/* The pipeline task and the background task */
+static StackType_t s_task_stacks[2][WAKE_PIPELINE_STACK_SIZE];
+static StaticTask_t s_task_buffers[2];
+/* A deleted task's buffer is only released by the idle task, the pipeline runs once per boot */
+static bool s_pipeline_ran;
+#endif
+
+/* Start and end of every stage and of the background stage, for the overlap */
+static int64_t s_stage_us[WAKE_PIPELINE_MAX_STAGES][2];
+static int64_t s_background_us[2];
+
+static void wake_pipeline_background_task(void *arg)
+{
+    const wake_pipeline_conf_t *conf = arg;
+    const wake_stage_t *stage = conf->background;
+
+    esp_err_t ret = stage->run(conf->ctx);
+
+    s_background_us[1] = esp_timer_get_time();
+    DLOGI(TAG, "Background stage %s %s in %lld ms on core %d", stage->name, ret == ESP_OK ? "done" : "failed",
+          (s_background_us[1] - s_background_us[0]) / 1000, xPortGetCoreID());
+
+    if (ret != ESP_OK && !stage->optional)
+    {
+        xEventGroupSetBits(s_pipeline_event_group, WAKE_PIPELINE_FAIL_BIT);
+    }
+    xEventGroupSetBits(s_pipeline_event_group, WAKE_PIPELINE_BACKGROUND_BIT);
+
+    vTaskDelete(NULL);
+}
+
+/* Wait for the background stage before the stage, and log how much of it ran alongside the earlier stages */
+static bool wake_pipeline_join(const wake_pipeline_conf_t *conf, size_t stage)
+{
+    int64_t join_us = esp_timer_get_time();
+    int64_t overlap_us;
+    EventBits_t bits;
+
+    bits = xEventGroupWaitBits(s_pipeline_event_group, WAKE_PIPELINE_BACKGROUND_BIT, pdFALSE, pdFALSE,
+                               portMAX_DELAY);
+    if (bits & WAKE_PIPELINE_FAIL_BIT)
+    {
+        return false;
+    }
+
+    DLOGI(TAG, "Stage %s waited %lld ms for %s", conf->stages[stage].name,
+          (esp_timer_get_time() - join_us) / 1000, conf->background->name);
+    for (size_t i = 0; i < stage; i++)
+    {
+        overlap_us = (s_stage_us[i][1] < s_background_us[1] ? s_stage_us[i][1] : s_background_us[1]) -
+                     (s_stage_us[i][0] > s_background_us[0] ? s_stage_us[i][0] : s_background_us[0]);
+        if (overlap_us > 0)
+        {
+            DLOGI(TAG, "  overlapped %s by %lld of %lld ms", conf->stages[i].name, overlap_us / 1000,
+                  (s_stage_us[i][1] - s_stage_us[i][0]) / 1000);
+        }
+    }
+
+    return true;
+}
+
+static void wake_pipeline_task(void *arg)
+{
+    const wake_pipeline_conf_t *conf = arg;
+
+    for (size_t i = 0; i < conf->num_stages; i++)
+    {
+        const wake_stage_t *stage = &conf->stages[i];
+
+        if (s_abort)
+        {
+            DLOGI(TAG, "Aborted before stage %s", stage->name);
+            break;
+        }
+        if (stage->after_background && conf->background != NULL && !wake_pipeline_join(conf, i))
+        {
+            break;
+        }
+        s_stage_us[i][0] = esp_timer_get_time();
+
+        esp_err_t ret = stage->run(conf->ctx);
+
+        s_stage_us[i][1] = esp_timer_get_time();
+        DLOGI(TAG, "Stage %s %s in %lld ms", stage->name, ret == ESP_OK ? "done" : "failed",
+              (s_stage_us[i][1] - s_stage_us[i][0]) / 1000);
+
+        if (ret != ESP_OK && !stage->optional)
+        {
+            xEventGroupSetBits(s_pipeline_event_group, WAKE_PIPELINE_FAIL_BIT);
+            break;
+        }
+        xEventGroupSetBits(s_pipeline_event_group, BIT(i));
+    }
+
+    xEventGroupSetBits(s_pipeline_event_group, WAKE_PIPELINE_DONE_BIT);
+    vTaskDelete(NULL);
+}
+
+static esp_err_t wake_pipeline_wait(const wake_pipeline_conf_t *conf, int64_t deadline_us)
+{
+    EventBits_t bits;
+    int64_t remaining_ms;
+    uint32_t wait_ms;
+
+    for (size_t i = 0; i < conf->num_stages; i++)
+    {
+        const wake_stage_t *stage = &conf->stages[i];
+
+        remaining_ms = (deadline_us - esp_timer_get_time()) / 1000;
+        if (remaining_ms <= 0)
+        {
+            ESP_LOGE(TAG, "Wake budget of %lu ms exhausted before stage %s", (unsigned long)conf->budget_ms, stage->name);
+            return ESP_ERR_TIMEOUT;
+        }
+        wait_ms = stage->timeout_ms < remaining_ms ? stage->timeout_ms : remaining_ms;
+
+        bits = xEventGroupWaitBits(s_pipeline_event_group,
+                                   BIT(i) | WAKE_PIPELINE_FAIL_BIT,
+                                   pdFALSE,
+                                   pdFALSE,
+                                   pdMS_TO_TICKS(wait_ms));
+
+        if (bits & BIT(i))
+        {
+            continue;
+        }
+        else if (bits & WAKE_PIPELINE_FAIL_BIT)
+        {
+            ESP_LOGE(TAG, "Stage %s failed", stage->name);
+            return ESP_FAIL;
+        }
+        else
+        {
+            ESP_LOGE(TAG, "Stage %s timed out after %lu ms", stage->name, (unsigned long)wait_ms);
+            return ESP_ERR_TIMEOUT;
+        }
+    }
+
+    return ESP_OK;
+}
+
+static bool wake_pipeline_create_task(TaskFunction_t task, const char *name, const wake_pipeline_conf_t *conf,
+                                      int core, size_t slot)
+{
+#ifdef CONFIG_SMART_MAILS_STATIC_ALLOC
+    return xTaskCreateStaticPinnedToCore(task, name, WAKE_PIPELINE_STACK_SIZE, (void *)conf, WAKE_PIPELINE_PRIORITY,
+                                         s_task_stacks[slot], &s_task_buffers[slot], core) != NULL;
+#else
+    return xTaskCreatePinnedToCore(task, name, WAKE_PIPELINE_STACK_SIZE, (void *)conf, WAKE_PIPELINE_PRIORITY,
+                                   NULL, core) == pdPASS;
+#endif
+}
+
+esp_err_t wake_pipeline_run(const wake_pipeline_conf_t *conf)
+{
+    int64_t deadline_us;
+    int64_t remaining_ms;
+    esp_err_t ret;
+
+    if (conf->num_stages > WAKE_PIPELINE_MAX_STAGES)
+    {
+        ESP_LOGE(TAG, "Too many stages");
+        return ESP_FAIL;
+    }
+
+#ifdef CONFIG_SMART_MAILS_STATIC_ALLOC
+    if (s_pipeline_ran)
+    {
+        ESP_LOGE(TAG, "Already ran on this boot");
+        return ESP_ERR_INVALID_STATE;
+    }
+    s_pipeline_ran = true;
+#endif
+
+    if (s_pipeline_event_group == NULL)
+    {
+#ifdef CONFIG_SMART_MAILS_STATIC_ALLOC
+        s_pipeline_event_group = xEventGroupCreateStatic(&s_pipeline_event_group_buffer);
+#else
+        s_pipeline_event_group = xEventGroupCreate();
+#endif
+        if (s_pipeline_event_group == NULL)
+        {
+            ESP_LOGE(TAG, "Failed to create event group");
+            return ESP_FAIL;
+        }
+    }
+    xEventGroupClearBits(s_pipeline_event_group, BIT(WAKE_PIPELINE_MAX_STAGES + 3) - 1);
+    s_abort = false;
+    s_tasks = 0;
+
+    deadline_us = esp_timer_get_time() + 1000LL * conf->budget_ms;
+
+    if (conf->background != NULL)
+    {
+        s_background_us[0] = esp_timer_get_time();
+        if (!wake_pipeline_create_task(wake_pipeline_background_task, "wake_background", conf,
+                                       conf->background_core, 1))
+        {
+            ESP_LOGE(TAG, "Failed to create background task");
+            return ESP_FAIL;
+        }
+        s_tasks |= WAKE_PIPELINE_BACKGROUND_BIT;
+    }
+
+    if (!wake_pipeline_create_task(wake_pipeline_task, "wake_pipeline", conf, conf->core, 0))
+    {
+        ESP_LOGE(TAG, "Failed to create task");
+        ret = ESP_FAIL;
+    }
+    else
+    {
+        s_tasks |= WAKE_PIPELINE_DONE_BIT;
+        ret = wake_pipeline_wait(conf, deadline_us);
+    }
+
+    // The caller touches what the stages use once this returns, e.g. spills to the event log, so the
+    // tasks have to be gone by then. A failure skips the stages that did not start
+    if (ret != ESP_OK)
+    {
+        s_abort = true;
+    }
+    remaining_ms = (deadline_us - esp_timer_get_time()) / 1000;
+    if (remaining_ms < conf->abort_ms)
+    {
+        remaining_ms = conf->abort_ms;
+    }
+    if (s_tasks != 0 && (xEventGroupWaitBits(s_pipeline_event_group, s_tasks, pdFALSE, pdTRUE,
+                                             pdMS_TO_TICKS(remaining_ms)) & s_tasks) != s_tasks)
+    {
+        ESP_LOGE(TAG, "Stages still running after %lld ms", remaining_ms);
+    }
+
+    return ret;
+}
+
+bool wake_pipeline_idle(void)
+{
+    if (s_pipeline_event_group == NULL)
+    {
+        return true;
+    }
+
+    return (xEventGroupGetBits(s_pipeline_event_group) & s_tasks) == s_tasks;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+/* One event group bit per stage, the last three flag the stages task done, the background stage done
+   and a failed stage */
+#define WAKE_PIPELINE_MAX_STAGES 21
+
+/**
+ * @brief Wake Stage Function Type
+ *
+ */
+typedef esp_err_t (*wake_stage_fn_t)(void *ctx);
+
+/**
+ * @brief Wake Stage Type
+ *
+ */
+typedef struct wake_stage_s
+{
+    const char *name;
+    wake_stage_fn_t run;
+    uint32_t timeout_ms;   /*!< budget of this stage */
+    bool optional;         /*!< a failure does not abort the following stages */
+    bool after_background; /*!< waits for the background stage to complete first */
+} wake_stage_t;
+
+/**
+ * @brief Wake Pipeline Configuration Type
+ *
+ */
+typedef struct wake_pipeline_conf_s
+{
+    const wake_stage_t *stages;
+    size_t num_stages;
+    uint32_t budget_ms;             /*!< budget of the whole wake */
+    void *ctx;                      /*!< passed to every stage */
+    int core;                       /*!< core the stages run on, tskNO_AFFINITY for any */
+    const wake_stage_t *background; /*!< runs alongside the stages from the start, NULL for none */
+    int background_core;            /*!< core the background stage runs on */
+    uint32_t abort_ms;              /*!< how long a stage still running after a failure gets to return */
+} wake_pipeline_conf_t;
+
+/**
+ * @brief Run the stages in order on a worker task
+ *
+ * Returns once the last stage completes, a stage fails, or a stage or the whole wake runs out
+ * of budget. On a failure the stages that did not start yet are skipped, and the stage still
+ * running gets abort_ms to return. If it does not, wake_pipeline_idle() says so and the caller
+ * is expected to leave what the stages use alone and enter deep sleep next. The configuration
+ * must stay valid until then.
+ *
+ * The background stage runs on a task of its own, so work that does not need the network
+ * overlaps the connect. Its timeout is ignored, the first stage after it waits within its own
+ * timeout. A background failure fails the pipeline unless the stage is optional.
+ *
+ * With CONFIG_SMART_MAILS_STATIC_ALLOC the tasks have static stacks, and the pipeline runs once per boot.
+ *
+ * @param conf: pipeline configuration
+ * @return
+ *      ESP_OK when every stage completed, ESP_ERR_TIMEOUT when a budget ran out, ESP_FAIL otherwise,
+ *      ESP_ERR_INVALID_STATE when the static pipeline already ran
+ */
+esp_err_t wake_pipeline_run(const wake_pipeline_conf_t *conf);
+
+/**
+ * @brief Whether the stages and the background stage have returned
+ *
+ * @return
+ *      true once no pipeline task runs any more, e.g. the event ring and log can be touched
+ */
+bool wake_pipeline_idle(void);
@@ -0,0 +1,66 @@
+#include "wake_policy.h"
+#include "wake_config.h"
+#include "backoff.h"
+
+static const backoff_policy_t s_sleep_backoff = {
+    .base = SLEEP_BACKOFF_BASE_SEC,
+    .max = HEARTBEAT_SEC,
+    .jitter_pct = SLEEP_BACKOFF_JITTER_PCT,
+};
+
+void wake_policy_reset(wake_policy_state_t *state)
+{
+    state->failed_wakes = 0;
+    state->retry_after = 0;
+}
+
+wake_policy_action_t wake_policy_decide(const wake_policy_state_t *state, const event_batch_ring_t *ring,
+                                        const event_batch_policy_t *flush, uint32_t now, bool other_due)
+{
+    if (!event_batch_should_flush(ring, flush, now) && !other_due)
+    {
+        return WAKE_POLICY_SLEEP;
+    }
+    // The last flush failed, e.g. the AP is down. Keep the radio off until the backoff ends
+    if (now < state->retry_after)
+    {
+        return WAKE_POLICY_BACKOFF;
+    }
+
+    return WAKE_POLICY_RADIO;
+}
+
+void wake_policy_done(wake_policy_state_t *state, bool ok, uint32_t now, uint32_t random)
+{
+    if (ok)
+    {
+        wake_policy_reset(state);
+        return;
+    }
+
+    state->retry_after = now + backoff_delay(&s_sleep_backoff, state->failed_wakes++, random);
+}
+
+uint32_t wake_policy_boot_in(const wake_policy_state_t *state, const event_batch_ring_t *ring,
+                             const event_batch_policy_t *flush, uint32_t now, uint32_t other_due_in)
+{
+    uint32_t due_in = event_batch_flush_due_in(ring, flush, now);
+
+    if (other_due_in < due_in)
+    {
+        due_in = other_due_in;
+    }
+
+    // Not before the backoff ends
+    if (state->retry_after > now && due_in < state->retry_after - now)
+    {
+        due_in = state->retry_after - now;
+    }
+
+    return due_in;
+}
+
+uint32_t wake_policy_sleep_sec(uint32_t boot_in, uint32_t heartbeat_sec)
+{
+    return boot_in == 0 || boot_in > heartbeat_sec ? heartbeat_sec : boot_in;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "event_batch.h"
+
+/**
+ * @brief Wake Policy State Type
+ *
+ * Kept in RTC memory across wakes.
+ */
+typedef struct wake_policy_state_s
+{
+    uint32_t failed_wakes; /*!< radio wakes in a row that failed */
+    uint32_t retry_after;  /*!< system time in seconds, no radio before */
+} wake_policy_state_t;
+
+/**
+ * @brief Wake Action Type
+ *
+ */
+typedef enum
+{
+    WAKE_POLICY_SLEEP,   /*!< nothing due, back to sleep without the radio */
+    WAKE_POLICY_BACKOFF, /*!< due, but the backoff after a failed wake has not ended */
+    WAKE_POLICY_RADIO,   /*!< run the wake pipeline */
+} wake_policy_action_t;
+
+/**
+ * @brief Forget failed wakes, after a reset or an update
+ *
+ * @param state: wake state
+ */
+void wake_policy_reset(wake_policy_state_t *state);
+
+/**
+ * @brief Decide whether a wake that reached app_main() brings up the radio
+ *
+ * @param state: wake state
+ * @param ring: pending events
+ * @param flush: flush policy
+ * @param now: system time in seconds
+ * @param other_due: something else needs the radio, e.g. the daily sync or events in flash
+ */
+wake_policy_action_t wake_policy_decide(const wake_policy_state_t *state, const event_batch_ring_t *ring,
+                                        const event_batch_policy_t *flush, uint32_t now, bool other_due);
+
+/**
+ * @brief Record the outcome of a radio wake, a failure backs off the next one
+ *
+ * @param state: wake state
+ * @param ok: the wake pipeline completed
+ * @param now: system time in seconds
+ * @param random: random value for the jitter
+ */
+void wake_policy_done(wake_policy_state_t *state, bool ok, uint32_t now, uint32_t random);
+
+/**
+ * @brief Seconds until a wake has to run app_main(), earlier timer wakes end in the wake stub
+ *
+ * @param state: wake state
+ * @param ring: pending events
+ * @param flush: flush policy
+ * @param now: system time in seconds
+ * @param other_due_in: seconds until something else is due, UINT32_MAX for nothing
+ */
+uint32_t wake_policy_boot_in(const wake_policy_state_t *state, const event_batch_ring_t *ring,
+                             const event_batch_policy_t *flush, uint32_t now, uint32_t other_due_in);
+
+/**
+ * @brief Deep sleep before the next timer wake: the heartbeat, or earlier when a boot comes due
+ *
+ * @param boot_in: from wake_policy_boot_in()
+ * @param heartbeat_sec: longest sleep
+ */
+uint32_t wake_policy_sleep_sec(uint32_t boot_in, uint32_t heartbeat_sec);